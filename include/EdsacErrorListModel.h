@@ -0,0 +1,110 @@
+/*
+ * Copyright 2017
+ * GPL3 Licensed
+ * EdsacErrorListModel.h
+ * GObject Class Definition of EdsacErrorListModel. A GtkTreeModel of the errors matching a Clickable
+ * which only keeps the rows near those being looked at in memory
+ */
+
+#ifndef EDSAC_ERROR_LIST_MODEL_H
+#define EDSAC_ERROR_LIST_MODEL_H
+
+// link properly with C++
+#ifdef _cplusplus
+extern "C" {
+#endif // _cplusplus
+
+// includes
+#include <glib.h>
+#include <gtk/gtk.h>
+#include "EdsacErrorNotebook.h"
+#include <stdbool.h>
+#include <time.h>
+
+// rows fetched from the database in one go
+#define EDSAC_ERROR_LIST_PAGE_SIZE 256
+
+// model columns
+typedef enum {
+    EDSAC_ERROR_LIST_COLUMN_RACK,        // G_TYPE_UINT
+    EDSAC_ERROR_LIST_COLUMN_CHASSIS,     // G_TYPE_UINT
+    EDSAC_ERROR_LIST_COLUMN_VALVE,       // G_TYPE_INT: negative for no valve
+    EDSAC_ERROR_LIST_COLUMN_MESSAGE,     // G_TYPE_STRING
+    EDSAC_ERROR_LIST_COLUMN_ENABLED,     // G_TYPE_BOOLEAN
+    EDSAC_ERROR_LIST_COLUMN_ID,          // G_TYPE_INT: errors.id
+    EDSAC_ERROR_LIST_N_COLUMNS
+} EdsacErrorListColumn;
+
+// a row of the model
+typedef struct {
+    const char *message; // owned by the model
+    time_t recv_time;
+    int id;
+    unsigned int rack_no;
+    unsigned int chassis_no;
+    int valve_no; // negative for no valve
+    bool enabled;
+    int occurrences; // more than one if duplicates were merged into this error. Shown at the end of message
+} EdsacErrorListRow;
+
+// GObject init
+G_BEGIN_DECLS
+
+// Macro definitions
+#define EDSAC_TYPE_ERROR_LIST_MODEL (edsac_error_list_model_get_type())
+#define EDSAC_ERROR_LIST_MODEL(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), EDSAC_TYPE_ERROR_LIST_MODEL, EdsacErrorListModel))
+#define EDSAC_ERROR_LIST_MODEL_CLASS(klass) (G_TYPE_CHECK_CLASS_CAST((klass), EDSAC_TYPE_ERROR_LIST_MODEL, EdsacErrorListModelClass))
+#define EDSAC_IS_ERROR_LIST_MODEL(obj) (G_TYPE_CHECK_INSTANCE_TYPE((obj), EDSAC_TYPE_ERROR_LIST_MODEL))
+#define EDSAC_IS_ERROR_LIST_MODEL_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE((klass), EDSAC_TYPE_ERROR_LIST_MODEL))
+#define EDSAC_ERROR_LIST_MODEL_GET_CLASS(obj) (G_TYPE_INSTANCE_GET_CLASS((obj), EDSAC_TYPE_ERROR_LIST_MODEL, EdsacErrorListModelClass))
+
+// forward declaration
+struct _EdsacErrorListModelPrivate;
+
+// Object
+typedef struct {
+    GObject parent_instance;
+    struct _EdsacErrorListModelPrivate *priv;
+} EdsacErrorListModel;
+
+// Class
+typedef struct {
+    GObjectClass parent_class;
+} EdsacErrorListModelClass;
+
+// called from the main loop once the rows have first been counted and whenever rows are added after that
+typedef void (*EdsacErrorListModelNotify)(EdsacErrorListModel *model, gpointer user_data);
+
+// public methods
+
+// the rows are counted and the newest page fetched on the database thread. The model is empty until notify is first called
+EdsacErrorListModel *edsac_error_list_model_new(const Clickable *search, EdsacErrorListModelNotify notify, gpointer user_data);
+
+// queue a count to catch up with errors added to the database since the last update.
+// Returns FALSE if rows already in the model have changed: the model should then be replaced with a new one
+gboolean edsac_error_list_model_update(EdsacErrorListModel *self);
+
+// the row iter points to without copying it, or NULL if it has not been fetched yet.
+// Missing rows are fetched in the background and signalled with row-changed when they arrive.
+// Owned by the model and only valid until the model is next used
+const EdsacErrorListRow *edsac_error_list_model_peek(EdsacErrorListModel *self, GtkTreeIter *iter);
+
+// -1 until the rows have been counted
+gint edsac_error_list_model_get_n_rows(EdsacErrorListModel *self);
+
+// forget about pages which have been asked for but not fetched yet, e.g. because the view is hidden
+void edsac_error_list_model_cancel_pending(EdsacErrorListModel *self);
+
+// stop all database work for the model. notify is not called again
+void edsac_error_list_model_cancel(EdsacErrorListModel *self);
+
+// boilerplate public methods
+GType edsac_error_list_model_get_type(void) G_GNUC_CONST;
+
+// GObject End
+G_END_DECLS
+
+#ifdef _cplusplus
+}
+#endif // _cplusplus
+#endif // EDSAC_ERROR_LIST_MODEL_H
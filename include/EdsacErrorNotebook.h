@@ -17,12 +17,17 @@ extern "C" {
 #include <glib.h>
 #include <gtk/gtk.h>
 
+// longest text a SEARCH can look for (including the terminator)
+#define SEARCH_TEXT_LEN 128
+
 // type of link or tab
 typedef enum {
     RACK,
     CHASSIS,
     VALVE,
-    ALL
+    ALL,
+    SEARCH, // errors whose description contains every word of text
+    HEATMAP // not a list: the heatmap of recent errors by node. Only for tabs
 } ClickableType;
 
 // information about a link
@@ -31,8 +36,16 @@ typedef struct {
     unsigned int rack_num;
     unsigned int chassis_num;
     int valve_num; // negative signifies that this is unspecified
+    char text[SEARCH_TEXT_LEN]; // only for SEARCH
 } Clickable;
 
+// where an error came from
+typedef struct {
+    unsigned int rack_no;
+    unsigned int chassis_no;
+    int valve_no; // negative for no valve
+} ErrorKey;
+
 // GObject init
 G_BEGIN_DECLS
 
@@ -62,10 +75,22 @@ typedef struct {
 } EdsacErrorNotebookClass;
 
 // public methods
+
+// emits "error-count-changed" when the count for the current page becomes known or changes
 EdsacErrorNotebook *edsac_error_notebook_new(void);
+
+// catch up with any change to the database. Hidden tabs catch up when they are next shown
 void edsac_error_notebook_update(EdsacErrorNotebook *self);
+
+// catch up with errors added at keys (a GList of ErrorKeys). Only tabs showing one of the keys are touched
+void edsac_error_notebook_errors_added(EdsacErrorNotebook *self, GList *keys);
+
 int edsac_error_notebook_get_error_count(EdsacErrorNotebook *self);
 void edsac_error_notebook_show_page(EdsacErrorNotebook *self, const Clickable *data);
+
+// ask where to export the errors in the current tab to, then export them in the background
+void edsac_error_notebook_export_current(EdsacErrorNotebook *self);
+
 void edsac_error_notebook_close_node(EdsacErrorNotebook *self, const unsigned int rack_no, const unsigned int chassis_no);
 
 // boilerplate public methods
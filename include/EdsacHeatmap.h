@@ -0,0 +1,84 @@
+/*
+ * Copyright 2017
+ * GPL3 Licensed
+ * EdsacHeatmap.h
+ * GObject Class Definition of EdsacHeatmap. A GtkDrawingArea showing how many errors each node
+ * received recently as a grid of racks by chassis, with the trend for the whole machine underneath
+ */
+
+#ifndef EDSAC_HEATMAP_H
+#define EDSAC_HEATMAP_H
+
+// link properly with C++
+#ifdef _cplusplus
+extern "C" {
+#endif // _cplusplus
+
+// includes
+#include <glib.h>
+#include <gtk/gtk.h>
+#include <time.h>
+
+// GObject init
+G_BEGIN_DECLS
+
+// Macro definitions
+#define EDSAC_TYPE_HEATMAP (edsac_heatmap_get_type())
+#define EDSAC_HEATMAP(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), EDSAC_TYPE_HEATMAP, EdsacHeatmap))
+#define EDSAC_HEATMAP_CLASS(klass) (G_TYPE_CHECK_CLASS_CAST((klass), EDSAC_TYPE_HEATMAP, EdsacHeatmapClass))
+#define EDSAC_IS_HEATMAP(obj) (G_TYPE_CHECK_INSTANCE_TYPE((obj), EDSAC_TYPE_HEATMAP))
+#define EDSAC_IS_HEATMAP_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE((klass), EDSAC_TYPE_HEATMAP))
+#define EDSAC_HEATMAP_GET_CLASS(obj) (G_TYPE_INSTANCE_GET_CLASS((obj), EDSAC_TYPE_HEATMAP, EdsacHeatmapClass))
+
+// spans offered by the notebook. Anything longer than HEATMAP_SPAN_HOUR is read from the per hour rollups
+#define HEATMAP_SPAN_HOUR (60 * 60)
+#define HEATMAP_SPAN_DAY (24 * HEATMAP_SPAN_HOUR)
+#define HEATMAP_SPAN_WEEK (7 * HEATMAP_SPAN_DAY)
+
+// forward declaration
+struct _EdsacHeatmapPrivate;
+
+// Object
+typedef struct {
+    GtkDrawingArea parent_instance;
+    struct _EdsacHeatmapPrivate *priv;
+} EdsacHeatmap;
+
+// Class
+typedef struct {
+    GtkDrawingAreaClass parent_class;
+} EdsacHeatmapClass;
+
+// called when a node's cell is clicked
+typedef void (*EdsacHeatmapActivate)(EdsacHeatmap *heatmap, unsigned int rack_no, unsigned int chassis_no, gpointer user_data);
+
+// called from the main loop whenever new counts have been loaded
+typedef void (*EdsacHeatmapNotify)(EdsacHeatmap *heatmap, gpointer user_data);
+
+// public methods
+
+// shows the last HEATMAP_SPAN_HOUR. The counts are read on the database thread so it is blank until they arrive
+GtkWidget *edsac_heatmap_new(EdsacHeatmapActivate activate, EdsacHeatmapNotify notify, gpointer user_data);
+
+// show the errors received in the last span seconds and reload
+void edsac_heatmap_set_span(EdsacHeatmap *self, const time_t span);
+
+// queue a reload. Cheap to call often: at most one reload is queued at a time
+void edsac_heatmap_update(EdsacHeatmap *self);
+
+// errors shown, or -1 until they have first been loaded
+gint edsac_heatmap_get_total(EdsacHeatmap *self);
+
+// stop all database work for the heatmap
+void edsac_heatmap_cancel(EdsacHeatmap *self);
+
+// boilerplate public methods
+GType edsac_heatmap_get_type(void) G_GNUC_CONST;
+
+// GObject End
+G_END_DECLS
+
+#ifdef _cplusplus
+}
+#endif // _cplusplus
+#endif // EDSAC_HEATMAP_H
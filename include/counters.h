@@ -0,0 +1,57 @@
+/*
+ * Copyright 2017
+ * GPL3 Licensed
+ * counters.h
+ * In memory error counts for each node and valve so that counting the errors matching a Clickable doesn't need to scan the database
+ */
+
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+// link properly with C++
+#ifdef _cplusplus
+extern "C" {
+#endif // _cplusplus
+
+// includes
+#include <stdbool.h>
+#include "EdsacErrorNotebook.h"
+
+// declarations
+// These are kept in step with the database by sql.c. The caller must hold the database lock
+
+void counters_init(void);
+void counters_free(void);
+
+// forget everything
+void counters_reset(void);
+
+// forget all errors but keep the nodes
+void counters_clear_errors(void);
+
+void counters_add_node(const unsigned int rack_no, const unsigned int chassis_no, const bool enabled);
+void counters_remove_node(const unsigned int rack_no, const unsigned int chassis_no);
+void counters_toggle_node(const unsigned int rack_no, const unsigned int chassis_no);
+
+// count num_errors new errors on a node, num_enabled of which are enabled
+void counters_add_errors(const unsigned int rack_no, const unsigned int chassis_no, const int valve_no,
+                         const unsigned int num_errors, const unsigned int num_enabled);
+
+// num_errors errors on a node have been deleted, num_enabled of which were enabled
+void counters_remove_errors(const unsigned int rack_no, const unsigned int chassis_no, const int valve_no,
+                            const unsigned int num_errors, const unsigned int num_enabled);
+
+// an error has just been enabled (or disabled if !enabled)
+void counters_set_error_enabled(const unsigned int rack_no, const unsigned int chassis_no, const int valve_no, const bool enabled);
+
+// num_errors errors on a node valve have just been enabled (or disabled if !enabled)
+void counters_set_errors_enabled(const unsigned int rack_no, const unsigned int chassis_no, const int valve_no,
+                                 const unsigned int num_errors, const bool enabled);
+
+// the number of errors matching search. Disabled errors and errors on disabled nodes are only included if include_disabled
+unsigned int counters_count(const Clickable *search, const bool include_disabled);
+
+#ifdef _cplusplus
+}
+#endif // _cplusplus
+#endif // COUNTERS_H
@@ -0,0 +1,41 @@
+/*
+ * Copyright 2017
+ * GPL3 Licensed
+ * db_worker.h
+ * Runs database queries on their own thread so that the gtk main loop never waits for sqlite
+ */
+
+#ifndef DB_WORKER_H
+#define DB_WORKER_H
+
+// link properly with C++
+#ifdef _cplusplus
+extern "C" {
+#endif // _cplusplus
+
+// includes
+#include <glib.h>
+#include <gio/gio.h>
+
+// declarations
+
+// a job run on the database thread. The return value is handed to the completion callback
+typedef gpointer (*DbJobFunc)(gpointer job_data, GCancellable *cancellable);
+
+// jobs may be pushed once this has been called
+void db_worker_start(void);
+
+// waits for queued jobs to finish. Their completion callbacks still run from the main loop if it is running
+void db_worker_stop(void);
+
+// queue func(job_data) on the database thread. Jobs run one at a time in the order they were pushed.
+// callback runs in the calling thread's main context with a GTask: get func's result with g_task_propagate_pointer.
+// If cancellable is cancelled before then, func might not run and the GTask returns G_IO_ERROR_CANCELLED instead.
+// source_object (may be NULL) is kept alive until callback has run. result_free frees unused results
+void db_worker_push(gpointer source_object, GCancellable *cancellable, DbJobFunc func, gpointer job_data,
+                    GDestroyNotify job_data_free, GDestroyNotify result_free, GAsyncReadyCallback callback, gpointer user_data);
+
+#ifdef _cplusplus
+}
+#endif // _cplusplus
+#endif // DB_WORKER_H
@@ -0,0 +1,57 @@
+/*
+ * Copyright 2017
+ * GPL3 Licensed
+ * export.h
+ * Writes the errors matching a filter to a CSV or JSON Lines file a chunk at a time
+ */
+
+#ifndef EXPORT_H
+#define EXPORT_H
+
+// link properly with C++
+#ifdef _cplusplus
+extern "C" {
+#endif // _cplusplus
+
+// includes
+#include <glib.h>
+#include <gio/gio.h>
+#include <stdbool.h>
+#include "sql.h"
+
+// declarations
+
+// rows read from the database at a time. Memory use depends on this rather than on how many rows are exported
+#define EXPORT_CHUNK_SIZE 1024
+
+typedef enum {
+    EXPORT_CSV,         // a header line then one line per error. Descriptions are always quoted
+    EXPORT_JSON_LINES   // one JSON object per error per line
+} ExportFormat;
+
+// EXPORT_JSON_LINES if path ends in .json or .jsonl, otherwise EXPORT_CSV
+ExportFormat export_format_for_path(const char *path);
+
+// called after each chunk with the rows written so far
+typedef void (*ExportProgressFunc)(const guint64 num_rows, gpointer user_data);
+
+// called in the gtk main loop when an export_errors_async has finished.
+// num_rows is the number of rows written or -1 if the export failed or was cancelled (the file is removed)
+typedef void (*ExportDoneFunc)(const gint64 num_rows, gpointer user_data);
+
+// write the errors matching filter (oldest first) to path. Whatever show_disabled is decides whether disabled errors
+// are included, as in the tab. The database is only locked for a chunk at a time so errors keep arriving meanwhile.
+// progress is called from this thread and may be NULL. Returns the number of rows written or -1 on failure or when
+// cancellable (may be NULL) is cancelled, in which case path is removed
+gint64 export_errors(const ErrorFilter *filter, const char *path, const ExportFormat format, GCancellable *cancellable,
+                     ExportProgressFunc progress, gpointer user_data);
+
+// as export_errors on a thread of its own. progress and done are called in the gtk main loop.
+// progress may be called less often than once a chunk if the main loop is busy
+void export_errors_async(const ErrorFilter *filter, const char *path, const ExportFormat format, GCancellable *cancellable,
+                         ExportProgressFunc progress, ExportDoneFunc done, gpointer user_data);
+
+#ifdef _cplusplus
+}
+#endif // _cplusplus
+#endif // EXPORT_H
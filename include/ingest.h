@@ -0,0 +1,50 @@
+/*
+ * Copyright 2017
+ * GPL3 Licensed
+ * ingest.h
+ * Moves errors from the server's buffer into the database in batches
+ */
+
+#ifndef INGEST_H
+#define INGEST_H
+
+// link properly with C++
+#ifdef _cplusplus
+extern "C" {
+#endif // _cplusplus
+
+// includes
+#include <glib.h>
+#include <stdbool.h>
+
+// declarations
+
+// defaults for start_ingest
+#define DEFAULT_INGEST_BATCH_SIZE 256
+#define DEFAULT_INGEST_LATENCY 100 // ms
+#define DEFAULT_INGEST_QUEUE_SIZE 4096
+
+typedef struct {
+    guint64 received;       // messages read from the server
+    guint64 added;          // errors added to the database
+    guint64 failed;         // errors the database would not take
+    guint64 unknown_node;   // errors from nodes which aren't in the database
+    guint64 batches;        // database transactions
+    guint64 full_waits;     // times the queue was full so the server kept the messages in its buffer
+    guint max_depth;        // deepest the queue has been
+} IngestStats;
+
+// start the threads reading messages from the server and writing them to the database.
+// Messages wait at most latency ms to be written unless batch_size have arrived first.
+// At most queue_size messages are held between the two threads
+bool start_ingest(const guint batch_size, const guint latency, const guint queue_size);
+
+// writes out whatever has been read so far then stops the threads. Call after stop_server
+void stop_ingest(void);
+
+void get_ingest_stats(IngestStats *stats);
+
+#ifdef _cplusplus
+}
+#endif // _cplusplus
+#endif // INGEST_H
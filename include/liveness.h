@@ -0,0 +1,50 @@
+/*
+ * Copyright 2017
+ * GPL3 Licensed
+ * liveness.h
+ * Keeps track of which nodes are connected
+ */
+
+#ifndef LIVENESS_H
+#define LIVENESS_H
+
+// link properly with C++
+#ifdef _cplusplus
+extern "C" {
+#endif // _cplusplus
+
+// includes
+#include <glib.h>
+#include <stdbool.h>
+#include <time.h>
+#include <edsac_server.h> // libedsacnetworking
+
+// declarations
+
+// default for start_liveness
+#define DEFAULT_LIVENESS_INTERVAL 10 // seconds
+
+// start a thread which compares the server's connections with the nodes in the database every interval seconds.
+// A "Node not connected" error is added when a node goes away and "Node recovered" when it comes back
+bool start_liveness(const guint interval);
+
+// stop the thread. Call before stop_server so that the server's connections closing doesn't look like every node going away
+void stop_liveness(void);
+
+// check straight away rather than waiting for the next interval
+void liveness_check_now(void);
+
+// nodes sending messages are connected. May be called from any thread
+void liveness_seen(BufferItem *const *items, const size_t num_items);
+
+// keep the tracked nodes in step with the database
+void liveness_add_node(const unsigned int rack_no, const unsigned int chassis_no);
+void liveness_remove_node(const unsigned int rack_no, const unsigned int chassis_no);
+
+// when the node last sent a message or was seen connected. 0 if never or if it isn't tracked
+time_t liveness_last_seen(const unsigned int rack_no, const unsigned int chassis_no);
+
+#ifdef _cplusplus
+}
+#endif // _cplusplus
+#endif // LIVENESS_H
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2017
+ * GPL3 Licensed
+ * metrics.h
+ * Counters and latency histograms for the hot paths. Off (and next to free) unless enabled
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+// link properly with C++
+#ifdef _cplusplus
+extern "C" {
+#endif // _cplusplus
+
+// includes
+#include <glib.h>
+#include <stdbool.h>
+
+// declarations
+
+// defaults for start_metrics_dump
+#define DEFAULT_METRICS_INTERVAL 60 // seconds
+
+typedef enum {
+    METRIC_INGEST_BATCH,    // errors in each batch written by ingest
+    METRIC_INGEST_BACKLOG,  // errors still queued when a batch is taken
+    METRIC_INGEST_WRITE,    // ns to write a batch to the database
+    METRIC_SQL_ADD,         // ns in add_errors_batch
+    METRIC_SQL_SEARCH,      // ns for each search_clickable_* call
+    METRIC_SQL_COUNT,       // ns for each count_clickable
+    METRIC_SQL_SYNC,        // ns for each sync_database that found changes
+    METRIC_TAB_UPDATE,      // ns in the notebook bringing a tab up to date
+    METRIC_TAB_ROWS,        // rows in a tab when it is updated
+    NUM_METRICS
+} Metric;
+
+// summary of one metric. Percentiles are the top of the power of two bucket they fall in
+typedef struct {
+    const char *name;
+    const char *unit;   // "ns" or "rows"
+    guint64 count;
+    guint64 sum;
+    guint64 max;
+    guint64 p50;
+    guint64 p99;
+} MetricSummary;
+
+void metrics_enable(const bool enable);
+bool metrics_enabled(void);
+
+// forget everything recorded so far
+void metrics_reset(void);
+
+// record value for metric
+void metrics_record(const Metric metric, const guint64 value);
+
+// for timing: pass the result to metrics_finish. 0 when metrics are off, which metrics_finish ignores
+gint64 metrics_start(void);
+
+// record the ns since start (from metrics_start)
+void metrics_finish(const Metric metric, const gint64 start);
+
+void metrics_summary(const Metric metric, MetricSummary *summary);
+
+// a table of every metric (json: one JSON object on one line). Free with g_string_free
+GString *metrics_dump(const bool json);
+
+// append metrics_dump to path every interval seconds (JSON lines if path ends in .json or .jsonl). Enables metrics
+bool start_metrics_dump(const char *path, const guint interval);
+
+// writes a last dump then stops the thread
+void stop_metrics_dump(void);
+
+#ifdef _cplusplus
+}
+#endif // _cplusplus
+#endif // METRICS_H
@@ -15,9 +15,53 @@ extern "C" {
 
 // includes
 #include <stdbool.h>
+#include <glib.h>
 
 // declarations
 
+// default for provision_nodes
+#define DEFAULT_PROVISION_WORKERS 8
+
+// a node to be set up by provision_nodes
+typedef struct {
+    unsigned int rack_no;
+    unsigned int chassis_no;
+    char *mac_addr;
+    char *conf_archive;
+} NodeSpec;
+
+typedef enum {
+    PROVISION_NETWORK,  // /etc/hosts and udhcpd.conf are being written
+    PROVISION_WAITING,  // waiting for the node to boot and answer ssh
+    PROVISION_SSH,      // copying the software over ssh
+    PROVISION_DONE,
+    PROVISION_FAILED,
+} ProvisionStage;
+
+// called in the gtk main loop each time a node moves on to stage
+typedef void (*ProvisionProgressFunc)(const NodeSpec *node, const ProvisionStage stage, gpointer user_data);
+
+// called in the gtk main loop once every node is done or has failed
+typedef void (*ProvisionDoneFunc)(const guint num_failed, gpointer user_data);
+
+void free_node_spec(gpointer node);
+
+// largest rack_no or chassis_no. Each is an octet of the node's IP address
+#define MAX_NODE_NUMBER 255
+
+// nodes in racks first_rack to last_rack are set up to send their errors to the collector listening on port.
+// Racks never given a port use the node software's default
+void set_collector_port(const unsigned int first_rack, const unsigned int last_rack, const guint16 port);
+
+// read a node list: one "rack_no chassis_no mac_address config_archive" per line. Blank lines and lines starting with # are ignored.
+// A relative config_archive is relative to the list's directory.
+// returns a GPtrArray of NodeSpec or NULL (having printed why) if the file can't be read, a line is invalid, a number is
+// more than MAX_NODE_NUMBER or a node is listed twice
+GPtrArray *read_node_list(const char *path);
+
+// as setup_node_network for every node at once: one privileged step and one udhcpd restart
+bool setup_nodes_network(NodeSpec *const *nodes, const size_t num_nodes);
+
 // attempt to set up a node specified by the arguments. These arguments are assumed to be valid.
 // returns success
 bool setup_node_network(const unsigned int rack_no, const unsigned int chassis_no, const char *mac_addr);
@@ -32,13 +76,20 @@ bool copy_file(const unsigned int rack_no, const unsigned int chassis_no, const
 // command should not include '
 bool run_remote_command(const unsigned int rack_no, const unsigned int chassis_no, const char *cmd);
 
-// copy over and extract a tar file (compression optional)
-// dest should be a directory on the remote host
+// extract a tar file (compression optional, going by the file extension) on the node, streaming it over ssh
+// dest should be a directory on the remote host. It is created if needed
 bool copy_and_extract_archive(const unsigned int rack_no, const unsigned int chassis_no, const char *archive, const char *dest);
 
-// setup stage using ssh once the network is configured
+// setup stage using ssh once the network is configured. Every step shares one login to the node.
+// Archives whose sha256 matches the node's manifest are not sent again
 bool setup_node_ssh(const unsigned int rack_no, const unsigned int chassis_no, const char *conf_archive);
 
+// set up every node in nodes (a GPtrArray of NodeSpec) without blocking the caller.
+// The network is set up for all of them at once then up to max_workers nodes are set up over ssh at a time.
+// ssh runs without a terminal so key based login to the nodes is needed. Takes a reference to nodes
+void provision_nodes(GPtrArray *nodes, const guint max_workers, ProvisionProgressFunc progress, ProvisionDoneFunc done,
+                     gpointer user_data);
+
 #ifdef _cplusplus
 }
 #endif // _cplusplus
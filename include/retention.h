@@ -0,0 +1,42 @@
+/*
+ * Copyright 2017
+ * GPL3 Licensed
+ * retention.h
+ * Moves old errors out of the live database on a schedule
+ */
+
+#ifndef RETENTION_H
+#define RETENTION_H
+
+// link properly with C++
+#ifdef _cplusplus
+extern "C" {
+#endif // _cplusplus
+
+// includes
+#include <glib.h>
+#include <stdbool.h>
+
+// declarations
+
+// defaults for start_retention
+#define DEFAULT_RETENTION_INTERVAL 60 // minutes
+
+typedef struct {
+    guint max_age;      // days. Older errors are archived. 0 for no limit
+    guint max_rows;     // the oldest errors over this many are archived. 0 for no limit
+    guint interval;     // minutes between runs
+    bool monthly;       // an archive file per month rather than one for everything
+} RetentionPolicy;
+
+// start a thread which archives errors breaking the policy to archive_prefix.db (or archive_prefix-YYYY-MM.db)
+// then frees the space they took up. It runs straight away and then every policy->interval minutes
+bool start_retention(const char *archive_prefix, const RetentionPolicy *policy);
+
+// finishes the chunk being moved then stops the thread. Call before close_database
+void stop_retention(void);
+
+#ifdef _cplusplus
+}
+#endif // _cplusplus
+#endif // RETENTION_H
@@ -21,11 +21,13 @@ extern "C" {
 
 typedef struct {
     char *message;
+    time_t recv_time;
     unsigned int rack_no;
     unsigned int chassis_no;
     int valve_no;
     bool enabled;
     int id;
+    int occurrences; // more than one if duplicates were merged into this error
 } SearchResult;
 
 typedef struct {
@@ -33,47 +35,230 @@ typedef struct {
     unsigned int chassis_no;
 } NodeIdentifier;
 
+// what kind of error a row is. Stored in errors.category rather than as part of the description, so never renumber
+typedef enum {
+    ERROR_CATEGORY_OTHER,       // raised by the mothership itself (e.g. liveness). No prefix
+    ERROR_CATEGORY_HARDWARE,    // shown as "Hardware Error: " then the description
+    ERROR_CATEGORY_SOFTWARE,    // shown as "Software Error: " then the description
+    NUM_ERROR_CATEGORIES
+} ErrorCategory;
+
+// why a message from the server was dropped rather than added
+typedef enum {
+    DROP_UNKNOWN_NODE,  // its node isn't in the database
+    DROP_UNKNOWN_TYPE,  // it isn't a type of error which can be stored. Always counted as ERROR_CATEGORY_OTHER
+    NUM_DROP_REASONS
+} DropReason;
+
+// space needed for format_search_time
+#define SEARCH_TIME_LEN 24
+
+// a row passed to a SearchRowFunc. The strings are borrowed and only valid until the callback returns
+typedef struct {
+    time_t recv_time;
+    const char *time_str;    // recv_time formatted by format_search_time
+    const char *description; // with its category's prefix
+    unsigned int rack_no;
+    unsigned int chassis_no;
+    int valve_no;
+    bool enabled;
+    int id;
+    int occurrences;         // more than one if duplicates were merged into this error
+    time_t last_seen;        // when the last duplicate arrived. recv_time is the first
+} SearchRow;
+
+// return false to stop the search
+typedef bool (*SearchRowFunc)(const SearchRow *row, gpointer user_data);
+
 // declarations
 bool check_mac_address(const char* str);
 
 void free_search_result(gpointer res);
 
+// opens (creating or upgrading as required) the database at path. NULL or "" for a memory resident database
 void init_database(const char* path);
+// what sync_database found
+#define DATABASE_ERRORS_ADDED 1
+#define DATABASE_ERRORS_CHANGED 2 // see get_database_generation and get_database_merges
+#define DATABASE_NODES_CHANGED 4
+
+// as init_database but for a database written by another process (a --headless collector): nothing is ever written to it.
+// The file must already exist and be at the current schema version. Call sync_database to catch up with the writer
+void init_database_read_only(const char *path);
+
+// most databases init_database_federated can show at once. SQLite attaches at most 10 to a connection by default
+#define MAX_SHARDS 8
+
+// as init_database_read_only but for the databases of several collectors, each recording its own racks (see set_rack_range).
+// They are attached to one connection and searched as one: error ids are made unique by interleaving each database's ids,
+// so each must have fewer than INT_MAX / num_paths. Nodes must not appear in more than one
+void init_database_federated(const char *const *paths, const int num_paths);
+
+// catch up with the changes other processes have made to the databases opened with init_database_read_only or
+// init_database_federated.
+// returns DATABASE_* flags for what changed (0 if nothing has). When errors were added and keys is not NULL,
+// *keys is set to a GArray of their ErrorKeys (free with g_array_unref)
+int sync_database(GArray **keys);
+
 void close_database(void);
 
+// the PRAGMA user_version of the open database
+int get_schema_version(void);
+
+// opened with init_database_read_only or init_database_federated: nothing can be changed
+bool get_database_read_only(void);
+
 // get the fields we want out of the IP v4 address (xxx.xxx.rack_no.chassis_no)
-NodeIdentifier *parse_ip_address(const struct in_addr *address);
+void get_node_identifier(const struct in_addr *address, NodeIdentifier *node);
+
+// where the error in item came from, without touching the database
+void get_error_key(const BufferItem *item, ErrorKey *key);
+
+// changes whenever results already returned by search_clickable may be out of date
+// (rather than there just being new errors to append)
+unsigned int get_database_generation(void);
+
+// errors which weren't added because their node isn't in the database
+unsigned int get_unknown_node_errors(void);
+
+// messages of category dropped for reason since init_database
+unsigned int get_dropped_errors(const DropReason reason, const ErrorCategory category);
+
+// changes whenever duplicates are merged into errors already in the database.
+// Only errors received within the dedup window of the newest ones can change like this
+unsigned int get_database_merges(void);
+
+// errors identical to one received less than seconds after it (same node, valve and description) are merged into it
+// rather than being added as a new error. 0 turns this off (the default)
+void set_dedup_window(const time_t seconds);
 
 // only effects things which search on clickables
 void set_show_disabled(bool new_val);
 bool get_show_disabled(void);
 
+// only racks first_rack to last_rack (inclusive) can be added to the database, so errors from any other rack are dropped
+// as coming from unknown nodes. For collectors which each record part of the machine. Until init_database
+void set_rack_range(const unsigned int first_rack, const unsigned int last_rack);
+
+// whether rack_no is in the set_rack_range, so add_node won't refuse it for that. Check before setting a node up
+bool add_node_allowed(const unsigned int rack_no);
+
 bool add_node(const unsigned int rack_no, const unsigned int chassis_no, const bool enabled);
+
+// as add_node for every one of nodes in one transaction: either all of them are added or none are
+bool add_nodes(const NodeIdentifier *nodes, const size_t num_nodes, const bool enabled);
 bool remove_node(const unsigned int rack_no, const unsigned int chassis_no);
 bool node_exists(const unsigned int rack_no, const unsigned int chassis_no);
 
+// false if the error's node isn't in the database (see get_unknown_node_errors)
 bool add_error(const BufferItem *error);
+
+// what happened to each error given to add_errors_batch
+typedef enum {
+    ADD_ERROR_FAILED,
+    ADD_ERROR_ADDED,        // or merged into a duplicate
+    ADD_ERROR_UNKNOWN_NODE, // dropped (see get_unknown_node_errors)
+} AddErrorResult;
+
+// add a batch of errors from the server's buffer in a single transaction.
+// If results is not NULL it must have space for num_items entries: results[i] is set to what happened to items[i].
+// returns the number of errors added
+size_t add_errors_batch(BufferItem *const *items, const size_t num_items, AddErrorResult *results);
+// msg may start with "Hardware Error: " or "Software Error: ", which sets the error's category
 bool add_error_decoded(const uint32_t rack_no, const uint32_t chassis_no, const int valve_no, const time_t recv_time, const char *msg);
 bool remove_all_errors(void);
 
-// returns a GList of SearchResults
+// returns a GList of every matching SearchResult, oldest first
 GList *search_clickable(const Clickable *search);
 
+// up to limit SearchResults immediately after (forward) or before (!forward) the error with key (key_time, key_id)
+// in the (recv_time, id) order used by search_clickable. Results are always in that order.
+// key_time = 0, key_id = 0 going forward starts from the beginning
+GList *search_clickable_page(const Clickable *search, const time_t key_time, const int key_id, const bool forward, const int limit);
+
+// up to limit SearchResults starting from the offset'th result of search_clickable.
+// This has to skip over offset rows so prefer search_clickable_page when a key is known
+GList *search_clickable_offset(const Clickable *search, const int offset, const int limit);
+
+// call func on up to limit (negative for no limit) rows after (forward) or before (!forward) the key (key_time, key_id),
+// streaming them from the database without building a list. Backward searches see rows newest first.
+// Continue from where a search stopped by passing the last row's recv_time and id as the key.
+// The database is locked while func runs so it must be quick and must not search again.
+// returns the number of rows passed to func or -1 on error
+int search_clickable_foreach(const Clickable *search, const time_t key_time, const int key_id, const bool forward, const int limit,
+                             SearchRowFunc func, gpointer user_data);
+
+// as search_clickable_foreach but starting from the offset'th row
+int search_clickable_foreach_offset(const Clickable *search, const int offset, const int limit, SearchRowFunc func, gpointer user_data);
+
+// as search_clickable_foreach backwards from the end: the newest limit rows, newest first.
+// *count is set to count_clickable at the same moment so the rows are the last of the *count it has counted
+int search_clickable_foreach_tail(const Clickable *search, const int limit, int *count, SearchRowFunc func, gpointer user_data);
+
+// the time prefix used in SearchResult messages: asctime without the year
+void format_search_time(const time_t recv_time, char time_str[SEARCH_TIME_LEN]);
+
 // GList of unsigned int
 GList *list_racks(void);
 
 // GList of chassis numbers
 GList *list_chassis_by_rack(const uintptr_t rack_no);
 
-// GList of NodeIdentifiers
-GSList *list_nodes(void);
+// GList of every NodeIdentifier (including disabled nodes) ordered by rack_no then chassis_no. Free with g_free
+GList *list_nodes_ordered(void);
+
+// per minute rollups are kept this long. Per hour rollups are kept as long as the database
+#define ROLLUP_MINUTES_KEPT (48 * 60)
+
+// errors received by a node (see node_activity). Merged duplicates count as well
+typedef struct {
+    unsigned int rack_no;
+    unsigned int chassis_no;
+    unsigned int count;
+} NodeActivity;
+
+// errors received by every node in one minute or hour (see activity_trend)
+typedef struct {
+    time_t start;
+    unsigned int count;
+} ActivityBucket;
+
+// NodeActivity for each node which has received errors since since (rounded down to the minute, or hour if hourly).
+// Read from rollups so only the buckets in range are looked at, however long the history. Free with g_array_unref
+GArray *node_activity(const time_t since, const bool hourly);
+
+// ActivityBucket for each minute (or hour) since since which had errors, oldest first. Free with g_array_unref
+GArray *activity_trend(const time_t since, const bool hourly);
 
 bool node_toggle_disabled(const unsigned long int rack_no, const unsigned long int chassis_no);
 bool error_toggle_disabled(const uintptr_t id);
 
+// which errors set_errors_enabled changes. All of the conditions have to match
+typedef struct {
+    Clickable search;       // errors the tab would show if disabled errors were shown
+    time_t from;            // received at or after this (0 for no limit)
+    time_t until;           // received before this (0 for no limit)
+    const char *contains;   // the description contains this, ignoring case. NULL or "" for any description
+} ErrorFilter;
+
+// enable (or disable if !enabled) every error matching filter with one UPDATE.
+// returns the number of errors changed or -1 on error
+int set_errors_enabled(const ErrorFilter *filter, const bool enabled);
+
 // -1 on error
 int count_clickable(const Clickable *search);
 
+// move up to max_rows of the oldest errors into the archive database at archive_prefix.db (created if needed).
+// Errors are moved if they were received before before (0 for no age limit) or if there are more than keep (0 for no limit).
+// If monthly each month goes to its own archive_prefix-YYYY-MM.db and only one month is moved per call.
+// Call repeatedly until nothing is left to move. returns the number moved or -1 on error
+int archive_old_errors(const char *archive_prefix, const time_t before, const unsigned int keep, const bool monthly,
+                       const unsigned int max_rows);
+
+// give up to max_pages (0 for all) pages freed by archive_old_errors back to the filesystem.
+// returns the number of free pages left in the file or -1 on error
+int reclaim_space(const int max_pages);
+
 #ifdef _cplusplus
 }
 #endif // _cplusplus
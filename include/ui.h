@@ -14,13 +14,25 @@ extern "C" {
 #endif // _cplusplus
 
 // includes
+#include <stdbool.h>
 #include <glib.h>
+#include "EdsacErrorNotebook.h"
 
 // declarations
-int start_ui(int *argc, char ***argv, gpointer timer_id);
+
+// default for start_ui
+#define DEFAULT_FRAME_BUDGET 100 // ms
+
+// frame_budget is the shortest time between refreshes for new errors.
+// watch_only is for a database opened with init_database_read_only: the gui follows the writer and can't change anything
+int start_ui(int *argc, char ***argv, const guint frame_budget, const bool watch_only);
 
 void gui_update(gpointer g_idle_id);
 
+// tell the gui about errors added to the database at keys. May be called from any thread.
+// Refreshes are coalesced so that they happen at most once per frame budget
+void gui_errors_added(const ErrorKey *keys, const guint num_keys);
+
 #ifdef _cplusplus
 }
 #endif // _cplusplus
@@ -0,0 +1,843 @@
+/*
+ * Copyright 2017
+ * GPL3 Licensed
+ * EdsacErrorListModel.c
+ * GObject Class implementing GtkTreeModel over the errors matching a Clickable.
+ * Rows are fetched from the database a page at a time when the view asks for them and only a few pages are kept.
+ * Everything that touches the database runs on the database thread so the view draws blank rows until they arrive.
+ * A new model starts with the newest page, which the views show first, so opening a tab never waits for old errors
+ */
+
+// includes
+#include "config.h"
+#include "EdsacErrorListModel.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+#include "sql.h"
+#include "db_worker.h"
+
+// declarations
+
+#define PAGE_SIZE EDSAC_ERROR_LIST_PAGE_SIZE
+
+// pages kept in memory. Enough for the visible rows plus some scrolling either way
+#define MAX_CACHED_PAGES 8
+
+// a page of rows from the database. Everything is in two allocations so it is cheap to throw away
+typedef struct {
+    gint page_no;
+    gint n_rows;            // rows in the model when the page was requested
+    GArray *rows;           // EdsacErrorListRows
+    GStringChunk *messages; // storage for the rows' message strings
+} Page;
+
+// keys of the first and last rows of a page. Kept after the page is dropped so that
+// neighbouring pages can be fetched with a keyset query rather than an OFFSET
+typedef struct {
+    time_t first_time;
+    int first_id;
+    time_t last_time;
+    int last_id;
+} PageKeys;
+
+// where a page is fetched from
+typedef enum {
+    FROM_START,
+    AFTER_KEY,
+    BEFORE_KEY,
+    FROM_OFFSET
+} PageFrom;
+
+// what the first load of a model finds
+typedef struct {
+    gint count;
+    Page *page; // the last page. NULL if there are no rows or they didn't line up with count
+} TailLoad;
+
+// a page for the database thread to fetch. It has its own copy of everything it needs
+typedef struct {
+    Clickable search;
+    gint page_no;
+    gint n_rows;
+    PageFrom from;
+    time_t key_time;
+    int key_id;
+} PageRequest;
+
+// private object data
+typedef struct _EdsacErrorListModelPrivate {
+    Clickable search;           // what this is a list of
+    gint n_rows;                // rows in the model
+    gboolean counted;           // n_rows has been read from the database
+    gboolean counting;          // a count is queued on the database thread
+    gboolean stale;             // rows have been removed from the database so the model needs replacing
+    gint stamp;                 // identifies iters belonging to this model
+    unsigned int generation;    // database generation the rows are valid for
+    unsigned int merges;        // get_database_merges when the newest rows were last fetched
+    GQueue pages;               // cached Pages, most recently used first
+    GHashTable *page_keys;      // page_no -> PageKeys
+    GHashTable *pending;        // page_no -> GCancellable of pages being fetched
+    GCancellable *cancellable;  // cancels everything the model has queued
+    EdsacErrorListModelNotify notify;
+    gpointer notify_data;
+} EdsacErrorListModelPrivate;
+
+static gpointer edsac_error_list_model_parent_class = NULL;
+#define EDSAC_ERROR_LIST_MODEL_GET_PRIVATE(_o) (G_TYPE_INSTANCE_GET_PRIVATE((_o), EDSAC_TYPE_ERROR_LIST_MODEL, EdsacErrorListModelPrivate))
+
+/**** local function declarations ****/
+static void free_page(gpointer page);
+static Page *find_page(EdsacErrorListModel *self, const gint page_no);
+static gpointer load_page_job(gpointer request, GCancellable *cancellable);
+static void request_page(EdsacErrorListModel *self, const gint page_no);
+static void page_loaded(GObject *source, GAsyncResult *result, gpointer unused);
+static void store_page(EdsacErrorListModel *self, Page *page);
+static void free_tail_load(gpointer load);
+static gpointer load_tail_job(gpointer search, GCancellable *cancellable);
+static void load_tail(EdsacErrorListModel *self);
+static void tail_loaded(GObject *source, GAsyncResult *result, gpointer unused);
+static gpointer count_job(gpointer search, GCancellable *cancellable);
+static void count_rows(EdsacErrorListModel *self);
+static void rows_counted(GObject *source, GAsyncResult *result, gpointer unused);
+static const EdsacErrorListRow *get_row(EdsacErrorListModel *self, const gint index);
+static void set_iter(EdsacErrorListModel *self, GtkTreeIter *iter, const gint index);
+static gint iter_index(EdsacErrorListModel *self, const GtkTreeIter *iter);
+
+/**** Public Methods ****/
+EdsacErrorListModel *edsac_error_list_model_new(const Clickable *search, EdsacErrorListModelNotify notify, gpointer user_data) {
+    assert(NULL != search);
+
+    EdsacErrorListModel *self = (EdsacErrorListModel *) g_object_new(EDSAC_TYPE_ERROR_LIST_MODEL, NULL);
+    assert(NULL != self);
+
+    memcpy(&self->priv->search, search, sizeof(self->priv->search));
+    self->priv->notify = notify;
+    self->priv->notify_data = user_data;
+
+    // read the generation first so that a change during the count is noticed by the next update
+    self->priv->generation = get_database_generation();
+    self->priv->merges = get_database_merges();
+
+    load_tail(self);
+
+    return self;
+}
+
+gboolean edsac_error_list_model_update(EdsacErrorListModel *self) {
+    assert(NULL != self);
+    EdsacErrorListModelPrivate *priv = self->priv;
+
+    if ((get_database_generation() != priv->generation) || priv->stale) {
+        return FALSE;
+    }
+
+    // duplicates are only merged into recent errors so just the newest pages can have changed.
+    // Older rows would need more than a couple of pages of different errors inside the dedup window
+    const unsigned int merges = get_database_merges();
+    if ((merges != priv->merges) && priv->counted && (priv->n_rows > 0)) {
+        priv->merges = merges;
+
+        const gint last_page = (priv->n_rows - 1) / PAGE_SIZE;
+        for (gint page_no = last_page; (page_no >= 0) && (page_no >= last_page - 1); page_no--) {
+            if (NULL != find_page(self, page_no)) {
+                request_page(self, page_no);
+            }
+        }
+    }
+
+    // new rows are inserted when the count comes back
+    if (!priv->counting) {
+        count_rows(self);
+    }
+
+    return TRUE;
+}
+
+const EdsacErrorListRow *edsac_error_list_model_peek(EdsacErrorListModel *self, GtkTreeIter *iter) {
+    assert(NULL != self);
+
+    return get_row(self, iter_index(self, iter));
+}
+
+gint edsac_error_list_model_get_n_rows(EdsacErrorListModel *self) {
+    assert(NULL != self);
+    return self->priv->counted ? self->priv->n_rows : -1;
+}
+
+// matches GHRFunc
+static gboolean cancel_page(__attribute__((unused)) gpointer page_no, gpointer cancellable, __attribute__((unused)) gpointer unused) {
+    g_cancellable_cancel(G_CANCELLABLE(cancellable));
+    return TRUE;
+}
+
+void edsac_error_list_model_cancel_pending(EdsacErrorListModel *self) {
+    assert(NULL != self);
+    g_hash_table_foreach_remove(self->priv->pending, cancel_page, NULL);
+}
+
+void edsac_error_list_model_cancel(EdsacErrorListModel *self) {
+    assert(NULL != self);
+
+    g_cancellable_cancel(self->priv->cancellable);
+    edsac_error_list_model_cancel_pending(self);
+}
+
+
+
+/*** stuff to do with internal structures ***/
+
+// matches GDestroyNotify
+static void free_page(gpointer page) {
+    assert(NULL != page);
+    Page *p = (Page *) page;
+
+    g_array_free(p->rows, TRUE);
+    g_string_chunk_free(p->messages);
+    g_free(p);
+}
+
+// look for a page in the cache and mark it as most recently used
+static Page *find_page(EdsacErrorListModel *self, const gint page_no) {
+    GQueue *pages = &self->priv->pages;
+
+    for (GList *item = pages->head; NULL != item; item = item->next) {
+        Page *page = (Page *) item->data;
+        if (page->page_no == page_no) {
+            if (item != pages->head) {
+                g_queue_unlink(pages, item);
+                g_queue_push_head_link(pages, item);
+            }
+            return page;
+        }
+    }
+
+    return NULL;
+}
+
+// backward searches are newest first
+static void reverse_rows(GArray *rows) {
+    for (guint a = 0, b = rows->len; a + 1 < b; a++, b--) {
+        EdsacErrorListRow tmp = g_array_index(rows, EdsacErrorListRow, a);
+        g_array_index(rows, EdsacErrorListRow, a) = g_array_index(rows, EdsacErrorListRow, b - 1);
+        g_array_index(rows, EdsacErrorListRow, b - 1) = tmp;
+    }
+}
+
+static Page *new_page(const gint page_no, const gint n_rows) {
+    Page *page = g_new(Page, 1);
+    assert(NULL != page);
+    page->page_no = page_no;
+    page->n_rows = n_rows;
+    page->rows = g_array_sized_new(FALSE, FALSE, sizeof(EdsacErrorListRow), PAGE_SIZE);
+    assert(NULL != page->rows);
+    page->messages = g_string_chunk_new(PAGE_SIZE * 64);
+    assert(NULL != page->messages);
+
+    return page;
+}
+
+// what append_row is filling in
+typedef struct {
+    Page *page;
+    GString *message; // reused to join the time and description of each row
+} PageLoad;
+
+// SearchRowFunc adding a row to a PageLoad
+static bool append_row(const SearchRow *row, gpointer load) {
+    PageLoad *l = (PageLoad *) load;
+
+    g_string_assign(l->message, row->time_str);
+    g_string_append(l->message, row->description);
+    if (row->occurrences > 1) {
+        g_string_append_printf(l->message, " \u00d7%i", row->occurrences);
+    }
+
+    EdsacErrorListRow new_row;
+    new_row.message = g_string_chunk_insert_len(l->page->messages, l->message->str, (gssize) l->message->len);
+    new_row.recv_time = row->recv_time;
+    new_row.id = row->id;
+    new_row.rack_no = row->rack_no;
+    new_row.chassis_no = row->chassis_no;
+    new_row.valve_no = row->valve_no;
+    new_row.enabled = row->enabled;
+    new_row.occurrences = row->occurrences;
+    g_array_append_val(l->page->rows, new_row);
+
+    return true;
+}
+
+// DbJobFunc fetching a PageRequest from the database. Runs on the database thread
+static gpointer load_page_job(gpointer request, __attribute__((unused)) GCancellable *cancellable) {
+    PageRequest *r = (PageRequest *) request;
+
+    Page *page = new_page(r->page_no, r->n_rows);
+
+    // rows are copied straight from the database into the page
+    PageLoad load;
+    load.page = page;
+    load.message = g_string_new(NULL);
+    assert(NULL != load.message);
+
+    switch (r->from) {
+        case FROM_START:
+            search_clickable_foreach(&r->search, 0, 0, true, PAGE_SIZE, append_row, &load);
+            break;
+        case AFTER_KEY:
+            search_clickable_foreach(&r->search, r->key_time, r->key_id, true, PAGE_SIZE, append_row, &load);
+            break;
+        case BEFORE_KEY:
+            search_clickable_foreach(&r->search, r->key_time, r->key_id, false, PAGE_SIZE, append_row, &load);
+            reverse_rows(page->rows);
+            break;
+        case FROM_OFFSET:
+            search_clickable_foreach_offset(&r->search, r->page_no * PAGE_SIZE, PAGE_SIZE, append_row, &load);
+            break;
+    }
+
+    g_string_free(load.message, TRUE);
+    return page;
+}
+
+// ask the database thread for a page unless it has already been asked
+static void request_page(EdsacErrorListModel *self, const gint page_no) {
+    EdsacErrorListModelPrivate *priv = self->priv;
+
+    if (g_cancellable_is_cancelled(priv->cancellable) || g_hash_table_contains(priv->pending, GINT_TO_POINTER(page_no))) {
+        return;
+    }
+
+    PageRequest *request = g_new(PageRequest, 1);
+    assert(NULL != request);
+    memcpy(&request->search, &priv->search, sizeof(request->search));
+    request->page_no = page_no;
+    request->n_rows = priv->n_rows;
+    request->key_time = 0;
+    request->key_id = 0;
+
+    // use a neighbour's keys if we have them so that the database doesn't have to skip over rows
+    const PageKeys *previous = g_hash_table_lookup(priv->page_keys, GINT_TO_POINTER(page_no - 1));
+    const PageKeys *next = g_hash_table_lookup(priv->page_keys, GINT_TO_POINTER(page_no + 1));
+    if (0 == page_no) {
+        request->from = FROM_START;
+    } else if (NULL != previous) {
+        request->from = AFTER_KEY;
+        request->key_time = previous->last_time;
+        request->key_id = previous->last_id;
+    } else if (NULL != next) {
+        request->from = BEFORE_KEY;
+        request->key_time = next->first_time;
+        request->key_id = next->first_id;
+    } else {
+        request->from = FROM_OFFSET;
+    }
+
+    GCancellable *cancellable = g_cancellable_new();
+    assert(NULL != cancellable);
+    g_hash_table_insert(priv->pending, GINT_TO_POINTER(page_no), cancellable);
+
+    db_worker_push(self, cancellable, load_page_job, request, g_free, free_page, page_loaded, NULL);
+}
+
+// matches GHRFunc
+static gboolean is_cancellable(__attribute__((unused)) gpointer page_no, gpointer cancellable, gpointer match) {
+    return cancellable == match;
+}
+
+// GAsyncReadyCallback for request_page
+static void page_loaded(GObject *source, GAsyncResult *result, __attribute__((unused)) gpointer unused) {
+    EdsacErrorListModel *self = EDSAC_ERROR_LIST_MODEL(source);
+    EdsacErrorListModelPrivate *priv = self->priv;
+    GTask *task = G_TASK(result);
+
+    // the entry is already gone if the request was cancelled
+    g_hash_table_foreach_remove(priv->pending, is_cancellable, g_task_get_cancellable(task));
+
+    Page *page = g_task_propagate_pointer(task, NULL);
+    if (NULL == page) {
+        return;
+    }
+
+    store_page(self, page);
+
+    // the view drew blank rows while it waited
+    const gint first = page->page_no * PAGE_SIZE;
+    const gint end = MIN(first + (gint) page->rows->len, priv->n_rows);
+    for (gint index = first; index < end; index++) {
+        GtkTreeIter iter;
+        set_iter(self, &iter, index);
+        GtkTreePath *path = gtk_tree_path_new_from_indices(index, -1);
+        gtk_tree_model_row_changed(GTK_TREE_MODEL(self), path, &iter);
+        gtk_tree_path_free(path);
+    }
+}
+
+// put a fetched page in the cache in place of any older copy
+static void store_page(EdsacErrorListModel *self, Page *page) {
+    EdsacErrorListModelPrivate *priv = self->priv;
+
+    Page *old = find_page(self, page->page_no);
+    if (NULL != old) {
+        // find_page moved it to the head
+        g_queue_pop_head(&priv->pages);
+        free_page(old);
+    }
+
+    // remember where this page starts and ends
+    if (0 != page->rows->len) {
+        const EdsacErrorListRow *first = &g_array_index(page->rows, EdsacErrorListRow, 0);
+        const EdsacErrorListRow *last = &g_array_index(page->rows, EdsacErrorListRow, page->rows->len - 1);
+
+        PageKeys *keys = g_new(PageKeys, 1);
+        assert(NULL != keys);
+        keys->first_time = first->recv_time;
+        keys->first_id = first->id;
+        keys->last_time = last->recv_time;
+        keys->last_id = last->id;
+        g_hash_table_replace(priv->page_keys, GINT_TO_POINTER(page->page_no), keys);
+    }
+
+    // make space
+    while (g_queue_get_length(&priv->pages) >= MAX_CACHED_PAGES) {
+        free_page(g_queue_pop_tail(&priv->pages));
+    }
+    g_queue_push_head(&priv->pages, page);
+}
+
+// matches GDestroyNotify
+static void free_tail_load(gpointer load) {
+    assert(NULL != load);
+    TailLoad *l = (TailLoad *) load;
+
+    if (NULL != l->page) {
+        free_page(l->page);
+    }
+    g_free(l);
+}
+
+// DbJobFunc counting the rows matching a Clickable and fetching the last page with a keyset search back from the end.
+// Runs on the database thread
+static gpointer load_tail_job(gpointer search, __attribute__((unused)) GCancellable *cancellable) {
+    TailLoad *tail = g_new(TailLoad, 1);
+    assert(NULL != tail);
+    tail->count = 0;
+    tail->page = NULL;
+
+    // page numbers aren't known until the rows are counted
+    Page *page = new_page(0, 0);
+    PageLoad load;
+    load.page = page;
+    load.message = g_string_new(NULL);
+    assert(NULL != load.message);
+
+    // fetches a whole page: only the rows after the last page boundary are kept
+    const int num_rows = search_clickable_foreach_tail((const Clickable *) search, PAGE_SIZE, &tail->count, append_row, &load);
+    g_string_free(load.message, TRUE);
+
+    if ((num_rows <= 0) || (tail->count <= 0)) {
+        tail->count = MAX(tail->count, 0);
+        free_page(page);
+        return tail;
+    }
+
+    page->page_no = (tail->count - 1) / PAGE_SIZE;
+    page->n_rows = tail->count;
+    const guint last_rows = (guint) (tail->count - page->page_no * PAGE_SIZE);
+    if (page->rows->len < last_rows) {
+        // the count and the rows disagree: leave it to get_row to fetch the page
+        free_page(page);
+        return tail;
+    }
+
+    g_array_set_size(page->rows, last_rows);
+    reverse_rows(page->rows);
+    tail->page = page;
+    return tail;
+}
+
+static void load_tail(EdsacErrorListModel *self) {
+    EdsacErrorListModelPrivate *priv = self->priv;
+
+    Clickable *search = g_new(Clickable, 1);
+    assert(NULL != search);
+    memcpy(search, &priv->search, sizeof(*search));
+
+    priv->counting = TRUE;
+    db_worker_push(self, priv->cancellable, load_tail_job, search, g_free, free_tail_load, tail_loaded, NULL);
+}
+
+// GAsyncReadyCallback for load_tail
+static void tail_loaded(GObject *source, GAsyncResult *result, __attribute__((unused)) gpointer unused) {
+    EdsacErrorListModel *self = EDSAC_ERROR_LIST_MODEL(source);
+    EdsacErrorListModelPrivate *priv = self->priv;
+
+    TailLoad *tail = g_task_propagate_pointer(G_TASK(result), NULL);
+    if (NULL == tail) {
+        // cancelled
+        return;
+    }
+    priv->counting = FALSE;
+
+    // no view has the model yet so there is nobody to tell about the rows
+    priv->n_rows = tail->count;
+    priv->counted = TRUE;
+    if (NULL != tail->page) {
+        store_page(self, tail->page);
+        tail->page = NULL;
+    }
+    free_tail_load(tail);
+
+    if (NULL != priv->notify) {
+        priv->notify(self, priv->notify_data);
+    }
+}
+
+// DbJobFunc counting the rows matching a Clickable. Runs on the database thread
+static gpointer count_job(gpointer search, __attribute__((unused)) GCancellable *cancellable) {
+    gint *count = g_new(gint, 1);
+    assert(NULL != count);
+
+    *count = count_clickable((const Clickable *) search);
+    return count;
+}
+
+static void count_rows(EdsacErrorListModel *self) {
+    EdsacErrorListModelPrivate *priv = self->priv;
+
+    Clickable *search = g_new(Clickable, 1);
+    assert(NULL != search);
+    memcpy(search, &priv->search, sizeof(*search));
+
+    priv->counting = TRUE;
+    db_worker_push(self, priv->cancellable, count_job, search, g_free, g_free, rows_counted, NULL);
+}
+
+// GAsyncReadyCallback for count_rows
+static void rows_counted(GObject *source, GAsyncResult *result, __attribute__((unused)) gpointer unused) {
+    EdsacErrorListModel *self = EDSAC_ERROR_LIST_MODEL(source);
+    EdsacErrorListModelPrivate *priv = self->priv;
+
+    gint *count_p = g_task_propagate_pointer(G_TASK(result), NULL);
+    if (NULL == count_p) {
+        // cancelled: nobody wants to hear about it
+        return;
+    }
+    gint count = *count_p;
+    g_free(count_p);
+    priv->counting = FALSE;
+
+    if (count < 0) {
+        if (priv->counted) {
+            // try again next time
+            return;
+        }
+        count = 0;
+    }
+
+    if (!priv->counted) {
+        // no view has the model yet so there is nobody to tell about the rows
+        priv->n_rows = count;
+        priv->counted = TRUE;
+    } else if (count < priv->n_rows) {
+        // rows were removed
+        priv->stale = TRUE;
+        return;
+    } else if (count == priv->n_rows) {
+        return;
+    } else {
+        // errors are timestamped as they are received so new ones always sort after existing ones.
+        // If the last page was partial get_row fetches it again.
+        // Tell the view about the new rows. n_rows must include a row before it is announced
+        for (gint index = priv->n_rows; index < count; index++) {
+            priv->n_rows = index + 1;
+
+            GtkTreeIter iter;
+            set_iter(self, &iter, index);
+            GtkTreePath *path = gtk_tree_path_new_from_indices(index, -1);
+            gtk_tree_model_row_inserted(GTK_TREE_MODEL(self), path, &iter);
+            gtk_tree_path_free(path);
+        }
+    }
+
+    if (NULL != priv->notify) {
+        priv->notify(self, priv->notify_data);
+    }
+}
+
+// NULL if the row has not been fetched yet: it is asked for and the row is changed when it arrives
+static const EdsacErrorListRow *get_row(EdsacErrorListModel *self, const gint index) {
+    EdsacErrorListModelPrivate *priv = self->priv;
+
+    if ((index < 0) || (index >= priv->n_rows)) {
+        return NULL;
+    }
+
+    const gint page_no = index / PAGE_SIZE;
+    const Page *page = find_page(self, page_no);
+    if (NULL == page) {
+        request_page(self, page_no);
+        return NULL;
+    }
+
+    const guint offset = (guint) (index % PAGE_SIZE);
+    if (offset >= page->rows->len) {
+        // the page was partial and has grown since
+        if (page->n_rows < priv->n_rows) {
+            request_page(self, page_no);
+        }
+        return NULL;
+    }
+
+    return &g_array_index(page->rows, EdsacErrorListRow, offset);
+}
+
+// iters just hold the row index
+static void set_iter(EdsacErrorListModel *self, GtkTreeIter *iter, const gint index) {
+    iter->stamp = self->priv->stamp;
+    iter->user_data = GINT_TO_POINTER(index);
+    iter->user_data2 = NULL;
+    iter->user_data3 = NULL;
+}
+
+static gint iter_index(EdsacErrorListModel *self, const GtkTreeIter *iter) {
+    assert(NULL != iter);
+    assert(self->priv->stamp == iter->stamp);
+
+    return GPOINTER_TO_INT(iter->user_data);
+}
+
+
+
+/**** GtkTreeModel implementation ****/
+static GtkTreeModelFlags get_flags(__attribute__((unused)) GtkTreeModel *model) {
+    return GTK_TREE_MODEL_LIST_ONLY;
+}
+
+static gint get_n_columns(__attribute__((unused)) GtkTreeModel *model) {
+    return EDSAC_ERROR_LIST_N_COLUMNS;
+}
+
+static GType get_column_type(__attribute__((unused)) GtkTreeModel *model, gint index) {
+    switch (index) {
+        case EDSAC_ERROR_LIST_COLUMN_RACK:
+        case EDSAC_ERROR_LIST_COLUMN_CHASSIS:
+            return G_TYPE_UINT;
+        case EDSAC_ERROR_LIST_COLUMN_VALVE:
+        case EDSAC_ERROR_LIST_COLUMN_ID:
+            return G_TYPE_INT;
+        case EDSAC_ERROR_LIST_COLUMN_MESSAGE:
+            return G_TYPE_STRING;
+        case EDSAC_ERROR_LIST_COLUMN_ENABLED:
+            return G_TYPE_BOOLEAN;
+        default:
+            return G_TYPE_INVALID;
+    }
+}
+
+static gboolean get_iter(GtkTreeModel *model, GtkTreeIter *iter, GtkTreePath *path) {
+    EdsacErrorListModel *self = EDSAC_ERROR_LIST_MODEL(model);
+    assert(NULL != path);
+
+    if (1 != gtk_tree_path_get_depth(path)) {
+        return FALSE;
+    }
+
+    const gint index = gtk_tree_path_get_indices(path)[0];
+    if ((index < 0) || (index >= self->priv->n_rows)) {
+        return FALSE;
+    }
+
+    set_iter(self, iter, index);
+    return TRUE;
+}
+
+static GtkTreePath *get_path(GtkTreeModel *model, GtkTreeIter *iter) {
+    EdsacErrorListModel *self = EDSAC_ERROR_LIST_MODEL(model);
+
+    return gtk_tree_path_new_from_indices(iter_index(self, iter), -1);
+}
+
+static void get_value(GtkTreeModel *model, GtkTreeIter *iter, gint column, GValue *value) {
+    EdsacErrorListModel *self = EDSAC_ERROR_LIST_MODEL(model);
+
+    g_value_init(value, get_column_type(model, column));
+
+    // leave the default value if the row couldn't be fetched
+    const EdsacErrorListRow *row = get_row(self, iter_index(self, iter));
+    if (NULL == row) {
+        return;
+    }
+
+    switch (column) {
+        case EDSAC_ERROR_LIST_COLUMN_RACK:
+            g_value_set_uint(value, row->rack_no);
+            break;
+        case EDSAC_ERROR_LIST_COLUMN_CHASSIS:
+            g_value_set_uint(value, row->chassis_no);
+            break;
+        case EDSAC_ERROR_LIST_COLUMN_VALVE:
+            g_value_set_int(value, row->valve_no);
+            break;
+        case EDSAC_ERROR_LIST_COLUMN_MESSAGE:
+            g_value_set_string(value, row->message);
+            break;
+        case EDSAC_ERROR_LIST_COLUMN_ENABLED:
+            g_value_set_boolean(value, row->enabled);
+            break;
+        case EDSAC_ERROR_LIST_COLUMN_ID:
+            g_value_set_int(value, row->id);
+            break;
+        default:
+            break;
+    }
+}
+
+static gboolean iter_next(GtkTreeModel *model, GtkTreeIter *iter) {
+    EdsacErrorListModel *self = EDSAC_ERROR_LIST_MODEL(model);
+
+    const gint index = iter_index(self, iter) + 1;
+    if (index >= self->priv->n_rows) {
+        return FALSE;
+    }
+
+    set_iter(self, iter, index);
+    return TRUE;
+}
+
+static gboolean iter_previous(GtkTreeModel *model, GtkTreeIter *iter) {
+    EdsacErrorListModel *self = EDSAC_ERROR_LIST_MODEL(model);
+
+    const gint index = iter_index(self, iter) - 1;
+    if (index < 0) {
+        return FALSE;
+    }
+
+    set_iter(self, iter, index);
+    return TRUE;
+}
+
+static gboolean iter_nth_child(GtkTreeModel *model, GtkTreeIter *iter, GtkTreeIter *parent, gint n) {
+    EdsacErrorListModel *self = EDSAC_ERROR_LIST_MODEL(model);
+
+    // it is a list so only the root has children
+    if ((NULL != parent) || (n < 0) || (n >= self->priv->n_rows)) {
+        return FALSE;
+    }
+
+    set_iter(self, iter, n);
+    return TRUE;
+}
+
+static gboolean iter_children(GtkTreeModel *model, GtkTreeIter *iter, GtkTreeIter *parent) {
+    return iter_nth_child(model, iter, parent, 0);
+}
+
+static gboolean iter_has_child(__attribute__((unused)) GtkTreeModel *model, __attribute__((unused)) GtkTreeIter *iter) {
+    return FALSE;
+}
+
+static gint iter_n_children(GtkTreeModel *model, GtkTreeIter *iter) {
+    EdsacErrorListModel *self = EDSAC_ERROR_LIST_MODEL(model);
+
+    if (NULL == iter) {
+        return self->priv->n_rows;
+    }
+
+    return 0;
+}
+
+static gboolean iter_parent(__attribute__((unused)) GtkTreeModel *model, __attribute__((unused)) GtkTreeIter *iter,
+                            __attribute__((unused)) GtkTreeIter *child) {
+    return FALSE;
+}
+
+static void edsac_error_list_model_tree_model_init(GtkTreeModelIface *iface) {
+    iface->get_flags = get_flags;
+    iface->get_n_columns = get_n_columns;
+    iface->get_column_type = get_column_type;
+    iface->get_iter = get_iter;
+    iface->get_path = get_path;
+    iface->get_value = get_value;
+    iface->iter_next = iter_next;
+    iface->iter_previous = iter_previous;
+    iface->iter_children = iter_children;
+    iface->iter_has_child = iter_has_child;
+    iface->iter_n_children = iter_n_children;
+    iface->iter_nth_child = iter_nth_child;
+    iface->iter_parent = iter_parent;
+}
+
+
+
+/**** internal GObject stuff ****/
+// DESTROY PRIVATE MEMBER DATA HERE
+static void edsac_error_list_model_finalize(GObject *obj) {
+    EdsacErrorListModel *self = EDSAC_ERROR_LIST_MODEL(obj);
+
+    g_queue_clear_full(&self->priv->pages, free_page);
+    g_hash_table_destroy(self->priv->page_keys);
+    g_hash_table_destroy(self->priv->pending);
+    g_object_unref(self->priv->cancellable);
+
+    G_OBJECT_CLASS(edsac_error_list_model_parent_class)->finalize(obj);
+}
+
+static void edsac_error_list_model_class_init(EdsacErrorListModelClass *class) {
+    edsac_error_list_model_parent_class = g_type_class_peek_parent(class);
+    g_type_class_add_private(class, sizeof(EdsacErrorListModelPrivate));
+    G_OBJECT_CLASS(class)->finalize = edsac_error_list_model_finalize;
+}
+
+// CONSTRUCT PRIVATE MEMBER DATA HERE
+static void edsac_error_list_model_instance_init(EdsacErrorListModel *self) {
+    self->priv = EDSAC_ERROR_LIST_MODEL_GET_PRIVATE(self);
+
+    self->priv->search.type = ALL;
+    self->priv->n_rows = 0;
+    self->priv->counted = FALSE;
+    self->priv->counting = FALSE;
+    self->priv->stale = FALSE;
+    self->priv->stamp = (gint) g_random_int();
+    self->priv->generation = 0;
+    self->priv->merges = 0;
+    g_queue_init(&self->priv->pages);
+    self->priv->page_keys = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+    assert(NULL != self->priv->page_keys);
+    self->priv->pending = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_object_unref);
+    assert(NULL != self->priv->pending);
+    self->priv->cancellable = g_cancellable_new();
+    assert(NULL != self->priv->cancellable);
+    self->priv->notify = NULL;
+    self->priv->notify_data = NULL;
+}
+
+GType edsac_error_list_model_get_type(void) {
+    static volatile gsize edsac_error_list_model_type_id_volatile = 0;
+    if (g_once_init_enter(&edsac_error_list_model_type_id_volatile)) {
+        static const GTypeInfo g_define_type_info = {
+            sizeof(EdsacErrorListModelClass),
+            (GBaseInitFunc) NULL,
+            (GBaseFinalizeFunc) NULL,
+            (GClassInitFunc) edsac_error_list_model_class_init,
+            (GClassFinalizeFunc) NULL,
+            NULL,
+            sizeof(EdsacErrorListModel),
+            0,
+            (GInstanceInitFunc) edsac_error_list_model_instance_init,
+            NULL
+        };
+
+        static const GInterfaceInfo tree_model_info = {
+            (GInterfaceInitFunc) edsac_error_list_model_tree_model_init,
+            NULL,
+            NULL
+        };
+
+        GType edsac_error_list_model_type_id;
+        edsac_error_list_model_type_id = g_type_register_static(G_TYPE_OBJECT, "EdsacErrorListModel", &g_define_type_info, 0);
+        g_type_add_interface_static(edsac_error_list_model_type_id, GTK_TYPE_TREE_MODEL, &tree_model_info);
+        g_once_init_leave(&edsac_error_list_model_type_id_volatile, edsac_error_list_model_type_id);
+    }
+
+    return edsac_error_list_model_type_id_volatile;
+}
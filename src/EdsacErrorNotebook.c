@@ -14,65 +14,148 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <pthread.h>
 #include "sql.h"
 #include "ui.h"
+#include "EdsacErrorListModel.h"
+#include "EdsacHeatmap.h"
+#include "db_worker.h"
+#include "export.h"
+#include "metrics.h"
 
 // declarations
 
+// pixels from the bottom of a list which still count as being at the newest errors
+#define FOLLOW_SLACK 4
+
 // context for an open tab
 typedef struct _LinkyTextBuffer {
-    Clickable description;  // information about what this is a list of
-    GtkTextBuffer *buffer;  // the text buffer
-    GSList *g_string_list;  // stuff to call g_string_free(., TRUE) on when we clear buffer
-    GSList *clickables;     // Clickables *within the text buffer* we need to free
-    gint page_id;           // the gtknotebook page id
-    GString *title;         // The string for the tab's title
+    Clickable description;          // information about what this is a list of
+    EdsacErrorNotebook *notebook;   // the notebook the tab is in
+    EdsacErrorListModel *model;     // the errors shown in the tab. NULL for HEATMAP
+    EdsacHeatmap *heatmap;          // only for HEATMAP
+    GtkTreeView *view;              // the list displaying model
+    GtkTreeViewColumn *rack_column; // link columns, so that clicks can be worked out
+    GtkTreeViewColumn *chassis_column;
+    GtkTreeViewColumn *valve_column;
+    gint page_id;                   // the gtknotebook page id
+    bool dirty;                     // the database has changed in a way the tab might show since it was last updated
+    bool follow;                    // the view is at the newest errors so it is scrolled to keep up with new ones
+    GString *title;                 // The string for the tab's title
 } LinkyBuffer;
 
+// enabling or disabling every error matching a filter, from the description menu
+typedef struct {
+    ErrorFilter filter;
+    bool enabled;
+    char *contains; // filter.contains points to this
+} BulkRequest;
+
+// the progress window of an export. Freed once the export is done and the window is gone
+typedef struct {
+    GtkWindow *window;          // NULL once destroyed
+    GtkProgressBar *bar;
+    GtkButton *button;          // cancels, then closes once the export is done
+    GCancellable *cancellable;
+    gint total;                 // rows in the tab when the export started. -1 if unknown
+    bool finished;
+} ExportWindow;
+
 // private object data
 typedef struct _EdsacErrorNotebookPrivate {
-    GSList *open_tabs_list; // list of open tabs (LinkyBuffers)
+    GSList *open_tabs_list;         // list of open tabs (LinkyBuffers)
+    PangoAttrList *link_style;      // shared by the link cells of every tab
+    PangoAttrList *disabled_style;  // shared by the descriptions of disabled errors
 } EdsacErrorNotebookPrivate;
 
 static gpointer edsac_error_notebook_parent_class = NULL;
+static guint error_count_changed_signal = 0;
 #define EDSAC_ERROR_NOTEBOOK_GET_PRIVATE(_o) (G_TYPE_INSTANCE_GET_PRIVATE((_o), EDSAC_TYPE_ERROR_NOTEBOOK, EdsacErrorNotebookPrivate))
 
 /**** local function declarations ****/
 // My Structures
 static bool clickable_compare(const Clickable *a, const Clickable *b);
+static bool clickable_matches_key(const Clickable *search, const ErrorKey *key);
 static gint open_tabs_list_compare_by_id(gconstpointer a, gconstpointer b);
 static gint open_tabs_list_compare_by_desc(gconstpointer a, gconstpointer b);
 static void open_tabs_list_dec_id(gpointer data, gpointer unused);
 static gint open_tabs_list_search_by_id(gconstpointer result, gconstpointer id);
-static LinkyBuffer *new_linky_buffer(const Clickable *description);
-static void append_linky_text_buffer(LinkyBuffer *linky_buffer, SearchResult *data);
+static LinkyBuffer *new_linky_buffer(EdsacErrorNotebook *self, const Clickable *description);
 static void free_g_string(gpointer g_string);
 static void free_linky_buffer(LinkyBuffer *linky_buffer);
-static void add_link(size_t start_pos, size_t end_pos, GtkTextBuffer *buffer, Clickable* data);
 static void update_tab(gpointer data, gpointer unused);
+static void update_current_tab(EdsacErrorNotebook *self);
+static void mark_dirty(gpointer data, gpointer unused);
+static void model_notify(EdsacErrorListModel *model, gpointer linky_buffer);
 static notebook_page_id_t add_new_page_to_notebook(EdsacErrorNotebook *self, const Clickable *data);
 static void close_tab(EdsacErrorNotebook *self, GSList *tab_in_list);
 
 // GTK
-static GtkWidget *new_text_view(void);
+static GtkWidget *new_error_view(EdsacErrorNotebook *self, LinkyBuffer *linky_buffer);
+static GtkTreeViewColumn *add_column(GtkTreeView *view, const char *title, const gint width, PangoAttrList *style, GtkTreeCellDataFunc func, gpointer data);
+static void link_cell_data(GtkTreeViewColumn *column, GtkCellRenderer *cell, GtkTreeModel *model, GtkTreeIter *iter, gpointer field);
+static void message_cell_data(GtkTreeViewColumn *column, GtkCellRenderer *cell, GtkTreeModel *model, GtkTreeIter *iter, gpointer disabled_style);
 static GtkWidget *put_in_scroll(GtkWidget *thing);
 static GtkWidget *tab_label(const char *msg, GtkWidget *contents);
 static GtkWidget *get_parent(const GtkWidget *child);
 
 // Signal Handlers
 static void close_button_handler(GtkWidget *button, GdkEvent *event, GtkWidget *contents);
-static void link_clicked(const GtkTextTag *tag, const GtkTextView *parent, const GdkEvent *event, const GtkTextIter *iter, Clickable *data);
-static void desc_clicked(const GtkTextTag *tag, const GtkTextView *parent, const GdkEvent *event, const GtkTextIter *iter, const gpointer error_id);
+static gboolean view_clicked(GtkWidget *widget, GdkEventButton *event, LinkyBuffer *linky_buffer);
+static void show_desc_menu(GdkEventButton *event, LinkyBuffer *linky_buffer, const EdsacErrorListRow *row);
 static void disable_click(const uintptr_t id);
+static gpointer disable_job(gpointer id, GCancellable *cancellable);
+static void disable_done(GObject *source, GAsyncResult *result, gpointer unused);
+static BulkRequest *new_bulk_request(const Clickable *search, const time_t from, const time_t until, const char *contains,
+                                     const bool enabled);
+static void free_bulk_request(gpointer request);
+static void bulk_click(BulkRequest *request);
+static gpointer bulk_job(gpointer request, GCancellable *cancellable);
+static void bulk_done(GObject *source, GAsyncResult *result, gpointer unused);
+static void show_bulk_dialog(EdsacErrorNotebook *self, const Clickable *search, const EdsacErrorListRow *row);
+static bool parse_time(const char *text, time_t *t);
+static GtkEntry *add_filter_entry(GtkGrid *grid, const gint top, const char *label, const char *text, const char *placeholder);
+static void append_bulk_item(GtkWidget *menu, const char *label, const Clickable *search, const bool enabled);
+static void free_row_copy(gpointer row);
+static void bulk_dialog_click(GtkMenuItem *item, LinkyBuffer *linky_buffer);
+static void page_switched(GtkNotebook *notebook, GtkWidget *page, guint page_num, gpointer unused);
+static void view_scrolled(GtkAdjustment *adjustment, LinkyBuffer *linky_buffer);
+static GtkWidget *new_heatmap_page(LinkyBuffer *linky_buffer);
+static void span_changed(GtkComboBox *combo, EdsacHeatmap *heatmap);
+static void heatmap_activate(EdsacHeatmap *heatmap, unsigned int rack_no, unsigned int chassis_no, gpointer linky_buffer);
+static void heatmap_notify(EdsacHeatmap *heatmap, gpointer linky_buffer);
+static LinkyBuffer *current_linky_buffer(EdsacErrorNotebook *self);
+static void show_export_dialog(LinkyBuffer *linky_buffer);
+static void start_export(LinkyBuffer *linky_buffer, const ErrorFilter *filter, const char *path, const ExportFormat format);
+static void export_progress(const guint64 num_rows, gpointer window);
+static void export_done(const gint64 num_rows, gpointer window);
+static void export_button_clicked(GtkButton *button, ExportWindow *window);
+static void export_window_destroyed(GtkWidget *widget, ExportWindow *window);
+static void export_click(GtkMenuItem *item, LinkyBuffer *linky_buffer);
 
 /**** Public Methods ****/
 // update data to be in line with the database
 void edsac_error_notebook_update(EdsacErrorNotebook *self) {
-    g_slist_foreach(self->priv->open_tabs_list, update_tab, NULL);
+    g_slist_foreach(self->priv->open_tabs_list, mark_dirty, NULL);
+    update_current_tab(self);
 }
 
-// get the error count for the currently displayed page
+void edsac_error_notebook_errors_added(EdsacErrorNotebook *self, GList *keys) {
+    assert(NULL != self);
+
+    for (GSList *item = self->priv->open_tabs_list; NULL != item; item = item->next) {
+        LinkyBuffer *linky_buffer = (LinkyBuffer *) item->data;
+
+        for (GList *key = keys; (NULL != key) && !linky_buffer->dirty; key = key->next) {
+            linky_buffer->dirty = clickable_matches_key(&linky_buffer->description, (const ErrorKey *) key->data);
+        }
+    }
+
+    update_current_tab(self);
+}
+
+// get the error count for the currently displayed page. -1 if it is still being counted
 int edsac_error_notebook_get_error_count(EdsacErrorNotebook *self) {
     assert(NULL != self);
 
@@ -90,8 +173,12 @@ int edsac_error_notebook_get_error_count(EdsacErrorNotebook *self) {
         return -1;
     } 
 
+    // counted by the model so this doesn't have to wait for the database
     LinkyBuffer *linky_buffer = (LinkyBuffer *) result->data;
-    return count_clickable(&linky_buffer->description);
+    if (NULL != linky_buffer->heatmap) {
+        return edsac_heatmap_get_total(linky_buffer->heatmap);
+    }
+    return edsac_error_list_model_get_n_rows(linky_buffer->model);
 }
 
 void edsac_error_notebook_show_page(EdsacErrorNotebook *self, const Clickable *data) {
@@ -113,6 +200,26 @@ void edsac_error_notebook_show_page(EdsacErrorNotebook *self, const Clickable *d
     add_new_page_to_notebook(self, data);
 }
 
+void edsac_error_notebook_export_current(EdsacErrorNotebook *self) {
+    assert(NULL != self);
+
+    LinkyBuffer *linky_buffer = current_linky_buffer(self);
+    if (NULL == linky_buffer) {
+        return;
+    }
+
+    if (NULL == linky_buffer->model) {
+        GtkWidget *toplevel = gtk_widget_get_toplevel(GTK_WIDGET(self));
+        GtkWidget *dialog = gtk_message_dialog_new(gtk_widget_is_toplevel(toplevel) ? GTK_WINDOW(toplevel) : NULL,
+                GTK_DIALOG_DESTROY_WITH_PARENT, GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE, "Only tabs listing errors can be exported");
+        gtk_dialog_run(GTK_DIALOG(dialog));
+        gtk_widget_destroy(dialog);
+        return;
+    }
+
+    show_export_dialog(linky_buffer);
+}
+
 void edsac_error_notebook_close_node(EdsacErrorNotebook *self, const unsigned int rack_no, const unsigned int chassis_no) {
     if (NULL == self)
         return;
@@ -123,7 +230,8 @@ void edsac_error_notebook_close_node(EdsacErrorNotebook *self, const unsigned in
         if (NULL == linky_buffer)
             return;
 
-        if (linky_buffer->description.rack_num == rack_no) {
+        const ClickableType type = linky_buffer->description.type;
+        if ((SEARCH != type) && (HEATMAP != type) && (linky_buffer->description.rack_num == rack_no)) {
             if (linky_buffer->description.chassis_num == chassis_no) {
                 // this tab needs closing
                 close_tab(self, item);
@@ -148,7 +256,7 @@ static notebook_page_id_t add_new_page_to_notebook(EdsacErrorNotebook *self, con
     GtkNotebook *notebook = &self->parent_instance;
 
     // LinkyBuffer to describe the notebook
-    LinkyBuffer *linky_buffer = new_linky_buffer(data);
+    LinkyBuffer *linky_buffer = new_linky_buffer(self, data);
     assert(NULL != linky_buffer);
 
     // Heading for the new tab
@@ -168,16 +276,27 @@ static notebook_page_id_t add_new_page_to_notebook(EdsacErrorNotebook *self, con
         case VALVE:
             g_string_printf(linky_buffer->title, "Rack %i, Chassis %i, Valve: %i", data->rack_num, data->chassis_num, data->valve_num);
             break;
+        case SEARCH:
+            g_string_printf(linky_buffer->title, "Search: %.*s", SEARCH_TEXT_LEN, data->text);
+            break;
+        case HEATMAP:
+            g_string_printf(linky_buffer->title, "Heatmap");
+            break;
         default:
             g_string_printf(linky_buffer->title, "(Unknown)");
     }
 
-    GtkWidget *msg = new_text_view(); 
-    assert(NULL != msg);
-
-    gtk_text_view_set_buffer(GTK_TEXT_VIEW(msg), linky_buffer->buffer);
+    GtkWidget *scroll;
+    if (HEATMAP == data->type) {
+        scroll = new_heatmap_page(linky_buffer);
+    } else {
+        GtkWidget *msg = new_error_view(self, linky_buffer);
+        assert(NULL != msg);
 
-    GtkWidget *scroll = put_in_scroll(msg);
+        scroll = put_in_scroll(msg);
+        g_signal_connect(G_OBJECT(gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(scroll))), "value-changed",
+                         G_CALLBACK(view_scrolled), linky_buffer);
+    }
     assert(NULL != scroll);
 
     gint index = gtk_notebook_append_page(notebook, scroll, tab_label(linky_buffer->title->str, scroll));
@@ -195,9 +314,6 @@ static notebook_page_id_t add_new_page_to_notebook(EdsacErrorNotebook *self, con
     // add the new tab to our open tabs list
     self->priv->open_tabs_list = g_slist_insert_sorted(self->priv->open_tabs_list, linky_buffer, open_tabs_list_compare_by_id);
 
-    // update the new page
-    update_tab((gpointer) linky_buffer, NULL);
-
     // show the new page
     GtkWidget *page = gtk_notebook_get_nth_page(notebook, index);
     gtk_widget_show_all(page);
@@ -256,9 +372,14 @@ static void free_g_string(gpointer g_string) {
 static void free_linky_buffer(LinkyBuffer *linky_buffer) {
     assert(NULL != linky_buffer);
 
-
-    g_slist_free_full(linky_buffer->g_string_list, free_g_string);
-    g_slist_free_full(linky_buffer->clickables, g_free); // invalid free
+    // nothing left to show the results to
+    if (NULL != linky_buffer->model) {
+        edsac_error_list_model_cancel(linky_buffer->model);
+        g_object_unref(linky_buffer->model);
+    }
+    if (NULL != linky_buffer->heatmap) {
+        edsac_heatmap_cancel(linky_buffer->heatmap);
+    }
 
     free_g_string(linky_buffer->title);
 
@@ -274,10 +395,14 @@ static bool clickable_compare(const Clickable *a, const Clickable *b) {
         return false;
     }
 
-    if (ALL == a->type) {
+    if ((ALL == a->type) || (HEATMAP == a->type)) {
         return true;
     }
 
+    if (SEARCH == a->type) {
+        return 0 == strncmp(a->text, b->text, SEARCH_TEXT_LEN);
+    }
+
     const bool rack_num = (a->rack_num == b->rack_num);
     if ((RACK == a->type) && rack_num) {
         return true;
@@ -296,6 +421,27 @@ static bool clickable_compare(const Clickable *a, const Clickable *b) {
     return false;
 }
 
+// would an error from key be listed by search?
+static bool clickable_matches_key(const Clickable *search, const ErrorKey *key) {
+    assert(NULL != search);
+    assert(NULL != key);
+
+    switch (search->type) {
+        case ALL:
+        case SEARCH: // the key doesn't say what the error was
+        case HEATMAP:
+            return true;
+        case RACK:
+            return search->rack_num == key->rack_no;
+        case CHASSIS:
+            return (search->rack_num == key->rack_no) && (search->chassis_num == key->chassis_no);
+        case VALVE:
+            return (search->rack_num == key->rack_no) && (search->chassis_num == key->chassis_no) && (search->valve_num == key->valve_no);
+        default:
+            return true; // be safe
+    }
+}
+
 // open tabs list compare func for searching by id
 // implements GCompareFunc: 0 is equal
 static gint open_tabs_list_compare_by_id(gconstpointer a, gconstpointer b) {
@@ -335,132 +481,34 @@ static gint open_tabs_list_search_by_id(gconstpointer result, gconstpointer id)
 }
 
 // creates a new LinkyBuffer
-static LinkyBuffer *new_linky_buffer(const Clickable *desc) {
-    LinkyBuffer *linky_buffer = malloc(sizeof(LinkyBuffer));
+static LinkyBuffer *new_linky_buffer(EdsacErrorNotebook *self, const Clickable *desc) {
+    LinkyBuffer *linky_buffer = g_malloc(sizeof(LinkyBuffer));
     assert(NULL != linky_buffer);
 
     // default values
-    linky_buffer->g_string_list = NULL;
-    linky_buffer->clickables = NULL;
     linky_buffer->page_id = -1;
-    linky_buffer->buffer = gtk_text_buffer_new(NULL);
-    assert(NULL != linky_buffer->buffer);
+    linky_buffer->notebook = self;
+    linky_buffer->dirty = false;
+    linky_buffer->follow = true; // new tabs open at the newest errors
+    linky_buffer->view = NULL;
+    linky_buffer->rack_column = NULL;
+    linky_buffer->chassis_column = NULL;
+    linky_buffer->valve_column = NULL;
+    linky_buffer->model = NULL;
+    linky_buffer->heatmap = NULL; // made along with the rest of the page
 
     // set description
     memcpy(&linky_buffer->description, desc, sizeof(linky_buffer->description));
-    
-    // make the text buffer un-editable
-    GtkTextTag *un_editable_tag = gtk_text_buffer_create_tag(linky_buffer->buffer, "un_editable", "editable", FALSE, "editable-set", TRUE, NULL);
-    assert(NULL != un_editable_tag);
-    GtkTextIter start; 
-    GtkTextIter end;
-    gtk_text_buffer_get_start_iter(linky_buffer->buffer, &start);
-    gtk_text_buffer_get_end_iter(linky_buffer->buffer, &end);
-    gtk_text_buffer_apply_tag(linky_buffer->buffer, un_editable_tag, &start, &end);
-
-    return linky_buffer;
-}
-
-// appends the specified error message to the linky buffer
-// negative valve_no to not specify it
-// assumes that linky_buffer is already locked
-static void append_linky_text_buffer(LinkyBuffer *linky_buffer, SearchResult *data) {
-    // generate message string
-    GString *message = g_string_new(NULL);
-    assert(NULL != message);
-    linky_buffer->g_string_list = g_slist_prepend(linky_buffer->g_string_list, message); // so we know to free message
-
-    GtkTextIter buffer_end;
-    gtk_text_buffer_get_end_iter(linky_buffer->buffer, &buffer_end);
-    const gsize offset = (gsize) gtk_text_iter_get_offset(&buffer_end);
-
-    g_string_printf(message, "Rack: %i, ", data->rack_no);
-    const gsize rack_start = offset;
-    const gsize rack_end = offset + message->len - 2; // comma, space 
-    const gsize chassis_start = offset + message->len; 
-
-    g_string_append_printf(message, "Chassis: %i, ", data->chassis_no);
-    const gsize chassis_end = offset + message->len - 2; // comma, space 
-    const gsize valve_start = offset + message->len; 
-
-    if (data->valve_no >= 0) {
-        g_string_append_printf(message, "Valve: %i: ", data->valve_no);
-    }
-    const gsize valve_end = offset + message->len - 2; // colon, space. (this is unused when valve_no < 0 so it remains valid)
-    
-    g_string_append_printf(message, "%s\n", data->message);
-    
-    gtk_text_buffer_insert(linky_buffer->buffer, &buffer_end, message->str, (gint) message->len);
-
-    // clickable objects to describe the links in this row
-    Clickable *rack_data = malloc(sizeof(Clickable));
-    assert(NULL != rack_data);
-    rack_data->type = RACK;
-    rack_data->rack_num = data->rack_no;
-
-    Clickable *chassis_data = malloc(sizeof(Clickable));
-    assert(NULL != chassis_data);
-    chassis_data->type = CHASSIS;
-    chassis_data->rack_num = data->rack_no;
-    chassis_data->chassis_num = data->chassis_no;
-
-    Clickable *valve_data = NULL;
-    if (data->valve_no >= 0) {
-        valve_data = malloc(sizeof(Clickable));
-        assert(NULL != valve_data);
-        valve_data->type = VALVE;
-        valve_data->rack_num = data->rack_no;
-        valve_data->chassis_num = data->chassis_no;
-        valve_data->valve_num = data->valve_no; 
-    }
-
-    // so we know to free them
-    linky_buffer->clickables = g_slist_prepend(linky_buffer->clickables, rack_data);
-    linky_buffer->clickables = g_slist_prepend(linky_buffer->clickables, chassis_data);
-    if (data->valve_no >= 0) {
-        linky_buffer->clickables = g_slist_prepend(linky_buffer->clickables, valve_data);
-    }
-    
-    // tag over the description for right-clicking
-    GtkTextIter start;
-    GtkTextIter end;
-    gtk_text_buffer_get_iter_at_offset(linky_buffer->buffer, &start, (gint) valve_end);
-    gtk_text_buffer_get_end_iter(linky_buffer->buffer, &end);
-
-    GtkTextTag *description = NULL;
-    // grey out disabled items
-    if (!data->enabled) {
-        description = gtk_text_buffer_create_tag(linky_buffer->buffer, NULL,
-            "foreground", "grey", NULL);
-    } else {
-        description = gtk_text_buffer_create_tag(linky_buffer->buffer, NULL, NULL);
-    }
-    g_signal_connect(G_OBJECT(description), "event", G_CALLBACK(desc_clicked), (gpointer) ((uintptr_t) data->id));
-    gtk_text_buffer_apply_tag(linky_buffer->buffer, description, &start, &end);
-
-    // links to other pages
-    add_link(rack_start, rack_end, linky_buffer->buffer, rack_data);
-    add_link(chassis_start, chassis_end, linky_buffer->buffer, chassis_data);
-    if (data->valve_no >= 0) {
-        add_link(valve_start, valve_end, linky_buffer->buffer, valve_data);
+    if (HEATMAP == desc->type) {
+        return linky_buffer;
     }
-}
 
-// adds a hyperlink to a text buffer
-static void add_link(size_t start_pos, size_t end_pos, GtkTextBuffer *buffer, Clickable *data) {
-    GtkTextTag *url = gtk_text_buffer_create_tag(buffer, NULL,
-        "underline", PANGO_UNDERLINE_SINGLE, "underline-set", TRUE,
-        "foreground", "blue", NULL);
+    // rows are only fetched from the database when the view wants to display them.
+    // The view gets the model once it has been counted, along with the newest rows
+    linky_buffer->model = edsac_error_list_model_new(&linky_buffer->description, model_notify, linky_buffer);
+    assert(NULL != linky_buffer->model);
 
-    // make it clickable
-    // event is the only signal allowed on a tag
-    g_signal_connect(G_OBJECT(url), "event", G_CALLBACK(link_clicked), (gpointer) data);
-    
-    GtkTextIter start;
-    GtkTextIter end;
-    gtk_text_buffer_get_iter_at_offset(buffer, &start, (gint) start_pos);
-    gtk_text_buffer_get_iter_at_offset(buffer, &end, (gint) end_pos);
-    gtk_text_buffer_apply_tag(buffer, url, &start, &end);
+    return linky_buffer;
 }
 
 // open tabs list compare func for searching by description
@@ -481,87 +529,687 @@ static gint open_tabs_list_compare_by_desc(gconstpointer a, gconstpointer b) {
     return ret;
 }
 
-static void insert_search_result(gpointer data, gpointer user_data) {
-    if ((NULL == data) || (NULL == user_data)) {
+static void update_tab(gpointer data, __attribute__((unused)) gpointer unused) {
+    assert(NULL != data);
+    LinkyBuffer *linky_buffer = (LinkyBuffer *) data;
+    linky_buffer->dirty = false;
+
+    if (NULL != linky_buffer->heatmap) {
+        edsac_heatmap_update(linky_buffer->heatmap);
+        return;
+    }
+
+    const gint64 timer = metrics_start();
+    const gint num_rows = edsac_error_list_model_get_n_rows(linky_buffer->model);
+    if (num_rows >= 0) {
+        metrics_record(METRIC_TAB_ROWS, (guint64) num_rows);
+    }
+
+    if (edsac_error_list_model_update(linky_buffer->model)) {
+        // any new errors have been appended
+        metrics_finish(METRIC_TAB_UPDATE, timer);
+        return;
+    }
+
+    // something other than new errors happened so what we have already shown may be wrong.
+    // The view keeps the old rows until model_notify swaps the new model in
+    EdsacErrorListModel *old = linky_buffer->model;
+    linky_buffer->model = edsac_error_list_model_new(&linky_buffer->description, model_notify, linky_buffer);
+    assert(NULL != linky_buffer->model);
+
+    edsac_error_list_model_cancel(old);
+    g_object_unref(old);
+    metrics_finish(METRIC_TAB_UPDATE, timer);
+}
+
+// only the tab being looked at is updated straight away
+static void update_current_tab(EdsacErrorNotebook *self) {
+    const gint current_page = gtk_notebook_get_current_page(GTK_NOTEBOOK(self));
+    GSList *result = g_slist_find_custom(self->priv->open_tabs_list, (gconstpointer) &current_page, open_tabs_list_search_by_id);
+    if (NULL == result) {
         return;
     }
 
-    SearchResult *res = (SearchResult *) data;
-    LinkyBuffer *linky_buffer = (LinkyBuffer *) user_data;
+    LinkyBuffer *linky_buffer = (LinkyBuffer *) result->data;
+    if (linky_buffer->dirty) {
+        update_tab(linky_buffer, NULL);
+    }
+}
 
-    append_linky_text_buffer(linky_buffer, res);
+// prototype to match glib foreach
+static void mark_dirty(gpointer data, __attribute__((unused)) gpointer unused) {
+    ((LinkyBuffer *) data)->dirty = true;
 }
 
-static void update_tab(gpointer data, __attribute__((unused)) gpointer unused) {
-    assert(NULL != data);
+// EdsacErrorListModelNotify for the models of tabs
+static void model_notify(EdsacErrorListModel *model, gpointer data) {
     LinkyBuffer *linky_buffer = (LinkyBuffer *) data;
+    assert(model == linky_buffer->model);
 
-    // query the database
-    GList *results = search_clickable(&linky_buffer->description);
+    // setting the model scrolls back to the top
+    const bool follow = linky_buffer->follow;
 
-    // clear stuff already in the buffer
-    GtkTextIter start;
-    gtk_text_buffer_get_start_iter(linky_buffer->buffer, &start);
-    GtkTextIter end;
-    gtk_text_buffer_get_end_iter(linky_buffer->buffer, &end);
-    
-    gtk_text_buffer_delete(linky_buffer->buffer, &start, &end);
+    // first count of a new model
+    if ((NULL != linky_buffer->view) && (gtk_tree_view_get_model(linky_buffer->view) != GTK_TREE_MODEL(model))) {
+        gtk_tree_view_set_model(linky_buffer->view, GTK_TREE_MODEL(model));
+    }
 
-    g_slist_free_full(linky_buffer->g_string_list, free_g_string);
-    linky_buffer->g_string_list = NULL;
-    g_slist_free_full(linky_buffer->clickables, g_free);
-    linky_buffer->clickables = NULL;
+    // the newest rows are already in the model so this doesn't wait for anything.
+    // Older rows are fetched as they are scrolled to
+    const gint num_rows = edsac_error_list_model_get_n_rows(model);
+    if (follow && (NULL != linky_buffer->view) && (num_rows > 0)) {
+        linky_buffer->follow = true;
+        GtkTreePath *path = gtk_tree_path_new_from_indices(num_rows - 1, -1);
+        gtk_tree_view_scroll_to_cell(linky_buffer->view, path, NULL, FALSE, 0, 0);
+        gtk_tree_path_free(path);
+    }
 
-    g_list_foreach(results, insert_search_result, (gpointer) linky_buffer);
+    if (gtk_notebook_get_current_page(GTK_NOTEBOOK(linky_buffer->notebook)) == linky_buffer->page_id) {
+        g_signal_emit(linky_buffer->notebook, error_count_changed_signal, 0);
+    }
 }
 
 
 
 /**** GTK Signal Handlers ****/
-// handler for when a link text tag is clicked
-static void link_clicked(__attribute__((unused)) const GtkTextTag *tag, const GtkTextView *parent, const GdkEvent *event,
-                    __attribute__((unused)) const GtkTextIter *iter, Clickable *data) {
+// handler for clicks on the error list. The column clicked decides what to do
+static gboolean view_clicked(GtkWidget *widget, GdkEventButton *event, LinkyBuffer *linky_buffer) {
     assert(NULL != event);
-    // work out if the event was a clicked
-    GdkEventButton *event_btn = (GdkEventButton *) event;
-    if (event->type == GDK_BUTTON_PRESS && event_btn->button == 1) { // left click
-        assert(NULL != data);
-        assert(NULL != parent);
-        // work up the tree to the notebook
-        GtkWidget *text_view = GTK_WIDGET(parent);
-        GtkWidget *scrolled_window = get_parent(text_view);
-        EdsacErrorNotebook *notebook = EDSAC_ERROR_NOTEBOOK(get_parent(scrolled_window));
+    assert(NULL != linky_buffer);
+
+    if ((GDK_BUTTON_PRESS != event->type) || ((1 != event->button) && (3 != event->button))) {
+        return FALSE;
+    }
+
+    // leave clicks on the column headers alone
+    GtkTreeView *view = GTK_TREE_VIEW(widget);
+    if (event->window != gtk_tree_view_get_bin_window(view)) {
+        return FALSE;
+    }
+
+    GtkTreePath *path = NULL;
+    GtkTreeViewColumn *column = NULL;
+    if (!gtk_tree_view_get_path_at_pos(view, (gint) event->x, (gint) event->y, &path, &column, NULL, NULL)) {
+        return FALSE; // not on a row
+    }
+
+    GtkTreeModel *model = gtk_tree_view_get_model(view);
+    GtkTreeIter iter;
+    const gboolean found = gtk_tree_model_get_iter(model, &iter, path);
+    gtk_tree_path_free(path);
+    if (!found) {
+        return FALSE;
+    }
+
+    // read the row straight out of the model's page cache
+    const EdsacErrorListRow *row = edsac_error_list_model_peek(EDSAC_ERROR_LIST_MODEL(model), &iter);
+    if (NULL == row) {
+        return FALSE;
+    }
+
+    // the description has the toggle disabled menu
+    if ((column != linky_buffer->rack_column) && (column != linky_buffer->chassis_column) && (column != linky_buffer->valve_column)) {
+        show_desc_menu(event, linky_buffer, row);
+        return TRUE;
+    }
 
-        edsac_error_notebook_show_page(notebook, data);
+    // links only follow left clicks
+    if (1 != event->button) {
+        return FALSE;
     }
+
+    Clickable link;
+    link.rack_num = row->rack_no;
+    link.chassis_num = row->chassis_no;
+    link.valve_num = row->valve_no;
+
+    if (column == linky_buffer->rack_column) {
+        link.type = RACK;
+    } else if (column == linky_buffer->chassis_column) {
+        link.type = CHASSIS;
+    } else if (row->valve_no >= 0) {
+        link.type = VALVE;
+    } else {
+        return FALSE; // no valve to link to
+    }
+
+    // work up the tree to the notebook
+    GtkWidget *scrolled_window = get_parent(widget);
+    EdsacErrorNotebook *notebook = EDSAC_ERROR_NOTEBOOK(get_parent(scrolled_window));
+
+    edsac_error_notebook_show_page(notebook, &link);
+    return TRUE;
 }
 
 static void disable_click(const uintptr_t id) {
-    error_toggle_disabled(id);
+    db_worker_push(NULL, NULL, disable_job, (gpointer) id, NULL, NULL, disable_done, NULL);
+}
+
+// DbJobFunc for disable_click. Runs on the database thread
+static gpointer disable_job(gpointer id, __attribute__((unused)) GCancellable *cancellable) {
+    if (!error_toggle_disabled((uintptr_t) id)) {
+        puts("Could not toggle the error");
+    }
+
+    return NULL;
+}
+
+// GAsyncReadyCallback for disable_job
+static void disable_done(__attribute__((unused)) GObject *source, __attribute__((unused)) GAsyncResult *result,
+                         __attribute__((unused)) gpointer unused) {
     gui_update(NULL);
 }
 
-// handler for when a description is clicked
-static void desc_clicked(__attribute((unused)) const GtkTextTag *tag , __attribute__((unused)) const GtkTextView *parent, const GdkEvent *event,
-        __attribute__((unused)) const GtkTextIter *iter, const gpointer error_id) {
-    assert(NULL != event);
+// contains is copied. It may be NULL
+static BulkRequest *new_bulk_request(const Clickable *search, const time_t from, const time_t until, const char *contains,
+                                     const bool enabled) {
+    BulkRequest *request = g_new(BulkRequest, 1);
+    assert(NULL != request);
+
+    memcpy(&request->filter.search, search, sizeof(request->filter.search));
+    request->filter.from = from;
+    request->filter.until = until;
+    request->contains = g_strdup(contains);
+    request->filter.contains = request->contains;
+    request->enabled = enabled;
+
+    return request;
+}
+
+// matches GDestroyNotify
+static void free_bulk_request(gpointer request) {
+    assert(NULL != request);
+
+    g_free(((BulkRequest *) request)->contains);
+    g_free(request);
+}
+
+// the menu item owns request so the database thread gets its own copy
+static void bulk_click(BulkRequest *request) {
+    BulkRequest *copy = new_bulk_request(&request->filter.search, request->filter.from, request->filter.until, request->contains,
+                                         request->enabled);
+    db_worker_push(NULL, NULL, bulk_job, copy, free_bulk_request, g_free, bulk_done, NULL);
+}
+
+// DbJobFunc for bulk_click. Runs on the database thread
+static gpointer bulk_job(gpointer request, __attribute__((unused)) GCancellable *cancellable) {
+    const BulkRequest *r = (const BulkRequest *) request;
+
+    gint *num_changed = g_new(gint, 1);
+    assert(NULL != num_changed);
+    *num_changed = set_errors_enabled(&r->filter, r->enabled);
+
+    return num_changed;
+}
+
+// GAsyncReadyCallback for bulk_job. Everything changed in one go so everything is refreshed once
+static void bulk_done(__attribute__((unused)) GObject *source, GAsyncResult *result, __attribute__((unused)) gpointer unused) {
+    gint *num_changed = g_task_propagate_pointer(G_TASK(result), NULL);
+    if (NULL == num_changed) {
+        return;
+    }
+
+    if (*num_changed < 0) {
+        puts("Could not change the errors");
+    } else if (*num_changed > 0) {
+        gui_update(NULL);
+    }
+    g_free(num_changed);
+}
+
+// "YYYY-MM-DD HH:MM[:SS]" in local time. Blank text is 0 (no limit). Returns false if text can't be read
+static bool parse_time(const char *text, time_t *t) {
+    while (' ' == *text) {
+        text++;
+    }
+    if ('\0' == *text) {
+        *t = 0;
+        return true;
+    }
+
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const int fields = sscanf(text, "%d-%d-%d %d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+    if (fields < 5) {
+        return false;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+
+    *t = mktime(&tm);
+    return -1 != *t;
+}
+
+// text entry in a grid with a label to its left
+static GtkEntry *add_filter_entry(GtkGrid *grid, const gint top, const char *label, const char *text, const char *placeholder) {
+    GtkWidget *label_widget = gtk_label_new(label);
+    assert(NULL != label_widget);
+    gtk_grid_attach(grid, label_widget, 0, top, 1, 1);
+
+    GtkWidget *entry = gtk_entry_new();
+    assert(NULL != entry);
+    gtk_entry_set_text(GTK_ENTRY(entry), text);
+    gtk_entry_set_placeholder_text(GTK_ENTRY(entry), placeholder);
+    gtk_entry_set_activates_default(GTK_ENTRY(entry), TRUE);
+    gtk_widget_set_hexpand(entry, TRUE);
+    gtk_grid_attach(grid, entry, 1, top, 1, 1);
+
+    return GTK_ENTRY(entry);
+}
+
+// ask which of the tab's errors to enable or disable. Starts off matching errors like row from its time onwards
+static void show_bulk_dialog(EdsacErrorNotebook *self, const Clickable *search, const EdsacErrorListRow *row) {
+    GtkWidget *toplevel = gtk_widget_get_toplevel(GTK_WIDGET(self));
+    GtkWindow *parent = gtk_widget_is_toplevel(toplevel) ? GTK_WINDOW(toplevel) : NULL;
+
+    enum {DISABLE_RESPONSE = 1, ENABLE_RESPONSE};
+    GtkWidget *dialog = gtk_dialog_new_with_buttons("Enable or Disable Errors", parent, GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
+                                                    "Cancel", GTK_RESPONSE_CANCEL, "Enable", ENABLE_RESPONSE,
+                                                    "Disable", DISABLE_RESPONSE, NULL);
+    assert(NULL != dialog);
+    gtk_dialog_set_default_response(GTK_DIALOG(dialog), DISABLE_RESPONSE);
+
+    GtkGrid *grid = GTK_GRID(gtk_grid_new());
+    assert(NULL != grid);
+    gtk_grid_set_row_spacing(grid, 5);
+    gtk_grid_set_column_spacing(grid, 5);
+    gtk_container_set_border_width(GTK_CONTAINER(grid), 10);
+
+    // the message starts with the time and can end with the number of merged duplicates
+    char time_str[SEARCH_TIME_LEN];
+    format_search_time(row->recv_time, time_str);
+    const size_t time_len = strlen(time_str);
+    GString *description = g_string_new((strncmp(row->message, time_str, time_len) == 0) ? row->message + time_len : row->message);
+    assert(NULL != description);
+    const char *count = g_strrstr(description->str, " \u00d7");
+    if ((row->occurrences > 1) && (NULL != count)) {
+        g_string_truncate(description, (gsize) (count - description->str));
+    }
+
+    char from_str[32] = "";
+    struct tm tm;
+    if (NULL != localtime_r(&row->recv_time, &tm)) {
+        strftime(from_str, sizeof(from_str), "%Y-%m-%d %H:%M:%S", &tm);
+    }
+
+    GtkEntry *from = add_filter_entry(grid, 0, "Received from", from_str, "YYYY-MM-DD HH:MM:SS (blank for any)");
+    GtkEntry *until = add_filter_entry(grid, 1, "Received before", "", "YYYY-MM-DD HH:MM:SS (blank for any)");
+    GtkEntry *contains = add_filter_entry(grid, 2, "Description contains", description->str, "blank for any");
+    g_string_free(description, TRUE);
+
+    GtkWidget *scope = gtk_label_new("Only errors in this tab are changed, including any which are hidden because they are disabled");
+    assert(NULL != scope);
+    gtk_grid_attach(grid, scope, 0, 3, 2, 1);
+
+    gtk_container_add(GTK_CONTAINER(gtk_dialog_get_content_area(GTK_DIALOG(dialog))), GTK_WIDGET(grid));
+    gtk_widget_show_all(dialog);
+
+    while (true) {
+        const gint response = gtk_dialog_run(GTK_DIALOG(dialog));
+        if ((DISABLE_RESPONSE != response) && (ENABLE_RESPONSE != response)) {
+            break;
+        }
+
+        time_t from_time = 0;
+        time_t until_time = 0;
+        if (!parse_time(gtk_entry_get_text(from), &from_time) || !parse_time(gtk_entry_get_text(until), &until_time)) {
+            GtkWidget *bad_time_dialog = gtk_message_dialog_new(GTK_WINDOW(dialog), GTK_DIALOG_DESTROY_WITH_PARENT, GTK_MESSAGE_ERROR,
+                    GTK_BUTTONS_CLOSE, "Times should look like 2017-06-30 14:05:00");
+            gtk_dialog_run(GTK_DIALOG(bad_time_dialog));
+            gtk_widget_destroy(bad_time_dialog);
+            continue;
+        }
+
+        BulkRequest *request = new_bulk_request(search, from_time, until_time, gtk_entry_get_text(contains),
+                                                ENABLE_RESPONSE == response);
+        bulk_click(request);
+        free_bulk_request(request);
+        break;
+    }
+
+    gtk_widget_destroy(dialog);
+}
+
+// matches GDestroyNotify for the row copies made by show_desc_menu
+static void free_row_copy(gpointer row) {
+    g_free((char *) ((EdsacErrorListRow *) row)->message);
+    g_free(row);
+}
+
+// for the "activate" signal of the menu item opening show_bulk_dialog. The menu item owns the row's copy
+static void bulk_dialog_click(GtkMenuItem *item, LinkyBuffer *linky_buffer) {
+    const EdsacErrorListRow *row = g_object_get_data(G_OBJECT(item), "row");
+    assert(NULL != row);
+
+    show_bulk_dialog(linky_buffer->notebook, &linky_buffer->description, row);
+}
+
+// rows of hidden tabs which have been asked for but not fetched yet are no longer needed.
+// The tab being shown catches up with anything which happened while it was hidden
+static void page_switched(GtkNotebook *notebook, __attribute__((unused)) GtkWidget *page, guint page_num,
+                          __attribute__((unused)) gpointer unused) {
+    EdsacErrorNotebook *self = EDSAC_ERROR_NOTEBOOK(notebook);
+
+    for (GSList *item = self->priv->open_tabs_list; NULL != item; item = item->next) {
+        LinkyBuffer *linky_buffer = (LinkyBuffer *) item->data;
+        if (linky_buffer->page_id != (gint) page_num) {
+            if (NULL != linky_buffer->model) {
+                edsac_error_list_model_cancel_pending(linky_buffer->model);
+            }
+        } else if (linky_buffer->dirty) {
+            update_tab(linky_buffer, NULL);
+        }
+    }
+}
+
+// the heatmap with a choice of how far back it looks
+static GtkWidget *new_heatmap_page(LinkyBuffer *linky_buffer) {
+    GtkWidget *heatmap = edsac_heatmap_new(heatmap_activate, heatmap_notify, linky_buffer);
+    assert(NULL != heatmap);
+    linky_buffer->heatmap = EDSAC_HEATMAP(heatmap);
+
+    // ids are the span in seconds
+    GtkWidget *combo = gtk_combo_box_text_new();
+    assert(NULL != combo);
+    char id[32];
+    snprintf(id, sizeof(id), "%i", HEATMAP_SPAN_HOUR);
+    gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(combo), id, "Last hour");
+    snprintf(id, sizeof(id), "%i", HEATMAP_SPAN_DAY);
+    gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(combo), id, "Last day");
+    snprintf(id, sizeof(id), "%i", HEATMAP_SPAN_WEEK);
+    gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(combo), id, "Last week");
+    snprintf(id, sizeof(id), "%i", HEATMAP_SPAN_HOUR);
+    gtk_combo_box_set_active_id(GTK_COMBO_BOX(combo), id);
+    g_signal_connect(G_OBJECT(combo), "changed", G_CALLBACK(span_changed), heatmap);
+
+    GtkWidget *controls = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 4);
+    assert(NULL != controls);
+    gtk_box_pack_end(GTK_BOX(controls), combo, FALSE, FALSE, 0);
+
+    GtkWidget *page = gtk_box_new(GTK_ORIENTATION_VERTICAL, 4);
+    assert(NULL != page);
+    gtk_box_pack_start(GTK_BOX(page), controls, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(page), heatmap, TRUE, TRUE, 0);
+
+    return page;
+}
+
+// "changed" signal handler for the heatmap span
+static void span_changed(GtkComboBox *combo, EdsacHeatmap *heatmap) {
+    const gchar *id = gtk_combo_box_get_active_id(combo);
+    if (NULL != id) {
+        edsac_heatmap_set_span(heatmap, (time_t) strtol(id, NULL, 10));
+    }
+}
+
+// EdsacHeatmapActivate: clicking a node opens its tab
+static void heatmap_activate(__attribute__((unused)) EdsacHeatmap *heatmap, unsigned int rack_no, unsigned int chassis_no,
+                             gpointer linky_buffer) {
+    Clickable node;
+    memset(&node, 0, sizeof(node));
+    node.type = CHASSIS;
+    node.rack_num = rack_no;
+    node.chassis_num = chassis_no;
+    node.valve_num = -1;
+
+    edsac_error_notebook_show_page(((LinkyBuffer *) linky_buffer)->notebook, &node);
+}
+
+// EdsacHeatmapNotify: the status bar shows the heatmap's total
+static void heatmap_notify(__attribute__((unused)) EdsacHeatmap *heatmap, gpointer data) {
+    LinkyBuffer *linky_buffer = (LinkyBuffer *) data;
+
+    if (gtk_notebook_get_current_page(GTK_NOTEBOOK(linky_buffer->notebook)) == linky_buffer->page_id) {
+        g_signal_emit(linky_buffer->notebook, error_count_changed_signal, 0);
+    }
+}
+
+// the LinkyBuffer of the page being shown, or NULL
+static LinkyBuffer *current_linky_buffer(EdsacErrorNotebook *self) {
+    const gint current_page = gtk_notebook_get_current_page(GTK_NOTEBOOK(self));
+    GSList *result = g_slist_find_custom(self->priv->open_tabs_list, (gconstpointer) &current_page, open_tabs_list_search_by_id);
+    if (NULL == result) {
+        return NULL;
+    }
+
+    return (LinkyBuffer *) result->data;
+}
+
+// ask where to export the tab's errors to and which of them
+static void show_export_dialog(LinkyBuffer *linky_buffer) {
+    GtkWidget *toplevel = gtk_widget_get_toplevel(GTK_WIDGET(linky_buffer->notebook));
+    GtkWindow *parent = gtk_widget_is_toplevel(toplevel) ? GTK_WINDOW(toplevel) : NULL;
+
+    GtkWidget *dialog = gtk_file_chooser_dialog_new("Export Errors", parent, GTK_FILE_CHOOSER_ACTION_SAVE,
+                                                    "Cancel", GTK_RESPONSE_CANCEL, "Export", GTK_RESPONSE_ACCEPT, NULL);
+    assert(NULL != dialog);
+    gtk_file_chooser_set_do_overwrite_confirmation(GTK_FILE_CHOOSER(dialog), TRUE);
+    gtk_file_chooser_set_current_name(GTK_FILE_CHOOSER(dialog), "errors.csv");
+    gtk_dialog_set_default_response(GTK_DIALOG(dialog), GTK_RESPONSE_ACCEPT);
+
+    GtkGrid *grid = GTK_GRID(gtk_grid_new());
+    assert(NULL != grid);
+    gtk_grid_set_row_spacing(grid, 5);
+    gtk_grid_set_column_spacing(grid, 5);
+
+    GtkEntry *from = add_filter_entry(grid, 0, "Received from", "", "YYYY-MM-DD HH:MM:SS (blank for any)");
+    GtkEntry *until = add_filter_entry(grid, 1, "Received before", "", "YYYY-MM-DD HH:MM:SS (blank for any)");
+
+    GtkWidget *format_label = gtk_label_new("Format");
+    assert(NULL != format_label);
+    gtk_grid_attach(grid, format_label, 0, 2, 1, 1);
+    GtkWidget *format = gtk_combo_box_text_new();
+    assert(NULL != format);
+    gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(format), "csv", "CSV");
+    gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(format), "jsonl", "JSON Lines");
+    gtk_combo_box_set_active_id(GTK_COMBO_BOX(format), "csv");
+    gtk_grid_attach(grid, format, 1, 2, 1, 1);
+
+    gtk_widget_show_all(GTK_WIDGET(grid));
+    gtk_file_chooser_set_extra_widget(GTK_FILE_CHOOSER(dialog), GTK_WIDGET(grid));
+
+    while (GTK_RESPONSE_ACCEPT == gtk_dialog_run(GTK_DIALOG(dialog))) {
+        ErrorFilter filter;
+        memset(&filter, 0, sizeof(filter));
+        memcpy(&filter.search, &linky_buffer->description, sizeof(filter.search));
+        if (!parse_time(gtk_entry_get_text(from), &filter.from) || !parse_time(gtk_entry_get_text(until), &filter.until)) {
+            GtkWidget *bad_time_dialog = gtk_message_dialog_new(GTK_WINDOW(dialog), GTK_DIALOG_DESTROY_WITH_PARENT, GTK_MESSAGE_ERROR,
+                    GTK_BUTTONS_CLOSE, "Times should look like 2017-06-30 14:05:00");
+            gtk_dialog_run(GTK_DIALOG(bad_time_dialog));
+            gtk_widget_destroy(bad_time_dialog);
+            continue;
+        }
+
+        char *path = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
+        if (NULL != path) {
+            const gchar *format_id = gtk_combo_box_get_active_id(GTK_COMBO_BOX(format));
+            const bool json = (NULL != format_id) && (0 == strcmp(format_id, "jsonl"));
+            start_export(linky_buffer, &filter, path, json ? EXPORT_JSON_LINES : EXPORT_CSV);
+            g_free(path);
+        }
+        break;
+    }
+    gtk_widget_destroy(dialog);
+}
+
+// run the export on its own thread with a window showing how far it has got
+static void start_export(LinkyBuffer *linky_buffer, const ErrorFilter *filter, const char *path, const ExportFormat format) {
+    GtkWidget *toplevel = gtk_widget_get_toplevel(GTK_WIDGET(linky_buffer->notebook));
+
+    GtkWindow *progress_window = GTK_WINDOW(gtk_window_new(GTK_WINDOW_TOPLEVEL));
+    assert(NULL != progress_window);
+    if (gtk_widget_is_toplevel(toplevel)) {
+        gtk_window_set_transient_for(progress_window, GTK_WINDOW(toplevel));
+    }
+    char *title = g_strdup_printf("Exporting %s", linky_buffer->title->str);
+    gtk_window_set_title(progress_window, title);
+    g_free(title);
+    gtk_window_set_default_size(progress_window, 400, -1);
+    gtk_container_set_border_width(GTK_CONTAINER(progress_window), 10);
 
-    // was it a click?
-    GdkEventButton *event_btn = (GdkEventButton *) event;
-    if (event->type == GDK_BUTTON_PRESS && event_btn->button == 1) { // left click. Not using right click because TextView already has a context menu that we can't remove
-        // show right-click menu
-        GtkWidget *menu = gtk_menu_new();
-        assert(NULL != menu);
+    GtkBox *box = GTK_BOX(gtk_box_new(GTK_ORIENTATION_VERTICAL, 5));
 
-        GtkWidget *menu_item = gtk_menu_item_new_with_label("Toggle Disabled");
-        assert(NULL != menu_item);
+    GtkWidget *progress_bar = gtk_progress_bar_new();
+    assert(NULL != progress_bar);
+    gtk_progress_bar_set_show_text(GTK_PROGRESS_BAR(progress_bar), TRUE);
+    gtk_progress_bar_set_text(GTK_PROGRESS_BAR(progress_bar), "Starting");
+    gtk_box_pack_start(box, progress_bar, FALSE, FALSE, 0);
 
-        g_signal_connect_swapped(G_OBJECT(menu_item), "activate", G_CALLBACK(disable_click), error_id);
+    GtkWidget *button = gtk_button_new_with_label("Cancel");
+    assert(NULL != button);
+    gtk_box_pack_end(box, button, FALSE, FALSE, 0);
+
+    gtk_container_add(GTK_CONTAINER(progress_window), GTK_WIDGET(box));
+
+    ExportWindow *window = g_new0(ExportWindow, 1);
+    assert(NULL != window);
+    window->window = progress_window;
+    window->bar = GTK_PROGRESS_BAR(progress_bar);
+    window->button = GTK_BUTTON(button);
+    window->cancellable = g_cancellable_new();
+    assert(NULL != window->cancellable);
+    // the count ignores the time bounds so it is only an upper limit
+    window->total = edsac_error_list_model_get_n_rows(linky_buffer->model);
+    window->finished = false;
+
+    g_signal_connect(G_OBJECT(button), "clicked", G_CALLBACK(export_button_clicked), window);
+    g_signal_connect(G_OBJECT(progress_window), "destroy", G_CALLBACK(export_window_destroyed), window);
+    gtk_widget_show_all(GTK_WIDGET(progress_window));
+
+    export_errors_async(filter, path, format, window->cancellable, export_progress, export_done, window);
+}
 
-        gtk_menu_shell_append(GTK_MENU_SHELL(menu), menu_item);
-        gtk_widget_show_all(menu);
-        gtk_menu_popup_at_pointer(GTK_MENU(menu), event); 
+// ExportProgressFunc for start_export
+static void export_progress(const guint64 num_rows, gpointer data) {
+    ExportWindow *window = (ExportWindow *) data;
+    if (NULL == window->window) {
+        return;
     }
+
+    if (window->total > 0) {
+        gtk_progress_bar_set_fraction(window->bar, MIN(1.0, (gdouble) num_rows / window->total));
+    } else {
+        gtk_progress_bar_pulse(window->bar);
+    }
+
+    char *text = g_strdup_printf("%" G_GUINT64_FORMAT " errors written", num_rows);
+    gtk_progress_bar_set_text(window->bar, text);
+    g_free(text);
+}
+
+// ExportDoneFunc for start_export
+static void export_done(const gint64 num_rows, gpointer data) {
+    ExportWindow *window = (ExportWindow *) data;
+    window->finished = true;
+
+    if (NULL == window->window) {
+        g_object_unref(window->cancellable);
+        g_free(window);
+        return;
+    }
+
+    char *text = NULL;
+    if (num_rows >= 0) {
+        gtk_progress_bar_set_fraction(window->bar, 1.0);
+        text = g_strdup_printf("Finished: %" G_GINT64_FORMAT " errors written", num_rows);
+    } else if (g_cancellable_is_cancelled(window->cancellable)) {
+        text = g_strdup("Cancelled");
+    } else {
+        text = g_strdup("FAILED: the reason is on the terminal");
+    }
+    gtk_progress_bar_set_text(window->bar, text);
+    g_free(text);
+
+    gtk_button_set_label(window->button, "Close");
+}
+
+// "clicked" handler for the button in the export window
+static void export_button_clicked(__attribute__((unused)) GtkButton *button, ExportWindow *window) {
+    if (window->finished) {
+        gtk_widget_destroy(GTK_WIDGET(window->window));
+    } else {
+        g_cancellable_cancel(window->cancellable);
+    }
+}
+
+// "destroy" handler for the export window. Closing the window cancels the export
+static void export_window_destroyed(__attribute__((unused)) GtkWidget *widget, ExportWindow *window) {
+    window->window = NULL;
+
+    if (window->finished) {
+        g_object_unref(window->cancellable);
+        g_free(window);
+    } else {
+        g_cancellable_cancel(window->cancellable);
+    }
+}
+
+// "activate" handler for Export Tab... in the description menu
+static void export_click(__attribute__((unused)) GtkMenuItem *item, LinkyBuffer *linky_buffer) {
+    show_export_dialog(linky_buffer);
+}
+
+// keep following new errors for as long as the view is at the bottom
+static void view_scrolled(GtkAdjustment *adjustment, LinkyBuffer *linky_buffer) {
+    const gdouble bottom = gtk_adjustment_get_upper(adjustment) - gtk_adjustment_get_page_size(adjustment);
+    linky_buffer->follow = (gtk_adjustment_get_value(adjustment) >= bottom - FOLLOW_SLACK);
+}
+
+// menu item changing every error in the tab
+static void append_bulk_item(GtkWidget *menu, const char *label, const Clickable *search, const bool enabled) {
+    GtkWidget *menu_item = gtk_menu_item_new_with_label(label);
+    assert(NULL != menu_item);
+    gtk_widget_set_sensitive(menu_item, !get_database_read_only());
+
+    BulkRequest *request = new_bulk_request(search, 0, 0, NULL, enabled);
+    g_signal_connect_data(G_OBJECT(menu_item), "activate", G_CALLBACK(bulk_click), request, (GClosureNotify) free_bulk_request,
+                          G_CONNECT_SWAPPED);
+
+    gtk_menu_shell_append(GTK_MENU_SHELL(menu), menu_item);
+}
+
+// pop up the menu for an error description
+static void show_desc_menu(GdkEventButton *event, LinkyBuffer *linky_buffer, const EdsacErrorListRow *row) {
+    GtkWidget *menu = gtk_menu_new();
+    assert(NULL != menu);
+
+    // a watched database belongs to its writer
+    const bool writable = !get_database_read_only();
+
+    GtkWidget *menu_item = gtk_menu_item_new_with_label("Toggle Disabled");
+    assert(NULL != menu_item);
+    gtk_widget_set_sensitive(menu_item, writable);
+
+    g_signal_connect_swapped(G_OBJECT(menu_item), "activate", G_CALLBACK(disable_click), (gpointer) ((uintptr_t) row->id));
+
+    gtk_menu_shell_append(GTK_MENU_SHELL(menu), menu_item);
+
+    // every error in the tab at once
+    gtk_menu_shell_append(GTK_MENU_SHELL(menu), gtk_separator_menu_item_new());
+    append_bulk_item(menu, "Disable All in Tab", &linky_buffer->description, false);
+    append_bulk_item(menu, "Enable All in Tab", &linky_buffer->description, true);
+
+    // the row only lives as long as the model's page cache
+    EdsacErrorListRow *row_copy = g_new(EdsacErrorListRow, 1);
+    assert(NULL != row_copy);
+    memcpy(row_copy, row, sizeof(*row_copy));
+    row_copy->message = g_strdup(row->message);
+    menu_item = gtk_menu_item_new_with_label("Enable or Disable Matching...");
+    assert(NULL != menu_item);
+    gtk_widget_set_sensitive(menu_item, writable);
+    g_object_set_data_full(G_OBJECT(menu_item), "row", row_copy, free_row_copy);
+    g_signal_connect(G_OBJECT(menu_item), "activate", G_CALLBACK(bulk_dialog_click), linky_buffer);
+    gtk_menu_shell_append(GTK_MENU_SHELL(menu), menu_item);
+
+    gtk_menu_shell_append(GTK_MENU_SHELL(menu), gtk_separator_menu_item_new());
+    menu_item = gtk_menu_item_new_with_label("Export Tab...");
+    assert(NULL != menu_item);
+    g_signal_connect(G_OBJECT(menu_item), "activate", G_CALLBACK(export_click), linky_buffer);
+    gtk_menu_shell_append(GTK_MENU_SHELL(menu), menu_item);
+
+    gtk_widget_show_all(menu);
+    gtk_menu_popup_at_pointer(GTK_MENU(menu), (GdkEvent *) event);
 }
 
 // handler for the close button on tab labels
@@ -595,14 +1243,97 @@ static void close_button_handler(GtkWidget *button, __attribute__((unused)) GdkE
 
 
 /**** GTK stuff ****/
-// new gtk text view without a visale cursor
-static GtkWidget *new_text_view(void) {
-    GtkWidget *text_view = gtk_text_view_new_with_buffer(NULL);
-    
-    // get rid of the cursor
-    gtk_text_view_set_cursor_visible(GTK_TEXT_VIEW(text_view), FALSE);
+// list view of the errors in linky_buffer->model
+static GtkWidget *new_error_view(EdsacErrorNotebook *self, LinkyBuffer *linky_buffer) {
+    assert(NULL != self);
+    assert(NULL != linky_buffer);
+
+    // model_notify sets the model once it has been counted
+    GtkWidget *widget = gtk_tree_view_new();
+    assert(NULL != widget);
+    GtkTreeView *view = GTK_TREE_VIEW(widget);
+
+    PangoAttrList *link_style = self->priv->link_style;
+    linky_buffer->view = view;
+    linky_buffer->rack_column = add_column(view, "Rack", 60, link_style, link_cell_data, GINT_TO_POINTER(RACK));
+    linky_buffer->chassis_column = add_column(view, "Chassis", 70, link_style, link_cell_data, GINT_TO_POINTER(CHASSIS));
+    linky_buffer->valve_column = add_column(view, "Valve", 60, link_style, link_cell_data, GINT_TO_POINTER(VALVE));
+    GtkTreeViewColumn *message_column = add_column(view, "Error", 400, NULL, message_cell_data, self->priv->disabled_style);
+    gtk_tree_view_column_set_expand(message_column, TRUE);
+
+    // every row is the same height so the view doesn't need to look at rows which aren't shown
+    gtk_tree_view_set_fixed_height_mode(view, TRUE);
 
-    return text_view;
+    // interactive search would read every row
+    gtk_tree_view_set_enable_search(view, FALSE);
+
+    g_signal_connect(G_OBJECT(widget), "button-press-event", G_CALLBACK(view_clicked), linky_buffer);
+
+    return widget;
+}
+
+// append a fixed width text column to view. style may be NULL
+static GtkTreeViewColumn *add_column(GtkTreeView *view, const char *title, const gint width, PangoAttrList *style, GtkTreeCellDataFunc func, gpointer data) {
+    GtkCellRenderer *renderer = gtk_cell_renderer_text_new();
+    assert(NULL != renderer);
+
+    if (NULL != style) {
+        g_object_set(G_OBJECT(renderer), "attributes", style, NULL);
+    }
+
+    GtkTreeViewColumn *column = gtk_tree_view_column_new();
+    assert(NULL != column);
+    gtk_tree_view_column_set_title(column, title);
+    gtk_tree_view_column_pack_start(column, renderer, TRUE);
+    gtk_tree_view_column_set_cell_data_func(column, renderer, func, data, NULL);
+
+    // needed for fixed height mode
+    gtk_tree_view_column_set_sizing(column, GTK_TREE_VIEW_COLUMN_FIXED);
+    gtk_tree_view_column_set_fixed_width(column, width);
+    gtk_tree_view_column_set_resizable(column, TRUE);
+
+    gtk_tree_view_append_column(view, column);
+    return column;
+}
+
+// cell data functions. These are only called for rows being drawn and borrow the row from the model rather than copying it
+// field is the ClickableType of the link
+static void link_cell_data(__attribute__((unused)) GtkTreeViewColumn *column, GtkCellRenderer *cell, GtkTreeModel *model,
+        GtkTreeIter *iter, gpointer field) {
+    const EdsacErrorListRow *row = edsac_error_list_model_peek(EDSAC_ERROR_LIST_MODEL(model), iter);
+
+    char text[16] = ""; // blank if there is nothing to show
+    if (NULL != row) {
+        switch ((ClickableType) GPOINTER_TO_INT(field)) {
+            case RACK:
+                snprintf(text, sizeof(text), "%u", row->rack_no);
+                break;
+            case CHASSIS:
+                snprintf(text, sizeof(text), "%u", row->chassis_no);
+                break;
+            case VALVE:
+                if (row->valve_no >= 0) {
+                    snprintf(text, sizeof(text), "%i", row->valve_no);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    g_object_set(G_OBJECT(cell), "text", text, NULL);
+}
+
+static void message_cell_data(__attribute__((unused)) GtkTreeViewColumn *column, GtkCellRenderer *cell, GtkTreeModel *model,
+        GtkTreeIter *iter, gpointer disabled_style) {
+    const EdsacErrorListRow *row = edsac_error_list_model_peek(EDSAC_ERROR_LIST_MODEL(model), iter);
+    if (NULL == row) {
+        g_object_set(G_OBJECT(cell), "text", "", "attributes", NULL, NULL);
+        return;
+    }
+
+    // grey out disabled items
+    g_object_set(G_OBJECT(cell), "text", row->message, "attributes", row->enabled ? NULL : disabled_style, NULL);
 }
 
 // puts thing into a scrolled window
@@ -670,6 +1401,8 @@ static void edsac_error_notebook_finalize(GObject *obj) {
     EdsacErrorNotebook *self = EDSAC_ERROR_NOTEBOOK(obj);
 
     g_slist_free_full(self->priv->open_tabs_list, (GDestroyNotify) free_linky_buffer);
+    pango_attr_list_unref(self->priv->link_style);
+    pango_attr_list_unref(self->priv->disabled_style);
 
     G_OBJECT_CLASS(edsac_error_notebook_parent_class)->finalize(obj);
 }
@@ -678,6 +1411,9 @@ static void edsac_error_notebook_class_init(EdsacErrorNotebookClass *class) {
     edsac_error_notebook_parent_class = g_type_class_peek_parent(class);
     g_type_class_add_private(class, sizeof(EdsacErrorNotebookPrivate));
     G_OBJECT_CLASS(class)->finalize = edsac_error_notebook_finalize;
+
+    error_count_changed_signal = g_signal_new("error-count-changed", G_TYPE_FROM_CLASS(class), G_SIGNAL_RUN_LAST, 0,
+                                              NULL, NULL, NULL, G_TYPE_NONE, 0);
 }
 
 // CONSTRUCT PRIVATE MEMBER DATA HERE
@@ -686,6 +1422,17 @@ static void edsac_error_notebook_instance_init(EdsacErrorNotebook *self) {
 
     self->priv->open_tabs_list = NULL; // empty slist
 
+    // blue and underlined
+    self->priv->link_style = pango_attr_list_new();
+    assert(NULL != self->priv->link_style);
+    pango_attr_list_insert(self->priv->link_style, pango_attr_foreground_new(0, 0, 0xffff));
+    pango_attr_list_insert(self->priv->link_style, pango_attr_underline_new(PANGO_UNDERLINE_SINGLE));
+
+    // grey
+    self->priv->disabled_style = pango_attr_list_new();
+    assert(NULL != self->priv->disabled_style);
+    pango_attr_list_insert(self->priv->disabled_style, pango_attr_foreground_new(0xbebe, 0xbebe, 0xbebe));
+
     Clickable *all_desc = malloc(sizeof(Clickable));
     assert(NULL != all_desc);
     all_desc->type = ALL;
@@ -694,6 +1441,8 @@ static void edsac_error_notebook_instance_init(EdsacErrorNotebook *self) {
     assert(NULL != all);
 
     gtk_notebook_set_scrollable(&self->parent_instance, TRUE);
+
+    g_signal_connect(G_OBJECT(self), "switch-page", G_CALLBACK(page_switched), NULL);
 }
 
 GType edsac_error_notebook_get_type(void) {
@@ -0,0 +1,485 @@
+/*
+ * Copyright 2017
+ * GPL3 Licensed
+ * EdsacHeatmap.c
+ * GObject Class drawing the errors each node received recently as a grid with a row per rack.
+ * The counts come from the rollup tables on the database thread, so a week costs no more to show than an hour
+ */
+
+// includes
+#include "config.h"
+#include "EdsacHeatmap.h"
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "sql.h"
+#include "db_worker.h"
+
+// declarations
+
+// seconds between reloads while shown, so that old errors slide out of the span even when nothing new arrives
+#define REFRESH_INTERVAL 60
+
+// pixels
+#define MARGIN 4
+#define RACK_LABEL_WIDTH 64
+#define TREND_HEIGHT 48
+#define TEXT_HEIGHT 14
+#define FONT_SIZE 10
+
+// a node in the grid
+typedef struct {
+    unsigned int rack_no;
+    unsigned int chassis_no;
+    unsigned int count;
+    guint row;      // index of the rack
+    guint column;   // index of the chassis within its rack
+} Cell;
+
+// everything the heatmap draws. Built on the database thread
+typedef struct {
+    GArray *cells;      // Cells ordered by rack_no then chassis_no
+    GArray *racks;      // rack_no of each row
+    guint columns;      // most chassis in a rack
+    GArray *trend;      // ActivityBuckets
+    time_t since;       // start of the first trend bucket
+    time_t bucket;      // seconds in a trend bucket
+    guint buckets;      // trend buckets in the span
+    unsigned int max_count;
+    unsigned int max_trend;
+    unsigned int total;
+} HeatmapData;
+
+// sizes of the parts of the drawing, worked out from the allocation
+typedef struct {
+    double cell_width;
+    double cell_height;
+    double grid_top;
+    double trend_top;
+    double width;
+} Layout;
+
+// private object data
+typedef struct _EdsacHeatmapPrivate {
+    HeatmapData *data;          // NULL until first loaded
+    time_t span;                // seconds shown
+    gboolean loading;           // a load is queued on the database thread
+    gboolean reload;            // load again when the one queued finishes
+    gboolean cancelled;         // edsac_heatmap_cancel has been called
+    guint timer;                // REFRESH_INTERVAL source
+    GCancellable *cancellable;  // cancels everything the heatmap has queued
+    EdsacHeatmapActivate activate;
+    EdsacHeatmapNotify notify;
+    gpointer user_data;
+} EdsacHeatmapPrivate;
+
+static gpointer edsac_heatmap_parent_class = NULL;
+#define EDSAC_HEATMAP_GET_PRIVATE(_o) (G_TYPE_INSTANCE_GET_PRIVATE((_o), EDSAC_TYPE_HEATMAP, EdsacHeatmapPrivate))
+
+/**** local function declarations ****/
+static void free_heatmap_data(gpointer data);
+static int compare_cells(const void *a, const void *b);
+static gpointer load_job(gpointer span, GCancellable *cancellable);
+static void load(EdsacHeatmap *self);
+static void loaded(GObject *source, GAsyncResult *result, gpointer unused);
+static gboolean refresh(gpointer heatmap);
+static void get_layout(EdsacHeatmap *self, Layout *layout);
+static void cell_colour(cairo_t *cr, const unsigned int count, const unsigned int max);
+static gboolean draw(GtkWidget *widget, cairo_t *cr, gpointer unused);
+static gboolean button_pressed(GtkWidget *widget, GdkEventButton *event, gpointer unused);
+
+/**** Public Methods ****/
+GtkWidget *edsac_heatmap_new(EdsacHeatmapActivate activate, EdsacHeatmapNotify notify, gpointer user_data) {
+    EdsacHeatmap *self = (EdsacHeatmap *) g_object_new(EDSAC_TYPE_HEATMAP, NULL);
+    assert(NULL != self);
+
+    self->priv->activate = activate;
+    self->priv->notify = notify;
+    self->priv->user_data = user_data;
+    self->priv->timer = g_timeout_add_seconds(REFRESH_INTERVAL, refresh, self);
+
+    load(self);
+
+    return GTK_WIDGET(self);
+}
+
+void edsac_heatmap_set_span(EdsacHeatmap *self, const time_t span) {
+    assert(NULL != self);
+    assert(span > 0);
+
+    if (span == self->priv->span) {
+        return;
+    }
+    self->priv->span = span;
+
+    // whatever is queued already is for the old span
+    if (self->priv->loading) {
+        self->priv->reload = TRUE;
+    } else {
+        load(self);
+    }
+}
+
+void edsac_heatmap_update(EdsacHeatmap *self) {
+    assert(NULL != self);
+
+    if (self->priv->loading) {
+        self->priv->reload = TRUE;
+    } else {
+        load(self);
+    }
+}
+
+gint edsac_heatmap_get_total(EdsacHeatmap *self) {
+    assert(NULL != self);
+
+    if (NULL == self->priv->data) {
+        return -1;
+    }
+    return (gint) self->priv->data->total;
+}
+
+void edsac_heatmap_cancel(EdsacHeatmap *self) {
+    assert(NULL != self);
+    EdsacHeatmapPrivate *priv = self->priv;
+
+    priv->cancelled = TRUE;
+    priv->reload = FALSE;
+    g_cancellable_cancel(priv->cancellable);
+
+    if (0 != priv->timer) {
+        g_source_remove(priv->timer);
+        priv->timer = 0;
+    }
+}
+
+/**** Private Methods ****/
+static void free_heatmap_data(gpointer data) {
+    HeatmapData *heatmap_data = data;
+    if (NULL == heatmap_data) {
+        return;
+    }
+
+    g_array_unref(heatmap_data->cells);
+    g_array_unref(heatmap_data->racks);
+    g_array_unref(heatmap_data->trend);
+    g_free(heatmap_data);
+}
+
+// by rack_no then chassis_no, for bsearch
+static int compare_cells(const void *a, const void *b) {
+    const Cell *cell_a = a;
+    const Cell *cell_b = b;
+
+    if (cell_a->rack_no != cell_b->rack_no) {
+        return (cell_a->rack_no < cell_b->rack_no) ? -1 : 1;
+    }
+    if (cell_a->chassis_no != cell_b->chassis_no) {
+        return (cell_a->chassis_no < cell_b->chassis_no) ? -1 : 1;
+    }
+    return 0;
+}
+
+// runs on the database thread
+static gpointer load_job(gpointer span_p, __attribute__((unused)) GCancellable *cancellable) {
+    const time_t span = *(time_t *) span_p;
+    const bool hourly = span > HEATMAP_SPAN_HOUR;
+
+    HeatmapData *data = g_new0(HeatmapData, 1);
+    assert(NULL != data);
+    data->cells = g_array_new(FALSE, FALSE, sizeof(Cell));
+    assert(NULL != data->cells);
+    data->racks = g_array_new(FALSE, FALSE, sizeof(unsigned int));
+    assert(NULL != data->racks);
+
+    // every node gets a cell, even without errors, so that quiet nodes stand out too
+    GList *nodes = list_nodes_ordered();
+    guint column = 0;
+    for (GList *node = nodes; NULL != node; node = node->next) {
+        const NodeIdentifier *identifier = node->data;
+
+        if ((0 == data->racks->len) ||
+            (g_array_index(data->racks, unsigned int, data->racks->len - 1) != identifier->rack_no)) {
+            g_array_append_val(data->racks, identifier->rack_no);
+            column = 0;
+        }
+
+        Cell cell = {identifier->rack_no, identifier->chassis_no, 0, data->racks->len - 1, column++};
+        g_array_append_val(data->cells, cell);
+        data->columns = MAX(data->columns, column);
+    }
+    g_list_free_full(nodes, g_free);
+
+    data->bucket = hourly ? 3600 : 60;
+    data->since = (time(NULL) - span) / data->bucket * data->bucket;
+    data->buckets = (guint) (span / data->bucket) + 1;
+
+    GArray *activity = node_activity(data->since, hourly);
+    for (guint i = 0; i < activity->len; i++) {
+        const NodeActivity *node = &g_array_index(activity, NodeActivity, i);
+        const Cell key = {node->rack_no, node->chassis_no, 0, 0, 0};
+
+        Cell *cell = bsearch(&key, data->cells->data, data->cells->len, sizeof(Cell), compare_cells);
+        if (NULL != cell) {
+            cell->count = node->count;
+            data->max_count = MAX(data->max_count, node->count);
+        }
+    }
+    g_array_unref(activity);
+
+    data->trend = activity_trend(data->since, hourly);
+    for (guint i = 0; i < data->trend->len; i++) {
+        const ActivityBucket *bucket = &g_array_index(data->trend, ActivityBucket, i);
+        data->max_trend = MAX(data->max_trend, bucket->count);
+        data->total += bucket->count;
+    }
+
+    return data;
+}
+
+static void load(EdsacHeatmap *self) {
+    EdsacHeatmapPrivate *priv = self->priv;
+    if (priv->cancelled) {
+        return;
+    }
+
+    time_t *span = g_new(time_t, 1);
+    assert(NULL != span);
+    *span = priv->span;
+
+    priv->loading = TRUE;
+    priv->reload = FALSE;
+    db_worker_push(self, priv->cancellable, load_job, span, g_free, free_heatmap_data, loaded, NULL);
+}
+
+// GAsyncReadyCallback for load
+static void loaded(GObject *source, GAsyncResult *result, __attribute__((unused)) gpointer unused) {
+    EdsacHeatmap *self = EDSAC_HEATMAP(source);
+    EdsacHeatmapPrivate *priv = self->priv;
+
+    HeatmapData *data = g_task_propagate_pointer(G_TASK(result), NULL);
+    if (NULL == data) {
+        // cancelled
+        return;
+    }
+    priv->loading = FALSE;
+
+    free_heatmap_data(priv->data);
+    priv->data = data;
+    gtk_widget_queue_draw(GTK_WIDGET(self));
+
+    if (NULL != priv->notify) {
+        priv->notify(self, priv->user_data);
+    }
+
+    if (priv->reload) {
+        load(self);
+    }
+}
+
+// GSourceFunc for the REFRESH_INTERVAL timer
+static gboolean refresh(gpointer heatmap) {
+    EdsacHeatmap *self = EDSAC_HEATMAP(heatmap);
+
+    // a hidden heatmap is reloaded by the notebook when it is switched to
+    if (gtk_widget_get_mapped(GTK_WIDGET(self))) {
+        edsac_heatmap_update(self);
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+// assumes self->priv->data is not NULL
+static void get_layout(EdsacHeatmap *self, Layout *layout) {
+    const HeatmapData *data = self->priv->data;
+    const double width = gtk_widget_get_allocated_width(GTK_WIDGET(self));
+    const double height = gtk_widget_get_allocated_height(GTK_WIDGET(self));
+
+    layout->width = width;
+    layout->grid_top = MARGIN;
+    layout->trend_top = MAX(height - MARGIN - TREND_HEIGHT, layout->grid_top);
+
+    const double grid_width = MAX(width - 2 * MARGIN - RACK_LABEL_WIDTH, 0);
+    const double grid_height = MAX(layout->trend_top - TEXT_HEIGHT - 2 * MARGIN, 0);
+    layout->cell_width = (0 == data->columns) ? 0 : grid_width / data->columns;
+    layout->cell_height = (0 == data->racks->len) ? 0 : grid_height / data->racks->len;
+}
+
+// white to red, with the square root so that a few errors still show next to a node with thousands
+static void cell_colour(cairo_t *cr, const unsigned int count, const unsigned int max) {
+    if (0 == count) {
+        cairo_set_source_rgb(cr, 0.85, 0.85, 0.85);
+        return;
+    }
+
+    const double level = sqrt((double) count / (double) MAX(max, 1));
+    cairo_set_source_rgb(cr, 1.0, 0.9 - 0.8 * level, 0.9 - 0.8 * level);
+}
+
+// "draw" signal handler
+static gboolean draw(GtkWidget *widget, cairo_t *cr, __attribute__((unused)) gpointer unused) {
+    EdsacHeatmap *self = EDSAC_HEATMAP(widget);
+    const HeatmapData *data = self->priv->data;
+
+    cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
+    cairo_paint(cr);
+    cairo_set_font_size(cr, FONT_SIZE);
+
+    if (NULL == data) {
+        cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
+        cairo_move_to(cr, MARGIN, MARGIN + TEXT_HEIGHT);
+        cairo_show_text(cr, "Loading...");
+        return TRUE;
+    }
+
+    Layout layout;
+    get_layout(self, &layout);
+    char text[64];
+
+    for (guint row = 0; row < data->racks->len; row++) {
+        snprintf(text, sizeof(text), "Rack %u", g_array_index(data->racks, unsigned int, row));
+        cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
+        cairo_move_to(cr, MARGIN, layout.grid_top + (row + 0.5) * layout.cell_height + FONT_SIZE / 2.0);
+        cairo_show_text(cr, text);
+    }
+
+    for (guint i = 0; i < data->cells->len; i++) {
+        const Cell *cell = &g_array_index(data->cells, Cell, i);
+        const double x = MARGIN + RACK_LABEL_WIDTH + cell->column * layout.cell_width;
+        const double y = layout.grid_top + cell->row * layout.cell_height;
+
+        cell_colour(cr, cell->count, data->max_count);
+        cairo_rectangle(cr, x + 1, y + 1, MAX(layout.cell_width - 2, 1), MAX(layout.cell_height - 2, 1));
+        cairo_fill(cr);
+
+        // only when there is room for it
+        snprintf(text, sizeof(text), "%u: %u", cell->chassis_no, cell->count);
+        cairo_text_extents_t extents;
+        cairo_text_extents(cr, text, &extents);
+        if ((extents.width < layout.cell_width - 4) && (FONT_SIZE < layout.cell_height - 2)) {
+            cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
+            cairo_move_to(cr, x + (layout.cell_width - extents.width) / 2, y + (layout.cell_height + FONT_SIZE) / 2);
+            cairo_show_text(cr, text);
+        }
+    }
+
+    // the trend for the whole machine: a bar per bucket
+    snprintf(text, sizeof(text), "%u errors in the last %s", data->total,
+             (self->priv->span > HEATMAP_SPAN_DAY) ? "week" : ((self->priv->span > HEATMAP_SPAN_HOUR) ? "day" : "hour"));
+    cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
+    cairo_move_to(cr, MARGIN, layout.trend_top - MARGIN);
+    cairo_show_text(cr, text);
+
+    const double bar_width = (layout.width - 2 * MARGIN) / data->buckets;
+    cairo_set_source_rgb(cr, 0.8, 0.2, 0.2);
+    for (guint i = 0; i < data->trend->len; i++) {
+        const ActivityBucket *bucket = &g_array_index(data->trend, ActivityBucket, i);
+        const double slot = (double) ((bucket->start - data->since) / data->bucket);
+        const double bar_height = TREND_HEIGHT * (double) bucket->count / MAX(data->max_trend, 1);
+
+        cairo_rectangle(cr, MARGIN + slot * bar_width, layout.trend_top + TREND_HEIGHT - bar_height, MAX(bar_width - 1, 1),
+                        bar_height);
+    }
+    cairo_fill(cr);
+
+    return TRUE;
+}
+
+// "button-press-event" signal handler
+static gboolean button_pressed(GtkWidget *widget, GdkEventButton *event, __attribute__((unused)) gpointer unused) {
+    EdsacHeatmap *self = EDSAC_HEATMAP(widget);
+    const HeatmapData *data = self->priv->data;
+
+    if ((NULL == data) || (GDK_BUTTON_PRESS != event->type) || (1 != event->button) || (NULL == self->priv->activate)) {
+        return FALSE;
+    }
+
+    Layout layout;
+    get_layout(self, &layout);
+
+    const double x = event->x - MARGIN - RACK_LABEL_WIDTH;
+    const double y = event->y - layout.grid_top;
+    if ((x < 0) || (y < 0) || (layout.cell_width <= 0) || (layout.cell_height <= 0)) {
+        return FALSE;
+    }
+    const guint column = (guint) (x / layout.cell_width);
+    const guint row = (guint) (y / layout.cell_height);
+
+    for (guint i = 0; i < data->cells->len; i++) {
+        const Cell *cell = &g_array_index(data->cells, Cell, i);
+        if ((cell->row == row) && (cell->column == column)) {
+            self->priv->activate(self, cell->rack_no, cell->chassis_no, self->priv->user_data);
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/**** internal GObject stuff ****/
+// DESTROY PRIVATE MEMBER DATA HERE
+static void edsac_heatmap_finalize(GObject *obj) {
+    EdsacHeatmap *self = EDSAC_HEATMAP(obj);
+
+    if (0 != self->priv->timer) {
+        g_source_remove(self->priv->timer);
+    }
+    free_heatmap_data(self->priv->data);
+    g_object_unref(self->priv->cancellable);
+
+    G_OBJECT_CLASS(edsac_heatmap_parent_class)->finalize(obj);
+}
+
+static void edsac_heatmap_class_init(EdsacHeatmapClass *class) {
+    edsac_heatmap_parent_class = g_type_class_peek_parent(class);
+    g_type_class_add_private(class, sizeof(EdsacHeatmapPrivate));
+    G_OBJECT_CLASS(class)->finalize = edsac_heatmap_finalize;
+}
+
+// CONSTRUCT PRIVATE MEMBER DATA HERE
+static void edsac_heatmap_instance_init(EdsacHeatmap *self) {
+    self->priv = EDSAC_HEATMAP_GET_PRIVATE(self);
+
+    self->priv->data = NULL;
+    self->priv->span = HEATMAP_SPAN_HOUR;
+    self->priv->loading = FALSE;
+    self->priv->reload = FALSE;
+    self->priv->cancelled = FALSE;
+    self->priv->timer = 0;
+    self->priv->cancellable = g_cancellable_new();
+    assert(NULL != self->priv->cancellable);
+    self->priv->activate = NULL;
+    self->priv->notify = NULL;
+    self->priv->user_data = NULL;
+
+    gtk_widget_add_events(GTK_WIDGET(self), GDK_BUTTON_PRESS_MASK);
+    gtk_widget_set_size_request(GTK_WIDGET(self), 320, 200);
+    g_signal_connect(self, "draw", G_CALLBACK(draw), NULL);
+    g_signal_connect(self, "button-press-event", G_CALLBACK(button_pressed), NULL);
+}
+
+GType edsac_heatmap_get_type(void) {
+    static volatile gsize edsac_heatmap_type_id_volatile = 0;
+    if (g_once_init_enter(&edsac_heatmap_type_id_volatile)) {
+        static const GTypeInfo g_define_type_info = {
+            sizeof(EdsacHeatmapClass),
+            (GBaseInitFunc) NULL,
+            (GBaseFinalizeFunc) NULL,
+            (GClassInitFunc) edsac_heatmap_class_init,
+            (GClassFinalizeFunc) NULL,
+            NULL,
+            sizeof(EdsacHeatmap),
+            0,
+            (GInstanceInitFunc) edsac_heatmap_instance_init,
+            NULL
+        };
+
+        GType edsac_heatmap_type_id;
+        edsac_heatmap_type_id = g_type_register_static(GTK_TYPE_DRAWING_AREA, "EdsacHeatmap", &g_define_type_info, 0);
+        g_once_init_leave(&edsac_heatmap_type_id_volatile, edsac_heatmap_type_id);
+    }
+
+    return edsac_heatmap_type_id_volatile;
+}
@@ -0,0 +1,290 @@
+/*
+ * Copyright 2017
+ * GPL3 Licensed
+ * counters.c
+ * In memory error counts for each node and valve so that counting the errors matching a Clickable doesn't need to scan the database
+ */
+
+// includes
+#include "config.h"
+#include "counters.h"
+#include <assert.h>
+#include <glib.h>
+
+// errors counted at some level
+typedef struct {
+    unsigned int total;     // all errors
+    unsigned int enabled;   // errors which are enabled (errors.enabled = 1)
+    unsigned int visible;   // enabled errors on enabled nodes. Only kept for racks and everything
+} Count;
+
+// a node and its valves
+typedef struct {
+    unsigned int rack_no;
+    bool enabled;
+    Count count;
+    GHashTable *valves; // valve_no -> Count
+} Node;
+
+static GHashTable *nodes = NULL;  // (rack_no, chassis_no) -> Node
+static GHashTable *racks = NULL;  // rack_no -> Count
+static Count all;
+
+// nodes are keyed by rack_no and chassis_no packed into a gint64
+static gint64 node_key(const unsigned int rack_no, const unsigned int chassis_no) {
+    return (gint64) (((guint64) rack_no << 32) | chassis_no);
+}
+
+static void free_node(gpointer node) {
+    Node *n = (Node *) node;
+    g_hash_table_destroy(n->valves);
+    g_free(n);
+}
+
+static Count *new_count(void) {
+    Count *count = g_new0(Count, 1);
+    assert(NULL != count);
+    return count;
+}
+
+// look up a Count in table by key, adding it if it is not there
+static Count *get_count(GHashTable *table, gpointer key) {
+    Count *count = g_hash_table_lookup(table, key);
+    if (NULL == count) {
+        count = new_count();
+        g_hash_table_insert(table, key, count);
+    }
+
+    return count;
+}
+
+static Node *get_node(const unsigned int rack_no, const unsigned int chassis_no) {
+    if (NULL == nodes) {
+        return NULL;
+    }
+    const gint64 key = node_key(rack_no, chassis_no);
+    return g_hash_table_lookup(nodes, &key);
+}
+
+void counters_init(void) {
+    assert(NULL == nodes);
+
+    nodes = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, free_node);
+    assert(NULL != nodes);
+    racks = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+    assert(NULL != racks);
+
+    all.total = all.enabled = all.visible = 0;
+}
+
+void counters_free(void) {
+    if (NULL == nodes) {
+        return;
+    }
+
+    g_hash_table_destroy(nodes);
+    nodes = NULL;
+    g_hash_table_destroy(racks);
+    racks = NULL;
+}
+
+void counters_reset(void) {
+    counters_free();
+    counters_init();
+}
+
+// matches GHFunc
+static void clear_node(__attribute__((unused)) gpointer key, gpointer node, __attribute__((unused)) gpointer unused) {
+    Node *n = (Node *) node;
+    n->count.total = n->count.enabled = n->count.visible = 0;
+    g_hash_table_remove_all(n->valves);
+}
+
+void counters_clear_errors(void) {
+    assert(NULL != nodes);
+
+    g_hash_table_foreach(nodes, clear_node, NULL);
+    g_hash_table_remove_all(racks);
+    all.total = all.enabled = all.visible = 0;
+}
+
+void counters_add_node(const unsigned int rack_no, const unsigned int chassis_no, const bool enabled) {
+    assert(NULL != nodes);
+
+    Node *node = g_new0(Node, 1);
+    assert(NULL != node);
+    node->rack_no = rack_no;
+    node->enabled = enabled;
+    node->valves = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+    assert(NULL != node->valves);
+
+    gint64 *key = g_new(gint64, 1);
+    assert(NULL != key);
+    *key = node_key(rack_no, chassis_no);
+    g_hash_table_replace(nodes, key, node);
+}
+
+// the nodes contribution to the visible counts of its rack and everything
+static unsigned int node_visible(const Node *node) {
+    return node->enabled ? node->count.enabled : 0;
+}
+
+void counters_remove_node(const unsigned int rack_no, const unsigned int chassis_no) {
+    Node *node = get_node(rack_no, chassis_no);
+    if (NULL == node) {
+        return;
+    }
+
+    // take the node's errors away from its rack and everything
+    Count *rack = get_count(racks, GUINT_TO_POINTER(rack_no));
+    const unsigned int visible = node_visible(node);
+
+    rack->total -= node->count.total;
+    rack->enabled -= node->count.enabled;
+    rack->visible -= visible;
+    all.total -= node->count.total;
+    all.enabled -= node->count.enabled;
+    all.visible -= visible;
+
+    const gint64 key = node_key(rack_no, chassis_no);
+    g_hash_table_remove(nodes, &key);
+}
+
+void counters_toggle_node(const unsigned int rack_no, const unsigned int chassis_no) {
+    Node *node = get_node(rack_no, chassis_no);
+    if (NULL == node) {
+        return;
+    }
+
+    Count *rack = get_count(racks, GUINT_TO_POINTER(rack_no));
+    rack->visible -= node_visible(node);
+    all.visible -= node_visible(node);
+
+    node->enabled = !node->enabled;
+
+    rack->visible += node_visible(node);
+    all.visible += node_visible(node);
+}
+
+void counters_add_errors(const unsigned int rack_no, const unsigned int chassis_no, const int valve_no,
+                         const unsigned int num_errors, const unsigned int num_enabled) {
+    Node *node = get_node(rack_no, chassis_no);
+    if (NULL == node) {
+        return; // the database doesn't store errors for unknown nodes either
+    }
+
+    Count *valve = get_count(node->valves, GINT_TO_POINTER(valve_no));
+    Count *rack = get_count(racks, GUINT_TO_POINTER(rack_no));
+    const unsigned int visible = node->enabled ? num_enabled : 0;
+
+    valve->total += num_errors;
+    valve->enabled += num_enabled;
+    node->count.total += num_errors;
+    node->count.enabled += num_enabled;
+    rack->total += num_errors;
+    rack->enabled += num_enabled;
+    rack->visible += visible;
+    all.total += num_errors;
+    all.enabled += num_enabled;
+    all.visible += visible;
+}
+
+void counters_remove_errors(const unsigned int rack_no, const unsigned int chassis_no, const int valve_no,
+                            const unsigned int num_errors, const unsigned int num_enabled) {
+    Node *node = get_node(rack_no, chassis_no);
+    if (NULL == node) {
+        return;
+    }
+
+    Count *valve = get_count(node->valves, GINT_TO_POINTER(valve_no));
+    Count *rack = get_count(racks, GUINT_TO_POINTER(rack_no));
+    const unsigned int visible = node->enabled ? num_enabled : 0;
+
+    valve->total -= num_errors;
+    valve->enabled -= num_enabled;
+    node->count.total -= num_errors;
+    node->count.enabled -= num_enabled;
+    rack->total -= num_errors;
+    rack->enabled -= num_enabled;
+    rack->visible -= visible;
+    all.total -= num_errors;
+    all.enabled -= num_enabled;
+    all.visible -= visible;
+}
+
+void counters_set_error_enabled(const unsigned int rack_no, const unsigned int chassis_no, const int valve_no, const bool enabled) {
+    counters_set_errors_enabled(rack_no, chassis_no, valve_no, 1, enabled);
+}
+
+void counters_set_errors_enabled(const unsigned int rack_no, const unsigned int chassis_no, const int valve_no,
+                                 const unsigned int num_errors, const bool enabled) {
+    Node *node = get_node(rack_no, chassis_no);
+    if (NULL == node) {
+        return;
+    }
+
+    Count *valve = get_count(node->valves, GINT_TO_POINTER(valve_no));
+    Count *rack = get_count(racks, GUINT_TO_POINTER(rack_no));
+
+    if (enabled) {
+        valve->enabled += num_errors;
+        node->count.enabled += num_errors;
+        rack->enabled += num_errors;
+        all.enabled += num_errors;
+    } else {
+        valve->enabled -= num_errors;
+        node->count.enabled -= num_errors;
+        rack->enabled -= num_errors;
+        all.enabled -= num_errors;
+    }
+
+    if (node->enabled) {
+        if (enabled) {
+            rack->visible += num_errors;
+            all.visible += num_errors;
+        } else {
+            rack->visible -= num_errors;
+            all.visible -= num_errors;
+        }
+    }
+}
+
+unsigned int counters_count(const Clickable *search, const bool include_disabled) {
+    assert(NULL != search);
+    assert(NULL != nodes);
+
+    switch (search->type) {
+        case ALL:
+            return include_disabled ? all.total : all.visible;
+        case RACK: {
+            const Count *rack = g_hash_table_lookup(racks, GUINT_TO_POINTER(search->rack_num));
+            if (NULL == rack) {
+                return 0;
+            }
+            return include_disabled ? rack->total : rack->visible;
+        }
+        case CHASSIS: {
+            const Node *node = get_node(search->rack_num, search->chassis_num);
+            if (NULL == node) {
+                return 0;
+            }
+            return include_disabled ? node->count.total : node_visible(node);
+        }
+        case VALVE: {
+            const Node *node = get_node(search->rack_num, search->chassis_num);
+            if (NULL == node) {
+                return 0;
+            }
+            const Count *valve = g_hash_table_lookup(node->valves, GINT_TO_POINTER(search->valve_num));
+            if (NULL == valve) {
+                return 0;
+            }
+            if (include_disabled) {
+                return valve->total;
+            }
+            return node->enabled ? valve->enabled : 0;
+        }
+        default:
+            return 0;
+    }
+}
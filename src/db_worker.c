@@ -0,0 +1,88 @@
+/*
+ * Copyright 2017
+ * GPL3 Licensed
+ * db_worker.c
+ * Runs database queries on their own thread so that the gtk main loop never waits for sqlite
+ */
+
+// includes
+#include "config.h"
+#include "db_worker.h"
+#include <assert.h>
+#include <stdlib.h>
+
+// a queued job
+typedef struct {
+    DbJobFunc func;
+    gpointer data;
+    GDestroyNotify data_free;
+    GDestroyNotify result_free;
+} DbJob;
+
+// one thread so that jobs run in order and don't queue up on the database lock behind each other
+static GThreadPool *pool = NULL;
+
+static void free_job(gpointer job) {
+    DbJob *j = (DbJob *) job;
+
+    if (NULL != j->data_free) {
+        j->data_free(j->data);
+    }
+    g_free(j);
+}
+
+// matches GFunc. Runs on the database thread
+static void run_job(gpointer task, __attribute__((unused)) gpointer unused) {
+    GTask *t = G_TASK(task);
+
+    // don't bother with jobs nobody is waiting for any more
+    if (!g_task_return_error_if_cancelled(t)) {
+        DbJob *job = g_task_get_task_data(t);
+        gpointer result = job->func(job->data, g_task_get_cancellable(t));
+        g_task_return_pointer(t, result, job->result_free);
+    }
+
+    g_object_unref(t);
+}
+
+void db_worker_start(void) {
+    assert(NULL == pool);
+
+    GError *error = NULL;
+    pool = g_thread_pool_new(run_job, NULL, 1, TRUE, &error);
+    if (NULL == pool) {
+        g_printerr("Could not start the database thread: %s\n", error->message);
+        g_error_free(error);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void db_worker_stop(void) {
+    if (NULL == pool) {
+        return;
+    }
+
+    // wait for the queue to drain
+    g_thread_pool_free(pool, FALSE, TRUE);
+    pool = NULL;
+}
+
+void db_worker_push(gpointer source_object, GCancellable *cancellable, DbJobFunc func, gpointer job_data,
+                    GDestroyNotify job_data_free, GDestroyNotify result_free, GAsyncReadyCallback callback, gpointer user_data) {
+    assert(NULL != pool);
+    assert(NULL != func);
+
+    DbJob *job = g_new(DbJob, 1);
+    assert(NULL != job);
+    job->func = func;
+    job->data = job_data;
+    job->data_free = job_data_free;
+    job->result_free = result_free;
+
+    GTask *task = g_task_new(source_object, cancellable, callback, user_data);
+    assert(NULL != task);
+    g_task_set_task_data(task, job, free_job);
+
+    // the pool owns this reference until run_job is done with it
+    g_thread_pool_push(pool, task, NULL);
+}
@@ -0,0 +1,325 @@
+/*
+ * Copyright 2017
+ * GPL3 Licensed
+ * export.c
+ * Writes the errors matching a filter to a file. Rows are streamed from the database with keyset pages
+ * straight into the file, so nothing grows with the number of rows exported
+ */
+
+// includes
+#include "config.h"
+#include "export.h"
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// declarations
+
+// where an export has got to. Passed to export_row
+typedef struct {
+    FILE *file;
+    ExportFormat format;
+    time_t until;           // 0 for no limit
+    const char *contains;   // lower case. NULL for any description
+    GString *scratch;       // reused for each row's lower case description
+    time_t key_time;        // the last row written, for the next chunk
+    int key_id;
+    guint64 num_rows;
+    bool finished;          // a row at or after until has been reached
+    bool failed;            // a write failed
+} ExportState;
+
+// one export_errors_async
+typedef struct {
+    ErrorFilter filter;
+    char *contains;         // filter.contains points to this
+    char *path;
+    ExportFormat format;
+    GCancellable *cancellable;
+    ExportProgressFunc progress;
+    ExportDoneFunc done;
+    gpointer user_data;
+    volatile gint progress_queued; // a ProgressReport is waiting for the main loop
+    gint64 num_rows;        // the result, for deliver_done
+} Export;
+
+// rows written by an Export, for deliver_progress
+typedef struct {
+    Export *export;
+    guint64 num_rows;
+} ProgressReport;
+
+// functions
+ExportFormat export_format_for_path(const char *path) {
+    assert(NULL != path);
+
+    if (g_str_has_suffix(path, ".json") || g_str_has_suffix(path, ".jsonl")) {
+        return EXPORT_JSON_LINES;
+    }
+    return EXPORT_CSV;
+}
+
+// recv_time as ISO 8601 local time
+static void format_export_time(const time_t recv_time, char time_str[32]) {
+    struct tm tm;
+    if ((NULL == localtime_r(&recv_time, &tm)) || (0 == strftime(time_str, 32, "%Y-%m-%dT%H:%M:%S%z", &tm))) {
+        strcpy(time_str, "");
+    }
+}
+
+// a CSV field in quotes with any quotes in it doubled. returns false if the write failed
+static bool write_csv_string(FILE *file, const char *text) {
+    if (EOF == fputc('"', file)) {
+        return false;
+    }
+    for (const char *c = text; '\0' != *c; c++) {
+        if (('"' == *c) && (EOF == fputc('"', file))) {
+            return false;
+        }
+        if (EOF == fputc(*c, file)) {
+            return false;
+        }
+    }
+    return EOF != fputc('"', file);
+}
+
+// a JSON string. The description is already UTF-8 so only quotes, backslashes and control characters need escaping.
+// returns false if the write failed
+static bool write_json_string(FILE *file, const char *text) {
+    if (EOF == fputc('"', file)) {
+        return false;
+    }
+    for (const char *c = text; '\0' != *c; c++) {
+        int ret;
+        if (('"' == *c) || ('\\' == *c)) {
+            ret = fprintf(file, "\\%c", *c);
+        } else if ((unsigned char) *c < 0x20) {
+            ret = fprintf(file, "\\u%04x", (unsigned int) (unsigned char) *c);
+        } else {
+            ret = fputc(*c, file);
+        }
+        if (ret < 0) {
+            return false;
+        }
+    }
+    return EOF != fputc('"', file);
+}
+
+static bool write_csv_row(FILE *file, const SearchRow *row, const char *time_str) {
+    char valve[16] = ""; // blank for no valve
+    if (row->valve_no >= 0) {
+        snprintf(valve, sizeof(valve), "%i", row->valve_no);
+    }
+
+    if (fprintf(file, "%i,%s,%li,%li,%u,%u,%s,%i,%i,", row->id, time_str, (long) row->recv_time, (long) row->last_seen,
+                row->rack_no, row->chassis_no, valve, row->enabled ? 1 : 0, row->occurrences) < 0) {
+        return false;
+    }
+    return write_csv_string(file, row->description) && (EOF != fputc('\n', file));
+}
+
+static bool write_json_row(FILE *file, const SearchRow *row, const char *time_str) {
+    char valve[16] = "null";
+    if (row->valve_no >= 0) {
+        snprintf(valve, sizeof(valve), "%i", row->valve_no);
+    }
+
+    if (fprintf(file, "{\"id\": %i, \"time\": \"%s\", \"recv_time\": %li, \"last_seen\": %li, \"rack\": %u, \"chassis\": %u, "
+                "\"valve\": %s, \"enabled\": %s, \"occurrences\": %i, \"description\": ", row->id, time_str,
+                (long) row->recv_time, (long) row->last_seen, row->rack_no, row->chassis_no, valve,
+                row->enabled ? "true" : "false", row->occurrences) < 0) {
+        return false;
+    }
+    return write_json_string(file, row->description) && (EOF != fputs("}\n", file));
+}
+
+// SearchRowFunc writing row to the ExportState's file
+static bool export_row(const SearchRow *row, gpointer data) {
+    ExportState *state = (ExportState *) data;
+
+    // rows come oldest first so nothing after this one is wanted either
+    if ((0 != state->until) && (row->recv_time >= state->until)) {
+        state->finished = true;
+        return false;
+    }
+    state->key_time = row->recv_time;
+    state->key_id = row->id;
+
+    // the same test as set_errors_enabled's LIKE, which ignores the case of ASCII letters
+    if (NULL != state->contains) {
+        g_string_assign(state->scratch, row->description);
+        for (gsize i = 0; i < state->scratch->len; i++) {
+            state->scratch->str[i] = g_ascii_tolower(state->scratch->str[i]);
+        }
+        if (NULL == strstr(state->scratch->str, state->contains)) {
+            return true;
+        }
+    }
+
+    char time_str[32];
+    format_export_time(row->recv_time, time_str);
+
+    const bool ok = (EXPORT_CSV == state->format) ? write_csv_row(state->file, row, time_str) :
+                                                    write_json_row(state->file, row, time_str);
+    if (!ok) {
+        perror("Could not write the export");
+        state->failed = true;
+        return false;
+    }
+
+    state->num_rows++;
+    return true;
+}
+
+gint64 export_errors(const ErrorFilter *filter, const char *path, const ExportFormat format, GCancellable *cancellable,
+                     ExportProgressFunc progress, gpointer user_data) {
+    assert(NULL != filter);
+    assert(NULL != path);
+
+    FILE *file = fopen(path, "w");
+    if (NULL == file) {
+        perror("fopen export");
+        return -1;
+    }
+
+    ExportState state;
+    memset(&state, 0, sizeof(state));
+    state.file = file;
+    state.format = format;
+    state.until = filter->until;
+    state.scratch = g_string_new(NULL);
+    assert(NULL != state.scratch);
+    char *contains = NULL;
+    if ((NULL != filter->contains) && ('\0' != filter->contains[0])) {
+        contains = g_ascii_strdown(filter->contains, -1);
+        assert(NULL != contains);
+        state.contains = contains;
+    }
+
+    // the first chunk starts just before from
+    state.key_time = filter->from - 1;
+    state.key_id = INT_MAX;
+
+    bool ok = true;
+    if ((EXPORT_CSV == format) &&
+        (EOF == fputs("id,time,recv_time,last_seen,rack,chassis,valve,enabled,occurrences,description\n", file))) {
+        perror("Could not write the export");
+        ok = false;
+    }
+
+    while (ok && !state.finished) {
+        if (g_cancellable_is_cancelled(cancellable)) {
+            ok = false;
+            break;
+        }
+
+        const int num_rows = search_clickable_foreach(&filter->search, state.key_time, state.key_id, true, EXPORT_CHUNK_SIZE,
+                                                      export_row, &state);
+        if ((num_rows < 0) || state.failed) {
+            ok = false;
+            break;
+        }
+        if (num_rows < EXPORT_CHUNK_SIZE) {
+            state.finished = true;
+        }
+
+        if (NULL != progress) {
+            progress(state.num_rows, user_data);
+        }
+    }
+
+    if (0 != fclose(file)) {
+        perror("fclose export");
+        ok = false;
+    }
+    g_string_free(state.scratch, TRUE);
+    g_free(contains);
+
+    // half an export would look like a complete one
+    if (!ok) {
+        remove(path);
+        return -1;
+    }
+    return (gint64) state.num_rows;
+}
+
+// GSourceFunc passing a ProgressReport to the caller of export_errors_async
+static gboolean deliver_progress(gpointer data) {
+    ProgressReport *report = (ProgressReport *) data;
+    Export *export = report->export;
+
+    g_atomic_int_set(&export->progress_queued, 0);
+    export->progress(report->num_rows, export->user_data);
+
+    g_free(report);
+    return G_SOURCE_REMOVE;
+}
+
+// ExportProgressFunc for export_thread. Only one report waits for the main loop at a time
+static void queue_progress(const guint64 num_rows, gpointer data) {
+    Export *export = (Export *) data;
+
+    if ((NULL == export->progress) || !g_atomic_int_compare_and_exchange(&export->progress_queued, 0, 1)) {
+        return;
+    }
+
+    ProgressReport *report = g_new(ProgressReport, 1);
+    assert(NULL != report);
+    report->export = export;
+    report->num_rows = num_rows;
+
+    // idle sources run in the order they were added so this arrives before deliver_done
+    g_idle_add(deliver_progress, report);
+}
+
+// GSourceFunc for the end of export_errors_async
+static gboolean deliver_done(gpointer data) {
+    Export *export = (Export *) data;
+
+    if (NULL != export->done) {
+        export->done(export->num_rows, export->user_data);
+    }
+
+    if (NULL != export->cancellable) {
+        g_object_unref(export->cancellable);
+    }
+    g_free(export->contains);
+    g_free(export->path);
+    g_free(export);
+    return G_SOURCE_REMOVE;
+}
+
+// GThreadFunc running one call to export_errors_async
+static gpointer export_thread(gpointer data) {
+    Export *export = (Export *) data;
+
+    export->num_rows = export_errors(&export->filter, export->path, export->format, export->cancellable, queue_progress, export);
+
+    g_idle_add(deliver_done, export);
+    return NULL;
+}
+
+void export_errors_async(const ErrorFilter *filter, const char *path, const ExportFormat format, GCancellable *cancellable,
+                         ExportProgressFunc progress, ExportDoneFunc done, gpointer user_data) {
+    assert(NULL != filter);
+    assert(NULL != path);
+
+    Export *export = g_new0(Export, 1);
+    assert(NULL != export);
+    memcpy(&export->filter, filter, sizeof(export->filter));
+    export->contains = g_strdup(filter->contains);
+    export->filter.contains = export->contains;
+    export->path = g_strdup(path);
+    assert(NULL != export->path);
+    export->format = format;
+    export->cancellable = (NULL == cancellable) ? NULL : g_object_ref(cancellable);
+    export->progress = progress;
+    export->done = done;
+    export->user_data = user_data;
+
+    // nothing waits for this: it finishes by calling done
+    GThread *thread = g_thread_new("export", export_thread, export);
+    g_thread_unref(thread);
+}
@@ -0,0 +1,229 @@
+/*
+ * Copyright 2017
+ * GPL3 Licensed
+ * ingest.c
+ * Moves errors from the server's buffer into the database in batches.
+ * One thread reads the server's buffer into a bounded queue and another writes the queue to the database
+ */
+
+// includes
+#include "config.h"
+#include "ingest.h"
+#include <assert.h>
+#include <stdio.h>
+#include <edsac_server.h>
+#include "sql.h"
+#include "ui.h"
+#include "liveness.h"
+#include "metrics.h"
+
+// declarations
+
+// everything below is protected by lock
+static GMutex lock;
+static GCond not_empty;         // signalled when the writer has something to do
+static GCond not_full;          // signalled when the reader may carry on
+static GQueue queue = G_QUEUE_INIT; // BufferItems waiting for the writer
+static bool stopping = false;
+static IngestStats stats;
+
+static guint max_batch = DEFAULT_INGEST_BATCH_SIZE;
+static guint max_latency = DEFAULT_INGEST_LATENCY;
+static guint max_queued = DEFAULT_INGEST_QUEUE_SIZE;
+
+static GThread *reader = NULL;
+static GThread *writer = NULL;
+
+static gpointer read_thread(gpointer unused);
+static gpointer write_thread(gpointer unused);
+static void write_batch(GPtrArray *items);
+
+// functions
+bool start_ingest(const guint batch_size, const guint latency, const guint queue_size) {
+    assert(NULL == reader);
+    assert(batch_size > 0);
+    assert(queue_size > 0);
+
+    max_batch = batch_size;
+    max_latency = latency;
+    max_queued = queue_size;
+    stopping = false;
+
+    GError *error = NULL;
+    writer = g_thread_try_new("ingest-write", write_thread, NULL, &error);
+    if (NULL == writer) {
+        fprintf(stderr, "Could not start the ingest thread: %s\n", error->message);
+        g_error_free(error);
+        return false;
+    }
+
+    reader = g_thread_try_new("ingest-read", read_thread, NULL, &error);
+    if (NULL == reader) {
+        fprintf(stderr, "Could not start the ingest thread: %s\n", error->message);
+        g_error_free(error);
+        stop_ingest();
+        return false;
+    }
+
+    return true;
+}
+
+void stop_ingest(void) {
+    g_mutex_lock(&lock);
+    stopping = true;
+    g_cond_broadcast(&not_full);
+    g_cond_broadcast(&not_empty);
+    g_mutex_unlock(&lock);
+
+    if (NULL != reader) {
+        g_thread_join(reader);
+        reader = NULL;
+    }
+
+    // the writer empties the queue before it finishes
+    if (NULL != writer) {
+        g_thread_join(writer);
+        writer = NULL;
+    }
+}
+
+void get_ingest_stats(IngestStats *out) {
+    assert(NULL != out);
+
+    g_mutex_lock(&lock);
+    *out = stats;
+    g_mutex_unlock(&lock);
+}
+
+// moves messages from the server's buffer to the queue
+static gpointer read_thread(__attribute__((unused)) gpointer unused) {
+    // libedsacnetworking can't tell us when a message arrives so look often enough that polling doesn't add much latency
+    const gint64 idle_wait = (max_latency >= 4) ? (max_latency / 4) * G_TIME_SPAN_MILLISECOND : G_TIME_SPAN_MILLISECOND;
+
+    g_mutex_lock(&lock);
+    while (!stopping) {
+        // leave messages in the server's buffer until the writer catches up
+        if (g_queue_get_length(&queue) >= max_queued) {
+            stats.full_waits++;
+            while ((g_queue_get_length(&queue) >= max_queued) && !stopping) {
+                g_cond_wait(&not_full, &lock);
+            }
+            continue;
+        }
+
+        g_mutex_unlock(&lock);
+        BufferItem *item = read_message();
+        g_mutex_lock(&lock);
+
+        if (NULL == item) {
+            // nothing to read. not_full is only used to wake up early when stopping
+            g_cond_wait_until(&not_full, &lock, g_get_monotonic_time() + idle_wait);
+            continue;
+        }
+
+        g_queue_push_tail(&queue, item);
+        stats.received++;
+
+        const guint depth = g_queue_get_length(&queue);
+        if (depth > stats.max_depth) {
+            stats.max_depth = depth;
+        }
+
+        // the writer only needs waking for the first message of a batch and when a batch is full
+        if ((1 == depth) || (depth >= max_batch)) {
+            g_cond_signal(&not_empty);
+        }
+    }
+    g_mutex_unlock(&lock);
+
+    return NULL;
+}
+
+// moves batches of messages from the queue to the database
+static gpointer write_thread(__attribute__((unused)) gpointer unused) {
+    GPtrArray *items = g_ptr_array_sized_new(max_batch);
+    assert(NULL != items);
+    g_ptr_array_set_free_func(items, (GDestroyNotify) free_bufferitem);
+
+    g_mutex_lock(&lock);
+    while (true) {
+        while (g_queue_is_empty(&queue) && !stopping) {
+            g_cond_wait(&not_empty, &lock);
+        }
+
+        if (g_queue_is_empty(&queue)) {
+            break; // stopping and everything has been written
+        }
+
+        // give the batch until the deadline to fill up
+        const gint64 deadline = g_get_monotonic_time() + max_latency * G_TIME_SPAN_MILLISECOND;
+        while ((g_queue_get_length(&queue) < max_batch) && !stopping) {
+            if (!g_cond_wait_until(&not_empty, &lock, deadline)) {
+                break; // deadline passed
+            }
+        }
+
+        while ((items->len < max_batch) && !g_queue_is_empty(&queue)) {
+            g_ptr_array_add(items, g_queue_pop_head(&queue));
+        }
+        g_cond_signal(&not_full);
+        metrics_record(METRIC_INGEST_BATCH, items->len);
+        metrics_record(METRIC_INGEST_BACKLOG, g_queue_get_length(&queue));
+
+        g_mutex_unlock(&lock);
+        write_batch(items);
+        g_ptr_array_set_size(items, 0);
+        g_mutex_lock(&lock);
+    }
+    g_mutex_unlock(&lock);
+
+    g_ptr_array_free(items, TRUE);
+    return NULL;
+}
+
+// add items to the database in one go and tell the gui
+static void write_batch(GPtrArray *items) {
+    const gint64 timer = metrics_start();
+    AddErrorResult *results = g_new(AddErrorResult, items->len);
+    assert(NULL != results);
+
+    liveness_seen((BufferItem **) items->pdata, items->len);
+
+    const size_t num_added = add_errors_batch((BufferItem **) items->pdata, items->len, results);
+
+    // errors from unknown nodes are expected so only report the others
+    guint64 num_unknown = 0;
+    guint64 num_failed = 0;
+    for (guint i = 0; i < items->len; i++) {
+        if (ADD_ERROR_UNKNOWN_NODE == results[i]) {
+            num_unknown++;
+        } else if (ADD_ERROR_FAILED == results[i]) {
+            num_failed++;
+            const BufferItem *failed = g_ptr_array_index(items, i);
+            fprintf(stderr, "Failed to add error (type %i) received at %li to the database\n", failed->msg.type, failed->recv_time);
+        }
+    }
+
+    // tell the gui where the new errors are so that it only refreshes the tabs showing them
+    ErrorKey *keys = g_new(ErrorKey, num_added);
+    assert((NULL != keys) || (0 == num_added));
+    guint num_keys = 0;
+    for (guint i = 0; i < items->len; i++) {
+        if (ADD_ERROR_ADDED == results[i]) {
+            get_error_key(g_ptr_array_index(items, i), &keys[num_keys]);
+            num_keys++;
+        }
+    }
+    gui_errors_added(keys, num_keys);
+    g_free(keys);
+    g_free(results);
+
+    g_mutex_lock(&lock);
+    stats.batches++;
+    stats.added += num_added;
+    stats.failed += num_failed;
+    stats.unknown_node += num_unknown;
+    g_mutex_unlock(&lock);
+
+    metrics_finish(METRIC_INGEST_WRITE, timer);
+}
@@ -0,0 +1,273 @@
+/*
+ * Copyright 2017
+ * GPL3 Licensed
+ * liveness.c
+ * Keeps track of which nodes are connected.
+ * Each node's state only changes when the server's connections or the messages arriving say so,
+ * so errors are only added when a node goes away or comes back
+ */
+
+// includes
+#include "config.h"
+#include "liveness.h"
+#include <assert.h>
+#include <stdio.h>
+#include <netinet/in.h>
+#include "sql.h"
+#include "ui.h"
+
+// declarations
+
+// nodes are keyed by rack and chassis packed into a pointer. Both come from one byte of an IP address
+#define NODE_KEY(rack_no, chassis_no) GUINT_TO_POINTER((((guint) (rack_no)) << 16) | ((guint) (chassis_no) & 0xFFFF))
+#define KEY_RACK(key) (GPOINTER_TO_UINT(key) >> 16)
+#define KEY_CHASSIS(key) (GPOINTER_TO_UINT(key) & 0xFFFF)
+
+typedef enum {
+    UNCHECKED,      // not looked for yet
+    CONNECTED,
+    DISCONNECTED,
+} NodeState;
+
+typedef struct {
+    NodeState state;
+    time_t last_seen;
+} NodeLiveness;
+
+// a node whose state changed
+typedef struct {
+    unsigned int rack_no;
+    unsigned int chassis_no;
+    bool connected;
+} LivenessEvent;
+
+// everything below is protected by lock
+static GMutex lock;
+static GCond wake;              // signalled when stopping or asked to check now
+static bool stopping = false;
+static bool check_requested = false;
+static GHashTable *nodes = NULL; // NODE_KEY -> NodeLiveness. NULL when not running
+static guint check_interval = DEFAULT_LIVENESS_INTERVAL;
+
+static GThread *thread = NULL;
+
+static gpointer liveness_thread(gpointer unused);
+static void check_connections(void);
+static void set_state(gpointer key, NodeLiveness *node, const bool connected, const time_t now, GArray *events);
+static void raise_events(GArray *events);
+
+// functions
+bool start_liveness(const guint interval) {
+    assert(NULL == thread);
+    assert(interval > 0);
+
+    GHashTable *tracked = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+    assert(NULL != tracked);
+
+    GList *db_nodes = list_nodes_ordered();
+    for (GList *item = db_nodes; NULL != item; item = item->next) {
+        const NodeIdentifier *node = item->data;
+        g_hash_table_replace(tracked, NODE_KEY(node->rack_no, node->chassis_no), g_new0(NodeLiveness, 1));
+    }
+    g_list_free_full(db_nodes, g_free);
+
+    g_mutex_lock(&lock);
+    nodes = tracked;
+    check_interval = interval;
+    stopping = false;
+    check_requested = false;
+    g_mutex_unlock(&lock);
+
+    GError *error = NULL;
+    thread = g_thread_try_new("liveness", liveness_thread, NULL, &error);
+    if (NULL == thread) {
+        fprintf(stderr, "Could not start the liveness thread: %s\n", error->message);
+        g_error_free(error);
+        stop_liveness();
+        return false;
+    }
+
+    return true;
+}
+
+void stop_liveness(void) {
+    g_mutex_lock(&lock);
+    stopping = true;
+    g_cond_broadcast(&wake);
+    g_mutex_unlock(&lock);
+
+    if (NULL != thread) {
+        g_thread_join(thread);
+        thread = NULL;
+    }
+
+    g_mutex_lock(&lock);
+    if (NULL != nodes) {
+        g_hash_table_destroy(nodes);
+        nodes = NULL;
+    }
+    g_mutex_unlock(&lock);
+}
+
+void liveness_check_now(void) {
+    g_mutex_lock(&lock);
+    check_requested = true;
+    g_cond_signal(&wake);
+    g_mutex_unlock(&lock);
+}
+
+// record a change of state. Assumes the caller holds lock
+static void set_state(gpointer key, NodeLiveness *node, const bool connected, const time_t now, GArray *events) {
+    if (connected && (now > node->last_seen)) {
+        node->last_seen = now;
+    }
+
+    const NodeState state = connected ? CONNECTED : DISCONNECTED;
+    if (state == node->state) {
+        return;
+    }
+
+    // a node which was fine the first time it was looked at hasn't recovered from anything
+    const bool report = (UNCHECKED != node->state) || !connected;
+    node->state = state;
+
+    if (report) {
+        const LivenessEvent event = {.rack_no = KEY_RACK(key), .chassis_no = KEY_CHASSIS(key), .connected = connected};
+        g_array_append_val(events, event);
+    }
+}
+
+// add an error for each change and tell the gui
+static void raise_events(GArray *events) {
+    if (0 == events->len) {
+        return;
+    }
+
+    const time_t now = time(NULL);
+    ErrorKey *keys = g_new(ErrorKey, events->len);
+    assert(NULL != keys);
+    guint num_keys = 0;
+
+    for (guint i = 0; i < events->len; i++) {
+        const LivenessEvent *event = &g_array_index(events, LivenessEvent, i);
+        const char *msg = event->connected ? "Node recovered" : "Node not connected";
+        if (add_error_decoded(event->rack_no, event->chassis_no, -1, now, msg)) {
+            keys[num_keys].rack_no = event->rack_no;
+            keys[num_keys].chassis_no = event->chassis_no;
+            keys[num_keys].valve_no = -1;
+            num_keys++;
+        }
+    }
+
+    gui_errors_added(keys, num_keys);
+    g_free(keys);
+}
+
+void liveness_seen(BufferItem *const *items, const size_t num_items) {
+    assert((NULL != items) || (0 == num_items));
+
+    GArray *events = g_array_new(FALSE, FALSE, sizeof(LivenessEvent));
+    assert(NULL != events);
+
+    g_mutex_lock(&lock);
+    if (NULL != nodes) {
+        for (size_t i = 0; i < num_items; i++) {
+            NodeIdentifier id;
+            get_node_identifier(&items[i]->address, &id);
+
+            gpointer key = NODE_KEY(id.rack_no, id.chassis_no);
+            NodeLiveness *node = g_hash_table_lookup(nodes, key);
+            if (NULL != node) {
+                set_state(key, node, true, items[i]->recv_time, events);
+            }
+        }
+    }
+    g_mutex_unlock(&lock);
+
+    raise_events(events);
+    g_array_free(events, TRUE);
+}
+
+void liveness_add_node(const unsigned int rack_no, const unsigned int chassis_no) {
+    g_mutex_lock(&lock);
+    if ((NULL != nodes) && !g_hash_table_contains(nodes, NODE_KEY(rack_no, chassis_no))) {
+        g_hash_table_replace(nodes, NODE_KEY(rack_no, chassis_no), g_new0(NodeLiveness, 1));
+    }
+    g_mutex_unlock(&lock);
+}
+
+void liveness_remove_node(const unsigned int rack_no, const unsigned int chassis_no) {
+    g_mutex_lock(&lock);
+    if (NULL != nodes) {
+        g_hash_table_remove(nodes, NODE_KEY(rack_no, chassis_no));
+    }
+    g_mutex_unlock(&lock);
+}
+
+time_t liveness_last_seen(const unsigned int rack_no, const unsigned int chassis_no) {
+    time_t ret = 0;
+
+    g_mutex_lock(&lock);
+    if (NULL != nodes) {
+        const NodeLiveness *node = g_hash_table_lookup(nodes, NODE_KEY(rack_no, chassis_no));
+        if (NULL != node) {
+            ret = node->last_seen;
+        }
+    }
+    g_mutex_unlock(&lock);
+
+    return ret;
+}
+
+// compare the server's connections with the tracked nodes
+static void check_connections(void) {
+    // connected nodes as a set of NODE_KEYs
+    GHashTable *connected = g_hash_table_new(g_direct_hash, g_direct_equal);
+    assert(NULL != connected);
+
+    GSList *addresses = get_connected_list();
+    for (GSList *item = addresses; NULL != item; item = item->next) {
+        const struct sockaddr_in *address = item->data;
+        NodeIdentifier id;
+        get_node_identifier(&address->sin_addr, &id);
+        g_hash_table_add(connected, NODE_KEY(id.rack_no, id.chassis_no));
+    }
+    g_slist_free_full(addresses, g_free);
+
+    GArray *events = g_array_new(FALSE, FALSE, sizeof(LivenessEvent));
+    assert(NULL != events);
+    const time_t now = time(NULL);
+
+    g_mutex_lock(&lock);
+    GHashTableIter iter;
+    gpointer key = NULL;
+    gpointer node = NULL;
+    g_hash_table_iter_init(&iter, nodes);
+    while (g_hash_table_iter_next(&iter, &key, &node)) {
+        set_state(key, node, g_hash_table_contains(connected, key), now, events);
+    }
+    g_mutex_unlock(&lock);
+
+    g_hash_table_destroy(connected);
+
+    raise_events(events);
+    g_array_free(events, TRUE);
+}
+
+static gpointer liveness_thread(__attribute__((unused)) gpointer unused) {
+    g_mutex_lock(&lock);
+    while (!stopping) {
+        check_requested = false;
+        g_mutex_unlock(&lock);
+        check_connections();
+        g_mutex_lock(&lock);
+
+        const gint64 next_check = g_get_monotonic_time() + (gint64) check_interval * G_TIME_SPAN_SECOND;
+        while (!stopping && !check_requested && g_cond_wait_until(&wake, &lock, next_check)) {
+            // woken early: go back to sleep unless there is something to do
+        }
+    }
+    g_mutex_unlock(&lock);
+
+    return NULL;
+}
@@ -8,62 +8,180 @@
 // includes
 #include "config.h"
 #include <glib.h>
+#include <glib-unix.h>
 #include <stdlib.h>
-#include <edsac_timer.h>
 #include <edsac_arguments.h>
 #include <edsac_server.h>
 #include "sql.h"
 #include <assert.h>
 #include "ui.h"
+#include "ingest.h"
+#include "retention.h"
+#include "liveness.h"
+#include "metrics.h"
+#include "node_setup.h"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <stdio.h>
+#include <signal.h>
+#include <stdint.h>
+#include <netinet/in.h>
 
 
 #define DEFAULT_PREFIX_PATH "./edsac"
 char *g_prefix_path = NULL;
 
+// a --racks collector's database is path/SHARD_PREFIX"FIRST-LAST.db"
+#define SHARD_PREFIX "mothership-racks-"
+
 // functions
 
-// called periodically in its own thread to update the database and gui with new messages
-static void periodic_update(__attribute__((unused)) void *unused) {
-    BufferItem *item = NULL;
-    bool need_update = false;
+static gboolean version_option_callback(__attribute__((unused)) gchar *option_name, __attribute__((unused)) gchar *value,
+                                 __attribute__((unused)) gpointer data, __attribute__((unused)) GError **error) {
+    puts(PACKAGE_STRING);
+    exit(EXIT_SUCCESS);
+}
 
-    while (true) {
-        // read messages from the server's buffer
-        item = read_message();
-        if (NULL == item) {
-            break;
+// gtk's options open the display as soon as they are parsed so they have to be left out before parsing when headless
+static bool headless_requested(const int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp("--headless", argv[i])) {
+            return true;
         }
+    }
 
-        // we have an update to do!
-        need_update = true;
-        // add the error to the database
-        assert(true == add_error(item));
-        free_bufferitem(item);
-        item = NULL;
+    return false;
+}
+
+// parse --racks FIRST-LAST. Racks are the third byte of the nodes' addresses
+static bool parse_rack_range(const char *arg, unsigned int *first, unsigned int *last) {
+    char end = '\0';
+    if ((2 != sscanf(arg, "%u-%u%c", first, last, &end)) || (*first > *last) || (*last > 255)) {
+        fprintf(stderr, "--racks must be FIRST-LAST with FIRST no more than LAST and both from 0 to 255\n");
+        return false;
     }
 
-    if (need_update) {
-        #pragma GCC diagnostic push
-        #pragma GCC diagnostic ignored "-Wpedantic"
-        g_idle_add((GSourceFunc) gui_update, (gpointer) gui_update); // uses the data parameter to remove itself from g_idle once it has run once
-        #pragma GCC diagnostic pop
+    return true;
+}
+
+// a --racks collector listens on -p's port plus one plus FIRST so that collectors sharing the machine never share a port.
+// A collector without --racks keeps -p's port
+static bool rack_range_port(const guint16 base_port, const unsigned int first, guint16 *port) {
+    if ((unsigned int) base_port + 1 + first > UINT16_MAX) {
+        fprintf(stderr, "--racks %u-... would listen on port %u: -p leaves no room for it\n", first, (unsigned int) base_port + 1 + first);
+        return false;
     }
+
+    *port = (guint16) (base_port + 1 + first);
+    return true;
 }
 
-static gboolean version_option_callback(__attribute__((unused)) gchar *option_name, __attribute__((unused)) gchar *value,
-                                 __attribute__((unused)) gpointer data, __attribute__((unused)) GError **error) {
-    puts(PACKAGE_STRING);
-    exit(EXIT_SUCCESS);
+// matches GCompareFunc for a GPtrArray of strings
+static gint compare_paths(gconstpointer a, gconstpointer b) {
+    return strcmp(*((const char *const *) a), *((const char *const *) b));
+}
+
+// the databases of every --racks collector under the prefix directory, in name order. Free with g_ptr_array_unref
+static GPtrArray *find_shard_databases(void) {
+    GPtrArray *paths = g_ptr_array_new_with_free_func(g_free);
+    assert(NULL != paths);
+
+    GDir *dir = g_dir_open(g_prefix_path, 0, NULL);
+    if (NULL != dir) {
+        const char *name = NULL;
+        while (NULL != (name = g_dir_read_name(dir))) {
+            if (g_str_has_prefix(name, SHARD_PREFIX) && g_str_has_suffix(name, ".db")) {
+                g_ptr_array_add(paths, g_build_filename(g_prefix_path, name, NULL));
+            }
+        }
+        g_dir_close(dir);
+    }
+
+    g_ptr_array_sort(paths, compare_paths);
+    return paths;
+}
+
+// provision each rack's nodes with the port of the collector whose database in shards (see find_shard_databases) has the rack.
+// returns false (having printed why) if a database isn't named after a rack range or two of them have the same rack
+static bool set_collector_ports(const GPtrArray *shards, const guint16 base_port) {
+    const char *owners[MAX_NODE_NUMBER + 1] = {NULL};
+
+    for (guint i = 0; i < shards->len; i++) {
+        const char *path = g_ptr_array_index(shards, i);
+        gchar *name = g_path_get_basename(path);
+        assert(NULL != name);
+        name[strlen(name) - strlen(".db")] = '\0';
+
+        unsigned int first = 0;
+        unsigned int last = 0;
+        guint16 port = 0;
+        bool ok = parse_rack_range(name + strlen(SHARD_PREFIX), &first, &last) && rack_range_port(base_port, first, &port);
+        g_free(name);
+        if (!ok) {
+            fprintf(stderr, "Can't tell which racks %s is for\n", path);
+            return false;
+        }
+
+        for (unsigned int rack = first; rack <= last; rack++) {
+            if (NULL != owners[rack]) {
+                fprintf(stderr, "%s and %s both have rack %u: each rack needs exactly one collector\n", owners[rack], path, rack);
+                return false;
+            }
+            owners[rack] = path;
+        }
+        set_collector_port(first, last, port);
+    }
+
+    return true;
+}
+
+// GSourceFunc for SIGINT and SIGTERM when headless
+static gboolean quit_main_loop(gpointer loop) {
+    g_main_loop_quit((GMainLoop *) loop);
+    return G_SOURCE_REMOVE;
+}
+
+// collect errors until told to stop. Retention and liveness still need a main loop for their idle callbacks
+static void run_headless(void) {
+    puts("Running headless: stop with SIGINT or SIGTERM");
+
+    GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+    assert(NULL != loop);
+    g_unix_signal_add(SIGINT, quit_main_loop, loop);
+    g_unix_signal_add(SIGTERM, quit_main_loop, loop);
+
+    g_main_loop_run(loop);
+    g_main_loop_unref(loop);
+}
+
+// stop new messages arriving then write out those already read
+static void stop_collector(void) {
+    stop_liveness();
+    stop_server();
+    stop_ingest();
+    stop_retention();
 }
 
 int main(int argc, char** argv) {
-    const time_t update_time = 2; // seconds
-    timer_t timer_id = NULL;
+    gint batch_size = DEFAULT_INGEST_BATCH_SIZE;
+    gint latency = DEFAULT_INGEST_LATENCY;
+    gint queue_size = DEFAULT_INGEST_QUEUE_SIZE;
+    gint frame_budget = DEFAULT_FRAME_BUDGET;
+    gint dedup_window = 0;
+    gint retention_days = 0;
+    gint retention_rows = 0;
+    gint retention_interval = DEFAULT_RETENTION_INTERVAL;
+    gboolean archive_monthly = FALSE;
+    gint liveness_interval = DEFAULT_LIVENESS_INTERVAL;
+    gboolean headless = FALSE;
+    gboolean attach = FALSE;
+    gboolean metrics = FALSE;
+    gchar *metrics_dump_path = NULL;
+    gint metrics_interval = DEFAULT_METRICS_INTERVAL;
+    gchar *racks = NULL;
 
     // option arguments new for this
     #pragma GCC diagnostic push
@@ -71,12 +189,87 @@ int main(int argc, char** argv) {
     GOptionEntry entries[] = {
         {"version", 'v', G_OPTION_FLAG_NO_ARG, G_OPTION_ARG_CALLBACK, version_option_callback, NULL, NULL},
         {"path", 'd', G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME, &g_prefix_path, "Path to the prefix directory underwhich the database is stored and other files are expected", "PATH"},
+        {"batch-size", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &batch_size, "Most errors written to the database in one transaction (default 256)", "N"},
+        {"latency", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &latency, "Longest an error waits before it is written to the database (default 100)", "MS"},
+        {"queue-size", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &queue_size, "Most errors held waiting for the database before they are left in the server's buffer (default 4096)", "N"},
+        {"frame-budget", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &frame_budget, "Shortest time between refreshes of the error lists for new errors (default 100)", "MS"},
+        {"dedup-window", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &dedup_window, "Merge identical errors from the same node and valve received within this long of the first (default 0: off)", "SECONDS"},
+        {"retention-days", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &retention_days, "Archive errors older than this (default 0: keep them)", "DAYS"},
+        {"retention-rows", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &retention_rows, "Archive the oldest errors when there are more than this (default 0: no limit)", "N"},
+        {"retention-interval", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &retention_interval, "How often old errors are archived (default 60)", "MINUTES"},
+        {"archive-monthly", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &archive_monthly, "Archive each month's errors to its own file", NULL},
+        {"liveness-interval", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &liveness_interval, "How often the server's connections are checked for nodes going away (default 10)", "SECONDS"},
+        {"headless", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &headless, "Collect errors into the database without a gui", NULL},
+        {"attach", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &attach, "Show the database written by a --headless collector (or those of every --racks collector) without changing it or listening for nodes", NULL},
+        {"racks", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING, &racks, "Only collect errors from racks FIRST to LAST, into a database of their own and on port -p plus one plus FIRST so that several collectors can share the machine (see --attach)", "FIRST-LAST"},
+        {"metrics", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &metrics, "Collect latency and size histograms from the start (see View > Diagnostics)", NULL},
+        {"metrics-dump", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME, &metrics_dump_path, "Append the metrics to this file every --metrics-interval (JSON lines if it ends in .json or .jsonl). Implies --metrics", "PATH"},
+        {"metrics-interval", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &metrics_interval, "How often the metrics are written to --metrics-dump (default 60)", "SECONDS"},
         {NULL}
     };
     #pragma GCC diagnostic pop
 
-    struct sockaddr *addr = get_args(&argc, &argv, gtk_get_option_group(TRUE), entries);
+    GOptionGroup *group = NULL;
+    if (headless_requested(argc, argv)) {
+        group = g_option_group_new("headless", "", "", NULL, NULL);
+    } else {
+        group = gtk_get_option_group(TRUE);
+    }
+    assert(NULL != group);
+
+    struct sockaddr *addr = get_args(&argc, &argv, group, entries);
     assert(NULL != addr);
+    assert(AF_INET == addr->sa_family);
+
+    // nodes send to -p's port unless their rack has a --racks collector
+    const guint16 base_port = ntohs(((struct sockaddr_in *) addr)->sin_port);
+    set_collector_port(0, MAX_NODE_NUMBER, base_port);
+
+    if (headless && attach) {
+        fprintf(stderr, "--headless and --attach can't be used together\n");
+        return EXIT_FAILURE;
+    }
+
+    // a collector's database and archives are named after its racks so that they don't collide with another's
+    unsigned int first_rack = 0;
+    unsigned int last_rack = 0;
+    if (NULL != racks) {
+        if (attach) {
+            fprintf(stderr, "--racks is for collectors: --attach shows every collector's racks\n");
+            return EXIT_FAILURE;
+        }
+        if (!parse_rack_range(racks, &first_rack, &last_rack)) {
+            return EXIT_FAILURE;
+        }
+
+        guint16 rack_port = 0;
+        if (!rack_range_port(base_port, first_rack, &rack_port)) {
+            return EXIT_FAILURE;
+        }
+        ((struct sockaddr_in *) addr)->sin_port = htons(rack_port);
+        set_collector_port(first_rack, last_rack, rack_port);
+        printf("Collecting racks %u to %u on port %u\n", first_rack, last_rack, (unsigned int) rack_port);
+    }
+
+    if ((batch_size < 1) || (latency < 0) || (queue_size < 1) || (frame_budget < 0)) {
+        fprintf(stderr, "--batch-size and --queue-size must be positive and --latency and --frame-budget must not be negative\n");
+        return EXIT_FAILURE;
+    }
+
+    if (liveness_interval < 1) {
+        fprintf(stderr, "--liveness-interval must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    if ((retention_days < 0) || (retention_rows < 0) || (retention_interval < 1)) {
+        fprintf(stderr, "--retention-days and --retention-rows must not be negative and --retention-interval must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    if (metrics_interval < 1) {
+        fprintf(stderr, "--metrics-interval must be positive\n");
+        return EXIT_FAILURE;
+    }
 
     if (NULL == g_prefix_path) {
         g_prefix_path = (char *) DEFAULT_PREFIX_PATH;
@@ -111,21 +304,108 @@ int main(int argc, char** argv) {
         return EXIT_FAILURE;
     }
 
-    // initialise database at path/mothership.db
+    // initialise database at path/mothership.db (path/mothership-racks-FIRST-LAST.db for --racks)
     GString *db_path = g_string_new(g_prefix_path);
     assert(NULL != db_path);
-    g_string_append_printf(db_path, "/mothership.db");
+    if (NULL != racks) {
+        g_string_append_printf(db_path, "/" SHARD_PREFIX "%u-%u.db", first_rack, last_rack);
+    } else {
+        g_string_append_printf(db_path, "/mothership.db");
+    }
+
+    metrics_enable(metrics);
+    if ((NULL != metrics_dump_path) && !start_metrics_dump(metrics_dump_path, (guint) metrics_interval)) {
+        return EXIT_FAILURE;
+    }
+
+    if (attach) {
+        // the collectors own the databases and the servers. Without any --racks collectors there is just the one
+        GPtrArray *shards = find_shard_databases();
+        if (!set_collector_ports(shards, base_port)) {
+            return EXIT_FAILURE;
+        }
+        if (0 == shards->len) {
+            g_ptr_array_add(shards, g_strdup(db_path->str));
+        }
+        g_string_free(db_path, TRUE);
+
+        if (shards->len > MAX_SHARDS) {
+            fprintf(stderr, "Can't show more than %i collectors' databases at once\n", MAX_SHARDS);
+            return EXIT_FAILURE;
+        }
+        for (guint i = 0; i < shards->len; i++) {
+            const char *path = g_ptr_array_index(shards, i);
+            if (0 != access(path, R_OK)) {
+                fprintf(stderr, "Can't read %s: is the collector running?\n", path);
+                return EXIT_FAILURE;
+            }
+        }
+        init_database_federated((const char *const *) shards->pdata, (int) shards->len);
+        g_ptr_array_unref(shards);
+
+        const int ret = start_ui(&argc, &argv, (guint) frame_budget, true);
+        stop_metrics_dump();
+        close_database();
+        return ret;
+    }
+
     init_database(db_path->str);
     g_string_free(db_path, TRUE);
     db_path = NULL;
 
-    assert(true == create_timer((timer_handler_t) periodic_update, &timer_id, update_time));
+    if (NULL != racks) {
+        set_rack_range(first_rack, last_rack);
+    }
+
+    set_dedup_window(dedup_window);
 
    if (false == start_server(addr, sizeof(*addr))) {
        fprintf(stderr, "Unable to bind to address\n");
        exit(EXIT_FAILURE);
    }
 
-    return start_ui(&argc, &argv, (gpointer) &timer_id);
+    if (!start_ingest((guint) batch_size, (guint) latency, (guint) queue_size)) {
+        exit(EXIT_FAILURE);
+    }
+
+    if (!start_liveness((guint) liveness_interval)) {
+        exit(EXIT_FAILURE);
+    }
+
+    // archives go next to the database at path/archive.db (or path/archive-YYYY-MM.db).
+    // A --racks collector's are path/archive-racks-FIRST-LAST.db and so on
+    if ((retention_days > 0) || (retention_rows > 0)) {
+        const RetentionPolicy policy = {
+            .max_age = (guint) retention_days,
+            .max_rows = (guint) retention_rows,
+            .interval = (guint) retention_interval,
+            .monthly = archive_monthly,
+        };
+
+        GString *archive_prefix = g_string_new(g_prefix_path);
+        assert(NULL != archive_prefix);
+        g_string_append_printf(archive_prefix, "/archive");
+        if (NULL != racks) {
+            g_string_append_printf(archive_prefix, "-racks-%u-%u", first_rack, last_rack);
+        }
+        const bool started = start_retention(archive_prefix->str, &policy);
+        g_string_free(archive_prefix, TRUE);
+
+        if (!started) {
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    int ret = EXIT_SUCCESS;
+    if (headless) {
+        run_headless();
+    } else {
+        ret = start_ui(&argc, &argv, (guint) frame_budget, false);
+    }
+
+    stop_collector();
+    stop_metrics_dump();
+    close_database();
+    return ret;
     // g_prefix_path points to a leaked dynamically allocated string if the argument was specified. 
 }
@@ -0,0 +1,267 @@
+/*
+ * Copyright 2017
+ * GPL3 Licensed
+ * metrics.c
+ * Counters and latency histograms for the hot paths.
+ * When off every call is one atomic read, so the instrumentation can stay in the hot paths
+ */
+
+// includes
+#include "config.h"
+#include "metrics.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// declarations
+
+// bucket i holds values below 2^i (bucket 0 holds 0)
+#define NUM_BUCKETS 64
+
+typedef struct {
+    guint64 count;
+    guint64 sum;
+    guint64 max;
+    guint64 buckets[NUM_BUCKETS];
+} Histogram;
+
+static const struct {
+    const char *name;
+    const char *unit;
+} descriptions[NUM_METRICS] = {
+    [METRIC_INGEST_BATCH] = {"ingest_batch", "rows"},
+    [METRIC_INGEST_BACKLOG] = {"ingest_backlog", "rows"},
+    [METRIC_INGEST_WRITE] = {"ingest_write", "ns"},
+    [METRIC_SQL_ADD] = {"sql_add_errors", "ns"},
+    [METRIC_SQL_SEARCH] = {"sql_search", "ns"},
+    [METRIC_SQL_COUNT] = {"sql_count", "ns"},
+    [METRIC_SQL_SYNC] = {"sql_sync", "ns"},
+    [METRIC_TAB_UPDATE] = {"tab_update", "ns"},
+    [METRIC_TAB_ROWS] = {"tab_rows", "rows"},
+};
+
+static volatile gint enabled = 0;
+
+// protects histograms. Records are a few additions so one lock for everything is cheap enough
+static GMutex lock;
+static Histogram histograms[NUM_METRICS];
+
+// everything below is protected by dump_lock
+static GMutex dump_lock;
+static GCond wake;              // signalled when stopping
+static bool stopping = false;
+static GThread *thread = NULL;
+static char *dump_path = NULL;
+static guint dump_interval = DEFAULT_METRICS_INTERVAL;
+
+static gpointer dump_thread(gpointer unused);
+
+// functions
+void metrics_enable(const bool enable) {
+    g_atomic_int_set(&enabled, enable ? 1 : 0);
+}
+
+bool metrics_enabled(void) {
+    return 0 != g_atomic_int_get(&enabled);
+}
+
+void metrics_reset(void) {
+    g_mutex_lock(&lock);
+    memset(histograms, 0, sizeof(histograms));
+    g_mutex_unlock(&lock);
+}
+
+static guint bucket_of(guint64 value) {
+    guint bucket = 0;
+    while ((0 != value) && (bucket < NUM_BUCKETS - 1)) {
+        value >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+void metrics_record(const Metric metric, const guint64 value) {
+    if (!g_atomic_int_get(&enabled)) {
+        return;
+    }
+    assert(metric < NUM_METRICS);
+
+    g_mutex_lock(&lock);
+    Histogram *histogram = &histograms[metric];
+    histogram->count++;
+    histogram->sum += value;
+    histogram->max = MAX(histogram->max, value);
+    histogram->buckets[bucket_of(value)]++;
+    g_mutex_unlock(&lock);
+}
+
+// monotonic ns. Never 0 so that 0 can mean "not timing"
+static gint64 now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (gint64) now.tv_sec * 1000000000 + now.tv_nsec + 1;
+}
+
+gint64 metrics_start(void) {
+    if (!g_atomic_int_get(&enabled)) {
+        return 0;
+    }
+    return now_ns();
+}
+
+void metrics_finish(const Metric metric, const gint64 start) {
+    if (0 == start) {
+        return;
+    }
+    metrics_record(metric, (guint64) (now_ns() - start));
+}
+
+// the top of the bucket holding the fraction'th value. Assumes the caller holds lock
+static guint64 percentile(const Histogram *histogram, const double fraction) {
+    if (0 == histogram->count) {
+        return 0;
+    }
+
+    const guint64 rank = (guint64) ((double) (histogram->count - 1) * fraction) + 1;
+    guint64 seen = 0;
+    for (guint bucket = 0; bucket < NUM_BUCKETS; bucket++) {
+        seen += histogram->buckets[bucket];
+        if (seen >= rank) {
+            // more than the biggest value would make no sense
+            const guint64 top = (0 == bucket) ? 0 : ((guint64) 1 << bucket) - 1;
+            return MIN(top, histogram->max);
+        }
+    }
+
+    return histogram->max;
+}
+
+void metrics_summary(const Metric metric, MetricSummary *summary) {
+    assert(metric < NUM_METRICS);
+    assert(NULL != summary);
+
+    summary->name = descriptions[metric].name;
+    summary->unit = descriptions[metric].unit;
+
+    g_mutex_lock(&lock);
+    const Histogram *histogram = &histograms[metric];
+    summary->count = histogram->count;
+    summary->sum = histogram->sum;
+    summary->max = histogram->max;
+    summary->p50 = percentile(histogram, 0.5);
+    summary->p99 = percentile(histogram, 0.99);
+    g_mutex_unlock(&lock);
+}
+
+GString *metrics_dump(const bool json) {
+    GString *dump = g_string_new(NULL);
+    assert(NULL != dump);
+
+    if (json) {
+        g_string_append_printf(dump, "{\"time\": %li, \"enabled\": %s, \"metrics\": {", (long) time(NULL),
+                               metrics_enabled() ? "true" : "false");
+    } else {
+        g_string_append_printf(dump, "%-16s %6s %12s %12s %12s %12s %12s\n", "metric", "unit", "count", "mean", "p50", "p99", "max");
+    }
+
+    for (int metric = 0; metric < NUM_METRICS; metric++) {
+        MetricSummary summary;
+        metrics_summary((Metric) metric, &summary);
+        const guint64 mean = (0 == summary.count) ? 0 : summary.sum / summary.count;
+
+        if (json) {
+            g_string_append_printf(dump, "%s\"%s\": {\"unit\": \"%s\", \"count\": %" G_GUINT64_FORMAT ", \"sum\": %" G_GUINT64_FORMAT
+                                   ", \"p50\": %" G_GUINT64_FORMAT ", \"p99\": %" G_GUINT64_FORMAT ", \"max\": %" G_GUINT64_FORMAT "}",
+                                   (0 == metric) ? "" : ", ", summary.name, summary.unit, summary.count, summary.sum, summary.p50,
+                                   summary.p99, summary.max);
+        } else {
+            g_string_append_printf(dump, "%-16s %6s %12" G_GUINT64_FORMAT " %12" G_GUINT64_FORMAT " %12" G_GUINT64_FORMAT " %12"
+                                   G_GUINT64_FORMAT " %12" G_GUINT64_FORMAT "\n", summary.name, summary.unit, summary.count, mean,
+                                   summary.p50, summary.p99, summary.max);
+        }
+    }
+
+    if (json) {
+        g_string_append(dump, "}}\n");
+    }
+
+    return dump;
+}
+
+static void write_dump(void) {
+    const bool json = g_str_has_suffix(dump_path, ".json") || g_str_has_suffix(dump_path, ".jsonl");
+    GString *dump = metrics_dump(json);
+
+    FILE *file = fopen(dump_path, "a");
+    if (NULL == file) {
+        perror("fopen metrics dump");
+    } else {
+        if (!json) {
+            const time_t now = time(NULL);
+            fprintf(file, "# %s", ctime(&now));
+        }
+        fputs(dump->str, file);
+        if (!json) {
+            fputc('\n', file);
+        }
+        fclose(file);
+    }
+
+    g_string_free(dump, TRUE);
+}
+
+bool start_metrics_dump(const char *path, const guint interval) {
+    assert(NULL == thread);
+    assert(NULL != path);
+    assert(interval > 0);
+
+    dump_path = g_strdup(path);
+    assert(NULL != dump_path);
+    dump_interval = interval;
+    stopping = false;
+    metrics_enable(true);
+
+    GError *error = NULL;
+    thread = g_thread_try_new("metrics", dump_thread, NULL, &error);
+    if (NULL == thread) {
+        fprintf(stderr, "Could not start the metrics thread: %s\n", error->message);
+        g_error_free(error);
+        g_free(dump_path);
+        dump_path = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+void stop_metrics_dump(void) {
+    g_mutex_lock(&dump_lock);
+    stopping = true;
+    g_cond_broadcast(&wake);
+    g_mutex_unlock(&dump_lock);
+
+    if (NULL != thread) {
+        g_thread_join(thread);
+        thread = NULL;
+    }
+
+    g_free(dump_path);
+    dump_path = NULL;
+}
+
+static gpointer dump_thread(__attribute__((unused)) gpointer unused) {
+    g_mutex_lock(&dump_lock);
+    while (!stopping) {
+        const gint64 next_dump = g_get_monotonic_time() + (gint64) dump_interval * G_TIME_SPAN_SECOND;
+        while (!stopping && g_cond_wait_until(&wake, &dump_lock, next_dump)) {
+            // woken early: go back to sleep unless stopping
+        }
+
+        // the last dump is written on the way out too
+        write_dump();
+    }
+    g_mutex_unlock(&dump_lock);
+
+    return NULL;
+}
@@ -15,6 +15,9 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <libgen.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "sql.h"
 
 extern const char * g_prefix_path; // main.c
 
@@ -22,6 +25,61 @@ static const char subnet[] = "172.16";
 static const char user[] = "pi"; // user used when logging in over ssh
 static const char term[] = "/usr/bin/xfce4-terminal -x ";
 
+// where the mothership is on the nodes' network
+static const char collector_address[] = "172.16.0.1";
+
+// the port of the collector for each rack (see set_collector_port). 0 leaves the node software's default
+static guint16 collector_ports[MAX_NODE_NUMBER + 1];
+
+// ssh options for provision_nodes, which has no terminal: fail rather than ask for anything
+static const char batch_options[] = "-o BatchMode=yes -o ConnectTimeout=10";
+
+// where the connection shared by a NodeSession's commands listens. ssh expands this per host
+static const char control_path[] = "-o ControlPath=~/.ssh/edsac-%r@%h:%p";
+
+// for commands in a NodeSession: only use the shared connection, never log in again
+static const char session_options[] = "-o BatchMode=yes -o ControlMaster=no -o ControlPath=~/.ssh/edsac-%r@%h:%p";
+
+// records the sha256 of each archive extracted on the node (in sha256sum's format) so that unchanged ones are skipped
+static const char manifest_path[] = "/home/pi/edsac/.manifest";
+
+// how long provision_nodes waits for each node to boot
+#define BOOT_TIMEOUT (10 * 60) // seconds
+#define BOOT_POLL 5 // seconds between attempts
+
+// how long node_session_open waits for someone to log in in the terminal
+#define LOGIN_TIMEOUT (2 * 60) // seconds
+#define LOGIN_POLL 1 // seconds between checks
+
+// one ssh login to a node shared by every command run on it (ssh ControlMaster)
+typedef struct {
+    char *host; // user@address
+} NodeSession;
+
+// archive_digest's record of a file it has already hashed
+typedef struct {
+    gint64 mtime;
+    goffset size;
+    char *digest;
+} CachedDigest;
+
+// a call to provision_nodes. Freed once done has been called
+typedef struct {
+    GPtrArray *nodes;
+    guint max_workers;
+    ProvisionProgressFunc progress;
+    ProvisionDoneFunc done;
+    gpointer user_data;
+    volatile gint num_failed;
+} Provisioning;
+
+// passed to the main loop by report_progress
+typedef struct {
+    Provisioning *provisioning;
+    const NodeSpec *node;
+    ProvisionStage stage;
+} ProgressReport;
+
 // command must not use single quotes
 // obviously use with care
 static bool run_as_root(const char *command) {
@@ -62,11 +120,21 @@ static char *append_to_file(const char *path, const char *text) {
     return ret;
 }
 
-bool setup_node_network(const unsigned int rack_no, const unsigned int chassis_no, __attribute__((unused)) const char *mac_addr) {
-    // remove this IP address and hostname from .ssh/known_hosts
+bool setup_nodes_network(NodeSpec *const *nodes, const size_t num_nodes) {
+    assert((NULL != nodes) || (0 == num_nodes));
+
+    if (0 == num_nodes) {
+        return true;
+    }
+
+    // remove these IP addresses and hostnames from .ssh/known_hosts
     GString *known_hosts = g_string_new(NULL);
     assert(NULL != known_hosts);
-    g_string_append_printf(known_hosts, "ssh-keygen -f ~/.ssh/known_hosts -R %s.%i.%i; ssh-keygen -f ~/.ssh/known_hosts -R node%i-%i;", subnet, rack_no, chassis_no, rack_no, chassis_no);
+    for (size_t i = 0; i < num_nodes; i++) {
+        const unsigned int rack_no = nodes[i]->rack_no;
+        const unsigned int chassis_no = nodes[i]->chassis_no;
+        g_string_append_printf(known_hosts, "ssh-keygen -f ~/.ssh/known_hosts -R %s.%i.%i; ssh-keygen -f ~/.ssh/known_hosts -R node%i-%i;", subnet, rack_no, chassis_no, rack_no, chassis_no);
+    }
 
     int known_hosts_ret = system(known_hosts->str);
     g_string_free(known_hosts, TRUE);
@@ -78,41 +146,46 @@ bool setup_node_network(const unsigned int rack_no, const unsigned int chassis_n
         return false;
     }
 
-    // add the node to /etc/hosts
-    GString *hosts_str = g_string_new(NULL);
-    assert(NULL != hosts_str);
-    g_string_append_printf(hosts_str, "%s.%i.%i\tnode%i-%i", subnet, rack_no, chassis_no, rack_no, chassis_no);
-
-    char *hosts_ret = append_to_file("/etc/hosts", hosts_str->str);
-    g_string_free(hosts_str, TRUE);
-    assert(NULL != hosts_ret);
+    // add every node to /etc/hosts and give each a DHCP entry then restart udhcpd once
+    GString *combined = g_string_new(NULL);
+    assert(NULL != combined);
+    GString *line = g_string_new(NULL);
+    assert(NULL != line);
 
-    // add DHCP entry for the node
-    GString *dhcp_str = g_string_new(NULL);
-    assert(NULL != dhcp_str);
-    g_string_append_printf(dhcp_str, "static_lease %s %s.%i.%i", mac_addr, subnet, rack_no, chassis_no);
+    for (size_t i = 0; i < num_nodes; i++) {
+        const unsigned int rack_no = nodes[i]->rack_no;
+        const unsigned int chassis_no = nodes[i]->chassis_no;
 
-    char *dhcp_ret = append_to_file("/etc/udhcpd.conf", dhcp_str->str);
-    g_string_free(dhcp_str, TRUE);
-    assert(NULL != dhcp_ret);
+        g_string_printf(line, "%s.%i.%i\tnode%i-%i", subnet, rack_no, chassis_no, rack_no, chassis_no);
+        char *hosts_ret = append_to_file("/etc/hosts", line->str);
+        assert(NULL != hosts_ret);
 
-    // restart udhcpd
-    const char restart[] = "/bin/systemctl restart udhcpd.service";
+        g_string_printf(line, "static_lease %s %s.%i.%i", nodes[i]->mac_addr, subnet, rack_no, chassis_no);
+        char *dhcp_ret = append_to_file("/etc/udhcpd.conf", line->str);
+        assert(NULL != dhcp_ret);
 
-    // combine the commands
-    GString *combined = g_string_new(hosts_ret);
-    assert(NULL != combined);
-    g_string_append_printf(combined, " && %s && %s", dhcp_ret, restart);
+        g_string_append_printf(combined, "%s && %s && ", hosts_ret, dhcp_ret);
+        g_free(hosts_ret);
+        g_free(dhcp_ret);
+    }
+    g_string_append(combined, "/bin/systemctl restart udhcpd.service");
 
     bool ret = run_as_root(combined->str);
 
+    g_string_free(line, TRUE);
     g_string_free(combined, TRUE);
-    g_free(hosts_ret);
-    g_free(dhcp_ret);
 
     return ret;
 }
 
+bool setup_node_network(const unsigned int rack_no, const unsigned int chassis_no, const char *mac_addr) {
+    assert(NULL != mac_addr);
+
+    NodeSpec node = {.rack_no = rack_no, .chassis_no = chassis_no, .mac_addr = (char *) mac_addr, .conf_archive = NULL};
+    NodeSpec *nodes[] = {&node};
+    return setup_nodes_network(nodes, 1);
+}
+
 // pretty dangerous function. Think carefully about the contents of file
 static char *revert_file(const char *file, unsigned int rack_no, unsigned int chassis_no) {
     GString *command = g_string_new(NULL);
@@ -142,14 +215,89 @@ void node_cleanup_network(const unsigned int rack_no, const unsigned int chassis
     g_string_free(combined, TRUE);
 }
 
-bool copy_file(const unsigned int rack_no, const unsigned int chassis_no, const char *src, const char *dest) {
+// whether the shared connection to host is up
+static bool session_master_running(const char *host) {
+    GString *command = g_string_new(NULL);
+    assert(NULL != command);
+    g_string_printf(command, "/usr/bin/ssh %s -O check %s > /dev/null 2>&1", control_path, host);
+
+    const int res = system(command->str);
+    g_string_free(command, TRUE);
+
+    return EXIT_SUCCESS == res;
+}
+
+// the terminal's exit status says nothing about the login and it may return while the password is still being typed,
+// so wait for the shared connection itself. returns false if it never comes up
+static bool wait_for_login(const char *host) {
+    const gint64 deadline = g_get_monotonic_time() + LOGIN_TIMEOUT * G_TIME_SPAN_SECOND;
+    while (g_get_monotonic_time() < deadline) {
+        if (session_master_running(host)) {
+            return true;
+        }
+        g_usleep(LOGIN_POLL * G_USEC_PER_SEC);
+    }
+
+    fprintf(stderr, "Gave up waiting for the login to %s\n", host);
+    return false;
+}
+
+// log in to the node and leave the connection open for node_session's commands to share.
+// When !batch the login runs in a terminal in case a password is needed
+static bool node_session_open(NodeSession *session, const unsigned int rack_no, const unsigned int chassis_no, const bool batch) {
+    assert(NULL != session);
+
+    session->host = g_strdup_printf("%s@%s.%i.%i", user, subnet, rack_no, chassis_no);
+    assert(NULL != session->host);
+
+    GString *command = g_string_new(NULL);
+    assert(NULL != command);
+
+    // -f goes into the background once logged in, out of the terminal's way
+    g_string_printf(command, "%s /usr/bin/ssh %s %s -o ControlMaster=auto -fN %s", batch ? "" : term, batch ? batch_options : "",
+        control_path, session->host);
+
+    const int res = system(command->str);
+    g_string_free(command, TRUE);
+
+    const bool ok = batch ? (EXIT_SUCCESS == res) : ((-1 != res) && wait_for_login(session->host));
+    if (!ok) {
+        g_free(session->host);
+        session->host = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+static void node_session_close(NodeSession *session) {
+    assert(NULL != session);
+
+    GString *command = g_string_new(NULL);
+    assert(NULL != command);
+    g_string_printf(command, "/usr/bin/ssh %s -O exit %s > /dev/null 2>&1", control_path, session->host);
+
+    // the connection closes on its own if the node goes away so there is nothing to do if this fails
+    if (-1 == system(command->str)) {
+        perror("system ssh -O exit");
+    }
+
+    g_string_free(command, TRUE);
+    g_free(session->host);
+    session->host = NULL;
+}
+
+static bool remote_copy(const NodeSession *session, const char *src, const char *dest) {
     assert(NULL != src);
     assert(NULL != dest);
 
     GString *command = g_string_new(NULL);
     assert(NULL != command);
 
-    g_string_printf(command, "%s /usr/bin/scp '%s' %s@%s.%i.%i:%s", term, src, user, subnet, rack_no, chassis_no, dest);
+    // src can come from a node list so it may contain anything
+    char *quoted_src = g_shell_quote(src);
+    g_string_printf(command, "/usr/bin/scp %s %s %s:%s", session_options, quoted_src, session->host, dest);
+    g_free(quoted_src);
 
     int res = system(command->str);
 
@@ -161,13 +309,24 @@ bool copy_file(const unsigned int rack_no, const unsigned int chassis_no, const
     return false;
 }
 
-bool run_remote_command(const unsigned int rack_no, const unsigned int chassis_no, const char *cmd) {
+bool copy_file(const unsigned int rack_no, const unsigned int chassis_no, const char *src, const char *dest) {
+    NodeSession session;
+    if (!node_session_open(&session, rack_no, chassis_no, false)) {
+        return false;
+    }
+
+    const bool ret = remote_copy(&session, src, dest);
+    node_session_close(&session);
+    return ret;
+}
+
+static bool remote_command(const NodeSession *session, const char *cmd) {
     assert(NULL != cmd);
 
     GString *command = g_string_new(NULL);
     assert(NULL != command);
 
-    g_string_printf(command, "%s /usr/bin/ssh %s@%s.%i.%i '%s'", term, user, subnet, rack_no, chassis_no, cmd);
+    g_string_printf(command, "/usr/bin/ssh %s %s '%s'", session_options, session->host, cmd);
 
     int res = system(command->str);
     g_string_free(command, TRUE);
@@ -178,49 +337,194 @@ bool run_remote_command(const unsigned int rack_no, const unsigned int chassis_n
     return false;
 }
 
+bool run_remote_command(const unsigned int rack_no, const unsigned int chassis_no, const char *cmd) {
+    NodeSession session;
+    if (!node_session_open(&session, rack_no, chassis_no, false)) {
+        return false;
+    }
+
+    const bool ret = remote_command(&session, cmd);
+    node_session_close(&session);
+    return ret;
+}
+
+// the tar option for archive's compression. A pipe can't be searched for the compression so go by the name
+static const char *tar_compression(const char *archive) {
+    if (g_str_has_suffix(archive, ".gz") || g_str_has_suffix(archive, ".tgz")) {
+        return "z";
+    } else if (g_str_has_suffix(archive, ".bz2")) {
+        return "j";
+    } else if (g_str_has_suffix(archive, ".xz")) {
+        return "J";
+    }
+    return "";
+}
 
-bool copy_and_extract_archive(const unsigned int rack_no, const unsigned int chassis_no, const char *archive, const char *dest) {
+// pipe the archive straight into tar on the node so that nothing needs copying or cleaning up
+static bool extract_archive(const NodeSession *session, const char *archive, const char *dest) {
     assert(NULL != archive);
+    assert(NULL != dest);
 
-    GString *mkdir = g_string_new(NULL);
-    assert(NULL != mkdir);
+    GString *command = g_string_new(NULL);
+    assert(NULL != command);
 
-    g_string_printf(mkdir, "mkdir -p %s", dest);
-    run_remote_command(rack_no, chassis_no, mkdir->str);
+    // archive can come from a node list so it may contain anything
+    char *quoted_archive = g_shell_quote(archive);
+    g_string_printf(command, "/usr/bin/ssh %s %s 'mkdir -p %s && tar -x%sf - -C %s' < %s", session_options, session->host,
+        dest, tar_compression(archive), dest, quoted_archive);
+    g_free(quoted_archive);
 
-    g_string_free(mkdir, TRUE);
-    mkdir = NULL;
+    int res = system(command->str);
+    g_string_free(command, TRUE);
+
+    return (EXIT_SUCCESS == res);
+}
 
-    if (!copy_file(rack_no, chassis_no, archive, dest)) {
+bool copy_and_extract_archive(const unsigned int rack_no, const unsigned int chassis_no, const char *archive, const char *dest) {
+    NodeSession session;
+    if (!node_session_open(&session, rack_no, chassis_no, false)) {
         return false;
     }
 
-    GString *archive_copy = g_string_new(archive);
-    assert(NULL != archive_copy);
+    const bool ret = extract_archive(&session, archive, dest);
+    node_session_close(&session);
+    return ret;
+}
+
+// path -> CachedDigest so that provisioning many nodes hashes each archive once
+static GHashTable *digests = NULL;
+static GMutex digests_lock;
+
+static void free_cached_digest(gpointer data) {
+    CachedDigest *cached = (CachedDigest *) data;
+    g_free(cached->digest);
+    g_free(cached);
+}
+
+static char *hash_file(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (NULL == file) {
+        perror("fopen archive");
+        return NULL;
+    }
 
-    const char *archive_name = basename(archive_copy->str);
-    assert(NULL != archive_name);
+    GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA256);
+    assert(NULL != checksum);
+
+    guchar buffer[64 * 1024];
+    size_t len;
+    while (0 < (len = fread(buffer, 1, sizeof(buffer), file))) {
+        g_checksum_update(checksum, buffer, (gssize) len);
+    }
+
+    char *digest = NULL;
+    if (ferror(file)) {
+        perror("fread archive");
+    } else {
+        digest = g_strdup(g_checksum_get_string(checksum));
+    }
+
+    g_checksum_free(checksum);
+    fclose(file);
+    return digest;
+}
+
+// the hex sha256 of the file at path (free with g_free) or NULL if it can't be read.
+// Only hashes the file again once it has changed
+static char *archive_digest(const char *path) {
+    struct stat info;
+    if (0 != stat(path, &info)) {
+        perror("stat archive");
+        return NULL;
+    }
+
+    g_mutex_lock(&digests_lock);
+    if (NULL == digests) {
+        digests = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free_cached_digest);
+        assert(NULL != digests);
+    }
+
+    CachedDigest *cached = g_hash_table_lookup(digests, path);
+    if ((NULL == cached) || (cached->mtime != info.st_mtime) || (cached->size != info.st_size)) {
+        char *digest = hash_file(path);
+        if (NULL == digest) {
+            g_mutex_unlock(&digests_lock);
+            return NULL;
+        }
+
+        cached = g_malloc(sizeof(*cached));
+        assert(NULL != cached);
+        cached->mtime = info.st_mtime;
+        cached->size = info.st_size;
+        cached->digest = digest;
+        g_hash_table_replace(digests, g_strdup(path), cached);
+    }
+
+    char *ret = g_strdup(cached->digest);
+    g_mutex_unlock(&digests_lock);
+    return ret;
+}
+
+// extract archive in dest unless the node's manifest says that this version (by sha256) is already there.
+// name is the archive's entry in the manifest. changed is set if the archive was extracted
+static bool install_archive(const NodeSession *session, const char *archive, const char *name, const char *dest, bool *changed) {
+    assert(NULL != changed);
+
+    char *digest = archive_digest(archive);
+    if (NULL == digest) {
+        return false;
+    }
 
     GString *command = g_string_new(NULL);
     assert(NULL != command);
 
-    g_string_printf(command, "cd %s && tar -xf %s && rm %s", dest, archive_name, archive_name);
+    g_string_printf(command, "grep -qxF \"%s  %s\" %s 2> /dev/null", digest, name, manifest_path);
+    if (remote_command(session, command->str)) {
+        *changed = false;
+        g_string_free(command, TRUE);
+        g_free(digest);
+        return true;
+    }
 
-    bool ret = run_remote_command(rack_no, chassis_no, command->str);
+    if (!extract_archive(session, archive, dest)) {
+        g_string_free(command, TRUE);
+        g_free(digest);
+        return false;
+    }
+    *changed = true;
+
+    // only recorded once extracted so an interrupted copy is sent again next time
+    g_string_printf(command, "touch %s && sed -i \"/  %s$/d\" %s && echo \"%s  %s\" >> %s", manifest_path, name, manifest_path,
+        digest, name, manifest_path);
+    if (!remote_command(session, command->str)) {
+        // not fatal: it is just sent again next time
+        printf("Could not update the manifest on %s\n", session->host);
+    }
 
-    g_string_free(archive_copy, TRUE);
     g_string_free(command, TRUE);
+    g_free(digest);
+    return true;
+}
 
-    return ret;
+void set_collector_port(const unsigned int first_rack, const unsigned int last_rack, const guint16 port) {
+    assert(first_rack <= last_rack);
+    assert(last_rack <= MAX_NODE_NUMBER);
+
+    for (unsigned int rack = first_rack; rack <= last_rack; rack++) {
+        collector_ports[rack] = port;
+    }
 }
 
-bool setup_node_ssh(const unsigned int rack_no, const unsigned int chassis_no, const char *conf_archive) {
+static bool ssh_stage(const NodeSession *session, const unsigned int rack_no, const char *conf_archive) {
+    assert(rack_no <= MAX_NODE_NUMBER);
+
     GString *dist_archive_path = g_string_new(g_prefix_path);
     assert(NULL != dist_archive_path);
 
     g_string_append_printf(dist_archive_path, "/dist-archive.tar.gz");
 
-    bool ret = copy_and_extract_archive(rack_no, chassis_no, dist_archive_path->str, "/home/pi/edsac");
+    bool dist_changed = false;
+    bool ret = install_archive(session, dist_archive_path->str, "dist-archive", "/home/pi/edsac", &dist_changed);
     g_string_free(dist_archive_path, TRUE);
     dist_archive_path = NULL;
     if (!ret) {
@@ -228,7 +532,8 @@ bool setup_node_ssh(const unsigned int rack_no, const unsigned int chassis_no, c
         return false;
     }
 
-    ret = copy_and_extract_archive(rack_no, chassis_no, conf_archive, "/home/pi/edsac");
+    bool conf_changed = false;
+    ret = install_archive(session, conf_archive, "conf-archive", "/home/pi/edsac", &conf_changed);
     if (!ret) {
         perror("Copying and extracting conf_archive");
         return false;
@@ -245,29 +550,313 @@ bool setup_node_ssh(const unsigned int rack_no, const unsigned int chassis_no, c
 
     [Service]
     Environment="LD_LIBRARY_PATH=/home/pi/edsac/dist-archive/"
-    ExecStart=/home/pi/edsac/dist-archive/sending.test -a 172.16.0.1
+    ExecStart=/home/pi/edsac/dist-archive/sending.test -a 172.16.0.1 -p PORT
 
     [Install]
     WantedBy=default.target
     */
 
+    // the node sends to the collector for its rack
+    GString *exec_start = g_string_new(NULL);
+    assert(NULL != exec_start);
+    g_string_append_printf(exec_start, "/home/%s/edsac/dist-archive/sending.test -a %s", user, collector_address);
+    if (0 != collector_ports[rack_no]) {
+        g_string_append_printf(exec_start, " -p %u", (unsigned int) collector_ports[rack_no]);
+    }
+
     GString *command = g_string_new(NULL);
     assert(NULL != command);
 
     g_string_append_printf(command, "mkdir -p /home/%s/.config/systemd/user && \
         echo -e \" \
         [Unit]\nDescription=EDSAC Status Monitor -- TODO this is only a test executable not the proper thing\nWants=network-online.target\nAfter=network-online.target\n\n\
-        [Service]\nEnvironment=LD_LIBRARY_PATH=/home/%s/edsac/dist-archive/\nExecStart=/home/%s/edsac/dist-archive/sending.test -a 172.16.0.1\n\n\
+        [Service]\nEnvironment=LD_LIBRARY_PATH=/home/%s/edsac/dist-archive/\nExecStart=%s\n\n\
         [Install]\nWantedBy=default.target\
-        \" | tee /home/%s/.config/systemd/user/edsac-status-monitor.service", user, user, user, user);
+        \" | tee /home/%s/.config/systemd/user/edsac-status-monitor.service", user, user, exec_start->str, user);
+    g_string_free(exec_start, TRUE);
 
     g_string_append_printf(command, " && systemctl --user daemon-reload");
     g_string_append_printf(command, " && systemctl --user enable edsac-status-monitor.service");
-    g_string_append_printf(command, " && systemctl --user start edsac-status-monitor.service");
+    // a running monitor only picks up new software or configuration when restarted
+    g_string_append_printf(command, " && systemctl --user %s edsac-status-monitor.service",
+        (dist_changed || conf_changed) ? "restart" : "start");
     g_string_append_printf(command, " && sudo loginctl enable-linger %s", user);
 
-    ret = run_remote_command(rack_no, chassis_no, command->str);
+    ret = remote_command(session, command->str);
     g_string_free(command, TRUE);
 
     return ret;
 }
+
+bool setup_node_ssh(const unsigned int rack_no, const unsigned int chassis_no, const char *conf_archive) {
+    // one login for every step
+    NodeSession session;
+    if (!node_session_open(&session, rack_no, chassis_no, false)) {
+        return false;
+    }
+
+    const bool ret = ssh_stage(&session, rack_no, conf_archive);
+    node_session_close(&session);
+    return ret;
+}
+
+void free_node_spec(gpointer node) {
+    if (NULL == node) {
+        return;
+    }
+
+    NodeSpec *spec = (NodeSpec *) node;
+    g_free(spec->mac_addr);
+    g_free(spec->conf_archive);
+    g_free(spec);
+}
+
+// parse one line of a node list. NULL if it isn't valid
+static NodeSpec *parse_node_line(const char *line, const char *list_dir) {
+    unsigned int rack_no = 0;
+    unsigned int chassis_no = 0;
+    char mac_addr[18];
+    int archive_start = 0;
+    if ((3 != sscanf(line, "%u %u %17s %n", &rack_no, &chassis_no, mac_addr, &archive_start)) || (0 == archive_start)) {
+        return NULL;
+    }
+
+    if (!check_mac_address(mac_addr)) {
+        return NULL;
+    }
+
+    char *archive = g_strstrip(g_strdup(line + archive_start));
+    assert(NULL != archive);
+    if ('\0' == archive[0]) {
+        g_free(archive);
+        return NULL;
+    }
+
+    if (!g_path_is_absolute(archive)) {
+        char *relative = archive;
+        archive = g_build_filename(list_dir, relative, NULL);
+        g_free(relative);
+    }
+
+    NodeSpec *node = g_new(NodeSpec, 1);
+    assert(NULL != node);
+    node->rack_no = rack_no;
+    node->chassis_no = chassis_no;
+    node->mac_addr = g_strdup(mac_addr);
+    node->conf_archive = archive;
+
+    return node;
+}
+
+GPtrArray *read_node_list(const char *path) {
+    assert(NULL != path);
+
+    FILE *file = fopen(path, "r");
+    if (NULL == file) {
+        perror("read_node_list");
+        return NULL;
+    }
+
+    GPtrArray *nodes = g_ptr_array_new_with_free_func(free_node_spec);
+    assert(NULL != nodes);
+    char *list_dir = g_path_get_dirname(path);
+    assert(NULL != list_dir);
+
+    char *line = NULL;
+    size_t line_len = 0;
+    unsigned int line_no = 0;
+    bool valid = true;
+    // the line each rack and chassis was first seen on
+    GHashTable *seen = g_hash_table_new(g_direct_hash, g_direct_equal);
+    assert(NULL != seen);
+    while (-1 != getline(&line, &line_len, file)) {
+        line_no++;
+
+        const char *text = line;
+        while (g_ascii_isspace(*text)) {
+            text++;
+        }
+        if (('\0' == *text) || ('#' == *text)) {
+            continue;
+        }
+
+        NodeSpec *node = parse_node_line(text, list_dir);
+        if (NULL == node) {
+            fprintf(stderr, "%s:%u: expected \"rack_no chassis_no mac_address config_archive\"\n", path, line_no);
+            valid = false;
+            continue; // report every bad line at once
+        }
+
+        // each is an octet of the node's address
+        if ((node->rack_no > MAX_NODE_NUMBER) || (node->chassis_no > MAX_NODE_NUMBER)) {
+            fprintf(stderr, "%s:%u: rack_no and chassis_no must be from 0 to %u\n", path, line_no, MAX_NODE_NUMBER);
+            valid = false;
+            free_node_spec(node);
+            continue;
+        }
+
+        gpointer key = GUINT_TO_POINTER(node->rack_no * (MAX_NODE_NUMBER + 1) + node->chassis_no);
+        const guint first_line = GPOINTER_TO_UINT(g_hash_table_lookup(seen, key));
+        if (0 != first_line) {
+            fprintf(stderr, "%s:%u: rack %u, chassis %u is already on line %u\n", path, line_no, node->rack_no,
+                    node->chassis_no, first_line);
+            valid = false;
+            free_node_spec(node);
+            continue;
+        }
+        g_hash_table_insert(seen, key, GUINT_TO_POINTER(line_no));
+
+        if (F_OK != access(node->conf_archive, R_OK)) {
+            fprintf(stderr, "%s:%u: can't read %s\n", path, line_no, node->conf_archive);
+            valid = false;
+        }
+
+        g_ptr_array_add(nodes, node);
+    }
+
+    free(line);
+    fclose(file);
+    g_free(list_dir);
+    g_hash_table_unref(seen);
+
+    if (!valid) {
+        g_ptr_array_unref(nodes);
+        return NULL;
+    }
+
+    return nodes;
+}
+
+// GSourceFunc passing a ProgressReport to the caller of provision_nodes
+static gboolean deliver_progress(gpointer data) {
+    ProgressReport *report = (ProgressReport *) data;
+    const Provisioning *provisioning = report->provisioning;
+
+    if (NULL != provisioning->progress) {
+        provisioning->progress(report->node, report->stage, provisioning->user_data);
+    }
+
+    g_free(report);
+    return G_SOURCE_REMOVE;
+}
+
+// tell the main loop that node has moved on to stage. May be called from any thread
+static void report_progress(Provisioning *provisioning, const NodeSpec *node, const ProvisionStage stage) {
+    if (PROVISION_FAILED == stage) {
+        g_atomic_int_inc(&provisioning->num_failed);
+    }
+
+    ProgressReport *report = g_new(ProgressReport, 1);
+    assert(NULL != report);
+    report->provisioning = provisioning;
+    report->node = node;
+    report->stage = stage;
+
+    // idle sources run in the order they were added so these all arrive before deliver_done
+    g_idle_add(deliver_progress, report);
+}
+
+// GSourceFunc for the end of provision_nodes
+static gboolean deliver_done(gpointer data) {
+    Provisioning *provisioning = (Provisioning *) data;
+
+    if (NULL != provisioning->done) {
+        provisioning->done((guint) g_atomic_int_get(&provisioning->num_failed), provisioning->user_data);
+    }
+
+    g_ptr_array_unref(provisioning->nodes);
+    g_free(provisioning);
+    return G_SOURCE_REMOVE;
+}
+
+// freshly set up nodes take a while to get their address and boot so keep trying to log in.
+// returns false if the node never answers
+static bool wait_for_node(NodeSession *session, const unsigned int rack_no, const unsigned int chassis_no) {
+    const gint64 deadline = g_get_monotonic_time() + BOOT_TIMEOUT * G_TIME_SPAN_SECOND;
+    while (g_get_monotonic_time() < deadline) {
+        if (node_session_open(session, rack_no, chassis_no, true)) {
+            return true;
+        }
+        g_usleep(BOOT_POLL * G_USEC_PER_SEC);
+    }
+
+    return false;
+}
+
+// GFunc for the ssh worker pool. data is a NodeSpec in provisioning->nodes
+static void provision_node(gpointer data, gpointer user_data) {
+    const NodeSpec *node = (const NodeSpec *) data;
+    Provisioning *provisioning = (Provisioning *) user_data;
+
+    report_progress(provisioning, node, PROVISION_WAITING);
+    NodeSession session;
+    if (!wait_for_node(&session, node->rack_no, node->chassis_no)) {
+        fprintf(stderr, "Node %u %u never answered ssh\n", node->rack_no, node->chassis_no);
+        report_progress(provisioning, node, PROVISION_FAILED);
+        return;
+    }
+
+    report_progress(provisioning, node, PROVISION_SSH);
+    const bool ok = ssh_stage(&session, node->rack_no, node->conf_archive);
+    node_session_close(&session);
+    report_progress(provisioning, node, ok ? PROVISION_DONE : PROVISION_FAILED);
+}
+
+// GThreadFunc running one call to provision_nodes
+static gpointer provision_thread(gpointer data) {
+    Provisioning *provisioning = (Provisioning *) data;
+    GPtrArray *nodes = provisioning->nodes;
+
+    for (guint i = 0; i < nodes->len; i++) {
+        report_progress(provisioning, g_ptr_array_index(nodes, i), PROVISION_NETWORK);
+    }
+
+    // this is the only step which needs root so there is only one password prompt
+    if (!setup_nodes_network((NodeSpec **) nodes->pdata, nodes->len)) {
+        for (guint i = 0; i < nodes->len; i++) {
+            report_progress(provisioning, g_ptr_array_index(nodes, i), PROVISION_FAILED);
+        }
+        g_idle_add(deliver_done, provisioning);
+        return NULL;
+    }
+
+    GError *error = NULL;
+    GThreadPool *pool = g_thread_pool_new(provision_node, provisioning, (gint) provisioning->max_workers, FALSE, &error);
+    if (NULL == pool) {
+        fprintf(stderr, "Could not start provisioning workers: %s\n", error->message);
+        g_error_free(error);
+        for (guint i = 0; i < nodes->len; i++) {
+            report_progress(provisioning, g_ptr_array_index(nodes, i), PROVISION_FAILED);
+        }
+        g_idle_add(deliver_done, provisioning);
+        return NULL;
+    }
+
+    for (guint i = 0; i < nodes->len; i++) {
+        g_thread_pool_push(pool, g_ptr_array_index(nodes, i), NULL);
+    }
+
+    // wait for every node to finish
+    g_thread_pool_free(pool, FALSE, TRUE);
+
+    g_idle_add(deliver_done, provisioning);
+    return NULL;
+}
+
+void provision_nodes(GPtrArray *nodes, const guint max_workers, ProvisionProgressFunc progress, ProvisionDoneFunc done,
+                     gpointer user_data) {
+    assert(NULL != nodes);
+    assert(max_workers > 0);
+
+    Provisioning *provisioning = g_new0(Provisioning, 1);
+    assert(NULL != provisioning);
+    provisioning->nodes = g_ptr_array_ref(nodes);
+    provisioning->max_workers = max_workers;
+    provisioning->progress = progress;
+    provisioning->done = done;
+    provisioning->user_data = user_data;
+
+    // nothing waits for this: it finishes by calling done
+    GThread *thread = g_thread_new("provision", provision_thread, provisioning);
+    g_thread_unref(thread);
+}
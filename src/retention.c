@@ -0,0 +1,138 @@
+/*
+ * Copyright 2017
+ * GPL3 Licensed
+ * retention.c
+ * Moves old errors out of the live database on a schedule.
+ * Errors are moved in small chunks so that ingest and the gui only ever wait for one chunk
+ */
+
+// includes
+#include "config.h"
+#include "retention.h"
+#include <assert.h>
+#include <stdio.h>
+#include <time.h>
+#include "sql.h"
+#include "ui.h"
+
+// declarations
+
+// errors moved per transaction
+#define ARCHIVE_CHUNK 1000
+
+// pages handed back to the filesystem between checks for stopping
+#define RECLAIM_CHUNK 1024
+
+#define SECONDS_PER_DAY (24 * 60 * 60)
+
+// everything below is protected by lock
+static GMutex lock;
+static GCond wake;              // signalled when stopping
+static bool stopping = false;
+
+static GThread *thread = NULL;
+static RetentionPolicy policy;
+static char *prefix = NULL;
+
+static gpointer retention_thread(gpointer unused);
+static bool should_stop(void);
+static guint apply_policy(void);
+static gboolean refresh_gui(gpointer unused);
+
+// functions
+bool start_retention(const char *archive_prefix, const RetentionPolicy *new_policy) {
+    assert(NULL == thread);
+    assert(NULL != archive_prefix);
+    assert(NULL != new_policy);
+    assert(new_policy->interval > 0);
+
+    policy = *new_policy;
+    prefix = g_strdup(archive_prefix);
+    assert(NULL != prefix);
+    stopping = false;
+
+    GError *error = NULL;
+    thread = g_thread_try_new("retention", retention_thread, NULL, &error);
+    if (NULL == thread) {
+        fprintf(stderr, "Could not start the retention thread: %s\n", error->message);
+        g_error_free(error);
+        g_free(prefix);
+        prefix = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+void stop_retention(void) {
+    g_mutex_lock(&lock);
+    stopping = true;
+    g_cond_broadcast(&wake);
+    g_mutex_unlock(&lock);
+
+    if (NULL != thread) {
+        g_thread_join(thread);
+        thread = NULL;
+    }
+
+    g_free(prefix);
+    prefix = NULL;
+}
+
+static bool should_stop(void) {
+    g_mutex_lock(&lock);
+    const bool ret = stopping;
+    g_mutex_unlock(&lock);
+
+    return ret;
+}
+
+// GSourceFunc: the gui's lists may be showing errors which have gone
+static gboolean refresh_gui(__attribute__((unused)) gpointer unused) {
+    gui_update(NULL);
+    return G_SOURCE_REMOVE;
+}
+
+// archive everything breaking the policy then free the space. returns the number of errors archived
+static guint apply_policy(void) {
+    const time_t before = (policy.max_age > 0) ? time(NULL) - (time_t) policy.max_age * SECONDS_PER_DAY : 0;
+
+    guint num_moved = 0;
+    while (!should_stop()) {
+        const int moved = archive_old_errors(prefix, before, policy.max_rows, policy.monthly, ARCHIVE_CHUNK);
+        if (moved <= 0) {
+            break; // finished (or failed: try again next time)
+        }
+        num_moved += (guint) moved;
+    }
+
+    while ((num_moved > 0) && !should_stop()) {
+        if (reclaim_space(RECLAIM_CHUNK) <= 0) {
+            break;
+        }
+    }
+
+    return num_moved;
+}
+
+static gpointer retention_thread(__attribute__((unused)) gpointer unused) {
+    g_mutex_lock(&lock);
+    while (!stopping) {
+        g_mutex_unlock(&lock);
+        const guint num_moved = apply_policy();
+        g_mutex_lock(&lock);
+
+        if (num_moved > 0) {
+            printf("Archived %u errors\n", num_moved);
+            g_idle_add(refresh_gui, NULL);
+        }
+
+        const gint64 next_run = g_get_monotonic_time() + (gint64) policy.interval * 60 * G_TIME_SPAN_SECOND;
+        while (!stopping && g_cond_wait_until(&wake, &lock, next_run)) {
+            // woken early: go back to sleep unless stopping
+        }
+    }
+    g_mutex_unlock(&lock);
+
+    return NULL;
+}
@@ -8,6 +8,8 @@
 // includes
 #include "config.h"
 #include "sql.h"
+#include "counters.h"
+#include "metrics.h"
 #include <stdio.h>
 #include <assert.h>
 #include <sqlite3.h>
@@ -17,17 +19,205 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
 
 static sqlite3 *db = NULL;
-static bool show_disabled = false;
+// set from the gtk main loop and read by whichever thread is searching
+static volatile gint show_disabled = 0;
+
+// incremented whenever existing search results may have changed (rather than just new errors being added)
+static volatile gint generation = 0;
+
+// incremented whenever a duplicate is merged into an existing error
+static volatile gint merges = 0;
+
+// errors which can still absorb duplicates, so that deduplicating doesn't need a query per message.
+// "rack chassis valve category description" -> RecentError. Protected by db_lock
+typedef struct {
+    sqlite3_int64 id;
+    time_t first_seen;
+} RecentError;
+
+// errors moved by archive_old_errors from one node and valve
+typedef struct {
+    unsigned int rack_no;
+    unsigned int chassis_no;
+    int valve_no;
+    unsigned int num_errors;
+    unsigned int num_enabled;
+} ArchivedCount;
+static GHashTable *recent_errors = NULL;
+static GString *recent_key = NULL; // scratch space for building keys
+static time_t dedup_window = 0;
+static time_t rollups_pruned = 0; // recv_time of the last prune_rollups. Protected by db_lock
+
+// every node in the database so that adding an error doesn't need to look its node up.
+// NodeIdentifier -> RegisteredNode. Protected by db_lock
+typedef struct {
+    sqlite3_int64 id;
+    bool enabled;
+} RegisteredNode;
+static GHashTable *node_registry = NULL;
+
+// messages dropped rather than added, by DropReason then ErrorCategory
+static volatile gint dropped_errors[NUM_DROP_REASONS][NUM_ERROR_CATEGORIES];
+
+// old entries are pruned once there are this many
+#define MAX_RECENT_ERRORS 4096
+
+// the connection is shared between the timer thread (ingest) and the gtk main loop.
+// Held for the duration of each public function so that transactions don't interleave
+static GRecMutex db_lock;
+
+// number of variants of ClickableType
+#define NUM_CLICKABLE_TYPES (SEARCH + 1)
+
+// statements prepared once in init_database. Parameters are bound per call and the
+// statement is reset afterwards (see finish_statement)
+typedef struct {
+    sqlite3_stmt *begin;
+    sqlite3_stmt *commit;
+    sqlite3_stmt *rollback;
+    sqlite3_stmt *add_node;
+    sqlite3_stmt *remove_node_errors;
+    sqlite3_stmt *remove_node;
+    sqlite3_stmt *node_exists;
+    sqlite3_stmt *remove_all_errors;
+    sqlite3_stmt *add_error;
+    sqlite3_stmt *merge_error;
+    sqlite3_stmt *list_racks;
+    sqlite3_stmt *list_chassis_by_rack;
+    sqlite3_stmt *list_nodes_ordered;
+    sqlite3_stmt *error_toggle_disabled;
+    sqlite3_stmt *node_toggle_disabled;
+    sqlite3_stmt *error_location;
+    // indexed by [ClickableType][show_disabled]
+    sqlite3_stmt *search[NUM_CLICKABLE_TYPES][2];
+    sqlite3_stmt *search_forward[NUM_CLICKABLE_TYPES][2];
+    sqlite3_stmt *search_backward[NUM_CLICKABLE_TYPES][2];
+    sqlite3_stmt *search_offset[NUM_CLICKABLE_TYPES][2];
+    // there are no counters for SEARCH so these are counted by the database. Indexed by [show_disabled]
+    sqlite3_stmt *count_search[2];
+    // for sync_database. Indexed by [shard]
+    sqlite3_stmt *data_version[MAX_SHARDS];
+    sqlite3_stmt *error_id_range[MAX_SHARDS];
+    sqlite3_stmt *node_summary[MAX_SHARDS];
+    sqlite3_stmt *errors_since[MAX_SHARDS];
+    // rollups. Indexed by [hourly]
+    sqlite3_stmt *rollup_nodes[2];
+    sqlite3_stmt *rollup_trend[2];
+    sqlite3_stmt *clear_rollups[2];
+    sqlite3_stmt *prune_minutes;
+} StatementCache;
+
+static StatementCache statements;
+
+// what sync_database has already seen of a database written by another process
+typedef struct {
+    int data_version;
+    sqlite3_int64 min_error_id;
+    sqlite3_int64 max_error_id;
+    sqlite3_int64 num_nodes;
+    sqlite3_int64 max_node_id;
+    sqlite3_int64 enabled_nodes;
+} DatabaseState;
+
+// set by init_database_read_only
+static bool read_only = false;
+static DatabaseState seen[MAX_SHARDS];
+
+// the databases searched, each of which is a shard. The first is main and the others are attached as shard1, shard2...
+// (see init_database_federated). Queries over them all are written with {db} and {shard} in place of each one's
+// schema name and index (see shard_sql). Error and node ids are interleaved: id * num_shards + shard
+static int num_shards = 1;
+
+// the racks add_node accepts (see set_rack_range)
+static unsigned int first_rack = 0;
+static unsigned int last_rack = UINT_MAX;
+
+// parameter SHARD_SEEN_PARAM + shard of the keyset search statements is the last id of that shard to include (NULL for all)
+#define SHARD_SEEN_PARAM 20
 
 // functions
+unsigned int get_database_generation(void) {
+    return (unsigned int) g_atomic_int_get(&generation);
+}
+
+unsigned int get_database_merges(void) {
+    return (unsigned int) g_atomic_int_get(&merges);
+}
+
+unsigned int get_unknown_node_errors(void) {
+    unsigned int ret = 0;
+    for (int category = 0; category < NUM_ERROR_CATEGORIES; category++) {
+        ret += (unsigned int) g_atomic_int_get(&dropped_errors[DROP_UNKNOWN_NODE][category]);
+    }
+    return ret;
+}
+
+unsigned int get_dropped_errors(const DropReason reason, const ErrorCategory category) {
+    assert(reason < NUM_DROP_REASONS);
+    assert(category < NUM_ERROR_CATEGORIES);
+
+    return (unsigned int) g_atomic_int_get(&dropped_errors[reason][category]);
+}
+
+// matches GHashFunc
+static guint node_identifier_hash(gconstpointer key) {
+    const NodeIdentifier *node = (const NodeIdentifier *) key;
+    return node->rack_no * 257u + node->chassis_no;
+}
+
+// matches GEqualFunc
+static gboolean node_identifier_equal(gconstpointer a, gconstpointer b) {
+    const NodeIdentifier *A = (const NodeIdentifier *) a;
+    const NodeIdentifier *B = (const NodeIdentifier *) b;
+    return (A->rack_no == B->rack_no) && (A->chassis_no == B->chassis_no);
+}
+
+// NULL if the node isn't in the database. Assumes the caller holds db_lock
+static RegisteredNode *lookup_node(const unsigned int rack_no, const unsigned int chassis_no) {
+    const NodeIdentifier key = {.rack_no = rack_no, .chassis_no = chassis_no};
+    return g_hash_table_lookup(node_registry, &key);
+}
+
+// Assumes the caller holds db_lock
+static void register_node(const unsigned int rack_no, const unsigned int chassis_no, const sqlite3_int64 id, const bool enabled) {
+    NodeIdentifier *key = g_new(NodeIdentifier, 1);
+    assert(NULL != key);
+    key->rack_no = rack_no;
+    key->chassis_no = chassis_no;
+
+    RegisteredNode *node = g_new(RegisteredNode, 1);
+    assert(NULL != node);
+    node->id = id;
+    node->enabled = enabled;
+
+    g_hash_table_replace(node_registry, key, node);
+}
+
+// the rows recent_errors points to may have gone (or their ids been reused).
+// Assumes the caller holds db_lock
+static void forget_recent_errors(void) {
+    if (NULL != recent_errors) {
+        g_hash_table_remove_all(recent_errors);
+    }
+}
+
 void set_show_disabled(bool new_val) {
-    show_disabled = new_val;
+    const gint old_val = g_atomic_int_get(&show_disabled);
+    g_atomic_int_set(&show_disabled, new_val ? 1 : 0);
+
+    // after the change so that anyone seeing the new generation also sees the new value
+    if ((new_val ? 1 : 0) != old_val) {
+        g_atomic_int_inc(&generation);
+    }
 }
 
 bool get_show_disabled(void) {
-    return show_disabled;
+    return 0 != g_atomic_int_get(&show_disabled);
 }
 
 // checks that str is a valid mac address
@@ -56,462 +246,1578 @@ bool check_mac_address(const char* str) {
     return true;
 }
 
-// removes quotes from strings so that they can go in queries safely
-static GString *fix_string(const char* str) {
-    GString *ret = g_string_new(str);
-    assert(NULL != ret);
-
-    for (gsize i = 0; i < ret->len; i++) {
-        if ('"' == ret->str[i]) {
-            #pragma GCC diagnostic push
-            #pragma GCC diagnostic ignored "-Wsign-conversion"
-            ret = g_string_insert_c(ret, i, '"');
-            #pragma GCC diagnostic pop
-            assert(NULL != ret);
-            i += 1; // don't loop forever
-        }
-    }
+// how the description of each ErrorCategory starts when it is shown. Both are CATEGORY_PREFIX_LEN long
+#define HARDWARE_PREFIX "Hardware Error: "
+#define SOFTWARE_PREFIX "Software Error: "
+#define CATEGORY_PREFIX_LEN 16
 
-    return ret;
-}
+// the description of a row of errors (or new or old in a trigger) with its category's prefix, as it is searched and shown
+#define DESCRIPTION_SQL(row) "(CASE " row ".category WHEN 1 THEN '" HARDWARE_PREFIX "' WHEN 2 THEN '" SOFTWARE_PREFIX "' \
+                              ELSE '' END || " row ".description)"
 
-static bool create_tables(void) {
-    const char *table_create_sql = \
-    "CREATE TABLE nodes(\
+// Each entry upgrades the schema by one version (PRAGMA user_version). Entry i takes a database at version i to i + 1.
+// Never change a released entry: append a new one instead so that existing databases are upgraded
+static const char *const migrations[] = {
+    // 1: the original tables. IF NOT EXISTS adopts databases created before the schema was versioned
+    "CREATE TABLE IF NOT EXISTS nodes(\
 	    id INTEGER PRIMARY KEY NOT NULL UNIQUE,\
 	    rack_no INTEGER NOT NULL,\
 	    chassis_no INTEGER NOT NULL,\
 	    enabled INTEGER DEFAULT 1,\
 	    UNIQUE(rack_no, chassis_no)\
     );\
-    CREATE TABLE errors(\
+    CREATE TABLE IF NOT EXISTS errors(\
 	    id INTEGER PRIMARY KEY NOT NULL UNIQUE,\
 	    node_id INTEGER NOT NULL,\
 	    recv_time INTEGER NOT NULL,\
 	    description TEXT NOT NULL,\
 	    valve_no INTEGER DEFAULT -1,\
 	    enabled INTEGER DEFAULT 1\
-    );";
-
-    char *errstr = NULL;
-    if (SQLITE_OK != sqlite3_exec(db, table_create_sql, NULL, NULL, &errstr)) {
-        puts(errstr);
-        return false;
-    }
-
-    return true;
+    );",
+
+    // 2: indexes matching the clickable_query filters and their ORDER BY recv_time.
+    // errors_by_node also serves remove_node
+    "CREATE INDEX IF NOT EXISTS errors_by_time ON errors(recv_time, id);\
+    CREATE INDEX IF NOT EXISTS errors_by_node ON errors(node_id, recv_time, id);\
+    CREATE INDEX IF NOT EXISTS errors_by_node_valve ON errors(node_id, valve_no, recv_time, id);",
+
+    // 3: duplicate errors merged into one row (see set_dedup_window). recv_time is when the first arrived
+    "ALTER TABLE errors ADD COLUMN last_seen INTEGER;\
+    ALTER TABLE errors ADD COLUMN occurrences INTEGER NOT NULL DEFAULT 1;\
+    UPDATE errors SET last_seen = recv_time;",
+
+    // 4: full text index of descriptions for SEARCH. The triggers keep it in step with every change to errors
+    "CREATE VIRTUAL TABLE errors_fts USING fts5(description, content = 'errors', content_rowid = 'id');\
+    CREATE TRIGGER errors_fts_insert AFTER INSERT ON errors BEGIN\
+        INSERT INTO errors_fts(rowid, description) VALUES(new.id, new.description);\
+    END;\
+    CREATE TRIGGER errors_fts_delete AFTER DELETE ON errors BEGIN\
+        INSERT INTO errors_fts(errors_fts, rowid, description) VALUES('delete', old.id, old.description);\
+    END;\
+    CREATE TRIGGER errors_fts_update AFTER UPDATE OF description ON errors BEGIN\
+        INSERT INTO errors_fts(errors_fts, rowid, description) VALUES('delete', old.id, old.description);\
+        INSERT INTO errors_fts(rowid, description) VALUES(new.id, new.description);\
+    END;\
+    INSERT INTO errors_fts(errors_fts) VALUES('rebuild');",
+
+    // 5: errors received per node valve each minute and hour, for node_activity and activity_trend.
+    // Kept up to date by triggers as errors are added and duplicates merged into them.
+    // The minutes are pruned to ROLLUP_MINUTES_KEPT as errors arrive (see prune_rollups)
+    "CREATE TABLE errors_per_minute(\
+        bucket INTEGER NOT NULL,\
+        node_id INTEGER NOT NULL,\
+        valve_no INTEGER NOT NULL,\
+        count INTEGER NOT NULL DEFAULT 0,\
+        PRIMARY KEY(bucket, node_id, valve_no)\
+    ) WITHOUT ROWID;\
+    CREATE TABLE errors_per_hour(\
+        bucket INTEGER NOT NULL,\
+        node_id INTEGER NOT NULL,\
+        valve_no INTEGER NOT NULL,\
+        count INTEGER NOT NULL DEFAULT 0,\
+        PRIMARY KEY(bucket, node_id, valve_no)\
+    ) WITHOUT ROWID;\
+    CREATE TRIGGER errors_rollup_insert AFTER INSERT ON errors BEGIN\
+        INSERT OR IGNORE INTO errors_per_minute(bucket, node_id, valve_no) VALUES(new.recv_time / 60 * 60, new.node_id, IFNULL(new.valve_no, -1));\
+        UPDATE errors_per_minute SET count = count + new.occurrences\
+            WHERE bucket = new.recv_time / 60 * 60 AND node_id = new.node_id AND valve_no = IFNULL(new.valve_no, -1);\
+        INSERT OR IGNORE INTO errors_per_hour(bucket, node_id, valve_no) VALUES(new.recv_time / 3600 * 3600, new.node_id, IFNULL(new.valve_no, -1));\
+        UPDATE errors_per_hour SET count = count + new.occurrences\
+            WHERE bucket = new.recv_time / 3600 * 3600 AND node_id = new.node_id AND valve_no = IFNULL(new.valve_no, -1);\
+    END;\
+    CREATE TRIGGER errors_rollup_merge AFTER UPDATE OF occurrences ON errors WHEN new.occurrences > old.occurrences BEGIN\
+        INSERT OR IGNORE INTO errors_per_minute(bucket, node_id, valve_no) VALUES(new.last_seen / 60 * 60, new.node_id, IFNULL(new.valve_no, -1));\
+        UPDATE errors_per_minute SET count = count + new.occurrences - old.occurrences\
+            WHERE bucket = new.last_seen / 60 * 60 AND node_id = new.node_id AND valve_no = IFNULL(new.valve_no, -1);\
+        INSERT OR IGNORE INTO errors_per_hour(bucket, node_id, valve_no) VALUES(new.last_seen / 3600 * 3600, new.node_id, IFNULL(new.valve_no, -1));\
+        UPDATE errors_per_hour SET count = count + new.occurrences - old.occurrences\
+            WHERE bucket = new.last_seen / 3600 * 3600 AND node_id = new.node_id AND valve_no = IFNULL(new.valve_no, -1);\
+    END;\
+    CREATE TRIGGER nodes_rollup_delete AFTER DELETE ON nodes BEGIN\
+        DELETE FROM errors_per_minute WHERE node_id = old.id;\
+        DELETE FROM errors_per_hour WHERE node_id = old.id;\
+    END;\
+    INSERT INTO errors_per_hour(bucket, node_id, valve_no, count)\
+        SELECT recv_time / 3600 * 3600, node_id, IFNULL(valve_no, -1), SUM(occurrences) FROM errors GROUP BY 1, 2, 3;\
+    INSERT INTO errors_per_minute(bucket, node_id, valve_no, count)\
+        SELECT recv_time / 60 * 60, node_id, IFNULL(valve_no, -1), SUM(occurrences) FROM errors\
+            WHERE recv_time >= (SELECT MAX(recv_time) FROM errors) - 60 * 2880 GROUP BY 1, 2, 3;",
+
+    // 6: the category (ErrorCategory) has its own column instead of being the start of the description.
+    // The full text index still has the prefixes so that searching for them finds the same errors as before. errors no
+    // longer holds that text so the index is contentless: only the triggers write to it and nothing reads its columns back
+    "DROP TRIGGER errors_fts_insert;\
+    DROP TRIGGER errors_fts_delete;\
+    DROP TRIGGER errors_fts_update;\
+    DROP TABLE errors_fts;\
+    ALTER TABLE errors ADD COLUMN category INTEGER NOT NULL DEFAULT 0;\
+    UPDATE errors SET category = 1, description = substr(description, 17) WHERE substr(description, 1, 16) = '" HARDWARE_PREFIX "';\
+    UPDATE errors SET category = 2, description = substr(description, 17) WHERE substr(description, 1, 16) = '" SOFTWARE_PREFIX "';\
+    CREATE VIRTUAL TABLE errors_fts USING fts5(description, content = '');\
+    CREATE TRIGGER errors_fts_insert AFTER INSERT ON errors BEGIN\
+        INSERT INTO errors_fts(rowid, description) VALUES(new.id, " DESCRIPTION_SQL("new") ");\
+    END;\
+    CREATE TRIGGER errors_fts_delete AFTER DELETE ON errors BEGIN\
+        INSERT INTO errors_fts(errors_fts, rowid, description) VALUES('delete', old.id, " DESCRIPTION_SQL("old") ");\
+    END;\
+    CREATE TRIGGER errors_fts_update AFTER UPDATE OF category, description ON errors BEGIN\
+        INSERT INTO errors_fts(errors_fts, rowid, description) VALUES('delete', old.id, " DESCRIPTION_SQL("old") ");\
+        INSERT INTO errors_fts(rowid, description) VALUES(new.id, " DESCRIPTION_SQL("new") ");\
+    END;\
+    INSERT INTO errors_fts(rowid, description) SELECT id, " DESCRIPTION_SQL("errors") " FROM errors;",
+};
+
+#define SCHEMA_VERSION ((int) G_N_ELEMENTS(migrations))
+
+// text with every token replaced by value. Free with g_free
+static char *replace_token(const char *text, const char *token, const char *value) {
+    char **parts = g_strsplit(text, token, -1);
+    assert(NULL != parts);
+    char *ret = g_strjoinv(value, parts);
+    assert(NULL != ret);
+    g_strfreev(parts);
+    return ret;
 }
 
-void init_database(const char *path) {
-    bool new_db = true;
-    if ((NULL != path) && (0 != strncmp("", path, 1))) {
-        // check to see if the database already exists
-        if (0 == access(path, F_OK)) {
-            // file exists
-            new_db = false;
-
-            // check that we have read and write permissions on the file
-            if (0 != access(path, W_OK | R_OK)) {
-                fprintf(stderr, "I don't have permission to access database file %s\n", path);
-                exit(EXIT_FAILURE);
-            } else {
-                printf("Using existing database at %s\n", path);
-                // open database with sqlite
-                assert(SQLITE_OK == sqlite3_open(path, &db));
-            }
-        } else {
-            printf("Creating a new database at %s\n", path);
-            // open database with sqlite
-            if (SQLITE_OK != sqlite3_open(path, &db)) {
-                fprintf(stderr, "I did not have permissions to create database file %s\n", path);
-                exit(EXIT_FAILURE);
-            }
-        }
-    } else {
-        puts("Creating memory resident database");
-        // open database with sqlite
-        assert(SQLITE_OK == sqlite3_open(NULL, &db));
-    }
+// sql for one shard: {db} becomes its schema name, {shard} its index, {shards} num_shards and {seen} its SHARD_SEEN_PARAM.
+// Free with g_free
+static char *shard_sql(const char *sql, const int shard) {
+    assert((shard >= 0) && (shard < num_shards));
 
-    if (new_db) {
-        create_tables();
+    char schema[16] = "main";
+    if (shard > 0) {
+        snprintf(schema, sizeof(schema), "shard%i", shard);
     }
+    char index[16];
+    snprintf(index, sizeof(index), "%i", shard);
+    char count[16];
+    snprintf(count, sizeof(count), "%i", num_shards);
+    char seen_param[16];
+    snprintf(seen_param, sizeof(seen_param), "?%i", SHARD_SEEN_PARAM + shard);
+
+    char *with_schema = replace_token(sql, "{db}", schema);
+    char *with_index = replace_token(with_schema, "{shard}", index);
+    char *with_count = replace_token(with_index, "{shards}", count);
+    char *ret = replace_token(with_count, "{seen}", seen_param);
+    g_free(with_schema);
+    g_free(with_index);
+    g_free(with_count);
+    return ret;
 }
 
-void close_database(void) {
-    assert(SQLITE_OK == sqlite3_close(db));
-}
-
-bool add_node(const unsigned int rack_no, const unsigned int chassis_no, const bool enabled) {
-    gint enabled_int;
-    if (enabled) {
-        enabled_int = 1;
-    } else {
-        enabled_int = 0;
-    }
-
-    GString *query = g_string_new(NULL);
+// head, then sql (see shard_sql) for every shard joined with UNION ALL, then tail.
+// An ORDER BY in tail applies to the whole: sqlite merges the shards' rows rather than sorting them if each is in order
+static GString *union_shards(const char *head, const char *sql, const char *tail) {
+    GString *query = g_string_new(head);
     assert(NULL != query);
 
-    g_string_printf(query,
-        "INSERT into nodes(rack_no, chassis_no, enabled) VALUES(%i, %i, %i);", 
-        rack_no, chassis_no, enabled_int);
-
-    bool ret = true;
-    char *errstr = NULL;
-    if (SQLITE_OK != sqlite3_exec(db, query->str, NULL, NULL, &errstr)) {
-        puts(errstr);
-        ret = false;
+    for (int shard = 0; shard < num_shards; shard++) {
+        if (shard > 0) {
+            g_string_append(query, " UNION ALL ");
+        }
+        char *arm = shard_sql(sql, shard);
+        g_string_append(query, arm);
+        g_free(arm);
     }
 
-    g_string_free(query, TRUE);
-
-    return ret;
+    g_string_append(query, tail);
+    return query;
 }
 
-bool remove_node(const unsigned int rack_no, const unsigned int chassis_no) {
-    // begin transaction
-    GString *query = g_string_new("begin transaction;");
-    assert(NULL != query);
-
-    // delete all of the errors associated with this node
-    g_string_append_printf(query,
-        "DELETE FROM errors WHERE node_id IN \
-            (SELECT DISTINCT id FROM nodes \
-                WHERE rack_no = %i AND chassis_no = %i);", rack_no, chassis_no);
-    
-    // delete the node
-    g_string_append_printf(query,
-        "DELETE FROM nodes WHERE rack_no = %i AND chassis_no = %i;", rack_no, chassis_no);
-
-    // commit transaction to the database
-    g_string_append(query, "commit;");
+// connection settings which are not stored in the database file
+static void set_pragmas(void) {
+    // WAL lets readers carry on while the ingest transaction is written and needs far fewer fsyncs.
+    // In WAL mode synchronous=NORMAL can only lose the last transactions on power loss, it can't corrupt the database
+    const char *pragmas = \
+        "PRAGMA journal_mode = WAL;\
+        PRAGMA synchronous = NORMAL;\
+        PRAGMA cache_size = -16384;\
+        PRAGMA temp_store = MEMORY;";
 
-    bool ret = true;
     char *errstr = NULL;
-    if (SQLITE_OK != sqlite3_exec(db, query->str, NULL, NULL, &errstr)) {
-        puts(errstr);
-        ret = false;
+    if (SQLITE_OK != sqlite3_exec(db, pragmas, NULL, NULL, &errstr)) {
+        // not fatal: we are just slower
+        printf("Failed to configure database: %s\n", errstr);
+        sqlite3_free(errstr);
     }
-
-    g_string_free(query, TRUE);
-
-    return ret;
 }
 
-bool node_exists(const unsigned int rack_no, const unsigned int chassis_no) {
-    GString *query = g_string_new(NULL);
-    assert(NULL != query);
-
-    g_string_sprintf(query, "SELECT COUNT(*) FROM nodes WHERE rack_no = %i AND chassis_no = %i;", rack_no, chassis_no);
-
+static int read_schema_version(const int shard) {
+    char *sql = shard_sql("PRAGMA {db}.user_version;", shard);
     sqlite3_stmt *statement = NULL;
-    assert(SQLITE_OK == sqlite3_prepare_v2(db, query->str, -1, &statement, NULL));
-    g_string_free(query, TRUE);
-
+    assert(SQLITE_OK == sqlite3_prepare_v2(db, sql, -1, &statement, NULL));
+    g_free(sql);
     assert(SQLITE_ROW == sqlite3_step(statement));
 
-    const int count = sqlite3_column_int(statement, 0);
+    const int version = sqlite3_column_int(statement, 0);
 
     assert(SQLITE_OK == sqlite3_finalize(statement));
-    return (count != 0);
+    return version;
 }
 
-bool remove_all_errors(void) {
-    const char *query = "DELETE FROM errors;";
-
-    bool ret = true;
-    if (SQLITE_OK != sqlite3_exec(db, query, NULL, NULL, NULL)) {
-        ret = false;
+// the search index needs SQLite to have been built with FTS5. Checked up front so that this isn't found out part way
+// through a migration
+static bool check_fts5(void) {
+    char *errstr = NULL;
+    if (SQLITE_OK != sqlite3_exec(db, "CREATE VIRTUAL TABLE temp.fts5_check USING fts5(text); DROP TABLE temp.fts5_check;",
+                                  NULL, NULL, &errstr)) {
+        fprintf(stderr, "SQLite %s was built without FTS5, which the error search needs: %s\n", sqlite3_libversion(), errstr);
+        sqlite3_free(errstr);
+        return false;
     }
 
-    return ret;
+    return true;
 }
 
-bool add_error_decoded(const uint32_t rack_no, const uint32_t chassis_no, const int valve_no, const time_t recv_time, const char *msg) {
-    GString *query = g_string_new(NULL);
-    assert(NULL != query);
+// bring the schema up to SCHEMA_VERSION. Each step is its own transaction
+static bool migrate_database(void) {
+    int version = read_schema_version(0);
+    if (version > SCHEMA_VERSION) {
+        fprintf(stderr, "Database schema version %i is newer than this program understands (%i)\n", version, SCHEMA_VERSION);
+        return false;
+    }
 
-    GString *msg_str = fix_string(msg);
+    for (; version < SCHEMA_VERSION; version++) {
+        GString *query = g_string_new("begin transaction;");
+        assert(NULL != query);
+        g_string_append(query, migrations[version]);
+        g_string_append_printf(query, "PRAGMA user_version = %i; commit;", version + 1);
 
-    g_string_printf(query,
-        "INSERT INTO errors(node_id, recv_time, description, enabled, valve_no) \
-            SELECT nodes.id, %li, \"%s\", 1, %i \
-                FROM nodes \
-                WHERE nodes.rack_no = %i AND nodes.chassis_no = %i;", \
-        recv_time, msg_str->str, valve_no, rack_no, chassis_no);
+        char *errstr = NULL;
+        const int status = sqlite3_exec(db, query->str, NULL, NULL, &errstr);
+        g_string_free(query, TRUE);
 
-    bool ret = true;
-    char *errmsg = NULL;
-    if (SQLITE_OK != sqlite3_exec(db, query->str, NULL, NULL, &errmsg)) {
-        puts(errmsg);
-        ret = false;
+        if (SQLITE_OK != status) {
+            fprintf(stderr, "Failed to upgrade database to schema version %i: %s\n", version + 1, errstr);
+            sqlite3_free(errstr);
+            sqlite3_exec(db, "rollback;", NULL, NULL, NULL);
+            return false;
+        }
     }
 
-    g_string_free(query, TRUE);
-    g_string_free(msg_str, TRUE);
-
-    return ret;
+    return true;
 }
 
-NodeIdentifier *parse_ip_address(const struct in_addr *address) {
-    assert(NULL != address);
-
-    NodeIdentifier *ret = malloc(sizeof(NodeIdentifier));
-    assert(NULL != ret);
-
-    // "Network" is big endian. We don't know what the host is
-    uint32_t addr = htonl(address->s_addr);
-    const uint32_t rack_num_n = (addr & 0x0000FF00) << 16;
-    const uint32_t chassis_num_n = (addr & 0x000000FF) << 24;
-
-    // don't assume host endianness
-    ret->rack_no = ntohl(rack_num_n);
-    ret->chassis_no = ntohl(chassis_num_n);
+bool get_database_read_only(void) {
+    g_rec_mutex_lock(&db_lock);
+    const bool ret = read_only;
+    g_rec_mutex_unlock(&db_lock);
 
     return ret;
 }
 
-bool add_error(const BufferItem *error) {
-    if (NULL == error) {
-        return false;
-    }
-
-    NodeIdentifier *node = parse_ip_address(&error->address);
-    
-    bool ret = false;
-
-    GString *error_msg = g_string_new(NULL);
-    assert(NULL != error_msg);
+int get_schema_version(void) {
+    g_rec_mutex_lock(&db_lock);
+    const int version = read_schema_version(0);
+    g_rec_mutex_unlock(&db_lock);
 
-    switch (error->msg.type) {
-        case HARD_ERROR_VALVE:
-            g_string_append_printf(error_msg, "Hardware Error: %s", 
-                error->msg.data.hardware_valve.message->str);
+    return version;
+}
 
-            ret = add_error_decoded(node->rack_no, node->chassis_no, 
-                error->msg.data.hardware_valve.valve_no,
-                error->recv_time, error_msg->str);
-            break;
+// the database can't be used without its statements so there is no point in carrying on
+static sqlite3_stmt *prepare_statement(const char *sql) {
+    assert(NULL != sql);
 
-        case HARD_ERROR_OTHER:
-            g_string_append_printf(error_msg, "Hardware Error: %s",
-                error->msg.data.hardware_other.message->str);
+    sqlite3_stmt *statement = NULL;
+    if (SQLITE_OK != sqlite3_prepare_v2(db, sql, -1, &statement, NULL)) {
+        fprintf(stderr, "Failed to prepare statement \"%s\": %s\n", sql, sqlite3_errmsg(db));
+        exit(EXIT_FAILURE);
+    }
 
-            ret = add_error_decoded(node->rack_no, node->chassis_no, -1, 
-                error->recv_time, error_msg->str);
-            break;
+    return statement;
+}
 
-        case SOFT_ERROR:
-            g_string_append_printf(error_msg, "Software Error: %s",
-                error->msg.data.software.message->str);
+// make a cached statement ready to be used again
+static void finish_statement(sqlite3_stmt *statement) {
+    sqlite3_reset(statement);
+    sqlite3_clear_bindings(statement);
+}
 
-            ret = add_error_decoded(node->rack_no, node->chassis_no, -1,
-                error->recv_time, error_msg->str);
-            break;
+// run a cached statement which does not return any rows
+static bool step_statement(sqlite3_stmt *statement) {
+    const int status = sqlite3_step(statement);
+    finish_statement(statement);
 
-        default:
-            g_string_append_printf(error_msg, "Unknown Error Type: %i",
-                error->msg.type);
-            break;
+    if (SQLITE_DONE != status) {
+        puts(sqlite3_errmsg(db));
+        return false;
     }
 
-    g_free(node);
-    g_string_free(error_msg, TRUE);
-    return ret;
+    return true;
 }
 
-void free_search_result(gpointer res) {
-    if (NULL == res) {
-        return;
-    }
-
-    SearchResult *result = (SearchResult *) res;
-    
-    g_free(result->message);
-    g_free(result);
+// a statement for one shard (see shard_sql)
+static sqlite3_stmt *prepare_shard_statement(const char *sql, const int shard) {
+    char *query = shard_sql(sql, shard);
+    sqlite3_stmt *statement = prepare_statement(query);
+    g_free(query);
+    return statement;
 }
 
-static GString *clickable_query(const Clickable *search, const char* fields) {
-    if (NULL == search) {
-        return NULL;
-    }
+// a statement over every shard (see union_shards)
+static sqlite3_stmt *prepare_union(const char *head, const char *sql, const char *tail) {
+    GString *query = union_shards(head, sql, tail);
+    sqlite3_stmt *statement = prepare_statement(query->str);
+    g_string_free(query, TRUE);
+    return statement;
+}
 
-    // construct query
-    GString *query = g_string_new("SELECT"); 
+// one shard's part of a query: tables are {db}.table (see shard_sql)
+static GString *clickable_query(const ClickableType type, const bool include_disabled, const char* fields) {
+    // construct query. Parameters are bound by bind_clickable
+    GString *query = g_string_new("SELECT");
     assert(NULL != query);
-    g_string_append_printf(query, " %s \
-                    FROM errors \
-                    INNER JOIN nodes \
-                    ON errors.node_id = nodes.id ", fields); 
-    if (!show_disabled) {
-        g_string_append(query, "WHERE nodes.enabled = 1 AND errors.enabled = 1 "); 
+    if (SEARCH == type) {
+        // CROSS JOIN makes sqlite start from the index's matches rather than scanning errors for them
+        g_string_append_printf(query, " %s \
+                        FROM {db}.errors_fts \
+                        CROSS JOIN {db}.errors AS errors \
+                        ON errors.id = errors_fts.rowid \
+                        INNER JOIN {db}.nodes AS nodes \
+                        ON errors.node_id = nodes.id \
+                        WHERE errors_fts MATCH ?8 ", fields);
+    } else {
+        g_string_append_printf(query, " %s \
+                        FROM {db}.errors AS errors \
+                        INNER JOIN {db}.nodes AS nodes \
+                        ON errors.node_id = nodes.id \
+                        WHERE 1 ", fields);
+    }
+    if (!include_disabled) {
+        g_string_append(query, "AND nodes.enabled = 1 AND errors.enabled = 1 ");
     }
 
-    switch(search->type) {
+    switch(type) {
         case ALL:
+        case SEARCH:
             break;
         case RACK:
-            g_string_append_printf(query, "AND nodes.rack_no = %i", search->rack_num); 
+            g_string_append(query, "AND nodes.rack_no = ?1 ");
             break;
         case CHASSIS:
-            g_string_append_printf(query, "AND nodes.rack_no = %i AND nodes.chassis_no = %i", search->rack_num, search->chassis_num);
+            g_string_append(query, "AND nodes.rack_no = ?1 AND nodes.chassis_no = ?2 ");
             break;
         case VALVE:
-            g_string_append_printf(query, "AND nodes.rack_no = %i AND nodes.chassis_no = %i AND errors.valve_no = %i", search->rack_num, search->chassis_num, search->valve_num);
+            g_string_append(query, "AND nodes.rack_no = ?1 AND nodes.chassis_no = ?2 AND errors.valve_no = ?3 ");
             break;
         default:
             g_string_free(query, TRUE);
-            g_print("I don't know how to search for that!\n");
             return NULL;
     }
 
     return query;
 }
 
-GList *search_clickable(const Clickable *search) {
-    GString *query = clickable_query(search, "errors.recv_time, errors.description, nodes.rack_no, nodes.chassis_no, errors.valve_no, nodes.enabled, errors.enabled, errors.id");
-    if (NULL == query) {
-        return NULL;
-    }
-    g_string_append(query, " ORDER BY errors.recv_time;");
-
-    GList *results = NULL; // empty list
+// an fts5 query for every word of text. Each word is quoted so that nothing the user types is taken as query syntax.
+// Free with g_free. Text without any words gives an empty phrase, which matches nothing
+static char *fts_query(const char *text) {
+    char **words = g_strsplit_set(text, " \t\n", -1);
+    assert(NULL != words);
 
-    sqlite3_stmt *statement = NULL;
-    if (SQLITE_OK != sqlite3_prepare_v2(db, query->str, -1, &statement, NULL)) {
-        g_string_free(query, TRUE);
-        return NULL;
-    }
-    g_string_free(query, TRUE);
+    GString *query = g_string_new(NULL);
+    assert(NULL != query);
+    for (char **word = words; NULL != *word; word++) {
+        if ('\0' == **word) {
+            continue;
+        }
 
-    int status = SQLITE_ERROR;
-    do {
-        status = sqlite3_step(statement);
-        if (SQLITE_DONE == status) {
-            break;
-        } else if (SQLITE_ROW != status) {
-            assert(SQLITE_OK == sqlite3_finalize(statement));
-            puts("Bad sqlite3_step");
-            g_list_free_full(results, free_search_result);
-            return NULL;
+        if (0 != query->len) {
+            g_string_append_c(query, ' ');
         }
-        // status == SQL_ROW so get the data
-        SearchResult *res = malloc(sizeof(SearchResult));
-        assert(NULL != res);
+        g_string_append_c(query, '"');
+        for (const char *c = *word; '\0' != *c; c++) {
+            if ('"' == *c) {
+                g_string_append_c(query, '"');
+            }
+            g_string_append_c(query, *c);
+        }
+        g_string_append_c(query, '"');
+    }
+    g_strfreev(words);
 
-        time_t recv_time = sqlite3_column_int64(statement, 0);
-        struct tm *time = localtime(&recv_time);
-        assert(NULL != time);
-        char *time_str = asctime(time);
-        assert(NULL != time_str);
+    if (0 == query->len) {
+        g_string_append(query, "\"\"");
+    }
+    return g_string_free(query, FALSE);
+}
 
-        GString *msg = g_string_new(time_str);
-        assert(NULL != msg);
-        //g_free(time_str);
+// bind the parameters used by the clickable_query for search->type
+static void bind_clickable(sqlite3_stmt *statement, const Clickable *search) {
+    switch(search->type) {
+        case SEARCH: {
+            // text might not be terminated if it came from outside
+            char text[SEARCH_TEXT_LEN];
+            g_strlcpy(text, search->text, sizeof(text));
 
-        // remove the year and newline from the time string
-        g_string_truncate(msg, msg->len - 5);
+            sqlite3_bind_text(statement, 8, fts_query(text), -1, g_free);
+            break;
+        }
+        case VALVE:
+            sqlite3_bind_int(statement, 3, search->valve_num);
+            // fall through
+        case CHASSIS:
+            sqlite3_bind_int64(statement, 2, search->chassis_num);
+            // fall through
+        case RACK:
+            sqlite3_bind_int64(statement, 1, search->rack_num);
+            break;
+        default:
+            break;
+    }
+}
 
-        #pragma GCC diagnostic push
-        #pragma GCC diagnostic ignored "-Wpointer-sign"
-        g_string_append(msg, sqlite3_column_text(statement, 1));
-        #pragma GCC diagnostic pop
-        res->message = msg->str;
-        g_string_free(msg, FALSE);
+static void prepare_statements(void) {
+    statements.begin = prepare_statement("begin transaction;");
+    statements.commit = prepare_statement("commit;");
+    statements.rollback = prepare_statement("rollback;");
 
-        #pragma GCC diagnostic push
-        #pragma GCC diagnostic ignored "-Wsign-conversion"
-        res->rack_no = sqlite3_column_int(statement, 2);
-        res->chassis_no = sqlite3_column_int(statement, 3);
-        #pragma GCC diagnostic pop
-        res->valve_no = sqlite3_column_int(statement, 4);
+    statements.add_node = prepare_statement("INSERT into nodes(rack_no, chassis_no, enabled) VALUES(?1, ?2, ?3);");
+    statements.remove_node_errors = prepare_statement(
+        "DELETE FROM errors WHERE node_id IN \
+            (SELECT DISTINCT id FROM nodes \
+                WHERE rack_no = ?1 AND chassis_no = ?2);");
+    statements.remove_node = prepare_statement("DELETE FROM nodes WHERE rack_no = ?1 AND chassis_no = ?2;");
+    statements.node_exists = prepare_union("SELECT COUNT(*) FROM (", "SELECT 1 FROM {db}.nodes WHERE rack_no = ?1 AND chassis_no = ?2", ");");
+    statements.remove_all_errors = prepare_statement("DELETE FROM errors;");
+
+    statements.add_error = prepare_statement(
+        "INSERT INTO errors(node_id, recv_time, category, description, enabled, valve_no, last_seen) VALUES(?4, ?1, ?5, ?2, 1, ?3, ?1);");
+    statements.merge_error = prepare_statement(
+        "UPDATE errors SET occurrences = occurrences + 1, last_seen = MAX(last_seen, ?1) WHERE id = ?2;");
+
+    statements.list_racks = prepare_union("SELECT DISTINCT rack_no FROM (", "SELECT rack_no FROM {db}.nodes", ");");
+    statements.list_chassis_by_rack = prepare_union("SELECT DISTINCT chassis_no FROM (",
+                                                    "SELECT chassis_no FROM {db}.nodes WHERE rack_no = ?1", ");");
+    // the UNIQUE(rack_no, chassis_no) index already has this order so the shards are merged rather than sorted
+    statements.list_nodes_ordered = prepare_union("", "SELECT rack_no, chassis_no FROM {db}.nodes", " ORDER BY 1, 2;");
+
+    statements.error_toggle_disabled = prepare_statement("UPDATE errors SET enabled = 1 - enabled WHERE id = ?1;");
+    statements.node_toggle_disabled = prepare_statement("UPDATE nodes SET enabled = 1 - enabled WHERE rack_no = ?1 AND chassis_no = ?2;");
+    statements.error_location = prepare_statement(
+        "SELECT nodes.rack_no, nodes.chassis_no, errors.valve_no, errors.enabled \
+            FROM errors \
+            INNER JOIN nodes \
+            ON errors.node_id = nodes.id \
+            WHERE errors.id = ?1;");
+
+    // search and count statements for each variant of ClickableType, over every shard.
+    // Parameters ?1 to ?3 are bound by bind_clickable. Results are in (recv_time, id) order, which for interleaved ids is
+    // (recv_time, local_id, shard): each shard's rows come in that order from its indexes so sqlite only has to merge them
+    const char *search_fields = "errors.recv_time, " DESCRIPTION_SQL("errors") ", nodes.rack_no, nodes.chassis_no, errors.valve_no, nodes.enabled, errors.enabled, \
+                                 errors.id * {shards} + {shard}, errors.occurrences, errors.last_seen, errors.id AS local_id, {shard} AS shard";
+    for (int type = 0; type < NUM_CLICKABLE_TYPES; type++) {
+        for (int include_disabled = 0; include_disabled < 2; include_disabled++) {
+            // everything
+            GString *search = clickable_query((ClickableType) type, include_disabled, search_fields);
+            assert(NULL != search);
+            statements.search[type][include_disabled] = prepare_union("", search->str, " ORDER BY 1, 11, 12;");
+            g_string_free(search, TRUE);
+
+            // keyset pages: ?6 rows after or before the key (?5 recv_time, ?4 id)
+            GString *forward = clickable_query((ClickableType) type, include_disabled, search_fields);
+            assert(NULL != forward);
+            g_string_append(forward, "AND (errors.recv_time > ?5 OR (errors.recv_time = ?5 AND errors.id * {shards} + {shard} > ?4)) \
+                AND ({seen} IS NULL OR errors.id <= {seen})");
+            statements.search_forward[type][include_disabled] = prepare_union("", forward->str, " ORDER BY 1, 11, 12 LIMIT ?6;");
+            g_string_free(forward, TRUE);
+
+            GString *backward = clickable_query((ClickableType) type, include_disabled, search_fields);
+            assert(NULL != backward);
+            g_string_append(backward, "AND (errors.recv_time < ?5 OR (errors.recv_time = ?5 AND errors.id * {shards} + {shard} < ?4)) \
+                AND ({seen} IS NULL OR errors.id <= {seen})");
+            statements.search_backward[type][include_disabled] = prepare_union("", backward->str,
+                                                                           " ORDER BY 1 DESC, 11 DESC, 12 DESC LIMIT ?6;");
+            g_string_free(backward, TRUE);
+
+            // for jumping to an arbitrary position where we don't have a key to start from
+            GString *offset = clickable_query((ClickableType) type, include_disabled, search_fields);
+            assert(NULL != offset);
+            statements.search_offset[type][include_disabled] = prepare_union("", offset->str, " ORDER BY 1, 11, 12 LIMIT ?6 OFFSET ?7;");
+            g_string_free(offset, TRUE);
+        }
+    }
 
-        int node_enabled = sqlite3_column_int(statement, 5);
-        int error_enabled = sqlite3_column_int(statement, 6);
-        res->enabled = 1 == (node_enabled & error_enabled);
+    for (int include_disabled = 0; include_disabled < 2; include_disabled++) {
+        GString *count = clickable_query(SEARCH, include_disabled, "COUNT(*) AS num_errors");
+        assert(NULL != count);
+        statements.count_search[include_disabled] = prepare_union("SELECT SUM(num_errors) FROM (", count->str, ");");
+        g_string_free(count, TRUE);
+    }
 
-        res->id = sqlite3_column_int(statement, 7);
+    // data_version changes whenever another connection commits. MIN and MAX of a rowid are a lookup, not a scan
+    for (int shard = 0; shard < num_shards; shard++) {
+        statements.data_version[shard] = prepare_shard_statement("PRAGMA {db}.data_version;", shard);
+        statements.error_id_range[shard] = prepare_shard_statement("SELECT IFNULL(MIN(id), 0), IFNULL(MAX(id), 0) FROM {db}.errors;", shard);
+        statements.node_summary[shard] = prepare_shard_statement(
+            "SELECT COUNT(*), IFNULL(MAX(id), 0), IFNULL(SUM(enabled), 0) FROM {db}.nodes;", shard);
+        statements.errors_since[shard] = prepare_shard_statement(
+            "SELECT nodes.rack_no, nodes.chassis_no, errors.valve_no, errors.enabled \
+                FROM {db}.errors AS errors \
+                INNER JOIN {db}.nodes AS nodes \
+                ON errors.node_id = nodes.id \
+                WHERE errors.id > ?1;", shard);
+    }
 
-        results = g_list_append(results, res);
-    } while (true);
+    // the rollups' primary keys start with the bucket so these only read the buckets asked for
+    const char *rollup_tables[2] = {"errors_per_minute", "errors_per_hour"};
+    for (int hourly = 0; hourly < 2; hourly++) {
+        GString *query = g_string_new(NULL);
+        assert(NULL != query);
 
-    assert(SQLITE_OK == sqlite3_finalize(statement));
+        // nodes are only in one shard so each shard's totals are already complete
+        g_string_printf(query, "SELECT nodes.rack_no, nodes.chassis_no, SUM(rollup.count) \
+                FROM {db}.%s AS rollup \
+                INNER JOIN {db}.nodes AS nodes \
+                ON rollup.node_id = nodes.id \
+                WHERE rollup.bucket >= ?1 \
+                GROUP BY rollup.node_id", rollup_tables[hourly]);
+        statements.rollup_nodes[hourly] = prepare_union("", query->str, ";");
 
-    return results;
-}    
+        g_string_printf(query, "SELECT bucket, count FROM {db}.%s WHERE bucket >= ?1", rollup_tables[hourly]);
+        statements.rollup_trend[hourly] = prepare_union("SELECT bucket, SUM(count) FROM (", query->str,
+                                                        ") GROUP BY bucket ORDER BY bucket;");
 
-int count_clickable(const Clickable *search) {
-    GString *query = clickable_query(search, "Count(*)");
-    if (NULL == query) {
-        return -1;
-    }
-    g_string_append_c(query, ';');
+        g_string_printf(query, "DELETE FROM %s;", rollup_tables[hourly]);
+        statements.clear_rollups[hourly] = prepare_statement(query->str);
 
-    sqlite3_stmt *statement = NULL;
-    if (SQLITE_OK != sqlite3_prepare_v2(db, query->str, -1, &statement, NULL)) {
         g_string_free(query, TRUE);
-        return -1;
     }
-    g_string_free(query, TRUE);
+    statements.prune_minutes = prepare_statement("DELETE FROM errors_per_minute WHERE bucket < ?1;");
+}
 
-    // there should only be one row
-    if (SQLITE_ROW != sqlite3_step(statement)) {
-        assert(SQLITE_OK == sqlite3_finalize(statement));
-        return -1;
+static void finalize_statements(void) {
+    // every member of StatementCache is a sqlite3_stmt *
+    sqlite3_stmt **all = (sqlite3_stmt **) &statements;
+    for (size_t i = 0; i < sizeof(statements) / sizeof(sqlite3_stmt *); i++) {
+        sqlite3_finalize(all[i]);
     }
 
-    int count = sqlite3_column_int(statement, 0);
-    assert(SQLITE_OK == sqlite3_finalize(statement));
-
-    return count;
+    memset(&statements, 0, sizeof(statements));
 }
 
-GList *list_racks(void) {
-    const char* query = "SELECT DISTINCT rack_no FROM nodes;";
-
-    GList *results = NULL; // empty list
+// count everything already in the database. This is the only full scan: afterwards the counters are kept up to date as things change.
+// Assumes the caller holds db_lock
+static void load_counters(void) {
+    counters_reset();
 
-    sqlite3_stmt *statement = NULL;
-    if (SQLITE_OK != sqlite3_prepare_v2(db, query, -1, &statement, NULL)) {
-        puts("Error constructing list_racks query");
-        return NULL;
+    sqlite3_stmt *node_list = prepare_union("", "SELECT rack_no, chassis_no, enabled FROM {db}.nodes", ";");
+    while (SQLITE_ROW == sqlite3_step(node_list)) {
+        #pragma GCC diagnostic push
+        #pragma GCC diagnostic ignored "-Wsign-conversion"
+        counters_add_node(sqlite3_column_int(node_list, 0), sqlite3_column_int(node_list, 1), 1 == sqlite3_column_int(node_list, 2));
+        #pragma GCC diagnostic pop
     }
-
-    int status = SQLITE_ERROR;
-    do {
-        status = sqlite3_step(statement);
+    sqlite3_finalize(node_list);
+
+    sqlite3_stmt *error_counts = prepare_union("",
+        "SELECT nodes.rack_no, nodes.chassis_no, errors.valve_no, COUNT(*), SUM(errors.enabled) \
+            FROM {db}.errors AS errors \
+            INNER JOIN {db}.nodes AS nodes \
+            ON errors.node_id = nodes.id \
+            GROUP BY errors.node_id, errors.valve_no", ";");
+    while (SQLITE_ROW == sqlite3_step(error_counts)) {
+        #pragma GCC diagnostic push
+        #pragma GCC diagnostic ignored "-Wsign-conversion"
+        counters_add_errors(sqlite3_column_int(error_counts, 0), sqlite3_column_int(error_counts, 1), sqlite3_column_int(error_counts, 2),
+                            sqlite3_column_int(error_counts, 3), sqlite3_column_int(error_counts, 4));
+        #pragma GCC diagnostic pop
+    }
+    sqlite3_finalize(error_counts);
+}
+
+// archive_old_errors relies on being able to hand freed pages back with PRAGMA incremental_vacuum.
+// Databases created before it existed are rebuilt once to turn this on
+static void enable_incremental_vacuum(void) {
+    sqlite3_stmt *statement = prepare_statement("PRAGMA auto_vacuum;");
+    assert(SQLITE_ROW == sqlite3_step(statement));
+    const int mode = sqlite3_column_int(statement, 0);
+    sqlite3_finalize(statement);
+
+    if (2 == mode) { // INCREMENTAL
+        return;
+    }
+
+    statement = prepare_statement("SELECT COUNT(*) FROM sqlite_master;");
+    assert(SQLITE_ROW == sqlite3_step(statement));
+    const bool has_tables = (0 != sqlite3_column_int(statement, 0));
+    sqlite3_finalize(statement);
+
+    // an empty database takes the setting straight away. Otherwise it only takes effect once the file is rebuilt
+    const char *query = "PRAGMA auto_vacuum = INCREMENTAL;";
+    if (has_tables) {
+        puts("Rebuilding the database so that archived errors free space (this only happens once)");
+        query = "PRAGMA auto_vacuum = INCREMENTAL; VACUUM;";
+    }
+
+    char *errstr = NULL;
+    if (SQLITE_OK != sqlite3_exec(db, query, NULL, NULL, &errstr)) {
+        // not fatal: the file just doesn't shrink
+        printf("Failed to enable incremental vacuum: %s\n", errstr);
+        sqlite3_free(errstr);
+    }
+}
+
+// fill node_registry from the database. Assumes the caller holds db_lock
+static void load_node_registry(void) {
+    g_hash_table_remove_all(node_registry);
+
+    sqlite3_stmt *node_list = prepare_union("", "SELECT rack_no, chassis_no, id * {shards} + {shard}, enabled FROM {db}.nodes", ";");
+    while (SQLITE_ROW == sqlite3_step(node_list)) {
+        #pragma GCC diagnostic push
+        #pragma GCC diagnostic ignored "-Wsign-conversion"
+        register_node(sqlite3_column_int(node_list, 0), sqlite3_column_int(node_list, 1), sqlite3_column_int64(node_list, 2),
+                      1 == sqlite3_column_int(node_list, 3));
+        #pragma GCC diagnostic pop
+    }
+    sqlite3_finalize(node_list);
+}
+
+// the state of one shard, with its own ids. Assumes the caller holds db_lock
+static void read_database_state(const int shard, DatabaseState *state) {
+    sqlite3_stmt *data_version = statements.data_version[shard];
+    assert(SQLITE_ROW == sqlite3_step(data_version));
+    state->data_version = sqlite3_column_int(data_version, 0);
+    finish_statement(data_version);
+
+    sqlite3_stmt *error_id_range = statements.error_id_range[shard];
+    assert(SQLITE_ROW == sqlite3_step(error_id_range));
+    state->min_error_id = sqlite3_column_int64(error_id_range, 0);
+    state->max_error_id = sqlite3_column_int64(error_id_range, 1);
+    finish_statement(error_id_range);
+
+    sqlite3_stmt *node_summary = statements.node_summary[shard];
+    assert(SQLITE_ROW == sqlite3_step(node_summary));
+    state->num_nodes = sqlite3_column_int64(node_summary, 0);
+    state->max_node_id = sqlite3_column_int64(node_summary, 1);
+    state->enabled_nodes = sqlite3_column_int64(node_summary, 2);
+    finish_statement(node_summary);
+}
+
+// everything kept in memory about a freshly opened database
+static void load_database(void) {
+    prepare_statements();
+
+    // one read transaction so that what is counted matches seen
+    step_statement(statements.begin);
+
+    counters_init();
+    load_counters();
+
+    node_registry = g_hash_table_new_full(node_identifier_hash, node_identifier_equal, g_free, g_free);
+    assert(NULL != node_registry);
+    load_node_registry();
+    for (int reason = 0; reason < NUM_DROP_REASONS; reason++) {
+        for (int category = 0; category < NUM_ERROR_CATEGORIES; category++) {
+            g_atomic_int_set(&dropped_errors[reason][category], 0);
+        }
+    }
+
+    for (int shard = 0; shard < num_shards; shard++) {
+        read_database_state(shard, &seen[shard]);
+    }
+    step_statement(statements.commit);
+
+    recent_errors = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    assert(NULL != recent_errors);
+    recent_key = g_string_new(NULL);
+    assert(NULL != recent_key);
+}
+
+void init_database(const char *path) {
+    read_only = false;
+    num_shards = 1;
+    first_rack = 0;
+    last_rack = UINT_MAX;
+    rollups_pruned = 0;
+
+    if ((NULL != path) && (0 != strncmp("", path, 1))) {
+        // check to see if the database already exists
+        if (0 == access(path, F_OK)) {
+            // file exists
+            // check that we have read and write permissions on the file
+            if (0 != access(path, W_OK | R_OK)) {
+                fprintf(stderr, "I don't have permission to access database file %s\n", path);
+                exit(EXIT_FAILURE);
+            } else {
+                printf("Using existing database at %s\n", path);
+                // open database with sqlite
+                assert(SQLITE_OK == sqlite3_open(path, &db));
+            }
+        } else {
+            printf("Creating a new database at %s\n", path);
+            // open database with sqlite
+            if (SQLITE_OK != sqlite3_open(path, &db)) {
+                fprintf(stderr, "I did not have permissions to create database file %s\n", path);
+                exit(EXIT_FAILURE);
+            }
+        }
+    } else {
+        puts("Creating memory resident database");
+        // open database with sqlite
+        assert(SQLITE_OK == sqlite3_open(NULL, &db));
+    }
+
+    if (!check_fts5()) {
+        exit(EXIT_FAILURE);
+    }
+
+    set_pragmas();
+    enable_incremental_vacuum();
+
+    if (!migrate_database()) {
+        exit(EXIT_FAILURE);
+    }
+
+    load_database();
+}
+
+void init_database_read_only(const char *path) {
+    assert(NULL != path);
+
+    init_database_federated(&path, 1);
+}
+
+void init_database_federated(const char *const *paths, const int num_paths) {
+    assert(NULL != paths);
+    assert((num_paths > 0) && (num_paths <= MAX_SHARDS));
+
+    // the writers own the files' settings so there are no pragmas or migrations here.
+    // Attached databases are opened read only like main
+    if (SQLITE_OK != sqlite3_open_v2(paths[0], &db, SQLITE_OPEN_READONLY, NULL)) {
+        fprintf(stderr, "Unable to open database file %s: %s\n", paths[0], sqlite3_errmsg(db));
+        exit(EXIT_FAILURE);
+    }
+    read_only = true;
+    num_shards = 0;
+
+    if (!check_fts5()) {
+        exit(EXIT_FAILURE);
+    }
+
+    for (int shard = 0; shard < num_paths; shard++) {
+        num_shards = shard + 1;
+        if (shard > 0) {
+            char *attach = shard_sql("ATTACH DATABASE ?1 AS {db};", shard);
+            sqlite3_stmt *statement = prepare_statement(attach);
+            g_free(attach);
+            sqlite3_bind_text(statement, 1, paths[shard], -1, SQLITE_STATIC);
+            const int status = sqlite3_step(statement);
+            sqlite3_finalize(statement);
+
+            if (SQLITE_DONE != status) {
+                fprintf(stderr, "Unable to open database file %s: %s\n", paths[shard], sqlite3_errmsg(db));
+                exit(EXIT_FAILURE);
+            }
+        }
+        printf("Watching database at %s\n", paths[shard]);
+
+        const int version = read_schema_version(shard);
+        if (SCHEMA_VERSION != version) {
+            fprintf(stderr, "Database schema version %i of %s is not %i: it has to be opened for writing first (see --headless)\n",
+                version, paths[shard], SCHEMA_VERSION);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    load_database();
+}
+
+int sync_database(GArray **keys) {
+    if (NULL != keys) {
+        *keys = NULL;
+    }
+
+    g_rec_mutex_lock(&db_lock);
+    if (!read_only) {
+        // every change is made through this connection so everything in memory is already up to date
+        g_rec_mutex_unlock(&db_lock);
+        return 0;
+    }
+
+    const gint64 timer = metrics_start();
+    step_statement(statements.begin);
+
+    DatabaseState now[MAX_SHARDS];
+    bool changed = false;
+    for (int shard = 0; shard < num_shards; shard++) {
+        read_database_state(shard, &now[shard]);
+        changed = changed || (now[shard].data_version != seen[shard].data_version);
+    }
+    if (!changed) {
+        step_statement(statements.commit);
+        g_rec_mutex_unlock(&db_lock);
+        return 0;
+    }
+
+    bool nodes_changed = false;
+    bool errors_gone = false;
+    for (int shard = 0; shard < num_shards; shard++) {
+        const DatabaseState *was = &seen[shard];
+        const DatabaseState *is = &now[shard];
+        nodes_changed = nodes_changed || (is->num_nodes != was->num_nodes) || (is->max_node_id != was->max_node_id) ||
+                        (is->enabled_nodes != was->enabled_nodes);
+        errors_gone = errors_gone || (is->min_error_id != was->min_error_id) || (is->max_error_id < was->max_error_id);
+    }
+
+    int changes = 0;
+    if (nodes_changed || errors_gone) {
+        // errors have gone (archived or removed with their node): start again
+        load_counters();
+        load_node_registry();
+        g_atomic_int_inc(&generation);
+        changes |= DATABASE_ERRORS_CHANGED;
+        if (nodes_changed) {
+            changes |= DATABASE_NODES_CHANGED;
+        }
+    } else {
+        GArray *added = g_array_new(FALSE, FALSE, sizeof(ErrorKey));
+        assert(NULL != added);
+
+        for (int shard = 0; shard < num_shards; shard++) {
+            if (now[shard].max_error_id <= seen[shard].max_error_id) {
+                continue;
+            }
+
+            sqlite3_stmt *statement = statements.errors_since[shard];
+            sqlite3_bind_int64(statement, 1, seen[shard].max_error_id);
+            while (SQLITE_ROW == sqlite3_step(statement)) {
+                ErrorKey key;
+                #pragma GCC diagnostic push
+                #pragma GCC diagnostic ignored "-Wsign-conversion"
+                key.rack_no = sqlite3_column_int(statement, 0);
+                key.chassis_no = sqlite3_column_int(statement, 1);
+                #pragma GCC diagnostic pop
+                key.valve_no = sqlite3_column_int(statement, 2);
+                counters_add_errors(key.rack_no, key.chassis_no, key.valve_no, 1, (unsigned int) sqlite3_column_int(statement, 3));
+                g_array_append_val(added, key);
+            }
+            finish_statement(statement);
+        }
+
+        if (0 == added->len) {
+            g_array_unref(added);
+        } else {
+            changes |= DATABASE_ERRORS_ADDED;
+            if (NULL != keys) {
+                *keys = added;
+            } else {
+                g_array_unref(added);
+            }
+        }
+    }
+
+    // the other changes made in place are duplicates being merged (see get_database_merges).
+    // Errors disabled by another writer aren't noticed until the next reload
+    g_atomic_int_inc(&merges);
+    if (0 == changes) {
+        changes = DATABASE_ERRORS_CHANGED;
+    }
+
+    memcpy(seen, now, sizeof(now[0]) * (size_t) num_shards);
+    step_statement(statements.commit);
+    g_rec_mutex_unlock(&db_lock);
+    metrics_finish(METRIC_SQL_SYNC, timer);
+    return changes;
+}
+
+void close_database(void) {
+    finalize_statements();
+    counters_free();
+    g_hash_table_destroy(node_registry);
+    node_registry = NULL;
+    g_hash_table_destroy(recent_errors);
+    recent_errors = NULL;
+    g_string_free(recent_key, TRUE);
+    recent_key = NULL;
+    assert(SQLITE_OK == sqlite3_close(db));
+}
+
+void set_rack_range(const unsigned int first, const unsigned int last) {
+    assert(first <= last);
+
+    g_rec_mutex_lock(&db_lock);
+    first_rack = first;
+    last_rack = last;
+    g_rec_mutex_unlock(&db_lock);
+}
+
+bool add_node_allowed(const unsigned int rack_no) {
+    g_rec_mutex_lock(&db_lock);
+    const bool ret = (rack_no >= first_rack) && (rack_no <= last_rack);
+    g_rec_mutex_unlock(&db_lock);
+
+    return ret;
+}
+
+bool add_node(const unsigned int rack_no, const unsigned int chassis_no, const bool enabled) {
+    g_rec_mutex_lock(&db_lock);
+
+    // another collector's database has this rack
+    if (!add_node_allowed(rack_no)) {
+        printf("Rack %u isn't kept in this database (only racks %u to %u)\n", rack_no, first_rack, last_rack);
+        g_rec_mutex_unlock(&db_lock);
+        return false;
+    }
+
+    sqlite3_stmt *statement = statements.add_node;
+    sqlite3_bind_int64(statement, 1, rack_no);
+    sqlite3_bind_int64(statement, 2, chassis_no);
+    sqlite3_bind_int(statement, 3, enabled ? 1 : 0);
+
+    const bool ret = step_statement(statement);
+    if (ret) {
+        counters_add_node(rack_no, chassis_no, enabled);
+        register_node(rack_no, chassis_no, sqlite3_last_insert_rowid(db), enabled);
+    }
+
+    g_rec_mutex_unlock(&db_lock);
+    return ret;
+}
+
+bool add_nodes(const NodeIdentifier *nodes, const size_t num_nodes, const bool enabled) {
+    assert((NULL != nodes) || (0 == num_nodes));
+
+    g_rec_mutex_lock(&db_lock);
+
+    // one transaction (and so one fsync) for the whole list
+    if (!step_statement(statements.begin)) {
+        g_rec_mutex_unlock(&db_lock);
+        return false;
+    }
+
+    bool ret = true;
+    for (size_t i = 0; ret && (i < num_nodes); i++) {
+        ret = add_node(nodes[i].rack_no, nodes[i].chassis_no, enabled);
+    }
+
+    if (ret) {
+        ret = step_statement(statements.commit);
+    }
+
+    if (!ret) {
+        step_statement(statements.rollback);
+
+        // add_node counted and registered the nodes before the rollback
+        load_counters();
+        load_node_registry();
+    }
+
+    g_rec_mutex_unlock(&db_lock);
+    return ret;
+}
+
+bool remove_node(const unsigned int rack_no, const unsigned int chassis_no) {
+    g_rec_mutex_lock(&db_lock);
+
+    if (!step_statement(statements.begin)) {
+        g_rec_mutex_unlock(&db_lock);
+        return false;
+    }
+
+    // delete all of the errors associated with this node
+    sqlite3_bind_int64(statements.remove_node_errors, 1, rack_no);
+    sqlite3_bind_int64(statements.remove_node_errors, 2, chassis_no);
+    bool ret = step_statement(statements.remove_node_errors);
+
+    // delete the node
+    if (ret) {
+        sqlite3_bind_int64(statements.remove_node, 1, rack_no);
+        sqlite3_bind_int64(statements.remove_node, 2, chassis_no);
+        ret = step_statement(statements.remove_node);
+    }
+
+    // commit transaction to the database
+    if (ret) {
+        ret = step_statement(statements.commit);
+    }
+
+    if (!ret) {
+        step_statement(statements.rollback);
+    } else {
+        counters_remove_node(rack_no, chassis_no);
+        const NodeIdentifier key = {.rack_no = rack_no, .chassis_no = chassis_no};
+        g_hash_table_remove(node_registry, &key);
+        forget_recent_errors();
+        g_atomic_int_inc(&generation);
+    }
+
+    g_rec_mutex_unlock(&db_lock);
+    return ret;
+}
+
+bool node_exists(const unsigned int rack_no, const unsigned int chassis_no) {
+    g_rec_mutex_lock(&db_lock);
+
+    sqlite3_stmt *statement = statements.node_exists;
+    sqlite3_bind_int64(statement, 1, rack_no);
+    sqlite3_bind_int64(statement, 2, chassis_no);
+
+    assert(SQLITE_ROW == sqlite3_step(statement));
+
+    const int count = sqlite3_column_int(statement, 0);
+
+    finish_statement(statement);
+    g_rec_mutex_unlock(&db_lock);
+    return (count != 0);
+}
+
+bool remove_all_errors(void) {
+    g_rec_mutex_lock(&db_lock);
+    const bool ret = step_statement(statements.remove_all_errors) && step_statement(statements.clear_rollups[0]) &&
+                     step_statement(statements.clear_rollups[1]);
+    if (ret) {
+        counters_clear_errors();
+    }
+    forget_recent_errors();
+    g_atomic_int_inc(&generation);
+    g_rec_mutex_unlock(&db_lock);
+
+    return ret;
+}
+
+void set_dedup_window(const time_t seconds) {
+    g_rec_mutex_lock(&db_lock);
+    dedup_window = (seconds > 0) ? seconds : 0;
+    forget_recent_errors();
+    g_rec_mutex_unlock(&db_lock);
+}
+
+// matches GHRFunc
+static gboolean recent_error_expired(__attribute__((unused)) gpointer key, gpointer value, gpointer now) {
+    return ((const RecentError *) value)->first_seen + dedup_window <= *((const time_t *) now);
+}
+
+// try to merge an error into an identical one received within the dedup window. recent_key must hold the error's key.
+// Assumes the caller holds db_lock
+static bool merge_duplicate(const time_t recv_time) {
+    RecentError *recent = g_hash_table_lookup(recent_errors, recent_key->str);
+    if (NULL == recent) {
+        return false;
+    }
+
+    if ((recv_time < recent->first_seen) || (recv_time - recent->first_seen >= dedup_window)) {
+        g_hash_table_remove(recent_errors, recent_key->str);
+        return false;
+    }
+
+    sqlite3_bind_int64(statements.merge_error, 1, recv_time);
+    sqlite3_bind_int64(statements.merge_error, 2, recent->id);
+    if (!step_statement(statements.merge_error) || (1 != sqlite3_changes(db))) {
+        g_hash_table_remove(recent_errors, recent_key->str);
+        return false;
+    }
+
+    g_atomic_int_inc(&merges);
+    return true;
+}
+
+// remember a newly added error so that duplicates can be merged into it. recent_key must hold the error's key.
+// Assumes the caller holds db_lock
+static void remember_error(const sqlite3_int64 id, const time_t recv_time) {
+    if (g_hash_table_size(recent_errors) >= MAX_RECENT_ERRORS) {
+        time_t now = recv_time;
+        g_hash_table_foreach_remove(recent_errors, recent_error_expired, &now);
+
+        // a lot of different errors within the window: give up on the older ones
+        if (g_hash_table_size(recent_errors) >= MAX_RECENT_ERRORS) {
+            g_hash_table_remove_all(recent_errors);
+        }
+    }
+
+    RecentError *recent = g_new(RecentError, 1);
+    assert(NULL != recent);
+    recent->id = id;
+    recent->first_seen = recv_time;
+    g_hash_table_replace(recent_errors, g_strdup(recent_key->str), recent);
+}
+
+// drop per minute rollups older than ROLLUP_MINUTES_KEPT. Only does anything once an hour (of recv_time).
+// Assumes the caller holds db_lock
+static void prune_rollups(const time_t recv_time) {
+    if (recv_time < rollups_pruned + 3600) {
+        return;
+    }
+    rollups_pruned = recv_time;
+
+    sqlite3_bind_int64(statements.prune_minutes, 1, recv_time - ROLLUP_MINUTES_KEPT * 60);
+    step_statement(statements.prune_minutes);
+}
+
+// add an error whose description is len bytes of description (-1 for all of it), which only has to live until this returns.
+// Nothing is allocated unless the dedup window is on
+static AddErrorResult add_categorised_error(const uint32_t rack_no, const uint32_t chassis_no, const int valve_no,
+                                            const time_t recv_time, const ErrorCategory category, const char *description,
+                                            const int len) {
+    g_rec_mutex_lock(&db_lock);
+
+    const RegisteredNode *node = lookup_node(rack_no, chassis_no);
+    if (NULL == node) {
+        g_atomic_int_inc(&dropped_errors[DROP_UNKNOWN_NODE][category]);
+        g_rec_mutex_unlock(&db_lock);
+        return ADD_ERROR_UNKNOWN_NODE;
+    }
+
+    if (dedup_window > 0) {
+        g_string_printf(recent_key, "%u %u %i %i %.*s", rack_no, chassis_no, valve_no, category,
+                        (len < 0) ? (int) strlen(description) : len, description);
+        if (merge_duplicate(recv_time)) {
+            g_rec_mutex_unlock(&db_lock);
+            return ADD_ERROR_ADDED;
+        }
+    }
+
+    sqlite3_stmt *statement = statements.add_error;
+    sqlite3_bind_int64(statement, 1, recv_time);
+    sqlite3_bind_text(statement, 2, description, len, SQLITE_STATIC);
+    sqlite3_bind_int(statement, 3, valve_no);
+    sqlite3_bind_int64(statement, 4, node->id);
+    sqlite3_bind_int(statement, 5, category);
+
+    const bool ret = step_statement(statement);
+    if (ret) {
+        counters_add_errors(rack_no, chassis_no, valve_no, 1, 1);
+        prune_rollups(recv_time);
+
+        if (dedup_window > 0) {
+            remember_error(sqlite3_last_insert_rowid(db), recv_time);
+        }
+    }
+
+    g_rec_mutex_unlock(&db_lock);
+    return ret ? ADD_ERROR_ADDED : ADD_ERROR_FAILED;
+}
+
+bool add_error_decoded(const uint32_t rack_no, const uint32_t chassis_no, const int valve_no, const time_t recv_time, const char *msg) {
+    assert(NULL != msg);
+
+    ErrorCategory category = ERROR_CATEGORY_OTHER;
+    if (0 == strncmp(msg, HARDWARE_PREFIX, CATEGORY_PREFIX_LEN)) {
+        category = ERROR_CATEGORY_HARDWARE;
+    } else if (0 == strncmp(msg, SOFTWARE_PREFIX, CATEGORY_PREFIX_LEN)) {
+        category = ERROR_CATEGORY_SOFTWARE;
+    }
+
+    const char *description = (ERROR_CATEGORY_OTHER == category) ? msg : msg + CATEGORY_PREFIX_LEN;
+    return ADD_ERROR_ADDED == add_categorised_error(rack_no, chassis_no, valve_no, recv_time, category, description, -1);
+}
+
+void get_node_identifier(const struct in_addr *address, NodeIdentifier *node) {
+    assert(NULL != address);
+    assert(NULL != node);
+
+    // s_addr is in network byte order
+    const uint32_t addr = ntohl(address->s_addr);
+    node->rack_no = (addr >> 8) & 0xFF;
+    node->chassis_no = addr & 0xFF;
+}
+
+// add_error saying why an error wasn't added.
+// The category is a column so the message is bound straight from the server's buffer
+static AddErrorResult add_buffer_item(const BufferItem *error) {
+    if (NULL == error) {
+        return ADD_ERROR_FAILED;
+    }
+
+    NodeIdentifier node;
+    get_node_identifier(&error->address, &node);
+
+    int valve_no = -1;
+    ErrorCategory category;
+    const GString *message;
+    switch (error->msg.type) {
+        case HARD_ERROR_VALVE:
+            category = ERROR_CATEGORY_HARDWARE;
+            message = error->msg.data.hardware_valve.message;
+            valve_no = error->msg.data.hardware_valve.valve_no;
+            break;
+
+        case HARD_ERROR_OTHER:
+            category = ERROR_CATEGORY_HARDWARE;
+            message = error->msg.data.hardware_other.message;
+            break;
+
+        case SOFT_ERROR:
+            category = ERROR_CATEGORY_SOFTWARE;
+            message = error->msg.data.software.message;
+            break;
+
+        default:
+            g_atomic_int_inc(&dropped_errors[DROP_UNKNOWN_TYPE][ERROR_CATEGORY_OTHER]);
+            return ADD_ERROR_FAILED;
+    }
+
+    assert(NULL != message);
+    return add_categorised_error(node.rack_no, node.chassis_no, valve_no, error->recv_time, category, message->str,
+                                 (int) message->len);
+}
+
+bool add_error(const BufferItem *error) {
+    return ADD_ERROR_ADDED == add_buffer_item(error);
+}
+
+void get_error_key(const BufferItem *item, ErrorKey *key) {
+    assert(NULL != item);
+    assert(NULL != key);
+
+    NodeIdentifier node;
+    get_node_identifier(&item->address, &node);
+    key->rack_no = node.rack_no;
+    key->chassis_no = node.chassis_no;
+
+    key->valve_no = (HARD_ERROR_VALVE == item->msg.type) ? item->msg.data.hardware_valve.valve_no : -1;
+}
+
+size_t add_errors_batch(BufferItem *const *items, const size_t num_items, AddErrorResult *results) {
+    if ((NULL == items) || (0 == num_items)) {
+        return 0;
+    }
+
+    const gint64 timer = metrics_start();
+    g_rec_mutex_lock(&db_lock);
+
+    // one transaction (and so one fsync) for the whole batch
+    if (!step_statement(statements.begin)) {
+        g_rec_mutex_unlock(&db_lock);
+
+        if (NULL != results) {
+            for (size_t i = 0; i < num_items; i++) {
+                results[i] = ADD_ERROR_FAILED;
+            }
+        }
+        return 0;
+    }
+
+    // a failed insert only rolls back that statement so carry on with the rest
+    size_t num_added = 0;
+    for (size_t i = 0; i < num_items; i++) {
+        const AddErrorResult result = add_buffer_item(items[i]);
+        if (ADD_ERROR_ADDED == result) {
+            num_added += 1;
+        }
+
+        if (NULL != results) {
+            results[i] = result;
+        }
+    }
+
+    if (!step_statement(statements.commit)) {
+        step_statement(statements.rollback);
+
+        // nothing made it into the database
+        load_counters();
+        forget_recent_errors();
+        num_added = 0;
+        for (size_t i = 0; (NULL != results) && (i < num_items); i++) {
+            // unknown nodes' errors were never going to be added
+            if (ADD_ERROR_UNKNOWN_NODE != results[i]) {
+                results[i] = ADD_ERROR_FAILED;
+            }
+        }
+    }
+
+    g_rec_mutex_unlock(&db_lock);
+    metrics_finish(METRIC_SQL_ADD, timer);
+    return num_added;
+}
+
+void free_search_result(gpointer res) {
+    if (NULL == res) {
+        return;
+    }
+
+    SearchResult *result = (SearchResult *) res;
+    
+    g_free(result->message);
+    g_free(result);
+}
+
+// read the current row of a search statement. The strings in row borrow from statement and time_str
+static void read_search_row(sqlite3_stmt *statement, SearchRow *row, char time_str[SEARCH_TIME_LEN]) {
+    row->recv_time = sqlite3_column_int64(statement, 0);
+    format_search_time(row->recv_time, time_str);
+    row->time_str = time_str;
+
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wpointer-sign"
+    row->description = sqlite3_column_text(statement, 1);
+    #pragma GCC diagnostic pop
+    if (NULL == row->description) {
+        row->description = "";
+    }
+
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wsign-conversion"
+    row->rack_no = sqlite3_column_int(statement, 2);
+    row->chassis_no = sqlite3_column_int(statement, 3);
+    #pragma GCC diagnostic pop
+    row->valve_no = sqlite3_column_int(statement, 4);
+
+    int node_enabled = sqlite3_column_int(statement, 5);
+    int error_enabled = sqlite3_column_int(statement, 6);
+    row->enabled = 1 == (node_enabled & error_enabled);
+
+    row->id = sqlite3_column_int(statement, 7);
+    row->occurrences = sqlite3_column_int(statement, 8);
+    row->last_seen = sqlite3_column_int64(statement, 9);
+}
+
+// step through a bound search statement calling func on each row.
+// Resets the statement. Assumes the caller holds db_lock
+static int foreach_search_row(sqlite3_stmt *statement, SearchRowFunc func, gpointer user_data) {
+    int num_rows = 0;
+    char time_str[SEARCH_TIME_LEN];
+
+    int status = SQLITE_ERROR;
+    do {
+        status = sqlite3_step(statement);
         if (SQLITE_DONE == status) {
             break;
         } else if (SQLITE_ROW != status) {
-            assert(SQLITE_OK == sqlite3_finalize(statement));
-            puts("Bad sqlite3_step list_racks");
-            g_list_free(results);
-            return NULL;
+            finish_statement(statement);
+            puts("Bad sqlite3_step");
+            return -1;
         }
-        // status == SQL_ROW so get data
-        gpointer item = (gpointer) sqlite3_column_int64(statement, 0);
-        results = g_list_append(results, item);
-    } while(true);
+        // status == SQL_ROW so get the data
+        SearchRow row;
+        read_search_row(statement, &row, time_str);
+        num_rows++;
+
+        if (!func(&row, user_data)) {
+            break;
+        }
+    } while (true);
+
+    finish_statement(statement);
+    return num_rows;
+}
+
+// SearchRowFunc prepending a SearchResult to the GList pointed to by results
+static bool prepend_search_result(const SearchRow *row, gpointer results) {
+    SearchResult *res = malloc(sizeof(SearchResult));
+    assert(NULL != res);
+
+    res->message = g_strconcat(row->time_str, row->description, NULL);
+    assert(NULL != res->message);
+    res->recv_time = row->recv_time;
+    res->rack_no = row->rack_no;
+    res->chassis_no = row->chassis_no;
+    res->valve_no = row->valve_no;
+    res->enabled = row->enabled;
+    res->id = row->id;
+    res->occurrences = row->occurrences;
+
+    GList **list = (GList **) results;
+    *list = g_list_prepend(*list, res);
+    return true;
+}
+
+// the rows collected by prepend_search_result, put in order for a search which ran forward (or backward if reversed)
+static GList *finish_search_results(GList *results, const int num_rows, const bool reversed) {
+    if (num_rows < 0) {
+        g_list_free_full(results, free_search_result);
+        return NULL;
+    }
+
+    // prepending reversed the order
+    if (reversed) {
+        return results;
+    }
+    return g_list_reverse(results);
+}
+
+// step through a bound search statement collecting SearchResults. reversed for statements which run backwards in time.
+// Resets the statement. Assumes the caller holds db_lock
+static GList *collect_search_results(sqlite3_stmt *statement, const bool reversed) {
+    GList *results = NULL; // empty list
+    const int num_rows = foreach_search_row(statement, prepend_search_result, &results);
+    return finish_search_results(results, num_rows, reversed);
+}
+
+void format_search_time(const time_t recv_time, char time_str[SEARCH_TIME_LEN]) {
+    struct tm time;
+    char buf[32];
+    if ((NULL == localtime_r(&recv_time, &time)) || (NULL == asctime_r(&time, buf))) {
+        time_str[0] = '\0';
+        return;
+    }
+
+    // remove the year and newline from the time string
+    const size_t len = strlen(buf);
+    size_t keep = (len > 5) ? len - 5 : 0;
+    if (keep >= SEARCH_TIME_LEN) {
+        keep = SEARCH_TIME_LEN - 1;
+    }
+    memcpy(time_str, buf, keep);
+    time_str[keep] = '\0';
+}
+
+static bool valid_search(const Clickable *search) {
+    if ((NULL == search) || (search->type >= NUM_CLICKABLE_TYPES)) {
+        g_print("I don't know how to search for that!\n");
+        return false;
+    }
 
-    assert(SQLITE_OK == sqlite3_finalize(statement));
+    return true;
+}
+
+GList *search_clickable(const Clickable *search) {
+    if (!valid_search(search)) {
+        return NULL;
+    }
+
+    const gint64 timer = metrics_start();
+    g_rec_mutex_lock(&db_lock);
+
+    sqlite3_stmt *statement = statements.search[search->type][get_show_disabled()];
+    bind_clickable(statement, search);
+
+    GList *results = collect_search_results(statement, false);
 
+    g_rec_mutex_unlock(&db_lock);
+    metrics_finish(METRIC_SQL_SEARCH, timer);
     return results;
 }
 
-GList *list_chassis_by_rack(const uintptr_t rack_no) {
-    GString* query = g_string_new(NULL);
-    g_string_printf(query, "SELECT DISTINCT chassis_no FROM nodes WHERE rack_no = %li;", rack_no);
-
-    GList *results = NULL; // empty list
+// search_clickable_foreach. If up_to_seen only the errors each shard had at the last sync_database are included.
+// Assumes valid arguments
+static int foreach_search_page(const Clickable *search, const time_t key_time, const int key_id, const bool forward,
+                               const int limit, const bool up_to_seen, SearchRowFunc func, gpointer user_data) {
+    const gint64 timer = metrics_start();
+    g_rec_mutex_lock(&db_lock);
 
     sqlite3_stmt *statement = NULL;
-    if (SQLITE_OK != sqlite3_prepare_v2(db, query->str, -1, &statement, NULL)) {
-        g_string_free(query, TRUE);
-        puts("Error constructing list_racks query");
-        return NULL;
+    if (forward) {
+        statement = statements.search_forward[search->type][get_show_disabled()];
+    } else {
+        statement = statements.search_backward[search->type][get_show_disabled()];
     }
-    g_string_free(query, TRUE);
+    bind_clickable(statement, search);
+    sqlite3_bind_int(statement, 4, key_id);
+    sqlite3_bind_int64(statement, 5, key_time);
+    sqlite3_bind_int(statement, 6, limit);
+    if (up_to_seen) {
+        for (int shard = 0; shard < num_shards; shard++) {
+            sqlite3_bind_int64(statement, SHARD_SEEN_PARAM + shard, seen[shard].max_error_id);
+        }
+    }
+
+    const int num_rows = foreach_search_row(statement, func, user_data);
+
+    g_rec_mutex_unlock(&db_lock);
+    metrics_finish(METRIC_SQL_SEARCH, timer);
+    return num_rows;
+}
+
+int search_clickable_foreach(const Clickable *search, const time_t key_time, const int key_id, const bool forward, const int limit,
+                             SearchRowFunc func, gpointer user_data) {
+    if (!valid_search(search) || (NULL == func)) {
+        return -1;
+    }
+
+    return foreach_search_page(search, key_time, key_id, forward, limit, false, func, user_data);
+}
+
+int search_clickable_foreach_offset(const Clickable *search, const int offset, const int limit, SearchRowFunc func, gpointer user_data) {
+    if (!valid_search(search) || (NULL == func)) {
+        return -1;
+    }
+
+    const gint64 timer = metrics_start();
+    g_rec_mutex_lock(&db_lock);
+
+    sqlite3_stmt *statement = statements.search_offset[search->type][get_show_disabled()];
+    bind_clickable(statement, search);
+    sqlite3_bind_int(statement, 6, limit);
+    sqlite3_bind_int(statement, 7, offset);
+
+    const int num_rows = foreach_search_row(statement, func, user_data);
+
+    g_rec_mutex_unlock(&db_lock);
+    metrics_finish(METRIC_SQL_SEARCH, timer);
+    return num_rows;
+}
+
+GList *search_clickable_page(const Clickable *search, const time_t key_time, const int key_id, const bool forward, const int limit) {
+    GList *results = NULL;
+    const int num_rows = search_clickable_foreach(search, key_time, key_id, forward, limit, prepend_search_result, &results);
+    return finish_search_results(results, num_rows, !forward);
+}
+
+GList *search_clickable_offset(const Clickable *search, const int offset, const int limit) {
+    GList *results = NULL;
+    const int num_rows = search_clickable_foreach_offset(search, offset, limit, prepend_search_result, &results);
+    return finish_search_results(results, num_rows, false);
+}
+
+int search_clickable_foreach_tail(const Clickable *search, const int limit, int *count, SearchRowFunc func, gpointer user_data) {
+    if (!valid_search(search) || (NULL == func) || (NULL == count)) {
+        return -1;
+    }
+
+    g_rec_mutex_lock(&db_lock);
+
+    // another connection can add errors between the count and the search
+    if (read_only) {
+        step_statement(statements.begin);
+    }
+
+    *count = count_clickable(search);
+    if (*count < 0) {
+        if (read_only) {
+            step_statement(statements.commit);
+        }
+        g_rec_mutex_unlock(&db_lock);
+        return -1;
+    }
+
+    // the counters only know about the errors each shard had at the last sync_database so newer rows are left out
+    const bool up_to_seen = read_only && (SEARCH != search->type);
+    const int num_rows = foreach_search_page(search, INT64_MAX, INT_MAX, false, limit, up_to_seen, func, user_data);
+
+    if (read_only) {
+        step_statement(statements.commit);
+    }
+    g_rec_mutex_unlock(&db_lock);
+    return num_rows;
+}
+
+int count_clickable(const Clickable *search) {
+    if (!valid_search(search)) {
+        return -1;
+    }
+
+    const gint64 timer = metrics_start();
+    g_rec_mutex_lock(&db_lock);
+
+    if (SEARCH == search->type) {
+        // only the index knows which errors match
+        sqlite3_stmt *statement = statements.count_search[get_show_disabled()];
+        bind_clickable(statement, search);
+
+        int count = -1;
+        if (SQLITE_ROW == sqlite3_step(statement)) {
+            count = sqlite3_column_int(statement, 0);
+        } else {
+            puts(sqlite3_errmsg(db));
+        }
+        finish_statement(statement);
+
+        g_rec_mutex_unlock(&db_lock);
+        metrics_finish(METRIC_SQL_COUNT, timer);
+        return count;
+    }
+
+    // kept up to date as errors are added, toggled and removed so there is no need to ask the database
+    const unsigned int count = counters_count(search, get_show_disabled());
+    g_rec_mutex_unlock(&db_lock);
+    metrics_finish(METRIC_SQL_COUNT, timer);
+
+    return (count > INT_MAX) ? INT_MAX : (int) count;
+}
+
+// GList of the first column of each row. Assumes the caller holds db_lock
+static GList *list_integers(sqlite3_stmt *statement, const char *name) {
+    GList *results = NULL; // empty list
 
     int status = SQLITE_ERROR;
     do {
@@ -519,155 +1825,544 @@ GList *list_chassis_by_rack(const uintptr_t rack_no) {
         if (SQLITE_DONE == status) {
             break;
         } else if (SQLITE_ROW != status) {
-            assert(SQLITE_OK == sqlite3_finalize(statement));
-            puts("Bad sqlite3_step list_racks");
+            finish_statement(statement);
+            printf("Bad sqlite3_step %s\n", name);
             g_list_free(results);
             return NULL;
         }
         // status == SQL_ROW so get data
         gpointer item = (gpointer) sqlite3_column_int64(statement, 0);
-        results = g_list_append(results, item);
+        results = g_list_prepend(results, item);
     } while(true);
 
-    assert(SQLITE_OK == sqlite3_finalize(statement));
+    finish_statement(statement);
+
+    return g_list_reverse(results);
+}
+
+GList *list_racks(void) {
+    g_rec_mutex_lock(&db_lock);
+    GList *results = list_integers(statements.list_racks, "list_racks");
+    g_rec_mutex_unlock(&db_lock);
 
     return results;
 }
 
-GSList *list_nodes(void) {
-    const char *query = "SELECT rack_no, chassis_no FROM nodes WHERE nodes.enabled = 1;";
+GList *list_chassis_by_rack(const uintptr_t rack_no) {
+    g_rec_mutex_lock(&db_lock);
 
-    GSList *results = NULL;
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wsign-conversion"
+    sqlite3_bind_int64(statements.list_chassis_by_rack, 1, rack_no);
+    #pragma GCC diagnostic pop
+    GList *results = list_integers(statements.list_chassis_by_rack, "list_chassis_by_rack");
 
-    sqlite3_stmt *statement = NULL;
-    if (SQLITE_OK != sqlite3_prepare_v2(db, query, -1, &statement, NULL)) {
-        puts("Error constructing list_nodes query");
-        return NULL;
-    }
+    g_rec_mutex_unlock(&db_lock);
+    return results;
+}
 
-    int status = SQLITE_ERROR;
-    do {
-        status = sqlite3_step(statement);
-        if (SQLITE_DONE == status) {
-            break;
-        } else if (SQLITE_ROW != status) {
-            assert(SQLITE_OK == sqlite3_finalize(statement));
-            puts("Bad sqlite3_step list_nodes");
-            return NULL;
-        }
-        // status == SQL_ROW so get data
+GArray *node_activity(const time_t since, const bool hourly) {
+    GArray *activity = g_array_new(FALSE, FALSE, sizeof(NodeActivity));
+    assert(NULL != activity);
+
+    g_rec_mutex_lock(&db_lock);
 
-        NodeIdentifier *list_item = malloc(sizeof(NodeIdentifier));
-        assert(NULL != list_item);
-        
+    sqlite3_stmt *statement = statements.rollup_nodes[hourly];
+    sqlite3_bind_int64(statement, 1, hourly ? since / 3600 * 3600 : since / 60 * 60);
+    while (SQLITE_ROW == sqlite3_step(statement)) {
+        NodeActivity node;
         #pragma GCC diagnostic push
         #pragma GCC diagnostic ignored "-Wsign-conversion"
-        list_item->rack_no = sqlite3_column_int(statement, 0);
-        list_item->chassis_no = sqlite3_column_int(statement, 1);
+        node.rack_no = sqlite3_column_int(statement, 0);
+        node.chassis_no = sqlite3_column_int(statement, 1);
+        node.count = sqlite3_column_int(statement, 2);
         #pragma GCC diagnostic pop
+        g_array_append_val(activity, node);
+    }
+    finish_statement(statement);
 
-        results = g_slist_prepend(results, list_item); 
-    } while(true);
+    g_rec_mutex_unlock(&db_lock);
+    return activity;
+}
 
-    assert(SQLITE_OK == sqlite3_finalize(statement));
+GArray *activity_trend(const time_t since, const bool hourly) {
+    GArray *trend = g_array_new(FALSE, FALSE, sizeof(ActivityBucket));
+    assert(NULL != trend);
 
-    return results;
+    g_rec_mutex_lock(&db_lock);
+
+    sqlite3_stmt *statement = statements.rollup_trend[hourly];
+    sqlite3_bind_int64(statement, 1, hourly ? since / 3600 * 3600 : since / 60 * 60);
+    while (SQLITE_ROW == sqlite3_step(statement)) {
+        ActivityBucket bucket;
+        bucket.start = (time_t) sqlite3_column_int64(statement, 0);
+        bucket.count = (unsigned int) sqlite3_column_int(statement, 1);
+        g_array_append_val(trend, bucket);
+    }
+    finish_statement(statement);
+
+    g_rec_mutex_unlock(&db_lock);
+    return trend;
 }
 
-bool error_toggle_disabled(const uintptr_t id) {
-    assert(SQLITE_OK == sqlite3_exec(db, "begin transaction;", NULL, NULL, NULL));
+GList *list_nodes_ordered(void) {
+    g_rec_mutex_lock(&db_lock);
 
-    // get the current state of the error
-    GString *query = g_string_new(NULL);
-    assert(NULL != query);
-    g_string_printf(query, "SELECT enabled from errors WHERE id=%li;", id);
+    sqlite3_stmt *statement = statements.list_nodes_ordered;
+    GList *results = NULL;
 
-    sqlite3_stmt *statement = NULL;
-    if (SQLITE_OK != sqlite3_prepare_v2(db, query->str, -1, &statement, NULL)) {
-        g_string_free(query, TRUE);
-        assert(SQLITE_OK == sqlite3_exec(db, "commit;", NULL, NULL, NULL));
+    int status;
+    while (SQLITE_ROW == (status = sqlite3_step(statement))) {
+        NodeIdentifier *node = g_new(NodeIdentifier, 1);
+        assert(NULL != node);
+
+        #pragma GCC diagnostic push
+        #pragma GCC diagnostic ignored "-Wsign-conversion"
+        node->rack_no = sqlite3_column_int(statement, 0);
+        node->chassis_no = sqlite3_column_int(statement, 1);
+        #pragma GCC diagnostic pop
+
+        results = g_list_prepend(results, node);
+    }
+    finish_statement(statement);
+
+    if (SQLITE_DONE != status) {
+        puts("Bad sqlite3_step list_nodes_ordered");
+        g_list_free_full(results, g_free);
+        results = NULL;
+    }
+
+    g_rec_mutex_unlock(&db_lock);
+    return g_list_reverse(results);
+}
+
+bool error_toggle_disabled(const uintptr_t id) {
+    g_rec_mutex_lock(&db_lock);
+    if (read_only) {
+        puts("The database is read only");
+        g_rec_mutex_unlock(&db_lock);
         return false;
     }
-    g_string_free(query, TRUE);
 
-    int enabled = -1;
-    int status = SQLITE_ERROR;
-    do {
-        status = sqlite3_step(statement);
-        if (SQLITE_DONE == status) {
-            break;
-        } else if (SQLITE_ROW != status) {
-            assert(SQLITE_OK == sqlite3_finalize(statement));
-            puts("Bad sqlite step toggle_error_disabled");
-            assert(SQLITE_OK == sqlite3_exec(db, "commit;", NULL, NULL, NULL));
-            return false;
-        }
-        // status == SQL_ROW
-        enabled = sqlite3_column_int(statement, 0);
-    } while (true);
-    assert(SQLITE_OK == sqlite3_finalize(statement));
+    sqlite3_stmt *statement = statements.error_toggle_disabled;
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wsign-conversion"
+    sqlite3_bind_int64(statement, 1, id);
+    #pragma GCC diagnostic pop
 
-    if (-1 == enabled) {
+    bool ret = step_statement(statement);
+    if (ret && (1 != sqlite3_changes(db))) {
         puts("Error not found!");
-        assert(SQLITE_OK == sqlite3_exec(db, "commit;", NULL, NULL, NULL));
-        return false;
+        ret = false;
     }
 
-    // update the node
-    GString *update = g_string_new(NULL);
-    g_string_sprintf(update, "UPDATE errors SET ENABLED = %i WHERE id = %li;", 1 - enabled, id);
-    assert(SQLITE_OK == sqlite3_exec(db, update->str, NULL, NULL, NULL));
-    g_string_free(update, TRUE);
+    if (ret) {
+        // find out what was toggled so it can be counted
+        sqlite3_stmt *location = statements.error_location;
+        #pragma GCC diagnostic push
+        #pragma GCC diagnostic ignored "-Wsign-conversion"
+        sqlite3_bind_int64(location, 1, id);
+        if (SQLITE_ROW == sqlite3_step(location)) {
+            counters_set_error_enabled(sqlite3_column_int(location, 0), sqlite3_column_int(location, 1),
+                                       sqlite3_column_int(location, 2), 1 == sqlite3_column_int(location, 3));
+        }
+        #pragma GCC diagnostic pop
+        finish_statement(location);
 
-    assert(SQLITE_OK == sqlite3_exec(db, "commit;", NULL, NULL, NULL));
-    return true;
+        g_atomic_int_inc(&generation);
+    }
+
+    g_rec_mutex_unlock(&db_lock);
+    return ret;
 }
 
 bool node_toggle_disabled(const unsigned long int rack_no, const unsigned long int chassis_no) {
-    assert(SQLITE_OK == sqlite3_exec(db, "begin transaction;", NULL, NULL, NULL));
+    g_rec_mutex_lock(&db_lock);
 
-    // get the current state of the node
-    GString *query = g_string_new(NULL);
+    sqlite3_stmt *statement = statements.node_toggle_disabled;
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wsign-conversion"
+    sqlite3_bind_int64(statement, 1, rack_no);
+    sqlite3_bind_int64(statement, 2, chassis_no);
+    #pragma GCC diagnostic pop
+
+    bool ret = step_statement(statement);
+    if (ret && (1 != sqlite3_changes(db))) {
+        puts("Node not found!");
+        ret = false;
+    }
+
+    if (ret) {
+        #pragma GCC diagnostic push
+        #pragma GCC diagnostic ignored "-Wconversion"
+        counters_toggle_node(rack_no, chassis_no);
+        RegisteredNode *node = lookup_node(rack_no, chassis_no);
+        #pragma GCC diagnostic pop
+        if (NULL != node) {
+            node->enabled = !node->enabled;
+        }
+        g_atomic_int_inc(&generation);
+    }
+
+    g_rec_mutex_unlock(&db_lock);
+    return ret;
+}
+
+// the errors set_errors_enabled has counted on one node valve
+typedef struct {
+    unsigned int rack_no;
+    unsigned int chassis_no;
+    int valve_no;
+    unsigned int num_errors;
+} ErrorGroup;
+
+// a LIKE pattern matching text anywhere. Wildcards in text are escaped with a backslash. Free with g_free
+static char *like_pattern(const char *text) {
+    GString *pattern = g_string_new("%");
+    assert(NULL != pattern);
+
+    for (const char *c = text; '\0' != *c; c++) {
+        if (('%' == *c) || ('_' == *c) || ('\\' == *c)) {
+            g_string_append_c(pattern, '\\');
+        }
+        g_string_append_c(pattern, *c);
+    }
+    g_string_append_c(pattern, '%');
+
+    return g_string_free(pattern, FALSE);
+}
+
+// a query over the errors matching filter, whatever show_disabled is. ?9 is the new value of enabled
+static GString *filter_query(const ErrorFilter *filter, const char *fields) {
+    GString *query = clickable_query(filter->search.type, true, fields);
     assert(NULL != query);
-    g_string_sprintf(query, "SELECT enabled FROM nodes WHERE rack_no=%li AND chassis_no=%li;", rack_no, chassis_no);
 
-    sqlite3_stmt *statement = NULL;
-    if (SQLITE_OK != sqlite3_prepare_v2(db, query->str, -1, &statement, NULL)) {
-        g_string_free(query, TRUE);
-        assert(SQLITE_OK == sqlite3_exec(db, "commit;", NULL, NULL, NULL));
-        return false;
+    // only what actually changes, so that the counters can be kept in step
+    g_string_append(query, "AND errors.enabled != ?9 ");
+    if (0 != filter->from) {
+        g_string_append(query, "AND errors.recv_time >= ?10 ");
+    }
+    if (0 != filter->until) {
+        g_string_append(query, "AND errors.recv_time < ?11 ");
+    }
+    if ((NULL != filter->contains) && ('\0' != filter->contains[0])) {
+        g_string_append(query, "AND " DESCRIPTION_SQL("errors") " LIKE ?12 ESCAPE '\\' ");
     }
-    g_string_free(query, TRUE);
 
-    int enabled = -1;
-    int status = SQLITE_ERROR;
-    do {
-        status = sqlite3_step(statement);
-        if (SQLITE_DONE == status) {
-            break;
-        } else if (SQLITE_ROW != status) {
-            assert(SQLITE_OK == sqlite3_finalize(statement));
-            puts("Bad sqlite step toggle_node_disabled");
-            assert(SQLITE_OK == sqlite3_exec(db, "commit;", NULL, NULL, NULL));
-            return false;
+    // only ever the writer's own database
+    char *sql = shard_sql(query->str, 0);
+    g_string_assign(query, sql);
+    g_free(sql);
+    return query;
+}
+
+static void bind_filter(sqlite3_stmt *statement, const ErrorFilter *filter, const bool enabled) {
+    bind_clickable(statement, &filter->search);
+    sqlite3_bind_int(statement, 9, enabled ? 1 : 0);
+    sqlite3_bind_int64(statement, 10, filter->from);
+    sqlite3_bind_int64(statement, 11, filter->until);
+    if ((NULL != filter->contains) && ('\0' != filter->contains[0])) {
+        sqlite3_bind_text(statement, 12, like_pattern(filter->contains), -1, g_free);
+    }
+}
+
+int set_errors_enabled(const ErrorFilter *filter, const bool enabled) {
+    if ((NULL == filter) || !valid_search(&filter->search)) {
+        return -1;
+    }
+
+    g_rec_mutex_lock(&db_lock);
+    if (read_only) {
+        puts("The database is read only");
+        g_rec_mutex_unlock(&db_lock);
+        return -1;
+    }
+
+    // what is about to change, for the counters
+    GString *group_query = filter_query(filter, "nodes.rack_no, nodes.chassis_no, errors.valve_no, COUNT(*)");
+    g_string_append(group_query, "GROUP BY errors.node_id, errors.valve_no;");
+    sqlite3_stmt *groups = prepare_statement(group_query->str);
+    g_string_free(group_query, TRUE);
+
+    GString *ids = filter_query(filter, "errors.id");
+    GString *update_query = g_string_new(NULL);
+    assert(NULL != update_query);
+    g_string_printf(update_query, "UPDATE errors SET enabled = ?9 WHERE id IN (%s);", ids->str);
+    g_string_free(ids, TRUE);
+    sqlite3_stmt *update = prepare_statement(update_query->str);
+    g_string_free(update_query, TRUE);
+
+    // without the transaction the counters could be changed for an UPDATE which only partly happened
+    if (!step_statement(statements.begin)) {
+        sqlite3_finalize(groups);
+        sqlite3_finalize(update);
+        g_rec_mutex_unlock(&db_lock);
+        return -1;
+    }
+
+    GArray *changed = g_array_new(FALSE, FALSE, sizeof(ErrorGroup));
+    assert(NULL != changed);
+    bind_filter(groups, filter, enabled);
+    while (SQLITE_ROW == sqlite3_step(groups)) {
+        ErrorGroup group;
+        #pragma GCC diagnostic push
+        #pragma GCC diagnostic ignored "-Wsign-conversion"
+        group.rack_no = sqlite3_column_int(groups, 0);
+        group.chassis_no = sqlite3_column_int(groups, 1);
+        group.valve_no = sqlite3_column_int(groups, 2);
+        group.num_errors = sqlite3_column_int(groups, 3);
+        #pragma GCC diagnostic pop
+        g_array_append_val(changed, group);
+    }
+
+    bind_filter(update, filter, enabled);
+    int num_changed = -1;
+    if (SQLITE_DONE == sqlite3_step(update)) {
+        num_changed = sqlite3_changes(db);
+    } else {
+        puts(sqlite3_errmsg(db));
+    }
+
+    if ((num_changed < 0) || !step_statement(statements.commit)) {
+        step_statement(statements.rollback);
+        num_changed = -1;
+    } else {
+        for (guint i = 0; i < changed->len; i++) {
+            const ErrorGroup *group = &g_array_index(changed, ErrorGroup, i);
+            counters_set_errors_enabled(group->rack_no, group->chassis_no, group->valve_no, group->num_errors, enabled);
         }
-        // status == SQL_ROW
-        enabled = sqlite3_column_int(statement, 0);
-    } while(true);
-    assert(SQLITE_OK == sqlite3_finalize(statement));
+        if (num_changed > 0) {
+            g_atomic_int_inc(&generation);
+        }
+    }
 
-    if (-1 == enabled) {
-        puts("Node not found!");
-        assert(SQLITE_OK == sqlite3_exec(db, "commit;", NULL, NULL, NULL));
-        return false;
+    sqlite3_finalize(groups);
+    sqlite3_finalize(update);
+    g_array_free(changed, TRUE);
+    g_rec_mutex_unlock(&db_lock);
+    return num_changed;
+}
+
+// the start of the month after the one t is in (local time). name is set to the month t is in as YYYY-MM
+static time_t month_end(const time_t t, char name[8]) {
+    struct tm tm;
+    if (NULL == localtime_r(&t, &tm)) {
+        strcpy(name, "unknown");
+        return t + 1;
+    }
+    strftime(name, 8, "%Y-%m", &tm);
+
+    tm.tm_mday = 1;
+    tm.tm_hour = 0;
+    tm.tm_min = 0;
+    tm.tm_sec = 0;
+    tm.tm_mon += 1; // mktime carries into the next year
+    tm.tm_isdst = -1;
+    return mktime(&tm);
+}
+
+// how many errors archive_old_errors should move this time. Assumes the caller holds db_lock
+static unsigned int count_archivable(const time_t before, const unsigned int keep, const unsigned int max_rows) {
+    // errors over the row budget
+    const Clickable everything = {.type = ALL, .rack_num = 0, .chassis_num = 0, .valve_num = -1};
+    const unsigned int total = counters_count(&everything, true);
+    unsigned int num_rows = ((keep > 0) && (total > keep)) ? total - keep : 0;
+    num_rows = MIN(num_rows, max_rows);
+
+    // and any older than before. Both are the oldest errors so moving the larger number covers both
+    if (before > 0) {
+        sqlite3_stmt *older = prepare_statement("SELECT COUNT(*) FROM (SELECT 1 FROM errors WHERE recv_time < ?1 LIMIT ?2);");
+        sqlite3_bind_int64(older, 1, before);
+        sqlite3_bind_int64(older, 2, max_rows);
+        if (SQLITE_ROW == sqlite3_step(older)) {
+            num_rows = MAX(num_rows, (unsigned int) sqlite3_column_int(older, 0));
+        }
+        sqlite3_finalize(older);
     }
 
-    // update the node
-    GString *update = g_string_new(NULL);
-    g_string_sprintf(update, "UPDATE nodes SET enabled = %i WHERE rack_no = %li AND chassis_no = %li;", 1 - enabled, rack_no, chassis_no);
-    assert(SQLITE_OK == sqlite3_exec(db, update->str, NULL, NULL, NULL));
-    g_string_free(update, TRUE);
+    return num_rows;
+}
+
+// run sql which doesn't need any parameters. Assumes the caller holds db_lock
+static bool exec_sql(const char *sql) {
+    char *errstr = NULL;
+    if (SQLITE_OK != sqlite3_exec(db, sql, NULL, NULL, &errstr)) {
+        puts(errstr);
+        sqlite3_free(errstr);
+        return false;
+    }
 
-    assert(SQLITE_OK == sqlite3_exec(db, "commit;", NULL, NULL, NULL));
     return true;
-}
\ No newline at end of file
+}
+
+// the oldest errors in temp.archive_chunk are copied to the attached archive then deleted.
+// counts is filled with what was moved so that the counters can be updated once this has committed.
+// Assumes the caller holds db_lock and has begun a transaction
+static bool move_archive_chunk(GArray *counts) {
+    bool ret = exec_sql(
+        "CREATE TABLE IF NOT EXISTS archive.errors(\
+            id INTEGER PRIMARY KEY NOT NULL UNIQUE,\
+            rack_no INTEGER NOT NULL,\
+            chassis_no INTEGER NOT NULL,\
+            valve_no INTEGER DEFAULT -1,\
+            recv_time INTEGER NOT NULL,\
+            last_seen INTEGER,\
+            occurrences INTEGER NOT NULL DEFAULT 1,\
+            description TEXT NOT NULL,\
+            enabled INTEGER DEFAULT 1\
+        );\
+        CREATE INDEX IF NOT EXISTS archive.errors_by_time ON errors(recv_time);\
+        INSERT INTO archive.errors(rack_no, chassis_no, valve_no, recv_time, last_seen, occurrences, description, enabled) \
+            SELECT nodes.rack_no, nodes.chassis_no, errors.valve_no, errors.recv_time, errors.last_seen, errors.occurrences, \
+                " DESCRIPTION_SQL("errors") ", errors.enabled \
+            FROM temp.archive_chunk \
+            INNER JOIN errors ON errors.id = archive_chunk.id \
+            INNER JOIN nodes ON errors.node_id = nodes.id \
+            ORDER BY errors.recv_time, errors.id;");
+    if (!ret) {
+        return false;
+    }
+
+    sqlite3_stmt *tally = prepare_statement(
+        "SELECT nodes.rack_no, nodes.chassis_no, errors.valve_no, COUNT(*), SUM(errors.enabled) \
+            FROM temp.archive_chunk \
+            INNER JOIN errors ON errors.id = archive_chunk.id \
+            INNER JOIN nodes ON errors.node_id = nodes.id \
+            GROUP BY errors.node_id, errors.valve_no;");
+    int status;
+    while (SQLITE_ROW == (status = sqlite3_step(tally))) {
+        #pragma GCC diagnostic push
+        #pragma GCC diagnostic ignored "-Wsign-conversion"
+        const ArchivedCount count = {
+            .rack_no = sqlite3_column_int(tally, 0),
+            .chassis_no = sqlite3_column_int(tally, 1),
+            .valve_no = sqlite3_column_int(tally, 2),
+            .num_errors = sqlite3_column_int(tally, 3),
+            .num_enabled = sqlite3_column_int(tally, 4),
+        };
+        #pragma GCC diagnostic pop
+        g_array_append_val(counts, count);
+    }
+    sqlite3_finalize(tally);
+    if (SQLITE_DONE != status) {
+        puts(sqlite3_errmsg(db));
+        return false;
+    }
+
+    return exec_sql("DELETE FROM errors WHERE id IN (SELECT id FROM temp.archive_chunk);");
+}
+
+int archive_old_errors(const char *archive_prefix, const time_t before, const unsigned int keep, const bool monthly,
+                       const unsigned int max_rows) {
+    assert(NULL != archive_prefix);
+    assert(max_rows > 0);
+
+    g_rec_mutex_lock(&db_lock);
+
+    const unsigned int num_rows = count_archivable(before, keep, max_rows);
+    if (0 == num_rows) {
+        g_rec_mutex_unlock(&db_lock);
+        return 0;
+    }
+
+    GString *path = g_string_new(archive_prefix);
+    assert(NULL != path);
+
+    // with a file per month only the oldest error's month is moved this time
+    sqlite3_int64 until = INT64_MAX;
+    if (monthly) {
+        sqlite3_stmt *oldest = prepare_statement("SELECT MIN(recv_time) FROM errors;");
+        assert(SQLITE_ROW == sqlite3_step(oldest));
+        char month[8];
+        until = month_end(sqlite3_column_int64(oldest, 0), month);
+        sqlite3_finalize(oldest);
+        g_string_append_printf(path, "-%s", month);
+    }
+    g_string_append(path, ".db");
+
+    // pick the errors to move up front so that every step below agrees on them
+    bool ret = exec_sql("CREATE TEMP TABLE IF NOT EXISTS archive_chunk(id INTEGER PRIMARY KEY); DELETE FROM temp.archive_chunk;");
+    if (ret) {
+        sqlite3_stmt *chunk = prepare_statement(
+            "INSERT INTO temp.archive_chunk(id) \
+                SELECT id FROM errors \
+                WHERE recv_time < ?1 AND node_id IN (SELECT id FROM nodes) \
+                ORDER BY recv_time, id \
+                LIMIT ?2;");
+        sqlite3_bind_int64(chunk, 1, until);
+        sqlite3_bind_int64(chunk, 2, num_rows);
+        ret = (SQLITE_DONE == sqlite3_step(chunk));
+        if (!ret) {
+            puts(sqlite3_errmsg(db));
+        }
+        sqlite3_finalize(chunk);
+    }
+
+    // ATTACH isn't allowed inside a transaction
+    bool attached = false;
+    if (ret) {
+        sqlite3_stmt *attach = prepare_statement("ATTACH DATABASE ?1 AS archive;");
+        sqlite3_bind_text(attach, 1, path->str, -1, SQLITE_STATIC);
+        ret = attached = (SQLITE_DONE == sqlite3_step(attach));
+        if (!ret) {
+            fprintf(stderr, "Could not open archive %s: %s\n", path->str, sqlite3_errmsg(db));
+        }
+        sqlite3_finalize(attach);
+    }
+
+    GArray *counts = g_array_new(FALSE, FALSE, sizeof(ArchivedCount));
+    assert(NULL != counts);
+
+    if (ret) {
+        ret = step_statement(statements.begin);
+        if (ret) {
+            ret = move_archive_chunk(counts) && step_statement(statements.commit);
+            if (!ret) {
+                step_statement(statements.rollback);
+            }
+        }
+    }
+
+    int num_moved = ret ? 0 : -1;
+    if (ret) {
+        for (guint i = 0; i < counts->len; i++) {
+            const ArchivedCount *count = &g_array_index(counts, ArchivedCount, i);
+            counters_remove_errors(count->rack_no, count->chassis_no, count->valve_no, count->num_errors, count->num_enabled);
+            num_moved += (int) count->num_errors;
+        }
+
+        forget_recent_errors();
+        g_atomic_int_inc(&generation);
+    }
+    g_array_free(counts, TRUE);
+
+    exec_sql("DELETE FROM temp.archive_chunk;");
+    if (attached) {
+        exec_sql("DETACH DATABASE archive;");
+    }
+
+    g_string_free(path, TRUE);
+    g_rec_mutex_unlock(&db_lock);
+    return num_moved;
+}
+
+int reclaim_space(const int max_pages) {
+    g_rec_mutex_lock(&db_lock);
+
+    char *query = g_strdup_printf("PRAGMA incremental_vacuum(%i);", (max_pages > 0) ? max_pages : 0);
+    assert(NULL != query);
+    const bool ret = exec_sql(query);
+    g_free(query);
+
+    int remaining = -1;
+    if (ret) {
+        sqlite3_stmt *statement = prepare_statement("PRAGMA freelist_count;");
+        if (SQLITE_ROW == sqlite3_step(statement)) {
+            remaining = sqlite3_column_int(statement, 0);
+        }
+        sqlite3_finalize(statement);
+    }
+
+    g_rec_mutex_unlock(&db_lock);
+    return remaining;
+}
@@ -0,0 +1,362 @@
+/*
+ * Copyright 2017
+ * GPL3 Licensed
+ * bench.c
+ * Synthetic fleet load generator and benchmark for the database (make bench)
+ */
+
+// includes
+#include "config.h"
+#include "sql.h"
+#include "ingest.h"
+#include "EdsacErrorListModel.h" // for its page size
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <edsac_representation.h>
+#include <edsac_arguments.h>
+#include <glib.h>
+
+// functions
+
+// descriptions used by the generated errors. The first word of each is searched for
+static const char *const hardware_messages[] = {
+    "exploded without warning",
+    "overheated and was shut down",
+    "heater voltage low",
+    "filament open circuit",
+};
+
+static const char *const software_messages[] = {
+    "watchdog expired",
+    "checksum mismatch in configuration",
+};
+
+// xorshift: reproducible runs without depending on the C library's rand
+static guint64 rng_state = 88172645463325252ull;
+
+static guint64 next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+// in [0, n)
+static guint random_below(const guint n) {
+    return (guint) (next_random() % n);
+}
+
+typedef struct {
+    guint racks;
+    guint chassis;
+    guint valves;
+    guint num_errors;
+    guint batch_size;
+    guint burst_length;     // errors in a row from the same node and valve
+    guint rate;             // errors per simulated second
+    guint software_percent; // errors which aren't from a valve
+    guint queries;          // of each kind for each ClickableType
+    gboolean single;        // add_error per row rather than add_errors_batch
+} Fleet;
+
+// every error the fleet can send: [node][valve (0 for software errors)][message]
+typedef struct {
+    BufferItem *items;
+    guint per_node;
+} ErrorPool;
+
+static BufferItem *pool_item(const ErrorPool *pool, const guint node, const guint valve, const guint message) {
+    assert(message < G_N_ELEMENTS(hardware_messages));
+    return &pool->items[node * pool->per_node + valve * G_N_ELEMENTS(hardware_messages) + message];
+}
+
+// made once so that generating errors costs nothing. The pool lasts until the end of the run
+static void make_pool(ErrorPool *pool, const Fleet *fleet) {
+    pool->per_node = (fleet->valves + 1) * G_N_ELEMENTS(hardware_messages);
+    const guint num_nodes = fleet->racks * fleet->chassis;
+    pool->items = g_malloc0_n(num_nodes * pool->per_node, sizeof(BufferItem));
+    assert(NULL != pool->items);
+
+    for (guint node = 0; node < num_nodes; node++) {
+        char address_string[32];
+        snprintf(address_string, sizeof(address_string), "127.0.%u.%u", node / fleet->chassis, node % fleet->chassis);
+        struct sockaddr *address = alloc_addr(address_string, /*arbitrary port number*/ 1234);
+        assert(NULL != address);
+
+        for (guint valve = 0; valve <= fleet->valves; valve++) {
+            const guint num_messages = (0 == valve) ? G_N_ELEMENTS(software_messages) : G_N_ELEMENTS(hardware_messages);
+            for (guint message = 0; message < num_messages; message++) {
+                BufferItem *item = pool_item(pool, node, valve, message);
+                memcpy(&item->address, address->sa_data + 2, sizeof(item->address));
+                if (0 == valve) {
+                    software_error(&item->msg, software_messages[message]);
+                } else {
+                    hardware_error_valve(&item->msg, (int) valve - 1, hardware_messages[message]);
+                }
+            }
+        }
+
+        free(address);
+    }
+}
+
+// the next error from the fleet. Bursts repeat the same node, valve and message burst_length times
+static BufferItem *next_error(const ErrorPool *pool, const Fleet *fleet) {
+    static BufferItem *current = NULL;
+    static guint repeats = 0;
+
+    if ((NULL == current) || (repeats >= fleet->burst_length)) {
+        const guint node = random_below(fleet->racks * fleet->chassis);
+        guint valve = 0;
+        guint message = 0;
+        if ((0 == fleet->valves) || (random_below(100) < fleet->software_percent)) {
+            message = random_below(G_N_ELEMENTS(software_messages));
+        } else {
+            valve = 1 + random_below(fleet->valves);
+            message = random_below(G_N_ELEMENTS(hardware_messages));
+        }
+
+        current = pool_item(pool, node, valve, message);
+        repeats = 0;
+    }
+
+    repeats++;
+    return current;
+}
+
+static void add_fleet_nodes(const Fleet *fleet) {
+    NodeIdentifier *nodes = g_new(NodeIdentifier, fleet->racks * fleet->chassis);
+    assert(NULL != nodes);
+    size_t num_nodes = 0;
+    for (guint rack = 0; rack < fleet->racks; rack++) {
+        for (guint chassis = 0; chassis < fleet->chassis; chassis++) {
+            nodes[num_nodes].rack_no = rack;
+            nodes[num_nodes].chassis_no = chassis;
+            num_nodes++;
+        }
+    }
+
+    assert(true == add_nodes(nodes, num_nodes, true));
+    g_free(nodes);
+}
+
+// returns the wall time taken in microseconds
+static gint64 ingest(const ErrorPool *pool, const Fleet *fleet, const time_t start) {
+    BufferItem **batch = g_malloc_n(fleet->batch_size, sizeof(BufferItem *));
+    assert(NULL != batch);
+
+    const gint64 began = g_get_monotonic_time();
+
+    guint sent = 0;
+    while (sent < fleet->num_errors) {
+        guint num_items = MIN(fleet->batch_size, fleet->num_errors - sent);
+        const time_t recv_time = start + (time_t) (sent / MAX(fleet->rate, 1u));
+
+        // a batch arrives within one ingest latency so everything in it shares the time
+        for (guint i = 0; i < num_items; i++) {
+            batch[i] = next_error(pool, fleet);
+            batch[i]->recv_time = recv_time;
+        }
+
+        if (fleet->single) {
+            for (guint i = 0; i < num_items; i++) {
+                add_error(batch[i]);
+            }
+        } else {
+            add_errors_batch(batch, num_items, NULL);
+        }
+        sent += num_items;
+    }
+
+    const gint64 taken = g_get_monotonic_time() - began;
+    g_free(batch);
+    return taken;
+}
+
+// matches GCompareFunc
+static gint compare_times(gconstpointer a, gconstpointer b) {
+    const gint64 A = *(const gint64 *) a;
+    const gint64 B = *(const gint64 *) b;
+    return (A > B) - (A < B);
+}
+
+static void print_latency(const char *what, const char *type, gint64 *times, const guint n) {
+    qsort(times, n, sizeof(*times), (int (*)(const void *, const void *)) compare_times);
+    const gint64 p50 = times[n / 2];
+    const gint64 p99 = times[MIN(n - 1, (n * 99) / 100)];
+    printf("%-14s %-8s p50 %8.3f ms   p99 %8.3f ms\n", what, type, (double) p50 / 1000.0, (double) p99 / 1000.0);
+}
+
+// SearchRowFunc: the rows are read but nothing is done with them
+static bool discard_row(__attribute__((unused)) const SearchRow *row, __attribute__((unused)) gpointer user_data) {
+    return true;
+}
+
+// a Clickable of type for a random part of the fleet
+static void random_clickable(const Fleet *fleet, const ClickableType type, Clickable *search) {
+    memset(search, 0, sizeof(*search));
+    search->type = type;
+    search->rack_num = random_below(fleet->racks);
+    search->chassis_num = random_below(fleet->chassis);
+    search->valve_num = (fleet->valves > 0) ? (int) random_below(fleet->valves) : -1;
+    const char *message = hardware_messages[random_below(G_N_ELEMENTS(hardware_messages))];
+    g_strlcpy(search->text, message, sizeof(search->text));
+    char *space = strchr(search->text, ' ');
+    if (NULL != space) {
+        *space = '\0'; // just the first word
+    }
+}
+
+// count_clickable, the first page, the newest page (where an updating tab is) and a page from the middle (scrolling)
+static void query_latency(const Fleet *fleet) {
+    static const struct {
+        ClickableType type;
+        const char *name;
+    } types[] = {{RACK, "rack"}, {CHASSIS, "chassis"}, {VALVE, "valve"}, {ALL, "all"}, {SEARCH, "search"}};
+
+    gint64 *count_times = g_malloc_n(fleet->queries, sizeof(gint64));
+    gint64 *first_times = g_malloc_n(fleet->queries, sizeof(gint64));
+    gint64 *newest_times = g_malloc_n(fleet->queries, sizeof(gint64));
+    gint64 *middle_times = g_malloc_n(fleet->queries, sizeof(gint64));
+    assert((NULL != count_times) && (NULL != first_times) && (NULL != newest_times) && (NULL != middle_times));
+
+    for (size_t t = 0; t < G_N_ELEMENTS(types); t++) {
+        for (guint q = 0; q < fleet->queries; q++) {
+            Clickable search;
+            random_clickable(fleet, types[t].type, &search);
+
+            gint64 began = g_get_monotonic_time();
+            const int count = count_clickable(&search);
+            count_times[q] = g_get_monotonic_time() - began;
+
+            began = g_get_monotonic_time();
+            search_clickable_foreach(&search, 0, 0, true, EDSAC_ERROR_LIST_PAGE_SIZE, discard_row, NULL);
+            first_times[q] = g_get_monotonic_time() - began;
+
+            // keyset page backwards from the end, as EdsacErrorListModel does for the newest rows
+            began = g_get_monotonic_time();
+            search_clickable_foreach(&search, INT64_MAX, INT_MAX, false, EDSAC_ERROR_LIST_PAGE_SIZE, discard_row, NULL);
+            newest_times[q] = g_get_monotonic_time() - began;
+
+            // jumping into the middle has no key
+            began = g_get_monotonic_time();
+            search_clickable_foreach_offset(&search, MAX(count, 0) / 2, EDSAC_ERROR_LIST_PAGE_SIZE, discard_row, NULL);
+            middle_times[q] = g_get_monotonic_time() - began;
+        }
+
+        print_latency("count", types[t].name, count_times, fleet->queries);
+        print_latency("first page", types[t].name, first_times, fleet->queries);
+        print_latency("newest page", types[t].name, newest_times, fleet->queries);
+        print_latency("middle page", types[t].name, middle_times, fleet->queries);
+    }
+
+    g_free(count_times);
+    g_free(first_times);
+    g_free(newest_times);
+    g_free(middle_times);
+}
+
+int main(int argc, char **argv) {
+    Fleet fleet = {
+        .racks = 8,
+        .chassis = 16,
+        .valves = 8,
+        .num_errors = 200000,
+        .batch_size = DEFAULT_INGEST_BATCH_SIZE,
+        .burst_length = 1,
+        .rate = 100,
+        .software_percent = 10,
+        .queries = 50,
+        .single = FALSE,
+    };
+    gint racks = (gint) fleet.racks, chassis = (gint) fleet.chassis, valves = (gint) fleet.valves;
+    gint num_errors = (gint) fleet.num_errors, batch_size = (gint) fleet.batch_size, burst_length = (gint) fleet.burst_length;
+    gint rate = (gint) fleet.rate, software_percent = (gint) fleet.software_percent, queries = (gint) fleet.queries;
+    gint dedup_window = 0;
+    gint64 seed = 0;
+    char *path = NULL;
+
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wpedantic"
+    GOptionEntry entries[] = {
+        {"racks", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &racks, "Racks in the fleet (default 8)", "N"},
+        {"chassis", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &chassis, "Chassis in each rack (default 16)", "N"},
+        {"valves", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &valves, "Valves in each chassis (default 8)", "N"},
+        {"errors", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &num_errors, "Errors to send (default 200000)", "N"},
+        {"batch-size", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &batch_size, "Errors written in each transaction (default 256)", "N"},
+        {"burst-length", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &burst_length, "Errors in a row from the same node and valve (default 1)", "N"},
+        {"rate", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &rate, "Errors per second of simulated time (default 100)", "N"},
+        {"software-percent", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &software_percent, "Percentage of errors not from a valve (default 10)", "N"},
+        {"dedup-window", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &dedup_window, "As mothership_gui --dedup-window (default 0: off)", "SECONDS"},
+        {"queries", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &queries, "Queries of each kind timed for each tab type (default 50)", "N"},
+        {"single", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &fleet.single, "Add errors one at a time rather than in batches", NULL},
+        {"seed", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT64, &seed, "Random seed (default: fixed)", "N"},
+        {"database", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME, &path, "Database file to fill, replacing it (default: memory)", "PATH"},
+        {NULL}
+    };
+    #pragma GCC diagnostic pop
+
+    GOptionContext *context = g_option_context_new("- benchmark the error database");
+    assert(NULL != context);
+    g_option_context_add_main_entries(context, entries, NULL);
+    GError *error = NULL;
+    if (!g_option_context_parse(context, &argc, &argv, &error)) {
+        fprintf(stderr, "%s\n", error->message);
+        g_error_free(error);
+        return EXIT_FAILURE;
+    }
+    g_option_context_free(context);
+
+    if ((racks < 1) || (chassis < 1) || (valves < 0) || (num_errors < 1) || (batch_size < 1) || (burst_length < 1) || (rate < 1) ||
+        (software_percent < 0) || (software_percent > 100) || (queries < 1) || (dedup_window < 0)) {
+        fprintf(stderr, "Counts must be positive (--valves may be 0) and --software-percent is a percentage\n");
+        return EXIT_FAILURE;
+    }
+    if ((racks > 255) || (chassis > 255)) {
+        fprintf(stderr, "Node addresses only have room for 255 racks and 255 chassis\n");
+        return EXIT_FAILURE;
+    }
+
+    fleet.racks = (guint) racks;
+    fleet.chassis = (guint) chassis;
+    fleet.valves = (guint) valves;
+    fleet.num_errors = (guint) num_errors;
+    fleet.batch_size = (guint) batch_size;
+    fleet.burst_length = (guint) burst_length;
+    fleet.rate = (guint) rate;
+    fleet.software_percent = (guint) software_percent;
+    fleet.queries = (guint) queries;
+    if (0 != seed) {
+        rng_state = (guint64) seed;
+    }
+
+    if (NULL != path) {
+        unlink(path);
+    }
+    init_database(path);
+    set_dedup_window(dedup_window);
+    add_fleet_nodes(&fleet);
+
+    ErrorPool pool;
+    make_pool(&pool, &fleet);
+
+    printf("%u racks x %u chassis x %u valves, %u errors in %s of %u, bursts of %u\n", fleet.racks, fleet.chassis, fleet.valves,
+           fleet.num_errors, fleet.single ? "single inserts instead of batches" : "batches", fleet.batch_size, fleet.burst_length);
+
+    const gint64 taken = ingest(&pool, &fleet, time(NULL) - (time_t) (fleet.num_errors / fleet.rate));
+    printf("ingest         %.0f rows/s (%.3f s)\n", (double) fleet.num_errors * G_USEC_PER_SEC / (double) MAX(taken, 1),
+           (double) taken / G_USEC_PER_SEC);
+    printf("merged         %u duplicates\n", get_database_merges());
+
+    query_latency(&fleet);
+
+    close_database();
+    g_free(pool.items);
+    return EXIT_SUCCESS;
+}
@@ -8,6 +8,8 @@
 // includes
 #include "config.h"
 #include "sql.h"
+#include "metrics.h"
+#include "export.h"
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -16,6 +18,8 @@
 #include <string.h>
 #include <time.h>
 #include <edsac_arguments.h>
+#include <sqlite3.h>
+#include <unistd.h>
 
 // functions
 
@@ -94,6 +98,888 @@ static void search_error(const unsigned int rack_no, const unsigned int chassis_
     g_string_free(expected_msg, TRUE);
 }
 
+// the in memory counts should always agree with what a search finds
+static void check_counters(void) {
+    Clickable searches[6];
+    searches[0].type = ALL;
+    searches[1].type = RACK;
+    searches[1].rack_num = 0;
+    searches[2].type = CHASSIS;
+    searches[2].rack_num = 0;
+    searches[2].chassis_num = 0;
+    searches[3].type = CHASSIS;
+    searches[3].rack_num = 0;
+    searches[3].chassis_num = 1;
+    searches[4].type = VALVE;
+    searches[4].rack_num = 0;
+    searches[4].chassis_num = 0;
+    searches[4].valve_num = 3;
+    searches[5].type = VALVE;
+    searches[5].rack_num = 0;
+    searches[5].chassis_num = 0;
+    searches[5].valve_num = -1;
+
+    const bool old_show_disabled = get_show_disabled();
+    for (int show = 0; show < 2; show++) {
+        set_show_disabled(show);
+        for (size_t i = 0; i < G_N_ELEMENTS(searches); i++) {
+            GList *results = search_clickable(&searches[i]);
+            assert((int) g_list_length(results) == count_clickable(&searches[i]));
+            g_list_free_full(results, free_search_result);
+        }
+    }
+    set_show_disabled(old_show_disabled);
+}
+
+static int count_rows(sqlite3 *db, const char *query) {
+    sqlite3_stmt *statement = NULL;
+    assert(SQLITE_OK == sqlite3_prepare_v2(db, query, -1, &statement, NULL));
+    assert(SQLITE_ROW == sqlite3_step(statement));
+    const int count = sqlite3_column_int(statement, 0);
+    assert(SQLITE_OK == sqlite3_finalize(statement));
+
+    return count;
+}
+
+// a database created before the schema was versioned should be upgraded in place
+static void test_legacy_upgrade(void) {
+    const char *path = "sql-test-legacy.db";
+    unlink(path);
+
+    sqlite3 *legacy = NULL;
+    assert(SQLITE_OK == sqlite3_open(path, &legacy));
+    assert(SQLITE_OK == sqlite3_exec(legacy,
+        "CREATE TABLE nodes(id INTEGER PRIMARY KEY NOT NULL UNIQUE, rack_no INTEGER NOT NULL, chassis_no INTEGER NOT NULL, enabled INTEGER DEFAULT 1, UNIQUE(rack_no, chassis_no));"
+        "CREATE TABLE errors(id INTEGER PRIMARY KEY NOT NULL UNIQUE, node_id INTEGER NOT NULL, recv_time INTEGER NOT NULL, description TEXT NOT NULL, valve_no INTEGER DEFAULT -1, enabled INTEGER DEFAULT 1);"
+        "INSERT INTO nodes(rack_no, chassis_no) VALUES(3, 4);"
+        "INSERT INTO errors(node_id, recv_time, description) VALUES(1, 100, 'Software Error: old');",
+        NULL, NULL, NULL));
+    assert(SQLITE_OK == sqlite3_close(legacy));
+
+    init_database(path);
+    const int version = get_schema_version();
+    assert(version > 0);
+
+    // old data is still there
+    Clickable search;
+    search.type = CHASSIS;
+    search.rack_num = 3;
+    search.chassis_num = 4;
+    assert(1 == count_clickable(&search));
+
+    // the prefix became the category but is still shown and searched
+    GList *results = search_clickable(&search);
+    assert(NULL != strstr(((SearchResult *) results->data)->message, "Software Error: old"));
+    g_list_free_full(results, free_search_result);
+    search.type = SEARCH;
+    g_strlcpy(search.text, "software error", sizeof(search.text));
+    assert(1 == count_clickable(&search));
+    close_database();
+
+    // opening again doesn't change anything
+    init_database(path);
+    assert(version == get_schema_version());
+    close_database();
+
+    assert(SQLITE_OK == sqlite3_open(path, &legacy));
+    assert(3 == count_rows(legacy, "SELECT COUNT(*) FROM sqlite_master WHERE type = 'index' AND name LIKE 'errors_by_%';"));
+    assert(1 == count_rows(legacy, "SELECT COUNT(*) FROM errors WHERE category = 2 AND description = 'old';"));
+
+    // the search index agrees with the triggers, including after a delete
+    assert(SQLITE_OK == sqlite3_exec(legacy, "INSERT INTO errors_fts(errors_fts) VALUES('integrity-check');", NULL, NULL, NULL));
+    assert(SQLITE_OK == sqlite3_exec(legacy, "DELETE FROM errors;", NULL, NULL, NULL));
+    assert(0 == count_rows(legacy, "SELECT COUNT(*) FROM errors_fts WHERE errors_fts MATCH 'software';"));
+    assert(SQLITE_OK == sqlite3_exec(legacy, "INSERT INTO errors_fts(errors_fts) VALUES('integrity-check');", NULL, NULL, NULL));
+    assert(SQLITE_OK == sqlite3_close(legacy));
+
+    unlink(path);
+    GString *wal = g_string_new(path);
+    g_string_append(wal, "-wal");
+    unlink(wal->str);
+    g_string_assign(wal, path);
+    g_string_append(wal, "-shm");
+    unlink(wal->str);
+    g_string_free(wal, TRUE);
+}
+
+// the category is stored apart from the description, and dropped messages are counted by category
+static void test_categories(void) {
+    init_database(NULL);
+    assert(true == add_node(0, 0, true));
+
+    BufferItem *hard = error(0, 0, "same", HARD_ERROR_OTHER);
+    BufferItem *soft = error(0, 0, "same", SOFT_ERROR);
+    hard->recv_time = 100;
+    soft->recv_time = 100;
+    const unsigned int merges = get_database_merges();
+    set_dedup_window(60);
+    assert(true == add_error(hard));
+    assert(true == add_error(soft));
+    assert(true == add_error_decoded(0, 0, -1, 100, "same"));
+    assert(merges == get_database_merges()); // the same text in different categories isn't a duplicate
+    set_dedup_window(0);
+
+    Clickable search;
+    memset(&search, 0, sizeof(search));
+    search.type = ALL;
+    GList *results = search_clickable(&search);
+    assert(3 == g_list_length(results));
+    assert(NULL != strstr(((SearchResult *) results->data)->message, " Hardware Error: same"));
+    assert(NULL != strstr(((SearchResult *) results->next->data)->message, " Software Error: same"));
+    assert(NULL == strstr(((SearchResult *) results->next->next->data)->message, "Error"));
+    g_list_free_full(results, free_search_result);
+
+    search.type = SEARCH;
+    g_strlcpy(search.text, "hardware", sizeof(search.text));
+    assert(1 == count_clickable(&search));
+
+    // an unknown node is counted under the message's category
+    BufferItem *unknown = error(5, 5, "lost", SOFT_ERROR);
+    assert(false == add_error(unknown));
+    assert(1 == get_dropped_errors(DROP_UNKNOWN_NODE, ERROR_CATEGORY_SOFTWARE));
+    assert(0 == get_dropped_errors(DROP_UNKNOWN_NODE, ERROR_CATEGORY_HARDWARE));
+    assert(1 == get_unknown_node_errors());
+
+    // a type which isn't an error is dropped without being formatted
+    hard->msg.type = (MessageType) 99;
+    assert(false == add_error(hard));
+    assert(1 == get_dropped_errors(DROP_UNKNOWN_TYPE, ERROR_CATEGORY_OTHER));
+    assert(1 == get_unknown_node_errors());
+
+    free(hard);
+    free(soft);
+    free(unknown);
+    close_database();
+}
+
+// collect the ids of a list of SearchResults into ids, returning how many there were
+static size_t result_ids(GList *results, int *ids, size_t max) {
+    size_t n = 0;
+    for (GList *item = results; NULL != item; item = item->next) {
+        assert(n < max);
+        ids[n++] = ((SearchResult *) item->data)->id;
+    }
+
+    return n;
+}
+
+// keyset and offset pages should agree with search_clickable
+// SearchRowFunc collecting ids into an IdCollector
+typedef struct {
+    int *ids;
+    size_t n;
+    size_t max;
+    time_t last_time;
+} IdCollector;
+
+static bool collect_id(const SearchRow *row, gpointer collector) {
+    IdCollector *c = (IdCollector *) collector;
+    assert(c->n < c->max);
+    assert(NULL != row->time_str);
+    assert(0 == strcmp("Software Error: page", row->description));
+
+    c->ids[c->n++] = row->id;
+    c->last_time = row->recv_time;
+    return c->n < c->max;
+}
+
+// as collect_id for any description
+static bool collect_any_id(const SearchRow *row, gpointer collector) {
+    IdCollector *c = (IdCollector *) collector;
+    assert(c->n < c->max);
+
+    c->ids[c->n++] = row->id;
+    c->last_time = row->recv_time;
+    return c->n < c->max;
+}
+
+static void test_paging(void) {
+    init_database(NULL);
+    assert(true == add_node(1, 1, true));
+
+    // several errors with the same time so that ties have to be broken by id
+    const time_t times[] = {50, 10, 20, 20, 20, 30, 40, 10, 60, 20};
+    const size_t num_errors = G_N_ELEMENTS(times);
+    for (size_t i = 0; i < num_errors; i++) {
+        assert(true == add_error_decoded(1, 1, -1, times[i], "Software Error: page"));
+    }
+
+    Clickable all;
+    all.type = ALL;
+
+    int expected[G_N_ELEMENTS(times)];
+    GList *everything = search_clickable(&all);
+    assert(num_errors == result_ids(everything, expected, num_errors));
+
+    // forward in pages of 3
+    int forward[G_N_ELEMENTS(times)];
+    size_t n = 0;
+    time_t key_time = 0;
+    int key_id = 0;
+    while (true) {
+        GList *page = search_clickable_page(&all, key_time, key_id, true, 3);
+        if (NULL == page) {
+            break;
+        }
+        const SearchResult *last = g_list_last(page)->data;
+        key_time = last->recv_time;
+        key_id = last->id;
+        n += result_ids(page, forward + n, num_errors - n);
+        g_list_free_full(page, free_search_result);
+    }
+    assert(num_errors == n);
+    assert(0 == memcmp(expected, forward, sizeof(expected)));
+
+    // backward from the last error
+    const SearchResult *last = g_list_last(everything)->data;
+    GList *before = search_clickable_page(&all, last->recv_time, last->id, false, 4);
+    int backward[4];
+    assert(4 == result_ids(before, backward, 4));
+    assert(0 == memcmp(expected + num_errors - 5, backward, sizeof(backward)));
+    g_list_free_full(before, free_search_result);
+
+    // offset
+    GList *middle = search_clickable_offset(&all, 4, 3);
+    int offset[3];
+    assert(3 == result_ids(middle, offset, 3));
+    assert(0 == memcmp(expected + 4, offset, sizeof(offset)));
+    g_list_free_full(middle, free_search_result);
+
+    // streaming in pages of 4, continuing from the last row seen
+    int streamed[G_N_ELEMENTS(times)];
+    IdCollector collector = {streamed, 0, num_errors, 0};
+    int rows = 0;
+    do {
+        const int last_id = (0 == collector.n) ? 0 : streamed[collector.n - 1];
+        rows = search_clickable_foreach(&all, collector.last_time, last_id, true, 4, collect_id, &collector);
+        assert(rows >= 0);
+    } while (0 != rows);
+    assert(num_errors == collector.n);
+    assert(0 == memcmp(expected, streamed, sizeof(expected)));
+
+    // the callback can stop early
+    IdCollector two = {streamed, 0, 2, 0};
+    assert(2 == search_clickable_foreach(&all, 0, 0, true, -1, collect_id, &two));
+    assert(0 == memcmp(expected, streamed, 2 * sizeof(int)));
+
+    // backward and offset streams
+    IdCollector back = {streamed, 0, 4, 0};
+    assert(4 == search_clickable_foreach(&all, last->recv_time, last->id, false, 4, collect_id, &back));
+    for (size_t i = 0; i < 4; i++) {
+        assert(expected[num_errors - 2 - i] == streamed[i]);
+    }
+    IdCollector skip = {streamed, 0, num_errors, 0};
+    assert((int) num_errors - 4 == search_clickable_foreach_offset(&all, 4, -1, collect_id, &skip));
+    assert(0 == memcmp(expected + 4, streamed, (num_errors - 4) * sizeof(int)));
+
+    // the newest rows, newest first, counted at the same time
+    IdCollector tail = {streamed, 0, num_errors, 0};
+    int count = -1;
+    assert(3 == search_clickable_foreach_tail(&all, 3, &count, collect_id, &tail));
+    assert((int) num_errors == count);
+    for (size_t i = 0; i < 3; i++) {
+        assert(expected[num_errors - 1 - i] == streamed[i]);
+    }
+
+    // times past 2038 are still the newest
+    const time_t late = (time_t) 1 << 32;
+    assert(true == add_error_decoded(1, 1, -1, late, "Software Error: late"));
+    IdCollector late_tail = {streamed, 0, 1, 0};
+    assert(1 == search_clickable_foreach_tail(&all, 1, &count, collect_any_id, &late_tail));
+    assert(late == late_tail.last_time);
+
+    g_list_free_full(everything, free_search_result);
+    close_database();
+}
+
+// identical errors within the dedup window become one row
+static void test_dedup(void) {
+    init_database(NULL);
+    assert(true == add_node(1, 1, true));
+    set_dedup_window(10);
+
+    Clickable all;
+    all.type = ALL;
+
+    const unsigned int merges = get_database_merges();
+    assert(true == add_error_decoded(1, 1, 2, 100, "Hardware Error: flood"));
+    assert(true == add_error_decoded(1, 1, 2, 105, "Hardware Error: flood"));
+    assert(true == add_error_decoded(1, 1, 2, 109, "Hardware Error: flood"));
+    assert(1 == count_clickable(&all));
+    assert(merges + 2 == get_database_merges());
+
+    // a different valve, description or a time outside of the window is a new error
+    assert(true == add_error_decoded(1, 1, 3, 106, "Hardware Error: flood"));
+    assert(true == add_error_decoded(1, 1, 2, 106, "Hardware Error: other"));
+    assert(true == add_error_decoded(1, 1, 2, 110, "Hardware Error: flood"));
+    assert(4 == count_clickable(&all));
+    check_counters();
+
+    GList *results = search_clickable(&all);
+    const SearchResult *first = results->data;
+    assert((100 == first->recv_time) && (3 == first->occurrences));
+    for (GList *item = results->next; NULL != item; item = item->next) {
+        assert(1 == ((SearchResult *) item->data)->occurrences);
+    }
+    g_list_free_full(results, free_search_result);
+
+    // removed errors can't be merged into
+    assert(true == remove_all_errors());
+    assert(true == add_error_decoded(1, 1, 2, 111, "Hardware Error: flood"));
+    assert(1 == count_clickable(&all));
+
+    // off again
+    set_dedup_window(0);
+    assert(true == add_error_decoded(1, 1, 2, 111, "Hardware Error: flood"));
+    assert(2 == count_clickable(&all));
+
+    close_database();
+}
+
+// errors in an archive file made by archive_old_errors
+static int count_archived(const char *path) {
+    sqlite3 *archive = NULL;
+    assert(SQLITE_OK == sqlite3_open(path, &archive));
+    sqlite3_stmt *statement = NULL;
+    assert(SQLITE_OK == sqlite3_prepare_v2(archive, "SELECT COUNT(*) FROM errors;", -1, &statement, NULL));
+    assert(SQLITE_ROW == sqlite3_step(statement));
+    const int count = sqlite3_column_int(statement, 0);
+    sqlite3_finalize(statement);
+    assert(SQLITE_OK == sqlite3_close(archive));
+
+    unlink(path);
+    return count;
+}
+
+// old errors and those over the row budget move to the archive, oldest first
+static void test_archive(void) {
+    init_database(NULL);
+    assert(true == add_node(0, 0, true));
+
+    Clickable all;
+    all.type = ALL;
+
+    // one error a day for ten days from the start of 2017 (local time)
+    struct tm start = {.tm_year = 117, .tm_mon = 0, .tm_mday = 1, .tm_hour = 12, .tm_isdst = -1};
+    const time_t first = mktime(&start);
+    for (int i = 0; i < 10; i++) {
+        assert(true == add_error_decoded(0, 0, i % 2, first + i * 24 * 60 * 60, "Hardware Error: old"));
+    }
+
+    // nothing breaks this policy
+    assert(0 == archive_old_errors("sql-test-archive", first, 0, false, 100));
+
+    // older than the fourth day, one chunk at a time
+    unsigned int generation = get_database_generation();
+    assert(2 == archive_old_errors("sql-test-archive", first + 3 * 24 * 60 * 60, 0, false, 2));
+    assert(1 == archive_old_errors("sql-test-archive", first + 3 * 24 * 60 * 60, 0, false, 2));
+    assert(0 == archive_old_errors("sql-test-archive", first + 3 * 24 * 60 * 60, 0, false, 2));
+    assert(generation != get_database_generation());
+    assert(7 == count_clickable(&all));
+    check_counters();
+
+    // keep the newest five
+    assert(2 == archive_old_errors("sql-test-archive", 0, 5, false, 100));
+    assert(5 == count_clickable(&all));
+    check_counters();
+    assert(0 <= reclaim_space(0));
+    assert(5 == count_archived("sql-test-archive.db"));
+
+    // the oldest left is in 2017-01-06 so this month goes to one file, then the next month's errors to another
+    assert(true == add_error_decoded(0, 0, 1, first + 40 * 24 * 60 * 60, "Hardware Error: new"));
+    assert(5 == archive_old_errors("sql-test-archive", 0, 1, true, 100));
+    assert(0 == archive_old_errors("sql-test-archive", 0, 1, true, 100));
+    assert(1 == count_clickable(&all));
+    check_counters();
+    assert(5 == count_archived("sql-test-archive-2017-01.db"));
+
+    close_database();
+}
+
+// SEARCH finds errors by the words of their description and keeps up as errors come and go
+static void test_search(void) {
+    init_database(NULL);
+    assert(true == add_node(0, 0, true));
+    assert(true == add_node(0, 1, true));
+
+    assert(true == add_error_decoded(0, 0, 2, 100, "Hardware Error: Valve 2 exploded"));
+    assert(true == add_error_decoded(0, 1, 2, 200, "Hardware Error: valve 2 EXPLODED again"));
+    assert(true == add_error_decoded(0, 1, 3, 300, "Hardware Error: Valve 3 overheated"));
+    assert(true == add_error_decoded(0, 1, -1, 400, "Software Error: \"exploded\" in a quote"));
+
+    Clickable search;
+    memset(&search, 0, sizeof(search));
+    search.type = SEARCH;
+    g_strlcpy(search.text, "valve exploded", sizeof(search.text));
+    assert(2 == count_clickable(&search));
+
+    // in (recv_time, id) order like every other tab
+    GList *found = search_clickable_page(&search, 0, 0, true, 1);
+    assert(NULL != found);
+    SearchResult *first = found->data;
+    assert(NULL != strstr(first->message, "Valve 2 exploded"));
+    GList *rest = search_clickable_page(&search, first->recv_time, first->id, true, 10);
+    assert(NULL != rest);
+    assert(NULL == rest->next);
+    assert(NULL != strstr(((SearchResult *) rest->data)->message, "again"));
+    g_list_free_full(rest, free_search_result);
+
+    // query syntax is searched for rather than obeyed
+    g_strlcpy(search.text, "\"exploded\" OR", sizeof(search.text));
+    assert(0 == count_clickable(&search));
+    g_strlcpy(search.text, "   ", sizeof(search.text));
+    assert(0 == count_clickable(&search));
+    assert(NULL == search_clickable(&search));
+
+    // disabled errors are hidden as usual
+    g_strlcpy(search.text, "exploded", sizeof(search.text));
+    assert(3 == count_clickable(&search));
+    assert(true == error_toggle_disabled((uintptr_t) first->id));
+    assert(2 == count_clickable(&search));
+    set_show_disabled(true);
+    assert(3 == count_clickable(&search));
+    set_show_disabled(false);
+    g_list_free_full(found, free_search_result);
+
+    // new errors are found straight away and removed ones are forgotten
+    assert(true == add_error_decoded(0, 0, 4, 500, "Software Error: exploded later"));
+    assert(3 == count_clickable(&search));
+    assert(true == remove_node(0, 1));
+    assert(1 == count_clickable(&search));
+    assert(true == remove_all_errors());
+    assert(0 == count_clickable(&search));
+
+    close_database();
+}
+
+// a read only connection catches up with errors written by another process
+static void test_read_only(void) {
+    const char *path = "sql-test-read-only.db";
+    unlink(path);
+
+    init_database(path);
+    assert(false == get_database_read_only());
+    assert(true == add_node(0, 0, true));
+    assert(true == add_error_decoded(0, 0, 1, 100, "Hardware Error: first"));
+    close_database();
+
+    // the collector
+    sqlite3 *writer = NULL;
+    assert(SQLITE_OK == sqlite3_open(path, &writer));
+    assert(SQLITE_OK == sqlite3_exec(writer, "PRAGMA journal_mode = WAL;", NULL, NULL, NULL));
+
+    init_database_read_only(path);
+    Clickable all;
+    all.type = ALL;
+    assert(1 == count_clickable(&all));
+    assert(0 == sync_database(NULL));
+    assert(false == add_error_decoded(0, 0, 1, 200, "Hardware Error: not written"));
+    assert(true == get_database_read_only());
+    assert(false == error_toggle_disabled(1));
+
+    // new errors are counted and their keys passed on
+    assert(SQLITE_OK == sqlite3_exec(writer,
+        "INSERT INTO errors(node_id, recv_time, category, description, valve_no, last_seen) VALUES(1, 300, 1, 'second', 2, 300);",
+        NULL, NULL, NULL));
+    GArray *keys = NULL;
+    assert(DATABASE_ERRORS_ADDED == sync_database(&keys));
+    assert((NULL != keys) && (1 == keys->len));
+    const ErrorKey *key = &g_array_index(keys, ErrorKey, 0);
+    assert((0 == key->rack_no) && (0 == key->chassis_no) && (2 == key->valve_no));
+    g_array_unref(keys);
+
+    // the tail stops at what has been counted
+    assert(SQLITE_OK == sqlite3_exec(writer,
+        "INSERT INTO errors(node_id, recv_time, category, description, valve_no, last_seen) VALUES(1, 400, 1, 'unsynced', 2, 400);",
+        NULL, NULL, NULL));
+    int tail_ids[2];
+    IdCollector tail = {tail_ids, 0, 2, 0};
+    int count = -1;
+    assert(2 == search_clickable_foreach_tail(&all, 2, &count, collect_any_id, &tail));
+    assert((2 == count) && (2 == tail_ids[0]) && (1 == tail_ids[1]));
+    assert(DATABASE_ERRORS_ADDED == sync_database(NULL));
+    assert(SQLITE_OK == sqlite3_exec(writer, "DELETE FROM errors WHERE recv_time = 400;", NULL, NULL, NULL));
+    assert(0 != (DATABASE_ERRORS_CHANGED & sync_database(NULL)));
+    assert(2 == count_clickable(&all));
+    check_counters();
+    assert(0 == sync_database(NULL));
+
+    // merged duplicates
+    const unsigned int merges = get_database_merges();
+    assert(SQLITE_OK == sqlite3_exec(writer, "UPDATE errors SET occurrences = 2 WHERE recv_time = 300;", NULL, NULL, NULL));
+    assert(DATABASE_ERRORS_CHANGED == sync_database(NULL));
+    assert(merges != get_database_merges());
+
+    // archived errors and new nodes reload everything
+    const unsigned int generation = get_database_generation();
+    assert(SQLITE_OK == sqlite3_exec(writer, "DELETE FROM errors WHERE recv_time = 100;", NULL, NULL, NULL));
+    assert(DATABASE_ERRORS_CHANGED == sync_database(NULL));
+    assert(generation != get_database_generation());
+    assert(1 == count_clickable(&all));
+    check_counters();
+    assert(SQLITE_OK == sqlite3_exec(writer, "INSERT INTO nodes(rack_no, chassis_no) VALUES(0, 1);", NULL, NULL, NULL));
+    assert(0 != (DATABASE_NODES_CHANGED & sync_database(NULL)));
+
+    close_database();
+    assert(SQLITE_OK == sqlite3_close(writer));
+    unlink(path);
+}
+
+// collectors which each record their own racks, shown as one
+static void test_federated(void) {
+    const char *paths[2] = {"sql-test-shard-0.db", "sql-test-shard-1.db"};
+    const char *messages[2][3] = {
+        {"Hardware Error: valve exploded", "Software Error: zero", "Software Error: zero again"},
+        {"Software Error: one", "Hardware Error: exploded too", "Software Error: one again"}
+    };
+    for (unsigned int shard = 0; shard < 2; shard++) {
+        unlink(paths[shard]);
+        init_database(paths[shard]);
+        assert(true == add_node_allowed(1 - shard));
+        set_rack_range(shard, shard);
+        assert((true == add_node_allowed(shard)) && (false == add_node_allowed(1 - shard)));
+        assert(false == add_node(1 - shard, 0, true)); // the other collector's
+        assert(true == add_node(shard, 0, true));
+        assert(true == add_node(shard, 1, true));
+
+        // the two shards' errors interleave in time and both have one at 300
+        for (int i = 0; i < 3; i++) {
+            const time_t recv_time = (0 == i) ? 100 + 100 * shard : 300 + 100 * shard * (unsigned int) i;
+            assert(true == add_error_decoded(shard, (unsigned int) i % 2, -1, recv_time, messages[shard][i]));
+        }
+        close_database();
+    }
+
+    init_database_federated(paths, 2);
+    Clickable all;
+    memset(&all, 0, sizeof(all));
+    all.type = ALL;
+    assert(6 == count_clickable(&all));
+    GList *racks = list_racks();
+    assert(2 == g_list_length(racks));
+    g_list_free(racks);
+    Clickable rack;
+    memset(&rack, 0, sizeof(rack));
+    rack.type = RACK;
+    rack.rack_num = 1;
+    assert(3 == count_clickable(&rack));
+
+    // merged in time order with unique ids
+    time_t expected_times[6] = {100, 200, 300, 300, 400, 500};
+    int ids[6];
+    GList *results = search_clickable(&all);
+    assert(6 == g_list_length(results));
+    size_t n = 0;
+    for (GList *item = results; NULL != item; item = item->next, n++) {
+        const SearchResult *res = item->data;
+        assert(expected_times[n] == res->recv_time);
+        ids[n] = res->id;
+        for (size_t j = 0; j < n; j++) {
+            assert(ids[j] != ids[n]);
+        }
+    }
+    assert(ids[2] < ids[3]);
+    g_list_free_full(results, free_search_result);
+
+    // keyset pages and offsets across the shards agree with that order
+    int paged[6];
+    IdCollector collector = {paged, 0, 6, 0};
+    int rows = 0;
+    do {
+        const int last_id = (0 == collector.n) ? 0 : paged[collector.n - 1];
+        rows = search_clickable_foreach(&all, collector.last_time, last_id, true, 2, collect_any_id, &collector);
+        assert(rows >= 0);
+    } while ((0 != rows) && (collector.n < 6));
+    assert(0 == memcmp(ids, paged, sizeof(ids)));
+    GList *before = search_clickable_page(&all, 400, ids[4], false, 2);
+    assert((2 == g_list_length(before)) && (ids[2] == ((SearchResult *) before->data)->id));
+    g_list_free_full(before, free_search_result);
+    GList *offset = search_clickable_offset(&all, 3, 2);
+    assert((2 == g_list_length(offset)) && (ids[3] == ((SearchResult *) offset->data)->id));
+    g_list_free_full(offset, free_search_result);
+
+    Clickable search;
+    memset(&search, 0, sizeof(search));
+    search.type = SEARCH;
+    g_strlcpy(search.text, "exploded", sizeof(search.text));
+    assert(2 == count_clickable(&search));
+
+    GArray *trend = activity_trend(0, true);
+    assert((1 == trend->len) && (6 == g_array_index(trend, ActivityBucket, 0).count));
+    g_array_unref(trend);
+
+    // each collector's new errors are found
+    sqlite3 *writer = NULL;
+    assert(SQLITE_OK == sqlite3_open(paths[1], &writer));
+    assert(SQLITE_OK == sqlite3_exec(writer,
+        "INSERT INTO errors(node_id, recv_time, category, description, last_seen) VALUES(1, 600, 2, 'later', 600);",
+        NULL, NULL, NULL));
+    GArray *keys = NULL;
+    assert(DATABASE_ERRORS_ADDED == sync_database(&keys));
+    assert((NULL != keys) && (1 == keys->len) && (1 == g_array_index(keys, ErrorKey, 0).rack_no));
+    g_array_unref(keys);
+    assert(7 == count_clickable(&all));
+
+    // the tail leaves out what hasn't been synced yet in any shard
+    assert(SQLITE_OK == sqlite3_exec(writer,
+        "INSERT INTO errors(node_id, recv_time, category, description, last_seen) VALUES(1, 50, 2, 'unsynced', 50);",
+        NULL, NULL, NULL));
+    int tail_ids[8];
+    IdCollector tail = {tail_ids, 0, 8, 0};
+    int count = -1;
+    assert(7 == search_clickable_foreach_tail(&all, 8, &count, collect_any_id, &tail));
+    assert((7 == count) && (ids[5] == tail_ids[1]));
+    assert(SQLITE_OK == sqlite3_close(writer));
+    close_database();
+
+    for (int shard = 0; shard < 2; shard++) {
+        GString *file = g_string_new(NULL);
+        const char *suffixes[3] = {"", "-wal", "-shm"};
+        for (size_t i = 0; i < G_N_ELEMENTS(suffixes); i++) {
+            g_string_printf(file, "%s%s", paths[shard], suffixes[i]);
+            unlink(file->str);
+        }
+        g_string_free(file, TRUE);
+    }
+}
+
+// set based enabling and disabling
+static void test_bulk_enable(void) {
+    init_database(NULL);
+    assert(true == add_node(0, 0, true));
+    assert(true == add_node(0, 1, true));
+    assert(true == add_error_decoded(0, 0, 3, 100, "Hardware Error: storm"));
+    assert(true == add_error_decoded(0, 0, 3, 200, "Hardware Error: storm"));
+    assert(true == add_error_decoded(0, 0, 3, 300, "Hardware Error: storm"));
+    assert(true == add_error_decoded(0, 0, -1, 200, "Software Error: 100% storm"));
+    assert(true == add_error_decoded(0, 1, 3, 200, "Hardware Error: storm"));
+
+    set_show_disabled(false);
+    Clickable all;
+    all.type = ALL;
+
+    // one node valve from a time onwards
+    ErrorFilter filter;
+    filter.search.type = VALVE;
+    filter.search.rack_num = 0;
+    filter.search.chassis_num = 0;
+    filter.search.valve_num = 3;
+    filter.from = 200;
+    filter.until = 0;
+    filter.contains = NULL;
+    assert(2 == set_errors_enabled(&filter, false));
+    assert(0 == set_errors_enabled(&filter, false)); // already disabled
+    assert(3 == count_clickable(&all));
+    check_counters();
+
+    // a description pattern with a LIKE wildcard in it, ignoring case
+    filter.search.type = ALL;
+    filter.from = 0;
+    filter.contains = "100% STORM";
+    assert(1 == set_errors_enabled(&filter, false));
+    assert(2 == count_clickable(&all));
+    check_counters();
+
+    // a time range
+    filter.contains = "";
+    filter.from = 150;
+    filter.until = 250;
+    assert(2 == set_errors_enabled(&filter, true));
+    assert(4 == count_clickable(&all));
+    check_counters();
+
+    // everything in a search tab
+    filter.search.type = SEARCH;
+    g_strlcpy(filter.search.text, "storm", sizeof(filter.search.text));
+    filter.from = 0;
+    filter.until = 0;
+    assert(4 == set_errors_enabled(&filter, false));
+    assert(0 == count_clickable(&all));
+    check_counters();
+    assert(5 == set_errors_enabled(&filter, true));
+    assert(5 == count_clickable(&all));
+
+    close_database();
+}
+
+// count for rack_no, chassis_no in a GArray from node_activity. 0 if it isn't there
+static unsigned int activity_of(const GArray *activity, const unsigned int rack_no, const unsigned int chassis_no) {
+    for (guint i = 0; i < activity->len; i++) {
+        const NodeActivity *node = &g_array_index(activity, NodeActivity, i);
+        if ((node->rack_no == rack_no) && (node->chassis_no == chassis_no)) {
+            return node->count;
+        }
+    }
+    return 0;
+}
+
+static void test_rollups(void) {
+    init_database(NULL);
+    assert(true == add_node(0, 0, true));
+    assert(true == add_node(0, 1, true));
+    set_dedup_window(30);
+
+    const time_t hour = 20 * 3600;
+    assert(true == add_error_decoded(0, 0, 1, hour + 10, "Hardware Error: rollup"));
+    assert(true == add_error_decoded(0, 0, 1, hour + 20, "Hardware Error: rollup")); // merged
+    assert(true == add_error_decoded(0, 0, 2, hour + 70, "Hardware Error: rollup"));
+    assert(true == add_error_decoded(0, 1, -1, hour + 3605, "Software Error: rollup"));
+
+    // merged duplicates still count
+    GArray *activity = node_activity(hour, false);
+    assert((2 == activity->len) && (3 == activity_of(activity, 0, 0)) && (1 == activity_of(activity, 0, 1)));
+    g_array_unref(activity);
+
+    // since is rounded down to the bucket
+    activity = node_activity(hour + 61, false);
+    assert((1 == activity_of(activity, 0, 0)) && (1 == activity_of(activity, 0, 1)));
+    g_array_unref(activity);
+    activity = node_activity(hour + 61, true);
+    assert((3 == activity_of(activity, 0, 0)) && (1 == activity_of(activity, 0, 1)));
+    g_array_unref(activity);
+
+    GArray *trend = activity_trend(hour, false);
+    assert(3 == trend->len);
+    assert((hour == g_array_index(trend, ActivityBucket, 0).start) && (2 == g_array_index(trend, ActivityBucket, 0).count));
+    assert((hour + 60 == g_array_index(trend, ActivityBucket, 1).start) && (1 == g_array_index(trend, ActivityBucket, 1).count));
+    assert((hour + 3600 == g_array_index(trend, ActivityBucket, 2).start) && (1 == g_array_index(trend, ActivityBucket, 2).count));
+    g_array_unref(trend);
+    trend = activity_trend(0, true);
+    assert((2 == trend->len) && (3 == g_array_index(trend, ActivityBucket, 0).count));
+    g_array_unref(trend);
+
+    // old minutes are pruned as newer errors arrive but the hours are kept
+    const time_t later = hour + 3600 + (ROLLUP_MINUTES_KEPT + 1) * 60;
+    assert(true == add_error_decoded(0, 0, 1, later, "Hardware Error: rollup"));
+    activity = node_activity(0, false);
+    assert((1 == activity_of(activity, 0, 0)) && (0 == activity_of(activity, 0, 1)));
+    g_array_unref(activity);
+    activity = node_activity(0, true);
+    assert((4 == activity_of(activity, 0, 0)) && (1 == activity_of(activity, 0, 1)));
+    g_array_unref(activity);
+
+    // removing a node removes its rollups
+    assert(true == remove_node(0, 1));
+    activity = node_activity(0, true);
+    assert((1 == activity->len) && (4 == activity_of(activity, 0, 0)));
+    g_array_unref(activity);
+
+    assert(true == remove_all_errors());
+    activity = node_activity(0, true);
+    assert(0 == activity->len);
+    g_array_unref(activity);
+    trend = activity_trend(0, false);
+    assert(0 == trend->len);
+    g_array_unref(trend);
+
+    set_dedup_window(0);
+    close_database();
+}
+
+// ExportProgressFunc counting chunks
+static void count_chunks(__attribute__((unused)) const guint64 num_rows, gpointer chunks) {
+    (*(int *) chunks)++;
+}
+
+static void test_export(void) {
+    init_database(NULL);
+    assert(true == add_node(0, 0, true));
+    assert(true == add_node(0, 1, true));
+    assert(true == add_error_decoded(0, 0, 2, 100, "Hardware Error: \"quoted\", comma"));
+    assert(true == add_error_decoded(0, 0, -1, 200, "Software Error: line\nbreak"));
+    assert(true == add_error_decoded(0, 1, 4, 300, "Hardware Error: other node"));
+
+    const char *path = "sql-test-export.csv";
+    assert(EXPORT_CSV == export_format_for_path(path));
+    assert(EXPORT_JSON_LINES == export_format_for_path("export.jsonl"));
+
+    ErrorFilter filter;
+    memset(&filter, 0, sizeof(filter));
+    filter.search.type = ALL;
+    assert(3 == export_errors(&filter, path, EXPORT_CSV, NULL, NULL, NULL));
+    gchar *contents = NULL;
+    assert(g_file_get_contents(path, &contents, NULL, NULL));
+    assert(contents == strstr(contents, "id,time,recv_time,last_seen,rack,chassis,valve,enabled,occurrences,description\n"));
+    assert(NULL != strstr(contents, ",100,100,0,0,2,1,1,\"Hardware Error: \"\"quoted\"\", comma\"\n"));
+    assert(NULL != strstr(contents, ",200,200,0,0,,1,1,\"Software Error: line\nbreak\"\n"));
+    g_free(contents);
+
+    // a tab with time bounds and a description, as JSON
+    filter.search.type = RACK;
+    filter.search.rack_num = 0;
+    filter.from = 150;
+    filter.until = 300;
+    assert(1 == export_errors(&filter, path, EXPORT_JSON_LINES, NULL, NULL, NULL));
+    assert(g_file_get_contents(path, &contents, NULL, NULL));
+    assert(NULL != strstr(contents, "\"recv_time\": 200, \"last_seen\": 200, \"rack\": 0, \"chassis\": 0, \"valve\": null, "
+                                    "\"enabled\": true, \"occurrences\": 1, \"description\": \"Software Error: line\\u000abreak\"}\n"));
+    assert(NULL == strstr(contents, "other node"));
+    g_free(contents);
+    filter.from = 0;
+    filter.until = 0;
+    filter.contains = "OTHER";
+    assert(1 == export_errors(&filter, path, EXPORT_JSON_LINES, NULL, NULL, NULL));
+
+    // a chunk at a time
+    for (int i = 0; i < EXPORT_CHUNK_SIZE; i++) {
+        assert(true == add_error_decoded(0, 1, -1, 1000 + i, "Hardware Error: many"));
+    }
+    filter.search.type = ALL;
+    filter.contains = NULL;
+    int chunks = 0;
+    assert(EXPORT_CHUNK_SIZE + 3 == export_errors(&filter, path, EXPORT_CSV, NULL, count_chunks, &chunks));
+    assert(2 == chunks);
+
+    // a cancelled export leaves nothing behind
+    GCancellable *cancellable = g_cancellable_new();
+    g_cancellable_cancel(cancellable);
+    assert(-1 == export_errors(&filter, path, EXPORT_CSV, cancellable, NULL, NULL));
+    assert(0 != access(path, F_OK));
+    g_object_unref(cancellable);
+
+    close_database();
+}
+
+static void test_metrics(void) {
+    metrics_reset();
+    MetricSummary summary;
+
+    // off: nothing recorded
+    metrics_enable(false);
+    assert(0 == metrics_start());
+    metrics_record(METRIC_TAB_ROWS, 5);
+    metrics_summary(METRIC_TAB_ROWS, &summary);
+    assert(0 == summary.count);
+
+    metrics_enable(true);
+    for (guint64 i = 1; i <= 100; i++) {
+        metrics_record(METRIC_TAB_ROWS, i);
+    }
+    metrics_summary(METRIC_TAB_ROWS, &summary);
+    assert((100 == summary.count) && (5050 == summary.sum) && (100 == summary.max));
+    assert(63 == summary.p50);  // 50 is in [32, 64)
+    assert(100 == summary.p99); // capped at the max
+
+    // the database is timed
+    init_database(NULL);
+    assert(true == add_node(0, 0, true));
+    Clickable all;
+    all.type = ALL;
+    assert(0 == count_clickable(&all));
+    metrics_summary(METRIC_SQL_COUNT, &summary);
+    assert(1 == summary.count);
+    close_database();
+
+    GString *dump = metrics_dump(true);
+    assert(NULL != strstr(dump->str, "\"tab_rows\": {\"unit\": \"rows\", \"count\": 100"));
+    g_string_free(dump, TRUE);
+
+    metrics_reset();
+    metrics_summary(METRIC_TAB_ROWS, &summary);
+    assert(0 == summary.count);
+    metrics_enable(false);
+}
+
 int main(void) {
     init_database(NULL); // NULL: memory only database
 
@@ -102,6 +988,15 @@ int main(void) {
     assert(true == add_node(0, 1, true));
     assert(true == add_node(0, 2, true));
 
+    // a node list is added all at once or not at all
+    const NodeIdentifier list[2] = {{.rack_no = 7, .chassis_no = 0}, {.rack_no = 0, .chassis_no = 0}};
+    assert(false == add_nodes(list, 2, true)); // 0, 0 is already there
+    assert(false == node_exists(7, 0));
+    assert(false == add_error_decoded(7, 0, -1, 100, "not registered"));
+    assert(true == add_nodes(list, 1, true));
+    assert(true == node_exists(7, 0));
+    assert(true == remove_node(7, 0));
+
     // for count searching
     Clickable search;
     search.type = RACK;
@@ -153,11 +1048,88 @@ int main(void) {
     node00_search.chassis_num = 0;
     assert(3 == count_clickable(&node00_search));
 
+    // batch insert with an error from an unknown node in the middle
+    BufferItem *batch[3];
+    batch[0] = error(0, 0, "batch one", SOFT_ERROR);
+    batch[1] = error(5, 5, "batch unknown", SOFT_ERROR);
+    batch[2] = error(0, 0, "batch two", HARD_ERROR_VALVE);
+    AddErrorResult batch_results[3];
+    const unsigned int unknown = get_unknown_node_errors();
+    assert(2 == add_errors_batch(batch, 3, batch_results));
+    assert((ADD_ERROR_ADDED == batch_results[0]) && (ADD_ERROR_UNKNOWN_NODE == batch_results[1]) &&
+           (ADD_ERROR_ADDED == batch_results[2]));
+    assert(5 == count_clickable(&node00_search)); // the unknown node's error is counted rather than stored
+    assert(unknown + 1 == get_unknown_node_errors());
+    assert(0 == add_errors_batch(batch, 0, NULL));
+
+    // keys of the batch's errors
+    ErrorKey key;
+    get_error_key(batch[1], &key);
+    assert((5 == key.rack_no) && (5 == key.chassis_no) && (-1 == key.valve_no));
+    get_error_key(batch[2], &key);
+    assert((0 == key.rack_no) && (0 == key.chassis_no) && (22 == key.valve_no));
+    for (size_t i = 0; i < 3; i++) {
+        free(batch[i]);
+    }
+
+    // quotes are stored as they are
+    assert(true == add_error_decoded(0, 0, 3, time(NULL), "Software Error: \"quoted\" 'text'"));
+    Clickable quoted_search;
+    quoted_search.type = VALVE;
+    quoted_search.rack_num = 0;
+    quoted_search.chassis_num = 0;
+    quoted_search.valve_num = 3;
+    GList *quoted = search_clickable(&quoted_search);
+    assert(NULL != quoted);
+    assert(NULL == quoted->next);
+    SearchResult *quoted_res = quoted->data;
+    assert(NULL != strstr(quoted_res->message, "\"quoted\" 'text'"));
+
+    // a newer error comes last
+    assert(true == add_error_decoded(0, 0, 3, time(NULL), "Software Error: newer"));
+    GList *newer = search_clickable(&quoted_search);
+    assert(2 == g_list_length(newer));
+    const SearchResult *newer_res = g_list_last(newer)->data;
+    assert(NULL != strstr(newer_res->message, "newer"));
+    const int newer_id = newer_res->id;
+    assert(quoted_res->id != newer_id);
+    g_list_free_full(newer, free_search_result);
+
+    // adding errors doesn't invalidate existing results but changing them does
+    const unsigned int generation = get_database_generation();
+    assert(true == error_toggle_disabled((uintptr_t) newer_id));
+    assert(generation != get_database_generation());
+    assert(true == error_toggle_disabled((uintptr_t) newer_id));
+
+    // toggling an error hides it unless disabled errors are shown
+    assert(true == error_toggle_disabled((uintptr_t) quoted_res->id));
+    assert(1 == count_clickable(&quoted_search));
+    set_show_disabled(true);
+    assert(2 == count_clickable(&quoted_search));
+    set_show_disabled(false);
+    check_counters();
+    assert(true == error_toggle_disabled((uintptr_t) quoted_res->id));
+    assert(2 == count_clickable(&quoted_search));
+    g_list_free_full(quoted, free_search_result);
+    assert(false == error_toggle_disabled(999999)); // no such error
+
+    // toggling a node hides all of its errors
+    assert(true == node_toggle_disabled(0, 0));
+    assert(0 == count_clickable(&node00_search));
+    check_counters();
+    set_show_disabled(true);
+    assert(7 == count_clickable(&node00_search));
+    set_show_disabled(false);
+    assert(true == node_toggle_disabled(0, 0));
+    assert(7 == count_clickable(&node00_search));
+    assert(false == node_toggle_disabled(9, 9)); // no such node
+
     // remove node 0, 0
     assert(true == remove_node(0, 0));
 
     // check that node 0, 0's errors were also removed
     assert(0 == count_clickable(&node00_search));
+    check_counters();
     
     // we only have one rack: rack 0
     GList *rack_0 = list_racks();
@@ -195,6 +1167,19 @@ int main(void) {
     assert(NULL == nodes_rack_1->next);
     assert(0 == (uintptr_t) nodes_rack_1->data);
 
+    // every node in one go, in rack then chassis order
+    assert(true == add_node(0, 3, false));
+    GList *ordered = list_nodes_ordered();
+    const unsigned int expected[][2] = {{0, 1}, {0, 2}, {0, 3}, {1, 0}};
+    assert(G_N_ELEMENTS(expected) == g_list_length(ordered));
+    GList *ordered_item = ordered;
+    for (size_t i = 0; i < G_N_ELEMENTS(expected); i++, ordered_item = ordered_item->next) {
+        const NodeIdentifier *node = ordered_item->data;
+        assert((expected[i][0] == node->rack_no) && (expected[i][1] == node->chassis_no));
+    }
+    g_list_free_full(ordered, g_free);
+    assert(true == remove_node(0, 3));
+
     assert(true == remove_node(0, 1));
     assert(true == remove_node(0, 2));
     assert(true == remove_node(1, 0));
@@ -204,4 +1189,17 @@ int main(void) {
     assert(NULL == list_chassis_by_rack(1));
 
     close_database();
+
+    test_legacy_upgrade();
+    test_categories();
+    test_paging();
+    test_dedup();
+    test_archive();
+    test_search();
+    test_read_only();
+    test_federated();
+    test_bulk_enable();
+    test_rollups();
+    test_export();
+    test_metrics();
 }
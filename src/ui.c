@@ -12,12 +12,15 @@
 #include <gtk/gtk.h>
 #include "EdsacErrorNotebook.h"
 #include "sql.h"
-#include <edsac_server.h>
-#include <edsac_timer.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include "node_setup.h"
+#include "db_worker.h"
+#include "liveness.h"
+#include "ingest.h"
+#include "metrics.h"
 
 extern const char * g_prefix_path; // main.c
 
@@ -29,19 +32,38 @@ static EdsacErrorNotebook *notebook = NULL;
 static GtkStatusbar *bar = NULL;
 static GtkWindow *main_window = NULL;
 static GMenu *model = NULL;
+static GMenu *nodes_menu = NULL;        // a submenu per rack containing a submenu per node
+
+// errors added since the last refresh. Protected by changes_lock because ingest adds to it
+static GMutex changes_lock;
+static GHashTable *changes = NULL;      // set of ErrorKeys
+static bool refresh_queued = false;
+static gint64 last_refresh = 0;         // monotonic time
+static gint64 frame_budget_us = DEFAULT_FRAME_BUDGET * G_TIME_SPAN_MILLISECOND;
+static volatile gint running = 0;       // the other threads' refreshes are dropped unless the gui is running
+static bool read_only = false;          // watching another process's database (see start_ui)
+static bool sync_pending = false;
+
+// how often a read only gui looks for the writer's changes
+#define SYNC_INTERVAL 250 // ms
 
 // functions
 
-int start_ui(int *argc, char ***argv, gpointer timer_id) {
+int start_ui(int *argc, char ***argv, const guint frame_budget, const bool watch_only) {
     assert(NULL != argc);
     assert(NULL != argv);
-    assert(NULL != timer_id);
+
+    frame_budget_us = frame_budget * G_TIME_SPAN_MILLISECOND;
+    read_only = watch_only;
 
     gtk_init(argc, argv);
 
+    // queries made by the ui run on their own thread
+    db_worker_start();
+
     GtkApplication *app = gtk_application_new("edsac.motherhip.gui", G_APPLICATION_FLAGS_NONE);
     g_signal_connect(app, "activate", G_CALLBACK(activate), NULL);
-    g_signal_connect(app, "shutdown", G_CALLBACK(shutdown_handler), timer_id);
+    g_signal_connect(app, "shutdown", G_CALLBACK(shutdown_handler), NULL);
     
     return g_application_run(G_APPLICATION(app), *argc, *argv);
 }
@@ -58,8 +80,8 @@ static void update_bar(void) {
         g_string_sprintf(msg, "Showing 1 error");
     } else if (0 == num_errors) {
         g_string_sprintf(msg, "No errors in this filter");
-    } else { // negative
-        g_string_sprintf(msg, "Failure to count errors (something is probably very wrong)");
+    } else { // negative: the notebook emits error-count-changed once it knows
+        g_string_sprintf(msg, "Counting errors...");
     }
 
     if (!get_show_disabled()) {
@@ -76,10 +98,87 @@ void gui_update(gpointer g_idle_id) {
     if (NULL != g_idle_id) {
         assert(TRUE == g_idle_remove_by_data(g_idle_id));
     }
+    if (!g_atomic_int_get(&running)) {
+        return;
+    }
     edsac_error_notebook_update(notebook);
     update_bar();
 }
 
+// matches GHashFunc
+static guint error_key_hash(gconstpointer key) {
+    const ErrorKey *k = (const ErrorKey *) key;
+    return (k->rack_no * 31u + k->chassis_no) * 31u + (guint) k->valve_no;
+}
+
+// matches GEqualFunc
+static gboolean error_key_equal(gconstpointer a, gconstpointer b) {
+    const ErrorKey *A = (const ErrorKey *) a;
+    const ErrorKey *B = (const ErrorKey *) b;
+    return (A->rack_no == B->rack_no) && (A->chassis_no == B->chassis_no) && (A->valve_no == B->valve_no);
+}
+
+// GSourceFunc for gui_errors_added
+static gboolean refresh_changes(__attribute__((unused)) gpointer unused) {
+    g_mutex_lock(&changes_lock);
+    GHashTable *keys = changes;
+    changes = NULL;
+    refresh_queued = false;
+    last_refresh = g_get_monotonic_time();
+    g_mutex_unlock(&changes_lock);
+
+    if ((NULL != keys) && (NULL != notebook)) {
+        GList *list = g_hash_table_get_keys(keys);
+        edsac_error_notebook_errors_added(notebook, list);
+        g_list_free(list);
+        update_bar();
+    }
+
+    if (NULL != keys) {
+        g_hash_table_destroy(keys);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+void gui_errors_added(const ErrorKey *keys, const guint num_keys) {
+    assert((NULL != keys) || (0 == num_keys));
+
+    if ((0 == num_keys) || !g_atomic_int_get(&running)) {
+        return;
+    }
+
+    g_mutex_lock(&changes_lock);
+
+    if (NULL == changes) {
+        changes = g_hash_table_new_full(error_key_hash, error_key_equal, g_free, NULL);
+        assert(NULL != changes);
+    }
+
+    for (guint i = 0; i < num_keys; i++) {
+        if (!g_hash_table_contains(changes, &keys[i])) {
+            ErrorKey *key = g_new(ErrorKey, 1);
+            assert(NULL != key);
+            *key = keys[i];
+            g_hash_table_add(changes, key);
+        }
+    }
+
+    // wait out the rest of the frame if the last refresh was recent
+    if (!refresh_queued) {
+        refresh_queued = true;
+
+        const gint64 wait = last_refresh + frame_budget_us - g_get_monotonic_time();
+        if (wait > 0) {
+            g_timeout_add((guint) (wait / G_TIME_SPAN_MILLISECOND) + 1, refresh_changes, NULL);
+        } else {
+            g_idle_add(refresh_changes, NULL);
+        }
+    }
+
+    g_mutex_unlock(&changes_lock);
+}
+
 // handles the quit action
 static void quit_activate(void) {
     if (NULL != main_window) {
@@ -87,61 +186,209 @@ static void quit_activate(void) {
     }
 }
 
-static GMenu *generate_nodes_menu(void) {
-    GMenu *nodes = g_menu_new();
-    assert(NULL != nodes);
+// DbJobFunc listing every node in rack then chassis order. Runs on the database thread
+static gpointer list_nodes_job(__attribute__((unused)) gpointer unused, __attribute__((unused)) GCancellable *cancellable) {
+    return list_nodes_ordered();
+}
 
-    GList *racks = list_racks();
-    while (NULL != racks) {
-        const uintptr_t rack_no = (uintptr_t) racks->data;
-        char rack_label[10];
-        snprintf(rack_label, 10, "Rack %li", rack_no);
+// matches GDestroyNotify
+static void free_node_list(gpointer nodes) {
+    g_list_free_full((GList *) nodes, g_free);
+}
 
-        GMenu *rack = g_menu_new();
+// the Show, Toggle Disabled and Delete actions for a node
+static GMenu *new_node_menu(const guint64 rack_no, const guint64 chassis_no) {
+    static const struct {
+        const char *label;
+        const char *action;
+    } actions[] = {
+        {"Show", "app.node_show"},
+        {"Toggle Disabled", "app.node_toggle_disabled"},
+        {"Delete", "app.node_delete"},
+    };
 
-        GList *chassis = list_chassis_by_rack(rack_no);
-        while (NULL != chassis) {
-            const uintptr_t chassis_no = (uintptr_t) chassis->data;
-            char chassis_label[15];
-            snprintf(chassis_label, 15, "Chassis %li", chassis_no);
+    GMenu *node = g_menu_new();
+    assert(NULL != node);
 
-            GMenu *node = g_menu_new();
-            assert(NULL != node);
-            
-            GMenuItem *show = g_menu_item_new("Show", "app.node_show");
-            assert(NULL != show);
-            g_menu_item_set_action_and_target_value(show, "app.node_show", g_variant_new("(tt)", rack_no, chassis_no));
-            g_menu_append_item(node, show);
+    for (size_t i = 0; i < G_N_ELEMENTS(actions); i++) {
+        GMenuItem *item = g_menu_item_new(actions[i].label, NULL);
+        assert(NULL != item);
+        g_menu_item_set_action_and_target_value(item, actions[i].action, g_variant_new("(tt)", rack_no, chassis_no));
+        g_menu_append_item(node, item);
+        g_object_unref(item);
+    }
+
+    g_menu_freeze(node);
+    return node;
+}
+
+// each submenu of the Nodes menu and of its racks is tagged with its number (as attribute) so that entries can be
+// found without keeping a copy of the tree. Entries are in order of number.
+// returns where number is (found) or should be inserted (!found)
+static gint find_menu_entry(GMenuModel *menu, const char *attribute, const guint number, bool *found) {
+    const gint n_items = g_menu_model_get_n_items(menu);
+
+    for (gint i = 0; i < n_items; i++) {
+        guint item_number = 0;
+        if (!g_menu_model_get_item_attribute(menu, i, attribute, "u", &item_number)) {
+            continue;
+        }
+
+        if (item_number >= number) {
+            *found = (item_number == number);
+            return i;
+        }
+    }
+
+    *found = false;
+    return n_items;
+}
+
+// insert a submenu tagged with number at position in menu
+static void insert_numbered_submenu(GMenu *menu, const gint position, const char *label, const char *attribute,
+                                    const guint number, GMenu *submenu) {
+    GMenuItem *item = g_menu_item_new_submenu(label, G_MENU_MODEL(submenu));
+    assert(NULL != item);
+    g_menu_item_set_attribute(item, attribute, "u", number);
+    g_menu_insert_item(menu, position, item);
+    g_object_unref(item);
+    g_object_unref(submenu);
+}
+
+// the rack's submenu of the Nodes menu (a new reference) or NULL if it has no nodes. Sets position to where it is or should go
+static GMenu *get_rack_menu(const guint rack_no, gint *position) {
+    bool found = false;
+    *position = find_menu_entry(G_MENU_MODEL(nodes_menu), "rack", rack_no, &found);
+    if (!found) {
+        return NULL;
+    }
+
+    return G_MENU(g_menu_model_get_item_link(G_MENU_MODEL(nodes_menu), *position, G_MENU_LINK_SUBMENU));
+}
 
-            GMenuItem *disable = g_menu_item_new("Toggle Disabled", "app.node_toggle_disabled");
-            assert(NULL != disable);
-            g_menu_item_set_action_and_target_value(disable, "app.node_toggle_disabled", g_variant_new("(tt)", rack_no, chassis_no));
-            g_menu_append_item(node, disable);
+// add a node to the Nodes menu (unless it is already there)
+static void nodes_menu_add(const guint rack_no, const guint chassis_no) {
+    gint rack_position = 0;
+    GMenu *rack = get_rack_menu(rack_no, &rack_position);
+    if (NULL == rack) {
+        char rack_label[20];
+        snprintf(rack_label, sizeof(rack_label), "Rack %u", rack_no);
+
+        rack = g_menu_new();
+        assert(NULL != rack);
+        insert_numbered_submenu(nodes_menu, rack_position, rack_label, "rack", rack_no, g_object_ref(rack));
+    }
+
+    bool found = false;
+    const gint position = find_menu_entry(G_MENU_MODEL(rack), "chassis", chassis_no, &found);
+    if (!found) {
+        char chassis_label[20];
+        snprintf(chassis_label, sizeof(chassis_label), "Chassis %u", chassis_no);
+        insert_numbered_submenu(rack, position, chassis_label, "chassis", chassis_no, new_node_menu(rack_no, chassis_no));
+    }
+
+    g_object_unref(rack);
+}
+
+// remove a node from the Nodes menu, along with its rack if that was the last node in it
+static void nodes_menu_remove(const guint rack_no, const guint chassis_no) {
+    gint rack_position = 0;
+    GMenu *rack = get_rack_menu(rack_no, &rack_position);
+    if (NULL == rack) {
+        return;
+    }
+
+    bool found = false;
+    const gint position = find_menu_entry(G_MENU_MODEL(rack), "chassis", chassis_no, &found);
+    if (found) {
+        g_menu_remove(rack, position);
+    }
+
+    if (0 == g_menu_model_get_n_items(G_MENU_MODEL(rack))) {
+        g_menu_remove(nodes_menu, rack_position);
+    }
+
+    g_object_unref(rack);
+}
 
-            GMenuItem *delete = g_menu_item_new("Delete", "app.node_delete");
-            assert(NULL != delete);
-            g_menu_item_set_action_and_target_value(delete, "app.node_delete", g_variant_new("(tt)", rack_no, chassis_no));
-            g_menu_append_item(node, delete);
+// GAsyncReadyCallback for list_nodes_job. nodes are in rack then chassis order so each can go on the end
+static void nodes_listed(__attribute__((unused)) GObject *source, GAsyncResult *result, __attribute__((unused)) gpointer unused) {
+    GList *nodes = g_task_propagate_pointer(G_TASK(result), NULL);
 
-            g_menu_freeze(node);
-            g_menu_append_submenu(rack, chassis_label, G_MENU_MODEL(node));
+    g_menu_remove_all(nodes_menu);
 
-            chassis = chassis->next;
+    GMenu *rack = NULL;
+    guint rack_no = 0;
+    for (GList *item = nodes; NULL != item; item = item->next) {
+        const NodeIdentifier *node = item->data;
+
+        if ((NULL == rack) || (node->rack_no != rack_no)) {
+            if (NULL != rack) {
+                g_object_unref(rack);
+            }
+
+            rack_no = node->rack_no;
+            char rack_label[20];
+            snprintf(rack_label, sizeof(rack_label), "Rack %u", rack_no);
+
+            rack = g_menu_new();
+            assert(NULL != rack);
+            insert_numbered_submenu(nodes_menu, -1, rack_label, "rack", rack_no, g_object_ref(rack));
         }
 
-        g_menu_freeze(rack);
-        g_menu_append_submenu(nodes, rack_label, G_MENU_MODEL(rack));
-        racks = racks->next;
-    } 
+        char chassis_label[20];
+        snprintf(chassis_label, sizeof(chassis_label), "Chassis %u", node->chassis_no);
+        insert_numbered_submenu(rack, -1, chassis_label, "chassis", node->chassis_no, new_node_menu(rack_no, node->chassis_no));
+    }
 
-    g_menu_freeze(nodes);
+    if (NULL != rack) {
+        g_object_unref(rack);
+    }
 
-    return nodes;
+    free_node_list(nodes);
 }
 
-static void update_nodes_menu(void) {
-    g_menu_remove(model, 2);
-    g_menu_append_submenu(model, "Nodes", G_MENU_MODEL(generate_nodes_menu()));
+// the menu is filled in once the database thread has listed the nodes. Afterwards it is kept up to date
+// by nodes_menu_add and nodes_menu_remove
+static void load_nodes_menu(void) {
+    db_worker_push(NULL, NULL, list_nodes_job, NULL, NULL, free_node_list, nodes_listed, NULL);
+}
+
+// DbJobFunc for watch_database. Runs on the database thread
+static gpointer sync_job(__attribute__((unused)) gpointer unused, __attribute__((unused)) GCancellable *cancellable) {
+    GArray *keys = NULL;
+    const int found = sync_database(&keys);
+
+    // gui_errors_added can be called from any thread so the keys needn't go back to the gui thread
+    if (NULL != keys) {
+        gui_errors_added((const ErrorKey *) (void *) keys->data, keys->len);
+        g_array_unref(keys);
+    }
+
+    return GINT_TO_POINTER(found);
+}
+
+// GAsyncReadyCallback for sync_job
+static void synced(__attribute__((unused)) GObject *source, GAsyncResult *result, __attribute__((unused)) gpointer unused) {
+    const int found = GPOINTER_TO_INT(g_task_propagate_pointer(G_TASK(result), NULL));
+    sync_pending = false;
+
+    if (0 != (found & DATABASE_NODES_CHANGED)) {
+        load_nodes_menu();
+    }
+    if (0 != (found & DATABASE_ERRORS_CHANGED)) {
+        gui_update(NULL);
+    }
+}
+
+// GSourceFunc: look for the writer's changes without blocking the gui
+static gboolean watch_database(__attribute__((unused)) gpointer unused) {
+    if (!sync_pending) {
+        sync_pending = true;
+        db_worker_push(NULL, NULL, sync_job, NULL, NULL, NULL, synced, NULL);
+    }
+
+    return G_SOURCE_CONTINUE;
 }
 
 static void choose_config_file_callback(__attribute__((unused)) GtkButton *unused, gpointer user_data) {
@@ -264,6 +511,15 @@ static void ok_callback(__attribute__((unused)) GtkButton *unused, gpointer user
                 GTK_BUTTONS_CLOSE, "Node at rack %i, chassis %i already in database!", rack_no, chassis_no);
         gtk_dialog_run(GTK_DIALOG(dialog));
         gtk_widget_destroy(dialog);
+    } else if (!add_node_allowed(rack_no)) {
+        // another collector (see --racks) keeps this rack so don't set up a node which couldn't be added
+        valid = false;
+        set_error_text(rack_no_buffer);
+
+        GtkWidget *dialog = gtk_message_dialog_new(add_node_window, GTK_DIALOG_DESTROY_WITH_PARENT, GTK_MESSAGE_ERROR,
+                GTK_BUTTONS_CLOSE, "Rack %u is recorded by another collector!", rack_no);
+        gtk_dialog_run(GTK_DIALOG(dialog));
+        gtk_widget_destroy(dialog);
     }
 
     if (valid) { // if everything so far was valid
@@ -315,8 +571,15 @@ static void ok_callback(__attribute__((unused)) GtkButton *unused, gpointer user
         }
 
         // add the node to the database
-        add_node(rack_no, chassis_no, true);
-        update_nodes_menu();
+        if (add_node(rack_no, chassis_no, true)) {
+            nodes_menu_add(rack_no, chassis_no);
+            liveness_add_node(rack_no, chassis_no);
+        } else {
+            GtkWidget *bad_add_dialog = gtk_message_dialog_new(add_node_window, GTK_DIALOG_DESTROY_WITH_PARENT, GTK_MESSAGE_ERROR,
+                GTK_BUTTONS_CLOSE, "Failed to add node to the database!");
+            gtk_dialog_run(GTK_DIALOG(bad_add_dialog));
+            gtk_widget_destroy(bad_add_dialog);
+        }
  
         g_object_unref(G_OBJECT(config_file_buffer)); // ref'ed in add_node_activate
         gtk_window_close(add_node_window);
@@ -420,6 +683,262 @@ static void add_node_activate(void) {
     gtk_widget_show_all(GTK_WIDGET(add_node_window));
 }
 
+// the progress window for one call to provision_nodes. The widgets are referenced so that closing the window early is harmless
+typedef struct {
+    GtkProgressBar *bar;
+    GtkTextBuffer *log;
+    guint num_nodes;
+    guint num_finished;
+} ProvisionWindow;
+
+// ProvisionProgressFunc
+static void provision_progress(const NodeSpec *node, const ProvisionStage stage, gpointer user_data) {
+    ProvisionWindow *window = (ProvisionWindow *) user_data;
+
+    static const char *const stage_names[] = {
+        [PROVISION_NETWORK] = "setting up the network",
+        [PROVISION_WAITING] = "waiting for the node to boot",
+        [PROVISION_SSH] = "copying software",
+        [PROVISION_DONE] = "done",
+        [PROVISION_FAILED] = "FAILED",
+    };
+
+    GtkTextIter end;
+    gtk_text_buffer_get_end_iter(window->log, &end);
+    char *line = g_strdup_printf("Rack %u chassis %u: %s\n", node->rack_no, node->chassis_no, stage_names[stage]);
+    gtk_text_buffer_insert(window->log, &end, line, -1);
+    g_free(line);
+
+    if ((PROVISION_DONE == stage) || (PROVISION_FAILED == stage)) {
+        window->num_finished++;
+        gtk_progress_bar_set_fraction(window->bar, (gdouble) window->num_finished / window->num_nodes);
+
+        char *text = g_strdup_printf("%u of %u nodes finished", window->num_finished, window->num_nodes);
+        gtk_progress_bar_set_text(window->bar, text);
+        g_free(text);
+    }
+}
+
+// ProvisionDoneFunc
+static void provision_done(const guint num_failed, gpointer user_data) {
+    ProvisionWindow *window = (ProvisionWindow *) user_data;
+
+    GtkTextIter end;
+    gtk_text_buffer_get_end_iter(window->log, &end);
+    char *line = g_strdup_printf("Finished: %u of %u nodes failed\n", num_failed, window->num_nodes);
+    gtk_text_buffer_insert(window->log, &end, line, -1);
+    g_free(line);
+
+    g_object_unref(window->bar);
+    g_object_unref(window->log);
+    g_free(window);
+}
+
+// DbJobFunc adding every NodeSpec in nodes in one transaction. Runs on the database thread.
+// returns NULL or, if none of them were added, why not (free with g_free)
+static gpointer add_nodes_job(gpointer nodes, __attribute__((unused)) GCancellable *cancellable) {
+    const GPtrArray *specs = (const GPtrArray *) nodes;
+
+    NodeIdentifier *ids = g_new(NodeIdentifier, specs->len);
+    assert(NULL != ids);
+    char *message = NULL;
+    for (guint i = 0; (NULL == message) && (i < specs->len); i++) {
+        const NodeSpec *node = g_ptr_array_index(specs, i);
+        if (node_exists(node->rack_no, node->chassis_no)) {
+            message = g_strdup_printf("Node at rack %u, chassis %u already in database!", node->rack_no, node->chassis_no);
+        } else if (!add_node_allowed(node->rack_no)) {
+            message = g_strdup_printf("Rack %u is recorded by another collector!", node->rack_no);
+        }
+        ids[i].rack_no = node->rack_no;
+        ids[i].chassis_no = node->chassis_no;
+    }
+
+    if ((NULL == message) && !add_nodes(ids, specs->len, true)) {
+        message = g_strdup("Failed to add the nodes to the database! None of them will be set up");
+    }
+
+    g_free(ids);
+    return message;
+}
+
+// GAsyncReadyCallback for add_nodes_job: set up the nodes which it added. The GTask still owns nodes
+static void nodes_added(__attribute__((unused)) GObject *source, GAsyncResult *result, gpointer user_data) {
+    GPtrArray *nodes = (GPtrArray *) user_data;
+
+    char *message = g_task_propagate_pointer(G_TASK(result), NULL);
+    if (NULL != message) {
+        GtkWidget *bad_add_dialog = gtk_message_dialog_new(main_window, GTK_DIALOG_DESTROY_WITH_PARENT, GTK_MESSAGE_ERROR,
+            GTK_BUTTONS_CLOSE, "%s", message);
+        gtk_dialog_run(GTK_DIALOG(bad_add_dialog));
+        gtk_widget_destroy(bad_add_dialog);
+        g_free(message);
+        return;
+    }
+
+    // as with a single node, nodes are added whether or not they can be set up
+    for (guint i = 0; i < nodes->len; i++) {
+        const NodeSpec *node = g_ptr_array_index(nodes, i);
+        nodes_menu_add(node->rack_no, node->chassis_no);
+        liveness_add_node(node->rack_no, node->chassis_no);
+    }
+
+    GtkWindow *progress_window = GTK_WINDOW(gtk_window_new(GTK_WINDOW_TOPLEVEL));
+    assert(NULL != progress_window);
+    gtk_window_set_transient_for(progress_window, main_window);
+    gtk_window_set_title(progress_window, "Setting Up Nodes");
+    gtk_window_set_default_size(progress_window, 500, 300);
+    gtk_container_set_border_width(GTK_CONTAINER(progress_window), 10);
+
+    GtkBox *box = GTK_BOX(gtk_box_new(GTK_ORIENTATION_VERTICAL, 5));
+
+    GtkWidget *progress_bar = gtk_progress_bar_new();
+    assert(NULL != progress_bar);
+    gtk_progress_bar_set_show_text(GTK_PROGRESS_BAR(progress_bar), TRUE);
+    gtk_progress_bar_set_text(GTK_PROGRESS_BAR(progress_bar), "Waiting for permission to change the network configuration");
+    gtk_box_pack_start(box, progress_bar, FALSE, FALSE, 0);
+
+    GtkWidget *log = gtk_text_view_new();
+    assert(NULL != log);
+    gtk_text_view_set_editable(GTK_TEXT_VIEW(log), FALSE);
+    GtkWidget *scroll = gtk_scrolled_window_new(NULL, NULL);
+    assert(NULL != scroll);
+    gtk_container_add(GTK_CONTAINER(scroll), log);
+    gtk_box_pack_start(box, scroll, TRUE, TRUE, 0);
+
+    gtk_container_add(GTK_CONTAINER(progress_window), GTK_WIDGET(box));
+    gtk_widget_show_all(GTK_WIDGET(progress_window));
+
+    ProvisionWindow *window = g_new0(ProvisionWindow, 1);
+    assert(NULL != window);
+    window->bar = g_object_ref(GTK_PROGRESS_BAR(progress_bar));
+    window->log = g_object_ref(gtk_text_view_get_buffer(GTK_TEXT_VIEW(log)));
+    window->num_nodes = nodes->len;
+
+    provision_nodes(nodes, DEFAULT_PROVISION_WORKERS, provision_progress, provision_done, window);
+    gui_update(NULL);
+}
+
+// add every node in a node list (see read_node_list) then set them up in the background.
+// The nodes are added by add_nodes_job
+static void add_nodes_activate(void) {
+    GtkWidget *dialog = gtk_file_chooser_dialog_new("Choose Node List", main_window,
+        GTK_FILE_CHOOSER_ACTION_OPEN, "Cancel", GTK_RESPONSE_CANCEL,
+        "Open", GTK_RESPONSE_ACCEPT, NULL);
+
+    GString *configs_path = g_string_new(g_prefix_path);
+    assert(NULL != configs_path);
+    g_string_append(configs_path, "/configs");
+    gtk_file_chooser_set_current_folder(GTK_FILE_CHOOSER(dialog), configs_path->str);
+    g_string_free(configs_path, TRUE);
+
+    char *path = NULL;
+    if (GTK_RESPONSE_ACCEPT == gtk_dialog_run(GTK_DIALOG(dialog))) {
+        path = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
+    }
+    gtk_widget_destroy(dialog);
+
+    if (NULL == path) {
+        return;
+    }
+
+    GPtrArray *nodes = read_node_list(path);
+    g_free(path);
+    if (NULL == nodes) {
+        GtkWidget *bad_list_dialog = gtk_message_dialog_new(main_window, GTK_DIALOG_DESTROY_WITH_PARENT, GTK_MESSAGE_ERROR,
+            GTK_BUTTONS_CLOSE, "Could not read the node list. The lines which are wrong are on the terminal");
+        gtk_dialog_run(GTK_DIALOG(bad_list_dialog));
+        gtk_widget_destroy(bad_list_dialog);
+        return;
+    }
+
+    db_worker_push(NULL, NULL, add_nodes_job, nodes, (GDestroyNotify) g_ptr_array_unref, g_free, nodes_added, nodes);
+}
+
+// the open diagnostics window's text. NULL when it isn't open
+static GtkTextBuffer *diagnostics = NULL;
+static guint diagnostics_timer = 0;
+
+// GSourceFunc: fill in the diagnostics window
+static gboolean refresh_diagnostics(__attribute__((unused)) gpointer unused) {
+    if (NULL == diagnostics) {
+        return G_SOURCE_REMOVE;
+    }
+
+    IngestStats stats;
+    get_ingest_stats(&stats);
+
+    GString *text = metrics_dump(false);
+    g_string_append_printf(text, "\ningest: %" G_GUINT64_FORMAT " received, %" G_GUINT64_FORMAT " added, %" G_GUINT64_FORMAT
+                           " failed, %" G_GUINT64_FORMAT " from unknown nodes\n", stats.received, stats.added, stats.failed,
+                           stats.unknown_node);
+    g_string_append_printf(text, "        %" G_GUINT64_FORMAT " batches, queue full %" G_GUINT64_FORMAT " times, deepest %u\n",
+                           stats.batches, stats.full_waits, stats.max_depth);
+    g_string_append_printf(text, "database: %u duplicates merged, %u errors from unknown nodes\n", get_database_merges(),
+                           get_unknown_node_errors());
+    g_string_append_printf(text, "          dropped from unknown nodes: %u hardware, %u software, %u other. %u of unknown types\n",
+                           get_dropped_errors(DROP_UNKNOWN_NODE, ERROR_CATEGORY_HARDWARE),
+                           get_dropped_errors(DROP_UNKNOWN_NODE, ERROR_CATEGORY_SOFTWARE),
+                           get_dropped_errors(DROP_UNKNOWN_NODE, ERROR_CATEGORY_OTHER),
+                           get_dropped_errors(DROP_UNKNOWN_TYPE, ERROR_CATEGORY_OTHER));
+
+    gtk_text_buffer_set_text(diagnostics, text->str, -1);
+    g_string_free(text, TRUE);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static void diagnostics_reset(void) {
+    metrics_reset();
+    refresh_diagnostics(NULL);
+}
+
+static void diagnostics_destroyed(void) {
+    g_source_remove(diagnostics_timer);
+    diagnostics_timer = 0;
+    g_object_unref(diagnostics);
+    diagnostics = NULL;
+}
+
+// metrics are collected from when this is first opened unless they were turned on with --metrics
+static void diagnostics_activate(void) {
+    if (NULL != diagnostics) {
+        return;
+    }
+    metrics_enable(true);
+
+    GtkWindow *window = GTK_WINDOW(gtk_window_new(GTK_WINDOW_TOPLEVEL));
+    assert(NULL != window);
+    gtk_window_set_transient_for(window, main_window);
+    gtk_window_set_title(window, "Diagnostics");
+    gtk_window_set_default_size(window, 700, 360);
+    gtk_container_set_border_width(GTK_CONTAINER(window), 10);
+
+    GtkBox *box = GTK_BOX(gtk_box_new(GTK_ORIENTATION_VERTICAL, 5));
+
+    GtkWidget *view = gtk_text_view_new();
+    assert(NULL != view);
+    gtk_text_view_set_editable(GTK_TEXT_VIEW(view), FALSE);
+    gtk_text_view_set_monospace(GTK_TEXT_VIEW(view), TRUE);
+    GtkWidget *scroll = gtk_scrolled_window_new(NULL, NULL);
+    assert(NULL != scroll);
+    gtk_container_add(GTK_CONTAINER(scroll), view);
+    gtk_box_pack_start(box, scroll, TRUE, TRUE, 0);
+
+    GtkWidget *reset = gtk_button_new_with_label("Reset");
+    assert(NULL != reset);
+    g_signal_connect(G_OBJECT(reset), "clicked", G_CALLBACK(diagnostics_reset), NULL);
+    gtk_box_pack_start(box, reset, FALSE, FALSE, 0);
+
+    gtk_container_add(GTK_CONTAINER(window), GTK_WIDGET(box));
+    g_signal_connect(G_OBJECT(window), "destroy", G_CALLBACK(diagnostics_destroyed), NULL);
+
+    diagnostics = g_object_ref(gtk_text_view_get_buffer(GTK_TEXT_VIEW(view)));
+    refresh_diagnostics(NULL);
+    diagnostics_timer = g_timeout_add_seconds(1, refresh_diagnostics, NULL);
+
+    gtk_widget_show_all(GTK_WIDGET(window));
+}
+
 static void hide_disabled_change_state(GSimpleAction *simple) {
     assert(NULL != simple);
     gboolean hide_disabled = g_variant_get_boolean(g_action_get_state(G_ACTION(simple)));
@@ -438,6 +957,23 @@ static void hide_disabled_change_state(GSimpleAction *simple) {
    }
 }
 
+// DbJobFunc for node_toggle_disabled_activate. Runs on the database thread
+static gpointer node_toggle_disabled_job(gpointer node, __attribute__((unused)) GCancellable *cancellable) {
+    const NodeIdentifier *n = (NodeIdentifier *) node;
+
+    assert(true == node_toggle_disabled(n->rack_no, n->chassis_no));
+    return NULL;
+}
+
+// GAsyncReadyCallback for node_toggle_disabled_job. The GTask still owns node
+static void node_toggled(__attribute__((unused)) GObject *source, __attribute__((unused)) GAsyncResult *result, gpointer node) {
+    const NodeIdentifier *n = (NodeIdentifier *) node;
+
+    printf("Node %u %u toggled\n", n->rack_no, n->chassis_no);
+
+    gui_update(NULL);
+}
+
 static void node_toggle_disabled_activate(__attribute__((unused)) GSimpleAction *simple, GVariant *parameter) {
     assert(NULL != parameter);
 
@@ -450,10 +986,35 @@ static void node_toggle_disabled_activate(__attribute__((unused)) GSimpleAction
     g_variant_unref(rack_variant);
     g_variant_unref(chassis_variant);
 
-    assert(true == node_toggle_disabled(rack_no, chassis_no));
-    
-    printf("Node %li %li toggled\n", rack_no, chassis_no);
+    NodeIdentifier *node = g_new(NodeIdentifier, 1);
+    assert(NULL != node);
+    node->rack_no = (unsigned int) rack_no;
+    node->chassis_no = (unsigned int) chassis_no;
+
+    db_worker_push(NULL, NULL, node_toggle_disabled_job, node, g_free, NULL, node_toggled, node);
+}
+
+// DbJobFunc for node_delete_activate. Runs on the database thread
+static gpointer node_delete_job(gpointer node, __attribute__((unused)) GCancellable *cancellable) {
+    const NodeIdentifier *n = (NodeIdentifier *) node;
+
+    assert(true == remove_node(n->rack_no, n->chassis_no));
+    return NULL;
+}
+
+// GAsyncReadyCallback for node_delete_job. The GTask still owns node
+static void node_deleted(__attribute__((unused)) GObject *source, __attribute__((unused)) GAsyncResult *result, gpointer node) {
+    const NodeIdentifier *n = (NodeIdentifier *) node;
+
+    edsac_error_notebook_close_node(notebook, n->rack_no, n->chassis_no);
+
+    // clean up node network configuration
+    node_cleanup_network(n->rack_no, n->chassis_no);
+
+    printf("Node %u %u removed\n", n->rack_no, n->chassis_no);
 
+    nodes_menu_remove(n->rack_no, n->chassis_no);
+    liveness_remove_node(n->rack_no, n->chassis_no);
     gui_update(NULL);
 }
 
@@ -469,20 +1030,26 @@ static void node_delete_activate(__attribute__((unused)) GSimpleAction *simple,
     g_variant_unref(rack_variant);
     g_variant_unref(chassis_variant);
 
-    #pragma GCC diagnostic push
-    #pragma GCC diagnostic ignored "-Wconversion"
-    assert(true == remove_node(rack_no, chassis_no));
-    #pragma GCC diagnostic pop
+    NodeIdentifier *node = g_new(NodeIdentifier, 1);
+    assert(NULL != node);
+    node->rack_no = (unsigned int) rack_no;
+    node->chassis_no = (unsigned int) chassis_no;
 
-    edsac_error_notebook_close_node(notebook, (unsigned int) rack_no, (unsigned int) chassis_no);
+    db_worker_push(NULL, NULL, node_delete_job, node, g_free, NULL, node_deleted, node);
+}
 
-    // clean up node network configuration
-    node_cleanup_network((unsigned int) rack_no, (unsigned int) chassis_no);
+// export the errors in the tab being shown
+static void export_activate(void) {
+    edsac_error_notebook_export_current(notebook);
+}
 
-    printf("Node %li %li removed\n", rack_no, chassis_no);
+// open (or switch to) the heatmap tab
+static void heatmap_activate(void) {
+    Clickable heatmap;
+    memset(&heatmap, 0, sizeof(heatmap));
+    heatmap.type = HEATMAP;
 
-    update_nodes_menu();
-    gui_update(NULL);
+    edsac_error_notebook_show_page(notebook, &heatmap);
 }
 
 static void node_show_activate(__attribute__((unused)) GSimpleAction *simple, GVariant *parameter) {
@@ -508,61 +1075,24 @@ static void node_show_activate(__attribute__((unused)) GSimpleAction *simple, GV
     edsac_error_notebook_show_page(notebook, &search);
 }   
 
-static void convert_to_nodeidentifiers(gpointer data, gpointer user_data) {
-    assert(NULL != data);
-    assert(NULL != user_data);
-
-    struct sockaddr_in *addr_struct = data;
-    GSList **list = user_data;
-
-    NodeIdentifier *list_data = parse_ip_address(&addr_struct->sin_addr);
-    assert(NULL != list_data);
-
-    *list = g_slist_prepend(*list, list_data);
-}
-
-static gint compare_nodeids(gconstpointer a, gconstpointer b) {
-    assert(NULL != a);
-    assert(NULL != b);
-
-    const NodeIdentifier *A = a;
-    const NodeIdentifier *B = b;
-
-    if ((A->chassis_no == B->chassis_no) && (A->rack_no == B->rack_no)) {
-        return 0;
-    } else {
-        return 1;
+// open a tab of the errors matching the text in the search entry
+static void search_activate(GtkEntry *entry) {
+    const char *text = gtk_entry_get_text(entry);
+    if ((NULL == text) || ('\0' == text[0])) {
+        return;
     }
-}
-
-static void complain_missing_nodes(gpointer data, gpointer user_data) {
-    assert(NULL != data);
 
-    NodeIdentifier *db_id = data;
-    GSList *server_nodes = user_data;
+    Clickable search;
+    memset(&search, 0, sizeof(search));
+    search.type = SEARCH;
+    g_strlcpy(search.text, text, sizeof(search.text));
 
-    GSList *res = g_slist_find_custom(server_nodes, data, compare_nodeids);
-    if (NULL == res) {
-        // not found so make an error about it
-        assert(true == add_error_decoded(db_id->rack_no, db_id->chassis_no, -1, time(NULL), "Node not connected"));
-    }
+    edsac_error_notebook_show_page(notebook, &search);
 }
 
+// the liveness tracker checks on its own every so often. This is for the impatient
 static void check_connected_activate(void) {
-    GSList *ip_addr_structs = get_connected_list();
-
-    // convert to NodeIdentifiers
-    GSList *ip_addrs_server = NULL;
-    g_slist_foreach(ip_addr_structs, convert_to_nodeidentifiers, &ip_addrs_server);
-    g_slist_free_full(ip_addr_structs, g_free);
-
-    GSList *ip_addrs_db = list_nodes();    
-    g_slist_foreach(ip_addrs_db, complain_missing_nodes, ip_addrs_server);
-
-    g_slist_free_full(ip_addrs_server, g_free);
-    g_slist_free_full(ip_addrs_db, g_free);
-
-    gui_update(NULL);
+    liveness_check_now();
 }
 
 typedef void (*action_handler_t)(GSimpleAction *simple, GVariant *parameter, gpointer user_data);
@@ -587,8 +1117,12 @@ static void activate(GtkApplication *app, __attribute__((unused)) gpointer data)
     #pragma GCC diagnostic ignored "-Wmissing-field-initializers"
     static const GActionEntry actions[] = {
         {"add_node", (action_handler_t) add_node_activate},
+        {"add_nodes", (action_handler_t) add_nodes_activate},
         {"quit", (action_handler_t) quit_activate},
         {"check_connected", (action_handler_t) check_connected_activate},
+        {"diagnostics", (action_handler_t) diagnostics_activate},
+        {"heatmap", (action_handler_t) heatmap_activate},
+        {"export", (action_handler_t) export_activate},
         {"hide_disabled", NULL, "b", "true", (action_handler_t) hide_disabled_change_state},
         {"node_show", (action_handler_t) node_show_activate, "(tt)"},
         {"node_toggle_disabled", (action_handler_t) node_toggle_disabled_activate, "(tt)"},
@@ -597,13 +1131,27 @@ static void activate(GtkApplication *app, __attribute__((unused)) gpointer data)
     #pragma GCC diagnostic pop
     g_action_map_add_action_entries(G_ACTION_MAP(app), actions, G_N_ELEMENTS(actions), NULL);
 
+    // everything which changes the database or needs the collector belongs to the writer
+    if (read_only) {
+        gtk_window_set_title(main_window, "EDSAC Status Monitor (read only)");
+
+        static const char *const writer_actions[] = {"add_node", "add_nodes", "check_connected", "node_toggle_disabled", "node_delete"};
+        for (size_t i = 0; i < G_N_ELEMENTS(writer_actions); i++) {
+            GAction *action = g_action_map_lookup_action(G_ACTION_MAP(app), writer_actions[i]);
+            assert(NULL != action);
+            g_simple_action_set_enabled(G_SIMPLE_ACTION(action), FALSE);
+        }
+    }
+
     // File menu model 
     GMenu *file = g_menu_new();
     assert(NULL != file);
     g_menu_append(file, "Add Node", "app.add_node");
     const char *add_accels[] = {"<Control>N", NULL};
     gtk_application_set_accels_for_action(app, "app.add_node", add_accels);
+    g_menu_append(file, "Add Nodes From List", "app.add_nodes");
     g_menu_append(file, "Check Connections", "app.check_connected");
+    g_menu_append(file, "Export Tab...", "app.export");
     g_menu_append(file, "Quit", "app.quit");
     const char *quit_accels[] = {"<Control>Q", NULL};
     gtk_application_set_accels_for_action(app, "app.quit", quit_accels);
@@ -616,27 +1164,41 @@ static void activate(GtkApplication *app, __attribute__((unused)) gpointer data)
     assert(NULL != hide_disabled);
     g_menu_item_set_action_and_target_value(hide_disabled, "app.hide_disabled", g_variant_new_boolean(TRUE));
     g_menu_append_item(view, hide_disabled);
+    g_menu_append(view, "Heatmap", "app.heatmap");
+    g_menu_append(view, "Diagnostics", "app.diagnostics");
     g_menu_freeze(view);
 
-    // Nodes menu model
-    GMenu *nodes = generate_nodes_menu();
-    
+    // Nodes menu model. Filled in by load_nodes_menu
+    nodes_menu = g_menu_new();
+    assert(NULL != nodes_menu);
+
     // Menu bar model
     model = g_menu_new();
     assert(NULL != model);
     g_menu_append_submenu(model, "File", G_MENU_MODEL(file));
     g_menu_append_submenu(model, "View", G_MENU_MODEL(view));
-    g_menu_append_submenu(model, "Nodes", G_MENU_MODEL(nodes));
-    g_menu_freeze(model);
+    g_menu_append_submenu(model, "Nodes", G_MENU_MODEL(nodes_menu));
+    load_nodes_menu();
 
-    // Menu bar widget
+    // Menu bar widget with the search entry beside it
+    GtkBox *menu_box = GTK_BOX(gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0));
+    assert(NULL != menu_box);
     GtkWidget *menu = gtk_menu_bar_new_from_model(G_MENU_MODEL(model));
     assert(NULL != menu);
-    gtk_box_pack_start(box, menu, FALSE, FALSE, 0);
+    gtk_box_pack_start(menu_box, menu, TRUE, TRUE, 0);
+
+    GtkWidget *search_entry = gtk_search_entry_new();
+    assert(NULL != search_entry);
+    gtk_entry_set_placeholder_text(GTK_ENTRY(search_entry), "Search errors");
+    gtk_entry_set_max_length(GTK_ENTRY(search_entry), SEARCH_TEXT_LEN - 1);
+    g_signal_connect(G_OBJECT(search_entry), "activate", G_CALLBACK(search_activate), NULL);
+    gtk_box_pack_end(menu_box, search_entry, FALSE, FALSE, 0);
+    gtk_box_pack_start(box, GTK_WIDGET(menu_box), FALSE, FALSE, 0);
 
     // make notebook
     notebook = edsac_error_notebook_new();
     g_signal_connect_after(G_OBJECT(notebook), "switch-page", G_CALLBACK(update_bar), NULL);
+    g_signal_connect(G_OBJECT(notebook), "error-count-changed", G_CALLBACK(update_bar), NULL);
     gtk_box_pack_start(box, GTK_WIDGET(notebook), TRUE, TRUE, 0);
 
     // make status bar
@@ -647,15 +1209,16 @@ static void activate(GtkApplication *app, __attribute__((unused)) gpointer data)
 
     gtk_container_add(GTK_CONTAINER(main_window), GTK_WIDGET(box));
     gtk_widget_show_all(GTK_WIDGET(main_window));
-}
 
-// handler called just before we terminate
-static void shutdown_handler(__attribute__((unused)) GApplication *app, gpointer user_data) {
-    if (NULL != user_data) {
-        timer_t *timer_id = user_data;
-        stop_timer(*timer_id);
+    g_atomic_int_set(&running, 1);
+    if (read_only) {
+        g_timeout_add(SYNC_INTERVAL, watch_database, NULL);
     }
+}
 
-    stop_server();
-    close_database();
+// handler called just before we terminate
+// the collector and the database are stopped by main once start_ui returns
+static void shutdown_handler(__attribute__((unused)) GApplication *app, __attribute__((unused)) gpointer user_data) {
+    g_atomic_int_set(&running, 0);
+    db_worker_stop();
 }
\ No newline at end of file